@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// helpers shared by the programs under bench/. header only, so each bench
+// stays a single translation unit next to the server sources it links.
+
+#include <time.h>
+
+/** monotonic clock in ns */
+static inline long long nsnow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif  // BENCH_H
@@ -0,0 +1,116 @@
+// program: cchat/bench/evbench.c
+// wakeup cost vs idle connection count for each event backend.
+// one socketpair is active (1 byte written, waited on, read back), the rest
+// sit idle in the interest set like parked chat clients.
+//
+// output: one line per (backend, idle) pair
+//   backend=<name> idle=<n> ns_per_wakeup=<x>
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evloop.h"
+
+#define ITERS 20000  // wakeups per run (scaled down for big idle sets)
+
+static const int idles[] = {0, 10, 100, 1000, 5000, 10000, 50000};
+
+/** raise RLIMIT_NOFILE soft limit to the hard limit
+ * @return usable fd count */
+static long fdlimit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1) return 1024;
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  getrlimit(RLIMIT_NOFILE, &rl);
+  return (long)rl.rlim_cur;
+}
+
+/** run one (backend, idle) configuration
+ * @param be backend
+ * @param idle idle socketpairs
+ * @return ns per wakeup, -1 fail */
+static double run(enum evbe be, int idle) {
+  int nfd = idle + 1;
+  struct pollfd* fds = calloc(nfd, sizeof(*fds));
+  int* peers = calloc(nfd, sizeof(*peers));
+  struct evloop ev;
+  double res = -1;
+
+  if (!fds || !peers || evinit(&ev, be, 64) == -1) {
+    free(fds);
+    free(peers);
+    return -1;
+  }
+
+  int opened = 0;
+  for (; opened < nfd; opened++) {
+    int sp[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sp) == -1) break;
+    fds[opened].fd = sp[0];
+    fds[opened].events = POLLIN;
+    peers[opened] = sp[1];
+    if (evadd(&ev, sp[0], POLLIN) == -1) {
+      opened++;
+      break;
+    }
+  }
+
+  if (opened == nfd) {
+    // active pair is last so poll() has to scan past every idle entry
+    int afd = fds[nfd - 1].fd, apeer = peers[nfd - 1];
+    int iters = idle > 1000 ? ITERS / 10 : ITERS;
+    char c = 'x';
+    long long t0 = nsnow();
+    int i;
+    for (i = 0; i < iters; i++) {
+      if (write(apeer, &c, 1) != 1) break;
+      int n = evwait(&ev, fds, nfd, -1);
+      if (n != 1 || ev.rdy[0].fd != afd) break;
+      if (read(afd, &c, 1) != 1) break;
+    }
+    if (i == iters) res = (double)(nsnow() - t0) / iters;
+  }
+
+  for (int i = 0; i < opened; i++) {
+    close(fds[i].fd);
+    close(peers[i]);
+  }
+  evfree(&ev);
+  free(fds);
+  free(peers);
+  return res;
+}
+
+int main(void) {
+  long maxfd = fdlimit();
+  enum evbe bes[] = {EV_POLL, EV_EPOLL};
+
+  for (size_t b = 0; b < sizeof(bes) / sizeof(bes[0]); b++) {
+    for (size_t i = 0; i < sizeof(idles) / sizeof(idles[0]); i++) {
+      int idle = idles[i];
+      if (2L * (idle + 1) + 16 > maxfd) {
+        fprintf(stderr, "skip idle=%d: RLIMIT_NOFILE=%ld\n", idle, maxfd);
+        continue;
+      }
+      double ns = run(bes[b], idle);
+      if (ns < 0) {
+        fprintf(stderr, "backend=%s idle=%d: %s\n", evname(bes[b]), idle,
+                strerror(errno));
+        break;
+      }
+      printf("backend=%s idle=%d ns_per_wakeup=%.0f\n", evname(bes[b]), idle,
+             ns);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
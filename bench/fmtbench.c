@@ -0,0 +1,136 @@
+// program: cchat/bench/fmtbench.c
+// formatted broadcast messages per second, before and after the cached
+// header path:
+//   old - time() + localtime() (libc tz lock) + strftime() + snprintf()
+//         header, then a fresh malloc per message: the fmtmsg() this
+//         replaced, rebuilding the date text for every single line
+//   new - fmtmsg() from server/msg.c: timestamp text refreshed by tstick()
+//         once per loop pass (PASS messages), pre-rendered sender prefix,
+//         message recycled through the per-thread cache
+//
+// each thread formats and drops messages as fast as it can, like a shard
+// whose clients all talk at once; the thread counts show the tz lock.
+//
+// output: one line per (path, threads) pair
+//   path=<p> threads=<n> msgs_per_s=<x> ns_per_msg=<x> allocs_per_msg=<x>
+// msgs_per_s is for all threads together, ns_per_msg per thread.
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "msg.h"
+
+#define MSGS 2000000  // messages per thread
+#define PASS 64       // messages formatted per loop pass
+#define MAXTHR 8
+#define PAYLOAD "the quick brown fox jumps over the lazy dog, again and again"
+
+// malloc/calloc/realloc are --wrap'd to count allocations
+static atomic_ulong nalloc;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t sz);
+void* __real_realloc(void* p, size_t n);
+
+void* __wrap_malloc(size_t n) {
+  atomic_fetch_add_explicit(&nalloc, 1, memory_order_relaxed);
+  return __real_malloc(n);
+}
+void* __wrap_calloc(size_t n, size_t sz) {
+  atomic_fetch_add_explicit(&nalloc, 1, memory_order_relaxed);
+  return __real_calloc(n, sz);
+}
+void* __wrap_realloc(void* p, size_t n) {
+  atomic_fetch_add_explicit(&nalloc, 1, memory_order_relaxed);
+  return __real_realloc(p, n);
+}
+
+/** the previous fmtmsg(): clock, tz and printf work on every message */
+static struct msg* oldfmt(int sfd, const char* msg, int len) {
+  time_t now = time(NULL);
+  struct tm* t = localtime(&now);
+  char tbuf[20];
+  strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", t);
+
+  char hdr[48];
+  int hlen = snprintf(hdr, sizeof(hdr), "[%s] %d: ", tbuf, sfd);
+  if (hlen < 0 || hlen >= (int)sizeof(hdr)) return NULL;
+
+  int nl = len == 0 || msg[len - 1] != '\n';
+  struct msg* out = malloc(sizeof(*out) + hlen + len + nl + 1);
+  if (!out) return NULL;
+  atomic_init(&out->ref, 1);
+  out->len = hlen + len + nl;
+  memcpy(out->data, hdr, hlen);
+  memcpy(out->data + hlen, msg, len);
+  if (nl) out->data[hlen + len] = '\n';
+  out->data[out->len] = '\0';
+  return out;
+}
+
+static int usenew;  // path under test
+static volatile unsigned long sink;
+
+static void* worker(void* arg) {
+  int sfd = (int)(long)arg;
+  struct tsclk clk = {0};
+  char pfx[PFXMAX], name[16];
+  snprintf(name, sizeof(name), "%d", sfd);  // same header as the baseline
+  int plen = fmtpfx(pfx, name);
+  int len = sizeof(PAYLOAD) - 1;
+
+  for (int i = 0; i < MSGS; i++) {
+    struct msg* m;
+    if (usenew) {
+      if (i % PASS == 0) tstick(&clk);
+      m = fmtmsg(&clk, pfx, plen, PAYLOAD, len);
+    } else {
+      m = oldfmt(sfd, PAYLOAD, len);
+    }
+    if (!m) abort();
+    sink += m->data[m->len - 2];
+    if (usenew) {
+      msgput(m);
+    } else {
+      free(m);
+    }
+  }
+  return NULL;
+}
+
+/** run one (path, threads) configuration and print its line */
+static void run(int path, int nthr) {
+  pthread_t tid[MAXTHR];
+  usenew = path;
+  atomic_store(&nalloc, 0);
+  long long t0 = nsnow();
+  for (int i = 0; i < nthr; i++) {
+    pthread_create(&tid[i], NULL, worker, (void*)(long)(7 + i));
+  }
+  for (int i = 0; i < nthr; i++) pthread_join(tid[i], NULL);
+  long long dt = nsnow() - t0;
+
+  double msgs = (double)MSGS * nthr;
+  printf("path=%s threads=%d msgs_per_s=%.0f ns_per_msg=%.1f "
+         "allocs_per_msg=%.4f\n",
+         path ? "new" : "old", nthr, msgs * 1e9 / dt, (double)dt / MSGS,
+         atomic_load(&nalloc) / msgs);
+}
+
+int main(void) {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxthr = ncpu < 1 ? 1 : ncpu > MAXTHR ? MAXTHR : (int)ncpu;
+
+  for (int path = 0; path <= 1; path++) {
+    run(path, 1);
+    if (maxthr > 1) run(path, maxthr);
+  }
+  return 0;
+}
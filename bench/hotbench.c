@@ -0,0 +1,299 @@
+// program: cchat/bench/hotbench.c
+// the server's hot path functions in isolation, on a shard built in
+// memory (no listener): clients are socketpairs whose far ends the bench
+// drains between runs, so every send is a real syscall into a socket
+// buffer that never fills.
+//   fdadd / fdrm - table insert and swap-with-last remove with <n> clients
+//                  already in the table (epoll registration included)
+//   fmtmsg       - one broadcast line formatted into a pooled message
+//   bcast        - fmtmsg + fan-out to every other client in the room
+//   proc         - the whole input path for one ready client: recv, line
+//                  framing, bcast, ready list walk
+//
+// server.c is compiled in (its main() left out with CCHAT_NOMAIN), so the
+// bench calls the same code the server runs (and times it with the
+// server's nsnow(), from utils.h). allocations and syscalls are counted
+// through --wrap'd libc entry points.
+//
+// output: one line per (op, clients, size)
+//   op=<name> clients=<n> size=<bytes> ns_per_op=<x> allocs_per_op=<x>
+//   syscalls_per_op=<x>
+#define CCHAT_NOMAIN
+#include "server.c"
+
+#include <sys/epoll.h>
+
+#define OPS 200000L    // fdadd/fdrm/fmtmsg ops; bcast/proc do OPS / clients
+#define MINOPS 500     // at least this many bcast/proc ops
+#define DRAIN 32       // ops between draining the far ends
+#define ADDS 1000      // fds added and removed per fdadd/fdrm round
+
+static const int ncons[] = {16, 256, 2048};
+static const int sizes[] = {16, 64, 240};
+
+// counters fed by the --wrap'd libc entry points
+static unsigned long nalloc, nsys;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t sz);
+void* __real_realloc(void* p, size_t n);
+ssize_t __real_send(int fd, const void* b, size_t n, int fl);
+ssize_t __real_sendmsg(int fd, const struct msghdr* mh, int fl);
+ssize_t __real_recv(int fd, void* b, size_t n, int fl);
+ssize_t __real_read(int fd, void* b, size_t n);
+ssize_t __real_write(int fd, const void* b, size_t n);
+int __real_epoll_ctl(int ep, int op, int fd, struct epoll_event* e);
+int __real_epoll_wait(int ep, struct epoll_event* e, int n, int tmo);
+
+void* __wrap_malloc(size_t n) {
+  nalloc++;
+  return __real_malloc(n);
+}
+void* __wrap_calloc(size_t n, size_t sz) {
+  nalloc++;
+  return __real_calloc(n, sz);
+}
+void* __wrap_realloc(void* p, size_t n) {
+  nalloc++;
+  return __real_realloc(p, n);
+}
+ssize_t __wrap_send(int fd, const void* b, size_t n, int fl) {
+  nsys++;
+  return __real_send(fd, b, n, fl);
+}
+ssize_t __wrap_sendmsg(int fd, const struct msghdr* mh, int fl) {
+  nsys++;
+  return __real_sendmsg(fd, mh, fl);
+}
+ssize_t __wrap_recv(int fd, void* b, size_t n, int fl) {
+  nsys++;
+  return __real_recv(fd, b, n, fl);
+}
+ssize_t __wrap_read(int fd, void* b, size_t n) {
+  nsys++;
+  return __real_read(fd, b, n);
+}
+ssize_t __wrap_write(int fd, const void* b, size_t n) {
+  nsys++;
+  return __real_write(fd, b, n);
+}
+int __wrap_epoll_ctl(int ep, int op, int fd, struct epoll_event* e) {
+  nsys++;
+  return __real_epoll_ctl(ep, op, fd, e);
+}
+int __wrap_epoll_wait(int ep, struct epoll_event* e, int n, int tmo) {
+  nsys++;
+  return __real_epoll_wait(ep, e, n, tmo);
+}
+
+// one measured span
+struct span {
+  long long ns;
+  unsigned long allocs, sys;
+};
+
+/** open a span: counters at its start */
+static struct span spanon(void) {
+  return (struct span){nsnow(), nalloc, nsys};
+}
+
+/** close a span into a running total */
+static void spanoff(struct span* tot, struct span s) {
+  tot->ns += nsnow() - s.ns;
+  tot->allocs += nalloc - s.allocs;
+  tot->sys += nsys - s.sys;
+}
+
+static void report(const char* op, int n, int size, struct span t, long ops) {
+  printf("op=%s clients=%d size=%d ns_per_op=%.1f allocs_per_op=%.3f "
+         "syscalls_per_op=%.3f\n",
+         op, n, size, (double)t.ns / ops, (double)t.allocs / ops,
+         (double)t.sys / ops);
+}
+
+/** shard in memory: like shinit() without listeners or the signal pipe
+ * @return 0 ok, -1 fail */
+static int hotinit(struct srv* sv) {
+  memset(sv, 0, sizeof(*sv));
+  sv->shards = sv;
+  sv->nshards = 1;
+  sv->lfd = sv->wfd = sv->tfd = sv->spare = -1;
+  poolinit(&sv->cpool, "conn", sizeof(struct fdmap));
+  poolinit(&sv->spool, "tsess", sizeof(struct tsess));
+  ibpinit(&sv->ip);
+  roomsinit(&sv->rooms, histn, histb);
+  sv->now = msnow();
+  wheelinit(&sv->wh, sv->now);
+  tstick(&sv->clk);
+  if (evinit(&sv->ev, EV_EPOLL, MAXEVS) == -1 || fdgrow(sv) == -1 ||
+      ibinit(&sv->ib) == -1 || fdadd(sv, sv->ib.rfd, true) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+/** connect n clients the way conadd() takes accepted sockets
+ * @param peer far ends (out, n entries)
+ * @return 0 ok, -1 fail */
+static int hotjoin(struct srv* sv, int n, int* peer) {
+  struct sockaddr_storage ss = {0};
+  struct sockaddr_in* in = (struct sockaddr_in*)&ss;
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int i = 0; i < n; i++) {
+    int sp[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == -1) return -1;
+    fcntl(sp[0], F_SETFL, O_NONBLOCK);
+    fcntl(sp[1], F_SETFL, O_NONBLOCK);
+    if (conadd(sv, sp[0], &ss, CK_TCP) == -1) return -1;
+    peer[i] = sp[1];
+  }
+  joinflush(sv);
+  return 0;
+}
+
+/** empty every far end (not counted) */
+static void hotdrain(int n, const int* peer) {
+  static char buf[65536];
+  for (int i = 0; i < n; i++) {
+    while (__real_recv(peer[i], buf, sizeof(buf), MSG_DONTWAIT) > 0);
+  }
+}
+
+/** flush what the server still queues (joins overflow the socket
+ * buffers), so every run starts with empty send queues (not counted) */
+static void hotsettle(struct srv* sv, int n, const int* peer) {
+  while (atomic_load(&sv->st.g[SG_BACKLOG]) > 0) {
+    hotdrain(n, peer);
+    int nrdy = evwait(&sv->ev, sv->fds, sv->nfd, 0);
+    if (nrdy > 0) proc(sv, nrdy);
+  }
+  hotdrain(n, peer);
+}
+
+/** drop every client (no leave announcements) and the shard */
+static void hotfree(struct srv* sv, int n, const int* peer) {
+  sv->stopping = true;
+  while (sv->nfd > sv->nsys) conrm(sv, sv->fds[sv->nfd - 1].fd, 0);
+  for (int i = 0; i < n; i++) close(peer[i]);
+  evfree(&sv->ev);
+  ibfree(&sv->ib);
+  ibpfree(&sv->ip);
+  roomsfree(&sv->rooms);
+  poolfree(&sv->cpool);
+  poolfree(&sv->spool);
+  free(sv->fds);
+  free(sv->kinds);
+  free(sv->cons);
+  free(sv->tgt);
+  free(sv->fdix);
+  free(sv->sids);
+  free(sv->sidfree);
+}
+
+/** fdadd then fdrm of ADDS extra fds, with n clients in the table */
+static void benchtable(struct srv* sv, int n, int* peer) {
+  int fds[ADDS];
+  for (int i = 0; i < ADDS; i++) fds[i] = dup(peer[0]);
+  struct span add = {0}, rm = {0};
+  long rounds = OPS / ADDS;
+  for (long r = 0; r < rounds; r++) {
+    atomic_fetch_add(&nclients, ADDS);  // fdrm() gives them back
+    struct span s = spanon();
+    for (int i = 0; i < ADDS; i++) fdadd(sv, fds[i], false);
+    spanoff(&add, s);
+    // remove in a different order than added, like real hangups
+    s = spanon();
+    for (int i = 0; i < ADDS; i++) fdrm(sv, fds[(i * 7919) % ADDS]);
+    spanoff(&rm, s);
+  }
+  for (int i = 0; i < ADDS; i++) close(fds[i]);
+  report("fdadd", n, 0, add, rounds * ADDS);
+  report("fdrm", n, 0, rm, rounds * ADDS);
+}
+
+/** format a broadcast line of each size */
+static void benchfmt(struct srv* sv, int n, int size, const char* text) {
+  struct fdmap* c = conget(sv, sv->fds[sv->nsys].fd);
+  struct span t = {0}, s = spanon();
+  for (long i = 0; i < OPS; i++) {
+    struct msg* m = fmtmsg(&sv->clk, c->pfx, c->pfxlen, text, size);
+    msgput(m);
+  }
+  spanoff(&t, s);
+  report("fmtmsg", n, size, t, OPS);
+}
+
+/** broadcast from a rotating sender to the room */
+static void benchbcast(struct srv* sv, int n, int* peer, int size,
+                       const char* text) {
+  long ops = OPS / n > MINOPS ? OPS / n : MINOPS;
+  struct span t = {0};
+  for (long i = 0; i < ops; i++) {
+    struct fdmap* c = sv->cons[sv->nsys + i % n];
+    struct span s = spanon();
+    bcast(sv, c, text, size);
+    spanoff(&t, s);
+    if (i % DRAIN == DRAIN - 1) hotdrain(n, peer);
+  }
+  hotsettle(sv, n, peer);
+  report("bcast", n, size, t, ops);
+}
+
+/** one line arrives from a rotating client: readiness, then proc() */
+static void benchproc(struct srv* sv, int n, int* peer, int size,
+                      const char* text) {
+  long ops = OPS / n > MINOPS ? OPS / n : MINOPS;
+  struct span t = {0};
+  for (long i = 0; i < ops; i++) {
+    __real_send(peer[i % n], text, size, MSG_NOSIGNAL);
+    int nrdy = evwait(&sv->ev, sv->fds, sv->nfd, 0);
+    if (nrdy <= 0) continue;
+    struct span s = spanon();
+    proc(sv, nrdy);
+    spanoff(&t, s);
+    if (i % DRAIN == DRAIN - 1) hotdrain(n, peer);
+  }
+  hotsettle(sv, n, peer);
+  report("proc", n, size, t, ops);
+}
+
+int main(void) {
+  // two fds per client and the fdadd/fdrm extras
+  int maxn = ncons[sizeof(ncons) / sizeof(*ncons) - 1];
+  if (nofile(2 * maxn + ADDS + 64) < 2 * maxn + ADDS + 64) {
+    fprintf(stderr, "RLIMIT_NOFILE too low for %d clients\n", maxn);
+    return 1;
+  }
+  maxcli = 10000000;  // MAX_CLIENTS ceiling
+  tmrms = hbms ? hbms : SEENMS;
+  if (roominit() == -1) return 1;
+
+  char text[256];
+  for (size_t i = 0; i < sizeof(text); i++) text[i] = 'a' + i % 26;
+
+  for (size_t k = 0; k < sizeof(ncons) / sizeof(*ncons); k++) {
+    int n = ncons[k];
+    int* peer = calloc(n, sizeof(*peer));
+    struct srv* sv = malloc(sizeof(*sv));
+    if (!peer || !sv || hotinit(sv) == -1 || hotjoin(sv, n, peer) == -1) {
+      fprintf(stderr, "setup (%d clients): %s\n", n, strerror(errno));
+      return 1;
+    }
+    hotsettle(sv, n, peer);  // join announcements
+
+    benchtable(sv, n, peer);
+    for (size_t j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+      int size = sizes[j];
+      text[size - 1] = '\n';
+      benchfmt(sv, n, size, text);
+      benchbcast(sv, n, peer, size, text);
+      benchproc(sv, n, peer, size, text);
+      text[size - 1] = 'a' + (size - 1) % 26;
+    }
+    hotfree(sv, n, peer);
+    free(sv);
+    free(peer);
+  }
+  return 0;
+}
@@ -0,0 +1,531 @@
+// program: cchat/bench/load.c
+// end-to-end load generator: opens thousands of non-blocking clients
+// against the server, paces messages of a configurable size mix at a total
+// rate, and has every client read everything. each message carries its
+// send time (CLOCK_MONOTONIC, so run it on the server's host), and every
+// delivery is timed from that stamp: the fan-out latency seen by clients.
+// clients are split across threads, each with its own event loop.
+//
+// usage: cchat-bench [-h host] [-p port] [-c clients] [-t threads]
+//                    [-S senders] [-r msgs/s] [-d secs] [-w warmup ms]
+//                    [-m size:weight,...] [-e poll|epoll] [-j]
+// output (one line, -j = one JSON object): clients=<live> failed=<n>
+//   threads=<n> secs=<x> sent=<n> sent_per_s=<x> blocked=<n>
+//   delivered=<n> delivered_per_s=<x> lost=<n> p50_us=<x> p99_us=<x>
+//   p999_us=<x> max_us=<x>
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evloop.h"
+
+#define MSGMAX 256      // server's message cap (incl. newline)
+#define MSGMIN 32       // room for the stamp
+#define HEADMAX 96      // line bytes kept for parsing (prefix + stamp)
+#define STAMP "cb:"     // stamp marker: cb:<send ns>:
+#define DIALBATCH 64    // connects started per loop pass
+#define DIALING 64      // connects in flight per thread (under the
+                        // server's listen backlog)
+#define DIALMS 10000    // greeting deadline after connect
+#define DRAINMS 1000    // reading on after the last send
+#define MAXMIX 8        // size mix entries
+#define LSUB 5          // log2 of histogram buckets per power of two
+#define LBUCKETS ((40 - LSUB + 1) << LSUB)  // up to 2^40 ns (~18 min)
+
+// one connection
+struct cli {
+  int fd;
+  bool live;           // greeted by the server
+  bool dead;           // refused, failed or closed
+  bool sender;         // takes part in sending
+  long long dialns;    // connect started
+  int hlen;            // bytes in head
+  bool over;           // line longer than head, rest skipped
+  char head[HEADMAX];  // current line's start
+  char pend[MSGMAX];   // unsent rest of the last message
+  int poff, plen;      // pend window
+};
+
+// a thread's share of the clients, and what it measured
+struct worker {
+  int id;
+  struct cli* cs;         // clients (slice of the global array)
+  int n;                  // client count
+  int ndial;              // clients dialed so far
+  int inflight;           // dialed, not greeted yet
+  int nsend;              // senders in the slice
+  double rate;            // this thread's msgs/s
+  struct pollfd* pfd;     // interest set (poll backend), one per client
+  struct evloop ev;
+  pthread_t tid;
+  uint64_t seed;          // size mix rng
+  unsigned long sent, blocked, delivered, live, failed;
+  long long maxns;
+  unsigned long* hist;    // LBUCKETS + 1 latency buckets
+};
+
+static struct addrinfo* ai;
+static enum evbe be;
+static int* cix;                  // fd -> client index in its worker
+static int ncix;
+static int mixn;                  // size mix
+static int mixsz[MAXMIX];
+static int mixcum[MAXMIX];        // cumulative weights
+static atomic_int dialdone;       // workers done connecting
+static _Atomic long long tstart;  // measured window (monotonic ns), 0 = not
+static _Atomic long long tend;    //   started yet
+
+/** histogram bucket of a value: exact below 32, then 32 per power of two */
+static int lbucket(uint64_t v) {
+  if (v < (1u << LSUB)) return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  int i = ((e - LSUB + 1) << LSUB) |
+          (int)((v >> (e - LSUB)) & ((1u << LSUB) - 1));
+  return i < LBUCKETS ? i : LBUCKETS;
+}
+
+/** first value of a bucket */
+static uint64_t llow(int i) {
+  if (i < (1 << LSUB)) return (uint64_t)i;
+  int g = i >> LSUB, s = i & ((1 << LSUB) - 1);
+  return (uint64_t)((1 << LSUB) + s) << (g - 1);
+}
+
+/** parse a size mix like 48:60,128:30,256:10
+ * @return 0 ok, -1 invalid */
+static int mixparse(const char* s) {
+  int cum = 0;
+  mixn = 0;
+  while (*s) {
+    char* end;
+    long sz = strtol(s, &end, 10), w = 1;
+    if (end == s || sz < MSGMIN || sz > MSGMAX || mixn == MAXMIX) return -1;
+    s = end;
+    if (*s == ':') {
+      w = strtol(s + 1, &end, 10);
+      if (end == s + 1 || w < 1 || w > 1000000) return -1;
+      s = end;
+    }
+    if (*s == ',') s++;
+    else if (*s) return -1;
+    mixsz[mixn] = sz;
+    mixcum[mixn++] = cum += w;
+  }
+  return mixn ? 0 : -1;
+}
+
+/** next message size from the mix */
+static int mixpick(struct worker* w) {
+  w->seed ^= w->seed << 13;
+  w->seed ^= w->seed >> 7;
+  w->seed ^= w->seed << 17;
+  int r = (int)(w->seed % (uint64_t)mixcum[mixn - 1]);
+  int i = 0;
+  while (r >= mixcum[i]) i++;
+  return mixsz[i];
+}
+
+/** start a non-blocking connect
+ * @return fd or -1 */
+static int dial(void) {
+  int fd = socket(ai->ai_family, ai->ai_socktype, 0);
+  if (fd != -1) fcntl(fd, F_SETFL, O_NONBLOCK);  // no SOCK_NONBLOCK on macOS
+  if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1 &&
+      errno != EINPROGRESS) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+/** watch or stop watching a client for POLLOUT */
+static void watch(struct worker* w, struct cli* c, bool out) {
+  short ev = POLLIN | (out ? POLLOUT : 0);
+  w->pfd[c - w->cs].events = ev;
+  evmod(&w->ev, c->fd, ev);
+}
+
+/** drop a client */
+static void drop(struct worker* w, struct cli* c) {
+  if (c->dead) return;
+  if (!c->live) {
+    w->inflight--;
+    w->failed++;
+  } else {
+    w->live--;
+  }
+  c->dead = true;
+  c->live = false;
+  evdel(&w->ev, c->fd);
+  w->pfd[c - w->cs].fd = -1;
+  close(c->fd);
+}
+
+/** one complete line (head = its start): greeting, refusal or a stamped
+ * message to time */
+static void online(struct worker* w, struct cli* c, long long now) {
+  c->head[c->hlen] = '\0';
+  if (!c->live) {
+    if (strstr(c->head, "you are ")) {
+      c->live = true;
+      w->inflight--;
+      w->live++;
+    } else if (strstr(c->head, "at capacity")) {
+      drop(w, c);
+    }
+    return;
+  }
+  char* p = strstr(c->head, STAMP);
+  if (!p) return;  // joins, leaves, scrollback
+  long long t = strtoll(p + sizeof(STAMP) - 1, NULL, 10);
+  long long t0 = atomic_load_explicit(&tstart, memory_order_relaxed);
+  if (t0 == 0 || t < t0) return;  // warmup or an older run's scrollback
+  long long lat = now - t;
+  if (lat < 0) lat = 0;
+  w->delivered++;
+  w->hist[lbucket(lat)]++;
+  if (lat > w->maxns) w->maxns = lat;
+}
+
+/** read everything a client has (edge-triggered: until EAGAIN) */
+static void conread(struct worker* w, struct cli* c) {
+  char buf[65536];
+  for (;;) {
+    ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+    if (r == 0 || (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                   errno != EINTR)) {
+      drop(w, c);
+      return;
+    }
+    if (r == -1) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    long long now = nsnow();
+    const char* p = buf;
+    const char* end = buf + r;
+    while (p < end) {
+      const char* nl = memchr(p, '\n', end - p);
+      const char* stop = nl ? nl : end;
+      if (!c->over) {
+        int k = stop - p;
+        if (k > HEADMAX - 1 - c->hlen) {
+          k = HEADMAX - 1 - c->hlen;
+          c->over = true;
+        }
+        memcpy(c->head + c->hlen, p, k);
+        c->hlen += k;
+      }
+      if (!nl) break;
+      online(w, c, now);
+      if (c->dead) return;
+      c->hlen = 0;
+      c->over = false;
+      p = nl + 1;
+    }
+  }
+}
+
+/** push out a client's pending bytes
+ * @return 0 all out, 1 still pending, -1 client dropped */
+static int conflush(struct worker* w, struct cli* c) {
+  while (c->poff < c->plen) {
+    ssize_t n = send(c->fd, c->pend + c->poff, c->plen - c->poff,
+                     MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      watch(w, c, true);
+      return 1;
+    }
+    if (n <= 0) {
+      drop(w, c);
+      return -1;
+    }
+    c->poff += n;
+  }
+  if (c->plen) watch(w, c, false);
+  c->poff = c->plen = 0;
+  return 0;
+}
+
+/** send one stamped message of a mix size from a client
+ * @return true sent (at least started), false blocked or gone */
+static bool consend(struct worker* w, struct cli* c) {
+  if (c->plen && conflush(w, c) != 0) return false;
+  int sz = mixpick(w);
+  int n = snprintf(c->pend, sizeof(c->pend), STAMP "%lld:", nsnow());
+  memset(c->pend + n, 'x', sz - 1 - n);
+  c->pend[sz - 1] = '\n';
+  c->plen = sz;
+  c->poff = 0;
+  return conflush(w, c) != -1;
+}
+
+/** start connects, keeping DIALING in flight; a client that gets no
+ * greeting within DIALMS is given up on */
+static void wdial(struct worker* w, long long now) {
+  for (int k = 0; k < DIALBATCH && w->ndial < w->n && w->inflight < DIALING;
+       k++) {
+    struct cli* c = &w->cs[w->ndial];
+    int i = w->ndial++;
+    c->dialns = now;
+    if ((c->fd = dial()) == -1 || c->fd >= ncix) {
+      if (c->fd != -1) close(c->fd);
+      c->dead = true;
+      w->failed++;
+      continue;
+    }
+    cix[c->fd] = i;
+    w->pfd[i].fd = c->fd;
+    w->pfd[i].events = POLLIN;
+    w->inflight++;
+    if (evadd(&w->ev, c->fd, POLLIN) == -1) drop(w, c);
+  }
+  for (int i = 0; i < w->ndial; i++) {
+    struct cli* c = &w->cs[i];
+    if (!c->live && !c->dead && now - c->dialns > DIALMS * 1000000LL) {
+      drop(w, c);
+    }
+  }
+}
+
+/** worker thread: connect its slice, then send its share of the rate and
+ * read until the drain ends */
+static void* wrun(void* arg) {
+  struct worker* w = arg;
+  bool dialing = true;
+  long long next = 0, gap = 0;
+  int rr = 0;  // round robin over senders
+
+  for (;;) {
+    long long now = nsnow();
+    if (dialing) {
+      wdial(w, now);
+      if (w->ndial == w->n && w->inflight == 0) {
+        dialing = false;
+        atomic_fetch_add(&dialdone, 1);
+      }
+    }
+
+    long long t0 = atomic_load(&tstart), t1 = atomic_load(&tend);
+    if (t0 && now >= t1 + DRAINMS * 1000000LL) break;
+    if (t0 && now < t1 && w->rate > 0) {
+      if (!next) {
+        gap = (long long)(1e9 / w->rate);
+        next = t0;
+      }
+      // catch up on every send that is due, spread round robin
+      for (; next <= now && next < t1; next += gap) {
+        struct cli* c = NULL;
+        for (int k = 0; k < w->n && !c; k++) {
+          struct cli* x = &w->cs[rr];
+          rr = (rr + 1) % w->n;
+          if (x->sender && x->live) c = x;
+        }
+        if (!c) break;
+        if (consend(w, c)) {
+          w->sent++;
+        } else {
+          w->blocked++;
+        }
+      }
+    }
+
+    int nr = evwait(&w->ev, w->pfd, w->n, 1);
+    for (int k = 0; k < nr; k++) {
+      struct pollfd* r = &w->ev.rdy[k];
+      struct cli* c = &w->cs[cix[r->fd]];
+      if (c->dead) continue;
+      if (r->revents & POLLOUT) conflush(w, c);
+      if (r->revents & (POLLIN | POLLHUP | POLLERR)) conread(w, c);
+    }
+  }
+  return NULL;
+}
+
+/** latency percentile over every worker's histogram (ns) */
+static double pct(struct worker* ws, int nw, double q, unsigned long total) {
+  if (!total) return 0;
+  unsigned long want = (unsigned long)(q * total), cum = 0;
+  if (want >= total) want = total - 1;
+  for (int i = 0; i <= LBUCKETS; i++) {
+    for (int k = 0; k < nw; k++) cum += ws[k].hist[i];
+    if (cum > want) {
+      // middle of the bucket (its values are within ~3%)
+      if (i == LBUCKETS) return (double)llow(LBUCKETS);
+      return (llow(i) + llow(i + 1)) / 2.0;
+    }
+  }
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: cchat-bench [-h host] [-p port] [-c clients] [-t threads]\n"
+          "                   [-S senders] [-r msgs/s] [-d secs] "
+          "[-w warmup ms]\n"
+          "                   [-m size:weight,...] [-e poll|epoll] [-j]\n");
+}
+
+int main(int argc, char** argv) {
+  const char* host = "localhost";
+  const char* port = "3490";
+  int n = 1000, nw = 0, nsend = -1, warm = 1000;
+  double rate = 1000, secs = 5;
+  const char* mix = "48:60,128:30,256:10";
+  bool json = false;
+#ifdef __linux__
+  be = EV_EPOLL;
+#else
+  be = EV_POLL;
+#endif
+
+  int o;
+  while ((o = getopt(argc, argv, "h:p:c:t:S:r:d:w:m:e:j")) != -1) {
+    if (o == 'h') host = optarg;
+    else if (o == 'p') port = optarg;
+    else if (o == 'c') n = atoi(optarg);
+    else if (o == 't') nw = atoi(optarg);
+    else if (o == 'S') nsend = atoi(optarg);
+    else if (o == 'r') rate = atof(optarg);
+    else if (o == 'd') secs = atof(optarg);
+    else if (o == 'w') warm = atoi(optarg);
+    else if (o == 'm') mix = optarg;
+    else if (o == 'j') json = true;
+    else if (o != 'e' || evparse(optarg, &be) == -1) {
+      usage();
+      return 2;
+    }
+  }
+  if (n < 2 || rate < 0 || secs <= 0 || warm < 0 || mixparse(mix) == -1) {
+    usage();
+    return 2;
+  }
+  if (nsend < 0 || nsend > n) nsend = n;
+  if (nw <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nw = cpus > 4 ? 4 : cpus > 0 ? (int)cpus : 1;
+  }
+  if (nw > n) nw = n;
+
+  // a descriptor per client and then some
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < rl.rlim_max && rl.rlim_cur < (rlim_t)n + 64) {
+    rl.rlim_cur = rl.rlim_max < (rlim_t)n + 64 ? rl.rlim_max : (rlim_t)n + 64;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (rl.rlim_cur < (rlim_t)n + 16) {
+    fprintf(stderr, "cchat-bench: %d clients need %d fds, limit is %lu\n", n,
+            n + 16, (unsigned long)rl.rlim_cur);
+    return 1;
+  }
+  ncix = (int)(rl.rlim_cur < INT32_MAX ? rl.rlim_cur : INT32_MAX);
+
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  int rc = getaddrinfo(host, port, &hints, &ai);
+  if (rc != 0) {
+    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rc));
+    return 1;
+  }
+
+  struct cli* cs = calloc(n, sizeof(*cs));
+  struct worker* ws = calloc(nw, sizeof(*ws));
+  cix = calloc(ncix, sizeof(*cix));
+  if (!cs || !ws || !cix) {
+    fprintf(stderr, "cchat-bench: out of memory\n");
+    return 1;
+  }
+  // senders are spread evenly over the clients (and so over the workers)
+  for (int i = 0; i < nsend; i++) cs[(long)i * n / nsend].sender = true;
+
+  for (int k = 0, off = 0; k < nw; k++) {
+    struct worker* w = &ws[k];
+    w->id = k;
+    w->cs = cs + off;
+    w->n = n / nw + (k < n % nw);
+    off += w->n;
+    for (int i = 0; i < w->n; i++) w->nsend += w->cs[i].sender;
+    w->rate = nsend ? rate * w->nsend / nsend : 0;
+    w->seed = 0x9e3779b97f4a7c15ULL * (k + 1);
+    w->pfd = calloc(w->n, sizeof(*w->pfd));
+    w->hist = calloc(LBUCKETS + 1, sizeof(*w->hist));
+    if (!w->pfd || !w->hist || evinit(&w->ev, be, 256) == -1) {
+      fprintf(stderr, "cchat-bench: worker setup: %s\n", strerror(errno));
+      return 1;
+    }
+    for (int i = 0; i < w->n; i++) w->pfd[i].fd = -1;
+  }
+  for (int k = 0; k < nw; k++) {
+    if ((rc = pthread_create(&ws[k].tid, NULL, wrun, &ws[k])) != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+      return 1;
+    }
+  }
+
+  // everyone connected (or given up on), joins settled: start the clock
+  while (atomic_load(&dialdone) < nw) usleep(10000);
+  usleep(warm * 1000);
+  long long t0 = nsnow();
+  atomic_store(&tend, t0 + (long long)(secs * 1e9));
+  atomic_store(&tstart, t0);
+  for (int k = 0; k < nw; k++) pthread_join(ws[k].tid, NULL);
+
+  unsigned long sent = 0, blocked = 0, dlv = 0, live = 0, failed = 0;
+  long long maxns = 0;
+  for (int k = 0; k < nw; k++) {
+    sent += ws[k].sent;
+    blocked += ws[k].blocked;
+    dlv += ws[k].delivered;
+    live += ws[k].live;
+    failed += ws[k].failed;
+    if (ws[k].maxns > maxns) maxns = ws[k].maxns;
+  }
+  // every message goes to every other client; clients that dropped
+  // mid-run make this an upper bound
+  unsigned long want = live ? sent * (live - 1) : 0;
+  unsigned long lost = want > dlv ? want - dlv : 0;
+  double p50 = pct(ws, nw, 0.5, dlv) / 1e3, p99 = pct(ws, nw, 0.99, dlv) / 1e3;
+  double p999 = pct(ws, nw, 0.999, dlv) / 1e3;
+
+  const char* fmt =
+      json ? "{\"clients\":%lu,\"failed\":%lu,\"threads\":%d,\"secs\":%.1f,"
+             "\"sent\":%lu,\"sent_per_s\":%.0f,\"blocked\":%lu,"
+             "\"delivered\":%lu,\"delivered_per_s\":%.0f,\"lost\":%lu,"
+             "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,"
+             "\"max_us\":%.1f}\n"
+           : "clients=%lu failed=%lu threads=%d secs=%.1f sent=%lu "
+             "sent_per_s=%.0f blocked=%lu delivered=%lu delivered_per_s=%.0f "
+             "lost=%lu p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n";
+  printf(fmt, live, failed, nw, secs, sent, sent / secs, blocked, dlv,
+         dlv / secs, lost, p50, p99, p999, maxns / 1e3);
+
+  for (int k = 0; k < nw; k++) {
+    struct worker* w = &ws[k];
+    for (int i = 0; i < w->n; i++) {
+      if (!w->cs[i].dead && w->cs[i].fd > 0) close(w->cs[i].fd);
+    }
+    evfree(&w->ev);
+    free(w->pfd);
+    free(w->hist);
+  }
+  free(ws);
+  free(cs);
+  free(cix);
+  freeaddrinfo(ai);
+  return 0;
+}
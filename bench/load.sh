@@ -0,0 +1,14 @@
+#!/bin/sh
+# end-to-end load: the server on this host, cchat-bench against it.
+# usage: bench/load.sh [cchat-bench options]
+#   server settings pass through the environment, e.g.
+#   SHARDS=4 bench/load.sh -c 5000 -r 500 -j
+# output: cchat-bench's result line (key=value, or JSON with -j)
+set -e
+
+MAX_CLIENTS=${MAX_CLIENTS:-100000} ./cchat-server >/dev/null 2>&1 &
+srv=$!
+sleep 0.5
+./cchat-bench "$@" || true
+kill "$srv" 2>/dev/null || true
+wait "$srv" 2>/dev/null || true
@@ -0,0 +1,173 @@
+// program: cchat/bench/logbench.c
+// message log throughput with durability off and on. producer threads stand
+// in for shards: each formats nothing, it just hands chat-sized lines to its
+// ring with walput() (server/wal.c) as fast as the ring takes them, and the
+// run ends when the writer has appended every record.
+//   write-fsync - write() + fdatasync() per message into one file, the naive
+//                 durable log (far fewer messages; it is that slow)
+//   wal         - rings + writer thread + mmap'd segments; fsync=off leaves
+//                 flushing to the OS, fsync=<ms> group-commits on that
+//                 interval
+//
+// the log goes to argv[1] (default ./cchat-bench-log.d), which should sit on
+// the disk the server would log to; tmpfs makes every fsync free. segment
+// files are removed after each run. a put that finds the ring full is
+// retried here (counted as full_spins, and reported by the writer as drops
+// on stderr) where the server would drop it.
+//
+// output: one line per (path, fsync, producers)
+//   path=<p> fsync=<off|ms|each> producers=<n> msgs=<n> msgs_per_s=<x>
+//   mb_per_s=<x> put_ns=<x> syncs=<n> full_spins=<n>
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "wal.h"
+
+#define MSGS 2000000    // messages per wal run (split across producers)
+#define FSMSGS 2000     // messages for the write-fsync path
+#define SEGSZ (64 << 20)
+#define LINEMIN 40      // "[2026-01-01 00:00:00] 12: " + a short line
+#define LINEMAX 160
+
+static const int nprod[] = {1, 4};
+static const int syncs[] = {0, 10, 1};  // ms, 0 = off
+
+static const char* dir;
+static char text[LINEMAX];
+
+/** remove the segments a run left behind */
+static void wipe(void) {
+  DIR* d = opendir(dir);
+  if (!d) return;
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] != '.') unlinkat(dirfd(d), e->d_name, 0);
+  }
+  closedir(d);
+}
+
+struct prod {
+  struct walq* q;
+  int n;                // messages to put
+  long long ns;         // time spent putting, waits on a full ring excluded
+  unsigned long spins;  // puts retried on a full ring
+  pthread_t tid;
+};
+
+static void* prun(void* arg) {
+  struct prod* p = arg;
+  unsigned rs = 0x9E3779B9u ^ (unsigned)(size_t)p;
+  long long t0 = nsnow(), wait = 0;
+  for (int i = 0; i < p->n; i++) {
+    rs = rs * 1103515245u + 12345u;
+    int len = LINEMIN + (rs >> 16) % (LINEMAX - LINEMIN);
+    if (walput(p->q, "lobby\t", 6, text, len) == 0) continue;
+    long long w0 = nsnow();  // the server would drop; wait for the writer
+    do {
+      p->spins++;
+      sched_yield();
+    } while (walput(p->q, "lobby\t", 6, text, len) == -1);
+    wait += nsnow() - w0;
+  }
+  p->ns = nsnow() - t0 - wait;
+  return NULL;
+}
+
+/** one wal run; prints its line */
+static void runwal(int syncms, int np) {
+  struct wal w;
+  if (walopen(&w, dir, SEGSZ, syncms, 0, np) == -1) {
+    fprintf(stderr, "walopen(%s): %s\n", dir, strerror(errno));
+    exit(1);
+  }
+  struct prod ps[8];
+  long long t0 = nsnow();
+  for (int i = 0; i < np; i++) {
+    ps[i] = (struct prod){.q = &w.qs[i], .n = MSGS / np};
+    pthread_create(&ps[i].tid, NULL, prun, &ps[i]);
+  }
+  long long putns = 0;
+  unsigned long spins = 0;
+  for (int i = 0; i < np; i++) {
+    pthread_join(ps[i].tid, NULL);
+    putns += ps[i].ns;
+    spins += ps[i].spins;
+  }
+
+  // appended (and, with fsync on, committed by the next interval)
+  struct walstat st;
+  do {
+    walstat(&w, &st);
+    if (st.records < (unsigned long)MSGS) usleep(100);
+  } while (st.records < (unsigned long)MSGS);
+  walclose(&w);  // last drain + sync
+  long long dt = nsnow() - t0;
+  walstat(&w, &st);
+
+  char fs[16];
+  snprintf(fs, sizeof(fs), syncms ? "%d" : "off", syncms);
+  printf("path=wal fsync=%s producers=%d msgs=%d msgs_per_s=%.0f "
+         "mb_per_s=%.1f put_ns=%.1f syncs=%lu full_spins=%lu\n",
+         fs, np, MSGS, MSGS * 1e9 / dt, st.bytes * 1e3 / dt,
+         (double)putns / MSGS, st.syncs, spins);
+  wipe();
+}
+
+/** the naive durable log: one write + fdatasync per message */
+static void runfsync(void) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/naive.log", dir);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+    exit(1);
+  }
+  unsigned long bytes = 0;
+  long long t0 = nsnow();
+  for (int i = 0; i < FSMSGS; i++) {
+    int len = LINEMIN + i % (LINEMAX - LINEMIN);
+    if (write(fd, text, len) != len || fdatasync(fd) == -1) {
+      fprintf(stderr, "write-fsync: %s\n", strerror(errno));
+      exit(1);
+    }
+    bytes += len;
+  }
+  long long dt = nsnow() - t0;
+  close(fd);
+  printf("path=write-fsync fsync=each producers=1 msgs=%d msgs_per_s=%.0f "
+         "mb_per_s=%.1f put_ns=%.1f syncs=%d full_spins=0\n",
+         FSMSGS, FSMSGS * 1e9 / dt, bytes * 1e3 / dt, (double)dt / FSMSGS,
+         FSMSGS);
+  wipe();
+}
+
+int main(int argc, char** argv) {
+  dir = argc > 1 ? argv[1] : "./cchat-bench-log.d";
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "mkdir(%s): %s\n", dir, strerror(errno));
+    return 1;
+  }
+  wipe();
+  for (int i = 0; i < LINEMAX - 1; i++) text[i] = 'a' + i % 26;
+  text[LINEMAX - 1] = '\n';
+
+  runfsync();
+  for (size_t s = 0; s < sizeof(syncs) / sizeof(syncs[0]); s++) {
+    for (size_t p = 0; p < sizeof(nprod) / sizeof(nprod[0]); p++) {
+      runwal(syncs[s], nprod[p]);
+    }
+  }
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,223 @@
+// program: cchat/bench/msgbench.c
+// allocations, user-space copies and send syscalls per delivered message for
+// the broadcast path, before and after refcounted messages:
+//   ring - fmtmsg() sized with snprintf then filled with a second snprintf
+//          into a fresh malloc, copied into each backlogged client's byte
+//          ring: the per-client queue this replaced, where every slow
+//          reader costs a full copy of the line
+//   ref  - fmtmsg() from server/msg.c formats once (cached timestamp, pre-
+//          rendered prefix, recycled message), each client queues a
+//          reference, flushed with one sendmsg() per SQIOV messages
+//
+// readers drain every DRAIN broadcasts so queues build up like they do for
+// real clients on a busy room.
+//
+// output: one line per (path, clients) pair
+//   path=<p> clients=<n> allocs_per_msg=<x> copy_bytes_per_msg=<x>
+//   syscalls_per_msg=<x> ns_per_msg=<x>
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "msg.h"
+#include "sendq.h"
+
+#define BCASTS 20000  // broadcasts per run
+#define DRAIN 32      // broadcasts between reader drains
+#define PAYLOAD "the quick brown fox jumps over the lazy dog, again and again\n"
+
+static const int nclients[] = {4, 64, 256};
+
+// counters fed by the --wrap'd libc entry points
+static unsigned long nalloc, ncopy, nsys;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t sz);
+void* __real_realloc(void* p, size_t n);
+void* __real_memcpy(void* d, const void* s, size_t n);
+ssize_t __real_send(int fd, const void* b, size_t n, int fl);
+ssize_t __real_sendmsg(int fd, const struct msghdr* mh, int fl);
+
+void* __wrap_malloc(size_t n) {
+  nalloc++;
+  return __real_malloc(n);
+}
+void* __wrap_calloc(size_t n, size_t sz) {
+  nalloc++;
+  return __real_calloc(n, sz);
+}
+void* __wrap_realloc(void* p, size_t n) {
+  nalloc++;
+  return __real_realloc(p, n);
+}
+void* __wrap_memcpy(void* d, const void* s, size_t n) {
+  ncopy += n;
+  return __real_memcpy(d, s, n);
+}
+ssize_t __wrap_send(int fd, const void* b, size_t n, int fl) {
+  nsys++;
+  return __real_send(fd, b, n, fl);
+}
+ssize_t __wrap_sendmsg(int fd, const struct msghdr* mh, int fl) {
+  nsys++;
+  return __real_sendmsg(fd, mh, fl);
+}
+
+// ─── baseline: double snprintf + per-client byte ring ───────────────────────
+
+#define RINGSZ 65536
+
+struct bring {
+  char* buf;
+  unsigned head, tail;
+};
+
+static char* oldfmt(int sfd, const char* msg) {
+  time_t now = time(NULL);
+  struct tm* t = localtime(&now);
+  char tbuf[20];
+  strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", t);
+  int need = snprintf(NULL, 0, "[%s] %d: %s", tbuf, sfd, msg);
+  char* out = malloc(need + 1);
+  if (out) snprintf(out, need + 1, "[%s] %d: %s", tbuf, sfd, msg);
+  return out;
+}
+
+static void oldsend(struct bring* q, int fd, const char* buf, unsigned len) {
+  unsigned sent = 0;
+  if (q->tail == q->head) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n > 0) sent = n;
+    if (sent == len) return;
+  }
+  if (len - sent > RINGSZ - (q->tail - q->head)) return;  // drop
+  if (!q->buf) q->buf = malloc(RINGSZ);
+  for (unsigned i = sent; i < len;) {
+    unsigned off = q->tail & (RINGSZ - 1);
+    unsigned n = RINGSZ - off < len - i ? RINGSZ - off : len - i;
+    memcpy(q->buf + off, buf + i, n);
+    q->tail += n;
+    i += n;
+  }
+}
+
+static void oldflush(struct bring* q, int fd) {
+  while (q->tail != q->head) {
+    unsigned off = q->head & (RINGSZ - 1), len = q->tail - q->head;
+    struct iovec iov[2] = {{q->buf + off, RINGSZ - off < len ? RINGSZ - off : len},
+                           {q->buf, 0}};
+    iov[1].iov_len = len - iov[0].iov_len;
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = iov[1].iov_len ? 2 : 1};
+    ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+    if (n <= 0) break;
+    q->head += n;
+  }
+  if (q->tail == q->head) {
+    free(q->buf);
+    q->buf = NULL;
+    q->head = q->tail = 0;
+  }
+}
+
+// ─── harness ────────────────────────────────────────────────────────────────
+
+/** read everything pending on the reader side of each pair */
+static unsigned long drain(int* peers, int n) {
+  static char buf[1 << 16];
+  unsigned long got = 0;
+  for (int i = 0; i < n; i++) {
+    ssize_t r;
+    while ((r = read(peers[i], buf, sizeof(buf))) > 0) got += r;
+  }
+  return got;
+}
+
+/** run one (path, clients) configuration and print its line
+ * @param ref 0 = ring baseline, 1 = refcounted msg */
+static int run(int ref, int n) {
+  int fds[n], peers[n];
+  for (int i = 0; i < n; i++) {
+    int sp[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sp) == -1) return -1;
+    int sz = 4096;  // small buffers so queues actually fill
+    setsockopt(sp[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    fds[i] = sp[0];
+    peers[i] = sp[1];
+  }
+  struct bring* rings = calloc(n, sizeof(*rings));
+  struct sendq* qs = calloc(n, sizeof(*qs));
+  struct tsclk clk = {0};
+  char pfx[PFXMAX];
+  int plen = fmtpfx(pfx, "7");
+
+  unsigned long bytes = 0;
+  nalloc = ncopy = nsys = 0;
+  long long t0 = nsnow();
+  for (int b = 0; b < BCASTS; b++) {
+    if (ref) {
+      tstick(&clk);
+      struct msg* m = fmtmsg(&clk, pfx, plen, PAYLOAD, sizeof(PAYLOAD) - 1);
+      for (int i = 0; i < n; i++) sqsend(&qs[i], fds[i], m);
+      msgput(m);
+    } else {
+      char* buf = oldfmt(7, PAYLOAD);
+      unsigned len = strlen(buf);
+      for (int i = 0; i < n; i++) oldsend(&rings[i], fds[i], buf, len);
+      free(buf);
+    }
+    if ((b + 1) % DRAIN == 0) {
+      bytes += drain(peers, n);
+      for (int i = 0; i < n; i++) {
+        if (ref) sqflush(&qs[i], fds[i]);
+        else oldflush(&rings[i], fds[i]);
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (ref) sqflush(&qs[i], fds[i]);
+    else oldflush(&rings[i], fds[i]);
+  }
+  bytes += drain(peers, n);
+  long long dt = nsnow() - t0;
+
+  // every formatted message has the same length
+  tstick(&clk);
+  struct msg* probe = fmtmsg(&clk, pfx, plen, PAYLOAD, sizeof(PAYLOAD) - 1);
+  double msgs = (double)bytes / probe->len;
+  msgput(probe);
+
+  printf("path=%s clients=%d allocs_per_msg=%.4f copy_bytes_per_msg=%.2f "
+         "syscalls_per_msg=%.4f ns_per_msg=%.1f\n",
+         ref ? "ref" : "ring", n, nalloc / msgs, ncopy / msgs, nsys / msgs,
+         dt / msgs);
+
+  for (int i = 0; i < n; i++) {
+    sqfree(&qs[i]);
+    free(rings[i].buf);
+    close(fds[i]);
+    close(peers[i]);
+  }
+  free(rings);
+  free(qs);
+  return 0;
+}
+
+int main(void) {
+  for (int ref = 0; ref <= 1; ref++) {
+    for (size_t i = 0; i < sizeof(nclients) / sizeof(nclients[0]); i++) {
+      if (run(ref, nclients[i]) == -1) {
+        fprintf(stderr, "run: %s\n", strerror(errno));
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
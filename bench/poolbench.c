@@ -0,0 +1,178 @@
+// program: cchat/bench/poolbench.c
+// reconnect storm: NCONN clients stay connected while one at a time drops
+// and a new one takes its place. every reconnect frees and allocates a
+// connection record, broadcasts a leave and a join notice and carries a
+// couple of chat lines of random length; a ring of the last BACKLOG
+// messages stays referenced, like the queues of slow readers, so frees
+// interleave with live messages of every size.
+//   malloc - calloc/free per record, malloc/free per message (the previous
+//            fdadd()/fdrm() and msgnew()/msgput())
+//   pool   - records from a slab pool (server/pool.c), messages from the
+//            size classes in server/msg.c
+//
+// each path runs in its own process so heap numbers start from zero.
+//
+// output: one line per path, then the pool counters
+//   path=<p> conns=<n> reconnects_per_s=<x> ns_per_reconnect=<x>
+//   allocs_per_reconnect=<x> heap_bytes=<n>
+//   pool=<name> objsz=<n> live=<n> hwm=<n> bytes=<n>
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "msg.h"
+#include "pool.h"
+
+#define NCONN 10000      // connected clients
+#define RECONN 2000000   // reconnects per run
+#define BACKLOG 4096     // messages kept referenced (slow readers)
+#define RECSZ 216        // about sizeof(struct fdmap)
+#define CHATMAX 2000     // longest chat line
+
+// malloc/calloc/realloc are --wrap'd to count allocations
+static unsigned long nalloc;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t sz);
+void* __real_realloc(void* p, size_t n);
+
+void* __wrap_malloc(size_t n) {
+  nalloc++;
+  return __real_malloc(n);
+}
+void* __wrap_calloc(size_t n, size_t sz) {
+  nalloc++;
+  return __real_calloc(n, sz);
+}
+void* __wrap_realloc(void* p, size_t n) {
+  nalloc++;
+  return __real_realloc(p, n);
+}
+
+// xorshift, so runs are repeatable
+static unsigned long long rs = 0x9E3779B97F4A7C15ULL;
+
+static unsigned rnd(void) {
+  rs ^= rs << 13;
+  rs ^= rs >> 7;
+  rs ^= rs << 17;
+  return (unsigned)(rs >> 16);
+}
+
+static int usepool;  // path under test
+static struct pool cpool;
+static void* conns[NCONN];
+static struct msg* ring[BACKLOG];
+static unsigned rhead;
+static char text[CHATMAX];
+
+/** a record, the way fdadd() gets one */
+static void* recget(void) {
+  return usepool ? poolget(&cpool) : calloc(1, RECSZ);
+}
+
+static void recput(void* r) {
+  if (usepool) {
+    poolput(&cpool, r);
+  } else {
+    free(r);
+  }
+}
+
+/** a message of len bytes, the way the broadcast path gets one */
+static struct msg* mget(int len) {
+  if (usepool) return msgnew(len);
+  struct msg* m = malloc(sizeof(*m) + len + 1);
+  if (!m) return NULL;
+  atomic_init(&m->ref, 1);
+  m->len = len;
+  m->data[len] = '\0';
+  return m;
+}
+
+static void mput(struct msg* m) {
+  if (!m) return;
+  if (usepool) {
+    msgput(m);
+  } else {
+    free(m);
+  }
+}
+
+/** broadcast: format, park on the backlog ring, drop the oldest */
+static void say(int len) {
+  struct msg* m = mget(len);
+  if (!m) abort();
+  memcpy(m->data, text, len);
+  mput(ring[rhead % BACKLOG]);
+  ring[rhead++ % BACKLOG] = m;
+}
+
+/** heap bytes in use or reserved by malloc, -1 = unknown */
+static long heapbytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 mi = mallinfo2();
+  return (long)(mi.arena + mi.hblkhd);
+#else
+  return -1;
+#endif
+}
+
+/** one storm on the current path; prints its lines */
+static void run(void) {
+  poolinit(&cpool, "conn", RECSZ);
+  for (int i = 0; i < NCONN; i++) {
+    if (!(conns[i] = recget())) abort();
+  }
+
+  nalloc = 0;
+  long long t0 = nsnow();
+  for (int i = 0; i < RECONN; i++) {
+    int c = rnd() % NCONN;
+    recput(conns[c]);
+    say(48 + rnd() % 16);  // "client N has left the chat!"
+    if (!(conns[c] = recget())) abort();
+    say(64 + rnd() % 16);  // "new client connecting from ..."
+    say(1 + rnd() % CHATMAX);
+    say(1 + rnd() % 120);
+  }
+  long long dt = nsnow() - t0;
+
+  printf("path=%s conns=%d reconnects_per_s=%.0f ns_per_reconnect=%.1f "
+         "allocs_per_reconnect=%.4f heap_bytes=%ld\n",
+         usepool ? "pool" : "malloc", NCONN, RECONN * 1e9 / dt,
+         (double)dt / RECONN, (double)nalloc / RECONN, heapbytes());
+
+  if (usepool) {
+    struct poolstat st[MSGNCLS + 2];
+    poolstat(&cpool, &st[0]);
+    msgstats(&st[1]);
+    for (int i = 0; i < MSGNCLS + 2; i++) {
+      printf("pool=%s objsz=%zu live=%ld hwm=%ld bytes=%ld\n", st[i].name,
+             st[i].objsz, st[i].live, st[i].hwm, st[i].bytes);
+    }
+  }
+}
+
+int main(void) {
+  for (int i = 0; i < CHATMAX; i++) text[i] = 'a' + i % 26;
+  fflush(stdout);
+  for (usepool = 0; usepool <= 1; usepool++) {
+    pid_t pid = fork();
+    if (pid == -1) return 1;
+    if (pid == 0) {
+      run();
+      return 0;
+    }
+    int st;
+    waitpid(pid, &st, 0);
+    if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) return 1;
+  }
+  return 0;
+}
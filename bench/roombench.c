@@ -0,0 +1,175 @@
+// program: cchat/bench/roombench.c
+// cost of one room message as the server population grows, rooms of a
+// fixed size. every client sits in one room; a message goes to the other
+// members of its sender's room.
+//   scan  - walk every slot of the connection table and test each client's
+//           room, which is what the one-room broadcast loop becomes with a
+//           room check bolted on: cost grows with the server, not the room
+//   index - walk the room's own dense member array (server/room.c), so
+//           only members are touched
+//
+// clients get fds in join order but rooms are assigned at random, so room
+// members are spread over the table like long lived clients' are. records
+// are laid out like struct fdmap: the hot fields the send touches first.
+// the index path still slows somewhat with the population: members are
+// scattered over more memory, so fewer of them stay in cache.
+//
+// output: one line per (path, conns, room size)
+//   path=<p> conns=<n> room=<k> ns_per_msg=<x> ns_per_target=<x>
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "room.h"
+
+#define MSGS 200000  // messages per run
+#define FD0 8        // first client fd
+
+static const int nconns[] = {1000, 10000, 100000};
+static const int rsize[] = {16, 256};
+
+// xorshift, so runs are repeatable
+static uint64_t rs = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rnd(void) {
+  rs ^= rs << 13;
+  rs ^= rs >> 7;
+  rs ^= rs << 17;
+  return (uint32_t)(rs >> 16);
+}
+
+// stand-in for the send queue the broadcast path checks per target
+struct sq {
+  void* ring;
+  unsigned head, tail, off, bytes;
+  unsigned long drops;
+};
+
+// the shape of struct fdmap
+struct fdmap {
+  int fd;
+  int idx;
+  int kind;
+  struct sq sq;
+  void* ws;
+  void* tc;
+  void* ts;
+  char in[32];
+  int room;
+  int ridx;
+  char pfx[24];
+  char nick[11];
+};
+
+struct tab {
+  struct pollfd* fds;
+  struct fdmap** cons;
+  int nfd;
+};
+
+static volatile unsigned long sink;
+
+/** deliver: what conq() reads from a target */
+static inline unsigned long q(struct fdmap* t) {
+  t->sq.tail++;
+  return t->sq.tail - t->sq.head;
+}
+
+/** the table walk, checking each client's room */
+static unsigned long scan(struct tab* t, int room, int sfd) {
+  unsigned long n = 0;
+  for (int i = 0; i < t->nfd; i++) {
+    if (t->fds[i].fd == sfd) continue;
+    struct fdmap* c = t->cons[i];
+    if (c->room != room) continue;
+    n += q(c);
+  }
+  return n;
+}
+
+/** the room's member array */
+static unsigned long walk(struct room* r, int sfd) {
+  unsigned long n = 0;
+  for (int i = 0; i < r->n; i++) {
+    struct fdmap* c = r->mem[i];
+    if (c->fd == sfd) continue;
+    n += q(c);
+  }
+  return n;
+}
+
+/** run one (path, conns, room size) configuration and print its line */
+static void run(int useidx, int n, int k) {
+  int nrooms = n / k;
+  struct tab t = {0};
+  struct rooms rms;
+  roomsinit(&rms, 0, 0);
+  t.fds = malloc(sizeof(*t.fds) * n);
+  t.cons = malloc(sizeof(*t.cons) * n);
+
+  // rooms filled evenly, in random order
+  int* slots = malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) slots[i] = 1 + i % nrooms;  // 0 = lobby
+  for (int i = n - 1; i > 0; i--) {
+    int j = rnd() % (i + 1), x = slots[i];
+    slots[i] = slots[j];
+    slots[j] = x;
+  }
+  for (int i = 0; i < n; i++) {
+    struct fdmap* c = calloc(1, sizeof(*c));
+    c->fd = FD0 + i;
+    c->idx = i;
+    c->room = slots[i];
+    c->ridx = roomadd(roomget(&rms, c->room), c);
+    t.fds[i].fd = c->fd;
+    t.fds[i].events = POLLIN;
+    t.cons[i] = c;
+  }
+  t.nfd = n;
+
+  // the scan is O(conns) per message: fewer messages for big tables
+  int msgs = useidx ? MSGS : MSGS / (n / 1000);
+  unsigned long tgts = 0;
+  long long t0 = nsnow();
+  for (int m = 0; m < msgs; m++) {
+    struct fdmap* from = t.cons[rnd() % n];
+    unsigned long got = useidx ? walk(roomget(&rms, from->room), from->fd)
+                               : scan(&t, from->room, from->fd);
+    sink += got;
+    tgts += k - 1;
+  }
+  long long dt = nsnow() - t0;
+
+  printf("path=%s conns=%d room=%d ns_per_msg=%.1f ns_per_target=%.2f\n",
+         useidx ? "index" : "scan", n, k, (double)dt / msgs,
+         (double)dt / tgts);
+
+  for (int i = 0; i < n; i++) free(t.cons[i]);
+  free(t.fds);
+  free(t.cons);
+  free(slots);
+  roomsfree(&rms);
+}
+
+int main(void) {
+  // room ids 1.. for the most rooms any run uses
+  if (roominit() == -1) return 1;
+  for (int i = 0; i < nconns[2] / rsize[0]; i++) {
+    char name[16];
+    if (roomid(name, snprintf(name, sizeof(name), "r%d", i)) != i + 1) {
+      return 1;
+    }
+  }
+  for (size_t c = 0; c < sizeof(nconns) / sizeof(nconns[0]); c++) {
+    for (size_t k = 0; k < sizeof(rsize) / sizeof(rsize[0]); k++) {
+      run(0, nconns[c], rsize[k]);
+      run(1, nconns[c], rsize[k]);
+    }
+  }
+  return 0;
+}
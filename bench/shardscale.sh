@@ -0,0 +1,22 @@
+#!/bin/sh
+# broadcast throughput with SHARDS=1..all cores (pinned).
+# usage: bench/shardscale.sh [clients-per-shard] [secs] [rate-per-client]
+# output: shards=<k> <cchat-bench result line>
+set -e
+
+PER=${1:-32}
+SECS=${2:-5}
+RATE=${3:-1000}
+NCPU=$(getconf _NPROCESSORS_ONLN)
+
+k=1
+while [ "$k" -le "$NCPU" ]; do
+  MAX_CLIENTS=100000 SHARDS=$k SHARD_CPUS=auto ./cchat-server >/dev/null 2>&1 &
+  pid=$!
+  sleep 0.5
+  printf 'shards=%d ' "$k"
+  ./cchat-bench -c $((PER * k)) -d "$SECS" -r $((RATE * PER * k)) || true
+  kill "$pid" 2>/dev/null || true
+  wait "$pid" 2>/dev/null || true
+  k=$((k + 1))
+done
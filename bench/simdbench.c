@@ -0,0 +1,224 @@
+// program: cchat/bench/simdbench.c
+// websocket payload kernels (server/simd.c): unmasking and UTF-8 validation
+// at each level the cpu supports, after a differential check of every
+// vector kernel against the scalar one:
+//   unmask - random payloads and keys, every size 1..1024 then a stride up
+//            to 64 KiB, at several buffer offsets; output must match byte
+//            for byte
+//   utf8   - random valid text (ASCII and 2/3/4 byte sequences) plus copies
+//            with a random byte, a bad sequence or a cut-off tail spliced
+//            in, then every 2 byte pair and 3 byte sequence placed across
+//            block boundaries; verdicts must match
+//
+// exits 1 on any mismatch, before timing anything.
+//
+// output: one check line per level, then one line per (kernel, level, size)
+//   check level=<l> cases=<n> invalid=<n> mismatches=<n>
+//   kernel=<k> level=<l> size=<bytes> ns_per_op=<x> gb_per_s=<x>
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "simd.h"
+
+#define MAXSZ 65536
+#define BENCHBYTES (256L << 20)  // bytes pushed through a kernel per timing
+
+static const int sizes[] = {16, 125, 1024, 4096, MAXSZ};
+
+static uint8_t src[MAXSZ + 64], a[MAXSZ + 64], b[MAXSZ + 64];
+
+// xorshift, so runs are repeatable
+static uint64_t rs = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rnd(void) {
+  rs ^= rs << 13;
+  rs ^= rs >> 7;
+  rs ^= rs << 17;
+  return (uint32_t)(rs >> 16);
+}
+
+/** fill p with valid UTF-8; ascii = percent of single byte characters */
+static void u8fill(uint8_t* p, int n, int ascii) {
+  int i = 0;
+  while (i < n) {
+    uint32_t cp;
+    int r = rnd() % 100, k;
+    if (r < ascii) {
+      cp = 0x20 + rnd() % 0x5F, k = 1;
+    } else if (r % 3 == 0) {
+      cp = 0x80 + rnd() % (0x800 - 0x80), k = 2;
+    } else if (r % 3 == 1) {
+      do cp = 0x800 + rnd() % (0x10000 - 0x800);
+      while (cp >= 0xD800 && cp <= 0xDFFF);
+      k = 3;
+    } else {
+      cp = 0x10000 + rnd() % (0x110000 - 0x10000), k = 4;
+    }
+    if (i + k > n) cp = 'x', k = 1;
+    if (k == 1) {
+      p[i] = cp;
+    } else if (k == 2) {
+      p[i] = 0xC0 | cp >> 6, p[i + 1] = 0x80 | (cp & 0x3F);
+    } else if (k == 3) {
+      p[i] = 0xE0 | cp >> 12, p[i + 1] = 0x80 | (cp >> 6 & 0x3F);
+      p[i + 2] = 0x80 | (cp & 0x3F);
+    } else {
+      p[i] = 0xF0 | cp >> 18, p[i + 1] = 0x80 | (cp >> 12 & 0x3F);
+      p[i + 2] = 0x80 | (cp >> 6 & 0x3F), p[i + 3] = 0x80 | (cp & 0x3F);
+    }
+    i += k;
+  }
+}
+
+// bad sequences spliced into valid text
+static const struct {
+  int n;
+  uint8_t b[4];
+} bad[] = {
+    {1, {0x80}},                    // lone continuation
+    {1, {0xFF}},                    // never valid
+    {2, {0xC0, 0x80}},              // overlong 2 byte
+    {2, {0xC1, 0xBF}},              // overlong 2 byte
+    {3, {0xE0, 0x80, 0x80}},        // overlong 3 byte
+    {3, {0xED, 0xA0, 0x80}},        // surrogate
+    {4, {0xF0, 0x80, 0x80, 0x80}},  // overlong 4 byte
+    {4, {0xF4, 0x90, 0x80, 0x80}},  // past U+10FFFF
+    {4, {0xF5, 0x80, 0x80, 0x80}},  // past U+10FFFF
+    {2, {0xE2, 0x82}},              // cut short
+    {3, {0xC3, 0xA9, 0xA9}},        // extra continuation
+};
+
+static long ncase, ninval, nbad;
+
+/** compare the current kernels with scalar on one buffer */
+static void u8diff(const uint8_t* p, int n, enum simdlvl lvl) {
+  simdset(SIMD_SCALAR);
+  bool want = utf8ok(p, n);
+  simdset(lvl);
+  bool got = utf8ok(p, n);
+  ncase++;
+  ninval += !want;
+  if (got != want && nbad++ < 5) {
+    fprintf(stderr, "utf8 %s: n=%d scalar=%d got=%d\n", simdname(lvl), n,
+            want, got);
+  }
+}
+
+/** compare unmask with scalar on one buffer */
+static void xdiff(int n, int off, enum simdlvl lvl) {
+  uint8_t key[4];
+  uint32_t k = rnd();
+  memcpy(key, &k, 4);
+  for (int i = 0; i < n; i++) src[i] = rnd();
+  memcpy(a + off, src, n);
+  memcpy(b + off, src, n);
+  simdset(SIMD_SCALAR);
+  unmask(a + off, n, key);
+  simdset(lvl);
+  unmask(b + off, n, key);
+
+  // scalar itself against the plain definition
+  int ok = memcmp(a + off, b + off, n) == 0;
+  for (int i = 0; ok && i < n; i++) ok = a[off + i] == (src[i] ^ key[i & 3]);
+  ncase++;
+  if (!ok && nbad++ < 5) {
+    fprintf(stderr, "unmask %s: n=%d off=%d mismatch\n", simdname(lvl), n, off);
+  }
+}
+
+/** differential check of one level against scalar
+ * @return mismatches */
+static long check(enum simdlvl lvl) {
+  ncase = ninval = nbad = 0;
+  for (int n = 1; n <= MAXSZ; n += n < 1024 ? 1 : 509) {
+    int off = n & 31;
+    xdiff(n, off, lvl);
+
+    uint8_t* p = a + off;
+    u8fill(p, n, rnd() % 2 ? 95 : 30);
+    u8diff(p, n, lvl);
+
+    memcpy(b, p, n);
+    b[rnd() % n] = rnd();  // random byte
+    u8diff(b, n, lvl);
+
+    int bi = rnd() % (sizeof(bad) / sizeof(bad[0]));
+    if (n >= bad[bi].n) {
+      memcpy(b, p, n);
+      memcpy(b + rnd() % (n - bad[bi].n + 1), bad[bi].b, bad[bi].n);
+      u8diff(b, n, lvl);
+    }
+
+    memcpy(b, p, n);
+    b[n - 1] = 0xC0 | rnd() % 0x40;  // lead byte with nothing after it
+    u8diff(b, n, lvl);
+  }
+  xdiff(MAXSZ, 0, lvl);
+  u8fill(a, MAXSZ, 80);
+  u8diff(a, MAXSZ, lvl);
+
+  // every byte pair and 3 byte sequence, straddling 16/32 byte boundaries
+  static const int at[] = {0, 14, 15, 30, 31, 33};
+  uint8_t buf[72];
+  for (int i = 0; i < 6; i++) {
+    for (int x = 0; x < 0x10000; x++) {
+      memset(buf, 'a', sizeof(buf));
+      buf[at[i]] = x >> 8, buf[at[i] + 1] = x;
+      u8diff(buf, sizeof(buf), lvl);
+      u8diff(buf, at[i] + 2, lvl);
+    }
+  }
+  for (int x = 0xC00000; x < 0x1000000; x++) {
+    int i = x % 6;
+    memset(buf, 'a', sizeof(buf));
+    buf[at[i]] = x >> 16, buf[at[i] + 1] = x >> 8, buf[at[i] + 2] = x;
+    u8diff(buf, sizeof(buf), lvl);
+  }
+  printf("check level=%s cases=%ld invalid=%ld mismatches=%ld\n",
+         simdname(lvl), ncase, ninval, nbad);
+  return nbad;
+}
+
+/** time one kernel at one size */
+static void timeit(const char* name, enum simdlvl lvl, int n, int ascii) {
+  static volatile int sink;
+  uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+  if (ascii >= 0) u8fill(a, n, ascii);
+  long iters = BENCHBYTES / n;
+  simdset(lvl);
+  long long t0 = nsnow();
+  for (long i = 0; i < iters; i++) {
+    if (ascii >= 0) {
+      sink += utf8ok(a, n);
+    } else {
+      unmask(a, n, key);
+    }
+  }
+  double ns = (double)(nsnow() - t0) / iters;
+  printf("kernel=%s level=%s size=%d ns_per_op=%.1f gb_per_s=%.2f\n", name,
+         simdname(lvl), n, ns, n / ns);
+}
+
+int main(void) {
+  enum simdlvl max = simdmax();
+  long mism = 0;
+  for (int l = SIMD_SSE2; l <= (int)max; l++) mism += check(l);
+  if (max == SIMD_SCALAR) printf("check skipped: no vector kernels here\n");
+  if (mism) return 1;
+
+  int ns = sizeof(sizes) / sizeof(sizes[0]);
+  for (int l = SIMD_SCALAR; l <= (int)max; l++) {
+    for (int i = 0; i < ns; i++) timeit("unmask", l, sizes[i], -1);
+  }
+  for (int l = SIMD_SCALAR; l <= (int)max; l++) {
+    for (int i = 0; i < ns; i++) timeit("utf8-ascii", l, sizes[i], 100);
+  }
+  for (int l = SIMD_SCALAR; l <= (int)max; l++) {
+    for (int i = 0; i < ns; i++) timeit("utf8-mixed", l, sizes[i], 70);
+  }
+  return 0;
+}
@@ -0,0 +1,288 @@
+// program: cchat/bench/tablebench.c
+// connection table operations at 10k and 100k connections, before and
+// after the dense table:
+//   uthash - records in a uthash map keyed by fd, each carrying its
+//            UT_hash_handle, hot and cold fields mixed; fdrm() does two
+//            finds, the broadcast loop one per target, so every target is
+//            a hash and a pointer chase into a cold record
+//   dense  - fd -> slot index, with fd (pollfd), kind and record pointer in
+//            arrays parallel to the poll array; the broadcast loop walks
+//            the arrays and only touches a record to queue the message
+//            (the layout in server/server.c)
+//
+// fds are handed out lowest-free-first like the kernel does. records of
+// both tables come from the same allocator so only the layout differs.
+//
+// output: one line per (table, conns) pair, ns per operation
+//   table=<t> conns=<n> add_ns=<x> rm_ns=<x> lookup_ns=<x>
+//   bcast_ns_per_conn=<x> bcast_us_per_pass=<x>
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "uthash.h"
+
+#define OPS 1000000  // random lookups per run
+#define PASSES 200   // full broadcast passes per run (10k; scaled for 100k)
+#define FD0 8        // first client fd (after listeners, inbox, stdio)
+
+static const int nconns[] = {10000, 100000};
+
+// xorshift, so runs are repeatable
+static uint64_t rs = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rnd(void) {
+  rs ^= rs << 13;
+  rs ^= rs >> 7;
+  rs ^= rs << 17;
+  return (uint32_t)(rs >> 16);
+}
+
+// stand-in for the send queue the broadcast path checks per target
+struct sq {
+  void* ring;
+  unsigned head, tail, off, bytes;
+  unsigned long drops;
+};
+
+// ─── baseline: uthash keyed by fd ───────────────────────────────────────────
+
+struct oldrec {
+  int fd;
+  int idx;
+  char nick[11];
+  int kind;
+  struct sq sq;
+  char in[32];  // line buffer state
+  void* ws;
+  UT_hash_handle hh;
+};
+
+struct oldtab {
+  struct pollfd* fds;
+  int nfd;
+  struct oldrec* usrs;
+};
+
+static void oldadd(struct oldtab* t, int fd) {
+  struct oldrec* r = calloc(1, sizeof(*r));
+  r->fd = fd;
+  r->idx = t->nfd;
+  r->kind = fd % 10 == 0;  // one in ten is a websocket client
+  HASH_ADD_INT(t->usrs, fd, r);
+  t->fds[t->nfd].fd = fd;
+  t->fds[t->nfd++].events = POLLIN;
+}
+
+static void oldrm(struct oldtab* t, int fd) {
+  struct oldrec *r, *last;
+  HASH_FIND_INT(t->usrs, &fd, r);
+  HASH_FIND_INT(t->usrs, &t->fds[t->nfd - 1].fd, last);
+  t->fds[r->idx] = t->fds[--t->nfd];
+  if (r != last) last->idx = r->idx;
+  HASH_DEL(t->usrs, r);
+  free(r);
+}
+
+static struct oldrec* oldget(struct oldtab* t, int fd) {
+  struct oldrec* r;
+  HASH_FIND_INT(t->usrs, &fd, r);
+  return r;
+}
+
+static unsigned long oldbcast(struct oldtab* t, int sfd) {
+  unsigned long n = 0;
+  for (int i = 0; i < t->nfd; i++) {
+    int fd = t->fds[i].fd;
+    if (fd == sfd) continue;
+    struct oldrec* r;
+    HASH_FIND_INT(t->usrs, &fd, r);
+    if (!r) continue;
+    if (r->kind == 0) n += r->sq.tail - r->sq.head;  // what sqsend checks
+    n++;
+  }
+  return n;
+}
+
+// ─── dense: fd index + slot arrays ──────────────────────────────────────────
+
+struct rec {
+  int fd;
+  int idx;
+  int kind;
+  struct sq sq;
+  void* ws;
+  char in[32];
+  char nick[11];
+};
+
+struct tab {
+  struct pollfd* fds;
+  uint8_t* kinds;
+  struct rec** cons;
+  int* fdix;
+  int nfd;
+};
+
+static void add(struct tab* t, int fd) {
+  struct rec* r = calloc(1, sizeof(*r));
+  r->fd = fd;
+  r->idx = t->nfd;
+  r->kind = fd % 10 == 0;
+  t->fds[t->nfd].fd = fd;
+  t->fds[t->nfd].events = POLLIN;
+  t->kinds[t->nfd] = r->kind;
+  t->cons[t->nfd] = r;
+  t->fdix[fd] = t->nfd++;
+}
+
+static void rm(struct tab* t, int fd) {
+  int i = t->fdix[fd], last = --t->nfd;
+  struct rec* r = t->cons[i];
+  t->fds[i] = t->fds[last];
+  t->kinds[i] = t->kinds[last];
+  t->cons[i] = t->cons[last];
+  t->cons[i]->idx = i;
+  t->fdix[t->fds[i].fd] = i;
+  t->fdix[fd] = -1;
+  free(r);
+}
+
+static struct rec* get(struct tab* t, int fd) {
+  int i = t->fdix[fd];
+  return i < 0 ? NULL : t->cons[i];
+}
+
+static unsigned long bcast(struct tab* t, int sfd) {
+  unsigned long n = 0;
+  for (int i = 0; i < t->nfd; i++) {
+    if (t->fds[i].fd == sfd) continue;
+    if (t->kinds[i] == 0) {
+      struct rec* r = t->cons[i];
+      n += r->sq.tail - r->sq.head;
+    }
+    n++;
+  }
+  return n;
+}
+
+// ─── harness ────────────────────────────────────────────────────────────────
+
+static volatile unsigned long sink;
+
+static int intcmp(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+/** run one (table, conns) configuration and print its line */
+static void run(bool dense, int n) {
+  struct oldtab ot = {0};
+  struct tab t = {0};
+  int maxfd = FD0 + n;
+  int* live = malloc(sizeof(int) * n);   // fds in use
+  int* freed = malloc(sizeof(int) * n);  // fds removed this round
+  if (dense) {
+    t.fds = malloc(sizeof(*t.fds) * n);
+    t.kinds = malloc(n);
+    t.cons = malloc(sizeof(*t.cons) * n);
+    t.fdix = malloc(sizeof(int) * maxfd);
+    for (int i = 0; i < maxfd; i++) t.fdix[i] = -1;
+  } else {
+    ot.fds = malloc(sizeof(*ot.fds) * n);
+  }
+
+  // fill, timing the adds
+  long long t0 = nsnow();
+  for (int i = 0; i < n; i++) {
+    live[i] = FD0 + i;
+    if (dense) {
+      add(&t, live[i]);
+    } else {
+      oldadd(&ot, live[i]);
+    }
+  }
+  long long tadd = nsnow() - t0, nadd = n;
+
+  // churn: drop a random half, then hand the same fds out again lowest
+  // first (the kernel reuses the lowest free fd)
+  long long trm = 0, nrm = 0;
+  for (int round = 0; round < 4; round++) {
+    int k = n / 2;
+    for (int i = n - 1; i > 0; i--) {  // shuffle, first k leave
+      int j = rnd() % (i + 1), x = live[i];
+      live[i] = live[j];
+      live[j] = x;
+    }
+    memcpy(freed, live, sizeof(int) * k);
+    t0 = nsnow();
+    for (int i = 0; i < k; i++) {
+      if (dense) {
+        rm(&t, freed[i]);
+      } else {
+        oldrm(&ot, freed[i]);
+      }
+    }
+    trm += nsnow() - t0;
+    nrm += k;
+
+    qsort(freed, k, sizeof(int), intcmp);
+    t0 = nsnow();
+    for (int i = 0; i < k; i++) {
+      if (dense) {
+        add(&t, freed[i]);
+      } else {
+        oldadd(&ot, freed[i]);
+      }
+    }
+    tadd += nsnow() - t0;
+    nadd += k;
+  }
+
+  t0 = nsnow();
+  for (int i = 0; i < OPS; i++) {
+    int fd = FD0 + rnd() % n;
+    sink += dense ? get(&t, fd)->idx : oldget(&ot, fd)->idx;
+  }
+  long long tget = nsnow() - t0;
+
+  int passes = PASSES * 10000 / n;
+  t0 = nsnow();
+  for (int p = 0; p < passes; p++) {
+    int sfd = FD0 + rnd() % n;
+    sink += dense ? bcast(&t, sfd) : oldbcast(&ot, sfd);
+  }
+  long long tb = nsnow() - t0;
+
+  printf("table=%s conns=%d add_ns=%.1f rm_ns=%.1f lookup_ns=%.1f "
+         "bcast_ns_per_conn=%.2f bcast_us_per_pass=%.1f\n",
+         dense ? "dense" : "uthash", n, (double)tadd / nadd,
+         (double)trm / nrm, (double)tget / OPS, (double)tb / passes / n,
+         tb / passes / 1e3);
+
+  if (dense) {
+    while (t.nfd > 0) rm(&t, t.fds[t.nfd - 1].fd);
+    free(t.fds);
+    free(t.kinds);
+    free(t.cons);
+    free(t.fdix);
+  } else {
+    while (ot.nfd > 0) oldrm(&ot, ot.fds[ot.nfd - 1].fd);
+    free(ot.fds);
+  }
+  free(live);
+  free(freed);
+}
+
+int main(void) {
+  for (size_t i = 0; i < sizeof(nconns) / sizeof(nconns[0]); i++) {
+    run(false, nconns[i]);
+    run(true, nconns[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,175 @@
+// program: cchat/bench/wheelbench.c
+// connection timer cost as the population grows. every connection has one
+// timer due within a heartbeat; traffic keeps pushing timers out again.
+//   heap  - binary min-heap indexed by position, the textbook timer
+//           queue: O(log n) sift per re-arm and per firing, each step a
+//           likely cache miss once the heap outgrows the cache
+//   wheel - hierarchical timing wheel (server/wheel.c): re-arm is a list
+//           unlink + link, firing walks only the slots that come due
+//
+// reset = re-arm a random connection's timer one heartbeat ahead (what a
+// naive server does on every message; the server itself only moves a
+// timestamp and re-arms when the timer fires). fire = step the clock 1 ms
+// at a time through a whole heartbeat, taking every timer that comes due
+// and re-arming it one heartbeat out, as the server's idle check does.
+//
+// output: one line per (path, timers)
+//   path=<p> timers=<n> reset_ns=<x> fire_ns=<x>
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "wheel.h"
+
+#define RESETS 4000000  // re-arms per run
+#define HBMS 30000      // heartbeat: timers are due within this
+
+static const int ntimers[] = {10000, 100000, 1000000};
+
+// xorshift, so runs are repeatable
+static uint64_t rs = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rnd(void) {
+  rs ^= rs << 13;
+  rs ^= rs >> 7;
+  rs ^= rs << 17;
+  return (uint32_t)(rs >> 16);
+}
+
+// baseline: min-heap of timers, each knowing its position
+struct htmr {
+  uint64_t when;
+  int pos;
+};
+
+struct heap {
+  struct htmr** h;
+  int n;
+};
+
+static void hswap(struct heap* hp, int a, int b) {
+  struct htmr* t = hp->h[a];
+  hp->h[a] = hp->h[b];
+  hp->h[b] = t;
+  hp->h[a]->pos = a;
+  hp->h[b]->pos = b;
+}
+
+static void hup(struct heap* hp, int i) {
+  while (i > 0 && hp->h[(i - 1) / 2]->when > hp->h[i]->when) {
+    hswap(hp, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void hdown(struct heap* hp, int i) {
+  for (;;) {
+    int l = 2 * i + 1, m = i;
+    if (l < hp->n && hp->h[l]->when < hp->h[m]->when) m = l;
+    if (l + 1 < hp->n && hp->h[l + 1]->when < hp->h[m]->when) m = l + 1;
+    if (m == i) return;
+    hswap(hp, i, m);
+    i = m;
+  }
+}
+
+/** arm or move a timer */
+static void hset(struct heap* hp, struct htmr* t, uint64_t when) {
+  if (t->pos == -1) {
+    t->pos = hp->n;
+    hp->h[hp->n++] = t;
+  }
+  t->when = when;
+  hup(hp, t->pos);
+  hdown(hp, t->pos);
+}
+
+/** take the earliest timer if due */
+static struct htmr* hpop(struct heap* hp, uint64_t now) {
+  if (hp->n == 0 || hp->h[0]->when > now) return NULL;
+  struct htmr* t = hp->h[0];
+  hswap(hp, 0, --hp->n);
+  hdown(hp, 0);
+  t->pos = -1;
+  return t;
+}
+
+static volatile unsigned long sink;
+
+/** run the heap for n timers and print its line */
+static void runheap(int n) {
+  struct heap hp = {malloc(sizeof(struct htmr*) * n), 0};
+  struct htmr* ts = malloc(sizeof(*ts) * n);
+  uint64_t now = 1000;
+  for (int i = 0; i < n; i++) {
+    ts[i].pos = -1;
+    hset(&hp, &ts[i], now + rnd() % HBMS);
+  }
+
+  long long t0 = nsnow();
+  for (int i = 0; i < RESETS; i++) {
+    hset(&hp, &ts[rnd() % n], now + HBMS + rnd() % 1000);
+  }
+  long long dreset = nsnow() - t0;
+
+  unsigned long fired = 0;
+  t0 = nsnow();
+  for (uint64_t end = now + 2 * HBMS; now < end; now++) {
+    struct htmr* t;
+    while ((t = hpop(&hp, now)) != NULL) {
+      hset(&hp, t, now + HBMS);
+      fired++;
+    }
+  }
+  long long dfire = nsnow() - t0;
+  sink += fired;
+
+  printf("path=heap timers=%d reset_ns=%.1f fire_ns=%.1f\n", n,
+         (double)dreset / RESETS, (double)dfire / fired);
+  free(hp.h);
+  free(ts);
+}
+
+/** run the wheel for n timers and print its line */
+static void runwheel(int n) {
+  struct wheel* w = malloc(sizeof(*w));
+  struct tmr* ts = calloc(n, sizeof(*ts));
+  uint64_t now = 1000;
+  wheelinit(w, now);
+  for (int i = 0; i < n; i++) tmradd(w, &ts[i], now + rnd() % HBMS);
+
+  long long t0 = nsnow();
+  for (int i = 0; i < RESETS; i++) {
+    tmradd(w, &ts[rnd() % n], now + HBMS + rnd() % 1000);
+  }
+  long long dreset = nsnow() - t0;
+
+  unsigned long fired = 0;
+  t0 = nsnow();
+  for (uint64_t end = now + 2 * HBMS; now < end; now++) {
+    wheeladv(w, now);
+    struct tmr* t;
+    while ((t = tmrpop(w)) != NULL) {
+      tmradd(w, t, now + HBMS);
+      fired++;
+    }
+  }
+  long long dfire = nsnow() - t0;
+  sink += fired;
+
+  printf("path=wheel timers=%d reset_ns=%.1f fire_ns=%.1f\n", n,
+         (double)dreset / RESETS, (double)dfire / fired);
+  free(w);
+  free(ts);
+}
+
+int main(void) {
+  for (size_t i = 0; i < sizeof(ntimers) / sizeof(ntimers[0]); i++) {
+    runheap(ntimers[i]);
+    runwheel(ntimers[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# browser path latency: native websocket gateway vs the node bridge.
+# usage: bench/wscompare.sh [msgs]
+# output: target=<native|bridge> msgs=<n> p50_us=<x> p99_us=<x> max_us=<x>
+set -e
+
+MSGS=${1:-10000}
+
+# native: the server's own websocket listener
+WS_PORT=8081 ./cchat-server >/dev/null 2>&1 &
+srv=$!
+sleep 0.5
+./cchat-bench-wslat localhost 8081 "$MSGS" native || true
+
+# bridge: browser -> node (8080) -> tcp 3490, same server
+if [ -d bridge/node_modules/ws ]; then
+  (cd bridge && exec node bridge.js) >/dev/null 2>&1 &
+  bridge=$!
+  sleep 1
+  ./cchat-bench-wslat localhost 8080 "$MSGS" bridge || true
+  kill "$bridge" 2>/dev/null || true
+  wait "$bridge" 2>/dev/null || true
+else
+  echo "target=bridge skipped: run 'cd bridge && npm install' first" >&2
+fi
+
+kill "$srv" 2>/dev/null || true
+wait "$srv" 2>/dev/null || true
@@ -0,0 +1,175 @@
+// program: cchat/bench/wslat.c
+// browser path latency: two websocket clients on one endpoint, one sends a
+// numbered message, the other times how long until it sees the broadcast.
+// run it against the native gateway (WS_PORT) and the node bridge to
+// compare the extra hop.
+//
+// usage: cchat-bench-wslat [host] [port] [msgs] [label]
+// output: target=<label> msgs=<n> p50_us=<x> p99_us=<x> max_us=<x>
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define RBUFSZ 65536
+
+/** connect a blocking client with Nagle off
+ * @return fd or -1 */
+static int dial(const char* host, const char* port) {
+  struct addrinfo hints, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &ai) != 0) return -1;
+  int fd = socket(ai->ai_family, ai->ai_socktype, 0);
+  if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai);
+  if (fd != -1) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+/** connect and upgrade to websocket (the accept key is not checked)
+ * @return fd or -1 */
+static int wsdial(const char* host, const char* port) {
+  int fd = dial(host, port);
+  if (fd == -1) return -1;
+
+  char req[256];
+  int n = snprintf(req, sizeof(req),
+                   "GET /ws HTTP/1.1\r\nHost: %s:%s\r\n"
+                   "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                   "Sec-WebSocket-Version: 13\r\n\r\n",
+                   host, port);
+  if (send(fd, req, n, 0) != n) goto fail;
+
+  // read the response header byte by byte so no frame bytes are eaten
+  char hdr[1024];
+  int h = 0;
+  while (h < (int)sizeof(hdr) - 1) {
+    if (recv(fd, hdr + h, 1, 0) != 1) goto fail;
+    h++;
+    if (h >= 4 && memcmp(hdr + h - 4, "\r\n\r\n", 4) == 0) break;
+  }
+  hdr[h] = '\0';
+  if (strncmp(hdr, "HTTP/1.1 101", 12) != 0) goto fail;
+  return fd;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+/** send one masked text frame (payload < 126 bytes)
+ * @return 0 ok, -1 fail */
+static int wssend(int fd, const char* p, int n) {
+  uint8_t f[2 + 4 + 125];
+  uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+  f[0] = 0x81;
+  f[1] = 0x80 | n;
+  memcpy(f + 2, key, 4);
+  for (int i = 0; i < n; i++) f[6 + i] = p[i] ^ key[i & 3];
+  return send(fd, f, 6 + n, 0) == 6 + n ? 0 : -1;
+}
+
+// receiver state: raw bytes, frames parsed out as they complete
+static uint8_t rbuf[RBUFSZ];
+static int rlen;
+
+/** read frames until one carries the wanted text
+ * @return 0 seen, -1 connection lost */
+static int wswait(int fd, const char* want) {
+  while (1) {
+    // parse every complete server frame in the buffer
+    int off = 0;
+    while (rlen - off >= 2) {
+      uint64_t n = rbuf[off + 1] & 0x7F;
+      int h = 2;
+      if (n == 126) {
+        if (rlen - off < 4) break;
+        n = (uint64_t)rbuf[off + 2] << 8 | rbuf[off + 3];
+        h = 4;
+      } else if (n == 127) {
+        if (rlen - off < 10) break;
+        n = 0;
+        for (int i = 0; i < 8; i++) n = n << 8 | rbuf[off + 2 + i];
+        h = 10;
+      }
+      if ((uint64_t)(rlen - off) < h + n) break;
+      int hit = memmem(rbuf + off + h, n, want, strlen(want)) != NULL;
+      off += h + (int)n;
+      if (hit) {
+        memmove(rbuf, rbuf + off, rlen - off);
+        rlen -= off;
+        return 0;
+      }
+    }
+    memmove(rbuf, rbuf + off, rlen - off);
+    rlen -= off;
+
+    if (rlen == RBUFSZ) rlen = 0;  // oversized frame, not ours
+    ssize_t r = recv(fd, rbuf + rlen, RBUFSZ - rlen, 0);
+    if (r <= 0) return -1;
+    rlen += r;
+  }
+}
+
+static int cmpll(const void* a, const void* b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+  const char* host = argc > 1 ? argv[1] : "localhost";
+  const char* port = argc > 2 ? argv[2] : "8080";
+  int msgs = argc > 3 ? atoi(argv[3]) : 10000;
+  const char* label = argc > 4 ? argv[4] : port;
+  if (msgs < 1) msgs = 1;
+
+  int tx = wsdial(host, port);
+  int rx = wsdial(host, port);
+  if (tx == -1 || rx == -1) {
+    fprintf(stderr, "wsdial %s:%s: %s\n", host, port,
+            errno ? strerror(errno) : "handshake failed");
+    return 1;
+  }
+  usleep(100000);  // let join announcements pass
+
+  long long* lat = malloc(sizeof(*lat) * msgs);
+  if (!lat) return 1;
+  char m[64];
+  for (int i = 0; i < msgs; i++) {
+    int n = snprintf(m, sizeof(m), "lat %d\n", i);
+    long long t0 = nsnow();
+    if (wssend(tx, m, n - 1) == -1 || wswait(rx, m) == -1) {
+      fprintf(stderr, "lost connection after %d msgs\n", i);
+      return 1;
+    }
+    lat[i] = nsnow() - t0;
+  }
+
+  qsort(lat, msgs, sizeof(*lat), cmpll);
+  printf("target=%s msgs=%d p50_us=%.1f p99_us=%.1f max_us=%.1f\n", label,
+         msgs, lat[msgs / 2] / 1e3, lat[(long long)msgs * 99 / 100] / 1e3,
+         lat[msgs - 1] / 1e3);
+  free(lat);
+  close(tx);
+  close(rx);
+  return 0;
+}
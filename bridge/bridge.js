@@ -1,26 +1,176 @@
 #!/usr/bin/env node
+// websocket gateway: every browser socket becomes a channel on one trunk
+// connection to the chat server (frame format in server/trunk.h).
 const net = require('net');
 const { Server } = require('ws');
 
-new Server({ port: 8080 }).on('connection', (ws) => {
-  const tcpHost = process.env.SERVER_HOST || 'localhost';
-  const tcp = net.connect(3490, tcpHost);
+const HDR = 8;          // frame header bytes
+const MAXPL = 65535;    // max payload per frame
+const WIN = 65536;      // per channel window, both directions
+const OPEN = 1, DATA = 2, CLOSE = 3, CREDIT = 4, BCAST = 5;
 
-  ws.on('message', (message) => {
-    tcp.write(`${message}\n`);
+const tcpHost = process.env.SERVER_HOST || 'localhost';
+const trunkPort = Number(process.env.TRUNK_PORT || 3491);
+
+const sessions = new Map();  // channel -> { ws, tx, pending }
+let nextch = 1;
+let trunk = null;            // connected trunk socket, null while down
+let out = [];                // frames batched until the end of this tick
+const credits = new Map();   // channel -> window to hand back
+let flushing = false;
+
+function frame(type, ch, payload = Buffer.alloc(0)) {
+  const h = Buffer.alloc(HDR);
+  h[0] = type;
+  h.writeUInt16BE(payload.length, 2);
+  h.writeUInt32BE(ch, 4);
+  out.push(h, payload);
+  schedule();
+}
+
+// everything queued in one tick leaves in one write
+function schedule() {
+  if (flushing) return;
+  flushing = true;
+  setImmediate(() => {
+    if (credits.size) {
+      const pairs = [...credits];
+      credits.clear();
+      for (let i = 0; i < pairs.length; i += MAXPL >> 3) {
+        const chunk = pairs.slice(i, i + (MAXPL >> 3));
+        const pl = Buffer.alloc(chunk.length * 8);
+        chunk.forEach(([ch, n], j) => {
+          pl.writeUInt32BE(ch, j * 8);
+          pl.writeUInt32BE(n, j * 8 + 4);
+        });
+        frame(CREDIT, 0, pl);
+      }
+    }
+    if (trunk && out.length) trunk.write(Buffer.concat(out));
+    out = [];
+    flushing = false;
   });
+}
+
+// the browser got a message: return that window to the server
+function delivered(ch, n) {
+  if (sessions.has(ch)) credits.set(ch, (credits.get(ch) || 0) + n);
+  schedule();
+}
+
+function deliver(ch, s, text, n) {
+  if (s.ws.readyState !== s.ws.OPEN) return;
+  s.ws.send(text, () => delivered(ch, n));
+}
+
+// browser -> server, as far as the server's window allows; the browser is
+// paused while its channel has no window left
+function upstream(ch, s) {
+  while (s.pending.length && s.tx > 0) {
+    let b = s.pending[0];
+    if (b.length > s.tx || b.length > MAXPL) {
+      s.pending[0] = b.subarray(Math.min(s.tx, MAXPL));
+      b = b.subarray(0, Math.min(s.tx, MAXPL));
+    } else {
+      s.pending.shift();
+    }
+    s.tx -= b.length;
+    frame(DATA, ch, b);
+  }
+  if (s.ws._socket) {
+    if (s.pending.length) s.ws._socket.pause();
+    else s.ws._socket.resume();
+  }
+}
+
+function onframe(type, ch, pl) {
+  if (type === DATA) {
+    const s = sessions.get(ch);
+    if (s) deliver(ch, s, pl.toString(), pl.length);
+  } else if (type === BCAST) {
+    const n = pl.readUInt16BE(0);
+    const skip = new Set();
+    for (let i = 0; i < n; i++) skip.add(pl.readUInt32BE(2 + 4 * i));
+    const msg = pl.subarray(2 + 4 * n);
+    const text = msg.toString();
+    for (const [c, s] of sessions) {
+      if (!skip.has(c)) deliver(c, s, text, msg.length);
+    }
+  } else if (type === CREDIT) {
+    for (let i = 0; i + 8 <= pl.length; i += 8) {
+      const c = pl.readUInt32BE(i);
+      const s = sessions.get(c);
+      if (!s) continue;
+      s.tx = Math.min(WIN, s.tx + pl.readUInt32BE(i + 4));
+      upstream(c, s);
+    }
+  } else if (type === CLOSE) {
+    // refused or dropped by the server; the payload says why
+    const s = sessions.get(ch);
+    if (!s) return;
+    sessions.delete(ch);
+    credits.delete(ch);
+    if (pl.length) s.ws.send(pl.toString());
+    s.ws.close();
+  }
+}
+
+function connect() {
+  const sock = net.connect(trunkPort, tcpHost);
+  let buf = Buffer.alloc(0);
 
-  tcp.on('data', (chunk) => {
-    ws.send(chunk.toString());
+  sock.setNoDelay(true);
+  sock.on('connect', () => {
+    trunk = sock;
+    console.log(`trunk connected to ${tcpHost}:${trunkPort}`);
+  });
+  sock.on('data', (chunk) => {
+    buf = buf.length ? Buffer.concat([buf, chunk]) : chunk;
+    let off = 0;
+    while (buf.length - off >= HDR) {
+      const len = buf.readUInt16BE(off + 2);
+      if (buf.length - off < HDR + len) break;
+      onframe(buf[off], buf.readUInt32BE(off + 4),
+              buf.subarray(off + HDR, off + HDR + len));
+      off += HDR + len;
+    }
+    buf = buf.subarray(off);
+  });
+  sock.on('error', (err) => console.error(`trunk: ${err.message}`));
+  sock.on('close', () => {
+    // every browser loses its session with the trunk; retry shortly
+    trunk = null;
+    out = [];
+    credits.clear();
+    for (const s of sessions.values()) s.ws.close(1011, 'chat server gone');
+    sessions.clear();
+    setTimeout(connect, 1000);
+  });
+}
+
+new Server({ port: 8080 }).on('connection', (ws, req) => {
+  if (!trunk) {
+    ws.close(1013, 'chat server unavailable');
+    return;
+  }
+  const ch = nextch;
+  nextch = nextch >= 0xffffffff ? 1 : nextch + 1;
+  const s = { ws, tx: WIN, pending: [] };
+  sessions.set(ch, s);
+  frame(OPEN, ch, Buffer.from(req.socket.remoteAddress || ''));
+
+  ws.on('message', (message) => {
+    s.pending.push(Buffer.from(`${message}\n`));
+    upstream(ch, s);
   });
 
   const shutdown = () => {
-    ws.close();
-    tcp.end();
+    if (!sessions.delete(ch)) return;
+    credits.delete(ch);
+    frame(CLOSE, ch);
   };
-
-  ws.on('close', () => tcp.end());
-  tcp.on('close', () => ws.close());
+  ws.on('close', shutdown);
   ws.on('error', shutdown);
-  tcp.on('error', shutdown);
 });
+
+connect();
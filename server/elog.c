@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+
+#include "elog.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define ELNAP 8          // longest idle sleep (ms)
+#define ELBUF 65536      // output batch bytes
+#define ELLINE 512       // longest formatted record
+
+static const char* lvlnames[] = {"debug", "info", "warn", "error", "off"};
+
+// writer side: output batch and the last rendered second
+struct elout {
+  char buf[ELBUF];
+  size_t len;
+  time_t sec;      // second in stamp
+  char stamp[24];  // "YYYY-MM-DDTHH:MM:SS"
+};
+
+/** write out the batch (blocking; a failing output loses it) */
+static void elflush(struct elog* l, struct elout* o) {
+  size_t off = 0;
+  while (off < o->len) {
+    ssize_t n = write(l->fd, o->buf + off, o->len - off);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) break;
+    off += n;
+  }
+  o->len = 0;
+}
+
+/** append a JSON string (quoted, escaped) to a line
+ * @return new line length */
+static size_t jstr(char* p, size_t len, size_t cap, const char* s) {
+  static const char hex[] = "0123456789abcdef";
+  if (len < cap) p[len++] = '"';
+  for (; *s && len + 7 < cap; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      p[len++] = '\\';
+      p[len++] = c;
+    } else if (c < 0x20) {
+      memcpy(p + len, "\\u00", 4);
+      p[len + 4] = hex[c >> 4];
+      p[len + 5] = hex[c & 15];
+      len += 6;
+    } else {
+      p[len++] = c;
+    }
+  }
+  if (len < cap) p[len++] = '"';
+  return len;
+}
+
+/** start a line: time, level, event
+ * @return line length */
+static size_t jhead(struct elout* o, char* p, int64_t us, enum ellvl lvl,
+                    const char* ev) {
+  time_t sec = us / 1000000;
+  if (sec != o->sec) {
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    strftime(o->stamp, sizeof(o->stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    o->sec = sec;
+  }
+  int n = snprintf(p, ELLINE,
+                   "{\"ts\":\"%s.%06dZ\",\"level\":\"%s\",\"event\":", o->stamp,
+                   (int)(us % 1000000), lvlnames[lvl]);
+  return jstr(p, n, ELLINE, ev);
+}
+
+/** format one record as a JSON line into the batch */
+static void elfmt(struct elog* l, struct elout* o, int shard,
+                  const struct elrec* r) {
+  if (o->len + ELLINE > ELBUF) elflush(l, o);
+  const struct elev* e = &l->evs[r->ev];
+  char* p = o->buf + o->len;
+  size_t len = jhead(o, p, r->us, e->lvl, e->name);
+  len += snprintf(p + len, ELLINE - len, ",\"shard\":%d", shard);
+  if (r->fd != -1) len += snprintf(p + len, ELLINE - len, ",\"fd\":%d", r->fd);
+  if (e->nkey) {
+    len += snprintf(p + len, ELLINE - len, ",\"%s\":%lld", e->nkey,
+                    (long long)r->n);
+    if (strcmp(e->nkey, "errno") == 0) {
+      len += snprintf(p + len, ELLINE - len, ",\"error\":");
+      len = jstr(p, len, ELLINE - 2, strerror((int)r->n));
+    }
+  }
+  if (e->skey) {
+    len += snprintf(p + len, ELLINE - len, ",\"%s\":", e->skey);
+    len = jstr(p, len, ELLINE - 2, r->s);
+  }
+  if (r->skip) {
+    len += snprintf(p + len, ELLINE - len, ",\"suppressed\":%u", r->skip);
+  }
+  if (len > ELLINE - 2) len = ELLINE - 2;
+  p[len++] = '}';
+  p[len++] = '\n';
+  o->len += len;
+}
+
+/** format everything queued on one ring
+ * @return records taken */
+static unsigned elqdrain(struct elog* l, struct elout* o, struct elq* q) {
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  for (unsigned i = head; i != tail; i++) {
+    elfmt(l, o, q->id, &q->r[i & (ELQLEN - 1)]);
+  }
+  atomic_store_explicit(&q->head, tail, memory_order_release);
+  return tail - head;
+}
+
+/** report records dropped since the last report, as a record of its own */
+static void eldropped(struct elog* l, struct elout* o) {
+  unsigned long drops = eldrops(l);
+  if (drops == l->rdrops) return;
+  if (o->len + ELLINE > ELBUF) elflush(l, o);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  char* p = o->buf + o->len;
+  size_t len = jhead(o, p, (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+                     EL_WARN, "log_dropped");
+  len += snprintf(p + len, ELLINE - len, ",\"count\":%lu}\n",
+                  drops - l->rdrops);
+  o->len += len;
+  l->rdrops = drops;
+}
+
+/** writer thread: drain the rings, write, nap when idle */
+static void* elrun(void* arg) {
+  struct elog* l = arg;
+  struct elout* o = calloc(1, sizeof(*o));
+  if (!o) return NULL;
+  int nap = 0;
+  long long lastrep = nsnow();
+
+  while (1) {
+    bool stop = atomic_load_explicit(&l->stop, memory_order_acquire);
+    unsigned n = 0;
+    for (int i = 0; i < l->nq; i++) n += elqdrain(l, o, &l->qs[i]);
+
+    long long now = nsnow();
+    if (stop || now - lastrep >= 1000000000LL) {
+      eldropped(l, o);
+      lastrep = now;
+    }
+    elflush(l, o);
+    if (stop) break;  // the drain above was the last one
+
+    // busy: go again at once; idle: back off 1, 2, 4.. ELNAP ms
+    if (n > 0) {
+      nap = 0;
+      continue;
+    }
+    nap = nap ? (nap * 2 > ELNAP ? ELNAP : nap * 2) : 1;
+    struct timespec ts = {0, nap * 1000000L};
+    nanosleep(&ts, NULL);
+  }
+  free(o);
+  return NULL;
+}
+
+// ─── api ────────────────────────────────────────────────────────────────────
+
+int ellevel(const char* name, enum ellvl* lvl) {
+  for (int i = EL_DEBUG; i <= EL_OFF; i++) {
+    if (strcmp(name, lvlnames[i]) == 0) {
+      *lvl = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void elput(struct elq* q, int ev, int fd, long n, const char* s) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  unsigned skip = 0;
+  if (q->evs[ev].lvl >= EL_WARN) {
+    // a burst per second; what is cut is counted into the next one
+    if (ts.tv_sec != q->rlsec[ev]) {
+      q->rlsec[ev] = ts.tv_sec;
+      q->rln[ev] = 0;
+    }
+    if (q->rln[ev]++ >= ELBURST) {
+      q->rlskip[ev]++;
+      return;
+    }
+    skip = q->rlskip[ev];
+    q->rlskip[ev] = 0;
+  }
+
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if (tail - q->chead >= ELQLEN) {
+    q->chead = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - q->chead >= ELQLEN) {
+      atomic_store_explicit(
+          &q->drops, atomic_load_explicit(&q->drops, memory_order_relaxed) + 1,
+          memory_order_relaxed);
+      return;
+    }
+  }
+  struct elrec* r = &q->r[tail & (ELQLEN - 1)];
+  r->us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  r->n = n;
+  r->fd = fd;
+  r->ev = ev;
+  r->skip = skip > UINT16_MAX ? UINT16_MAX : skip;
+  if (s) {
+    strncpy(r->s, s, ELSTR - 1);
+    r->s[ELSTR - 1] = '\0';
+  } else {
+    r->s[0] = '\0';
+  }
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+int elopen(struct elog* l, const struct elev* evs, int nev, enum ellvl min,
+           int fd, int nq) {
+  memset(l, 0, sizeof(*l));
+  l->evs = evs;
+  l->nev = nev;
+  l->min = min;
+  l->fd = fd;
+  if (nev > ELEVMAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (min == EL_OFF) return 0;
+
+  l->qs = calloc(nq, sizeof(*l->qs));
+  if (!l->qs) return -1;
+  l->nq = nq;
+  for (int i = 0; i < nq; i++) {
+    struct elq* q = &l->qs[i];
+    if (!(q->r = malloc(sizeof(*q->r) * ELQLEN))) {
+      elclose(l);
+      errno = ENOMEM;
+      return -1;
+    }
+    q->evs = evs;
+    q->min = min;
+    q->id = i;
+  }
+  atomic_init(&l->stop, false);
+  int rc = pthread_create(&l->tid, NULL, elrun, l);
+  if (rc != 0) {
+    elclose(l);
+    errno = rc;
+    return -1;
+  }
+  l->on = true;
+  return 0;
+}
+
+void elclose(struct elog* l) {
+  if (l->on) {
+    atomic_store_explicit(&l->stop, true, memory_order_release);
+    pthread_join(l->tid, NULL);
+    l->on = false;
+  }
+  for (int i = 0; i < l->nq; i++) free(l->qs[i].r);
+  free(l->qs);
+  l->qs = NULL;
+  l->nq = 0;
+}
+
+unsigned long eldrops(struct elog* l) {
+  unsigned long drops = 0;
+  for (int i = 0; i < l->nq; i++) drops += atomic_load(&l->qs[i].drops);
+  return drops;
+}
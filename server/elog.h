@@ -0,0 +1,118 @@
+#ifndef ELOG_H
+#define ELOG_H
+
+// structured event log (connections, errors, shutdown) as JSON lines. a
+// shard never formats or writes anything itself: it copies a fixed size
+// binary record into its own single-producer ring (wait-free, no locks),
+// and a background thread turns records into JSON and writes them in
+// batches. a slow terminal or pipe only fills the ring; records that don't
+// fit are dropped and counted. events below the level are filtered before
+// a record is made, and each shard passes at most ELBURST warnings/errors
+// per event per second, counting the rest into the next one that passes.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ELQLEN 4096   // records per ring (power of two)
+#define ELSTR 36      // text argument bytes (incl. NUL, longer is cut)
+#define ELEVMAX 32    // event kinds
+#define ELBURST 10    // warnings/errors per event per second per shard
+
+enum ellvl { EL_DEBUG, EL_INFO, EL_WARN, EL_ERROR, EL_OFF };
+
+// an event kind: what a record of it means, and its two argument names
+struct elev {
+  const char* name;  // "event" value
+  enum ellvl lvl;    // level
+  const char* nkey;  // numeric argument key, NULL = none ("errno" also
+                     // gets the message text as "error")
+  const char* skey;  // text argument key, NULL = none
+};
+
+// one event, as the shard wrote it (64 bytes)
+struct elrec {
+  int64_t us;        // wall clock, us since the epoch
+  int64_t n;         // numeric argument
+  int32_t fd;        // connection, -1 = none
+  uint16_t ev;       // event kind
+  uint16_t skip;     // events of this kind suppressed just before it
+  char s[ELSTR];     // text argument
+};
+
+// a producer (shard) ring
+struct elq {
+  struct elrec* r;           // ELQLEN records
+  unsigned chead;            // producer's cached copy of head
+  _Atomic unsigned tail;     // next record the producer writes
+  _Atomic unsigned head;     // next record the writer reads
+  atomic_ulong drops;        // records dropped on a full ring
+  const struct elev* evs;    // event table
+  enum ellvl min;            // lowest level logged
+  int id;                    // shard
+  int64_t rlsec[ELEVMAX];    // rate limit: current second per event
+  int rln[ELEVMAX];          // records passed this second
+  unsigned rlskip[ELEVMAX];  // records suppressed since the last passed
+};
+
+struct elog {
+  struct elq* qs;           // one ring per shard
+  int nq;                   // ring count
+  const struct elev* evs;   // event table
+  int nev;                  // event kinds
+  enum ellvl min;           // lowest level logged
+  int fd;                   // output
+  pthread_t tid;            // writer thread
+  atomic_bool stop;         // writer exits after a last drain
+  bool on;                  // rings and writer exist
+  unsigned long rdrops;     // drops already reported (writer)
+};
+
+/** level by name: debug, info, warn, error or off
+ * @param name level name
+ * @param lvl level (out)
+ * @return 0 ok, -1 unknown */
+int ellevel(const char* name, enum ellvl* lvl);
+
+/** make the rings and start the writer
+ * @param l log
+ * @param evs event table (static, nev entries, <= ELEVMAX)
+ * @param nev event kinds
+ * @param min lowest level logged (EL_OFF = no rings, no thread)
+ * @param fd output (kept open; the caller closes it after elclose())
+ * @param nq producer rings (one per shard)
+ * @return 0 ok, -1 fail (errno set) */
+int elopen(struct elog* l, const struct elev* evs, int nev, enum ellvl min,
+           int fd, int nq);
+
+/** queue an event (producer side, wait-free; see elog())
+ * @param q the calling shard's ring
+ * @param ev event kind
+ * @param fd connection, -1 = none
+ * @param n numeric argument
+ * @param s text argument, NULL = none */
+void elput(struct elq* q, int ev, int fd, long n, const char* s);
+
+/** log an event if its level is on
+ * @param q the calling shard's ring, NULL = log off
+ * @param ev event kind
+ * @param fd connection, -1 = none
+ * @param n numeric argument
+ * @param s text argument, NULL = none */
+static inline void elog(struct elq* q, int ev, int fd, long n,
+                        const char* s) {
+  if (q && q->evs[ev].lvl >= q->min) elput(q, ev, fd, n, s);
+}
+
+/** stop the writer after it wrote out every ring, and free them
+ * @param l log */
+void elclose(struct elog* l);
+
+/** records dropped on full rings so far
+ * @param l log
+ * @return count */
+unsigned long eldrops(struct elog* l);
+
+#endif  // ELOG_H
@@ -0,0 +1,154 @@
+#include "evloop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+int evinit(struct evloop* ev, enum evbe be, int cap) {
+  memset(ev, 0, sizeof(*ev));
+  ev->be = be;
+  ev->epfd = -1;
+  ev->cap = cap > 0 ? cap : 64;
+  ev->rdy = malloc(sizeof(*ev->rdy) * ev->cap);
+  if (!ev->rdy) return -1;
+
+  if (be == EV_EPOLL) {
+#ifdef __linux__
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->epfd == -1) {
+      free(ev->rdy);
+      return -1;
+    }
+#else
+    free(ev->rdy);
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+  return 0;
+}
+
+void evfree(struct evloop* ev) {
+  if (ev->epfd != -1) close(ev->epfd);
+  free(ev->rdy);
+  ev->rdy = NULL;
+  ev->epfd = -1;
+}
+
+#ifdef __linux__
+/** epoll_ctl wrapper, edge-triggered
+ * @param ev loop
+ * @param op EPOLL_CTL_ADD/MOD
+ * @param fd fd
+ * @param events POLLIN/POLLOUT mask
+ * @return 0 ok, -1 fail */
+static int epctl(struct evloop* ev, int op, int fd, short events) {
+  struct epoll_event e;
+  memset(&e, 0, sizeof(e));
+  e.events = EPOLLET | EPOLLRDHUP;
+  if (events & POLLIN) e.events |= EPOLLIN;
+  if (events & POLLOUT) e.events |= EPOLLOUT;
+  e.data.fd = fd;
+  return epoll_ctl(ev->epfd, op, fd, &e);
+}
+#endif
+
+int evadd(struct evloop* ev, int fd, short events) {
+#ifdef __linux__
+  if (ev->be == EV_EPOLL) return epctl(ev, EPOLL_CTL_ADD, fd, events);
+#endif
+  (void)ev, (void)fd, (void)events;
+  return 0;
+}
+
+int evmod(struct evloop* ev, int fd, short events) {
+#ifdef __linux__
+  if (ev->be == EV_EPOLL) return epctl(ev, EPOLL_CTL_MOD, fd, events);
+#endif
+  (void)ev, (void)fd, (void)events;
+  return 0;
+}
+
+int evdel(struct evloop* ev, int fd) {
+#ifdef __linux__
+  if (ev->be == EV_EPOLL) return epoll_ctl(ev->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+  (void)ev, (void)fd;
+  return 0;
+}
+
+/** poll() the whole array, then copy ready entries to the ready list
+ * (copying keeps dispatch safe when handlers reorder the array) */
+static int pwait(struct evloop* ev, struct pollfd* fds, int nfd, int tmo) {
+  if (nfd > ev->cap) {
+    struct pollfd* r = realloc(ev->rdy, sizeof(*r) * nfd);
+    if (!r) return -1;
+    ev->rdy = r;
+    ev->cap = nfd;
+  }
+
+  int n = poll(fds, nfd, tmo);
+  if (n <= 0) return n;
+
+  int nrdy = 0;
+  for (int i = 0; i < nfd && nrdy < n; i++) {
+    if (fds[i].revents) ev->rdy[nrdy++] = fds[i];
+  }
+  return nrdy;
+}
+
+#ifdef __linux__
+/** epoll_wait() into a scratch list and translate to pollfd form.
+ * cost is O(ready), idle connections are never touched */
+static int ewait(struct evloop* ev, int tmo) {
+  struct epoll_event evs[ev->cap];
+  int n = epoll_wait(ev->epfd, evs, ev->cap, tmo);
+  if (n <= 0) return n;
+
+  for (int i = 0; i < n; i++) {
+    short re = 0;
+    if (evs[i].events & EPOLLIN) re |= POLLIN;
+    if (evs[i].events & EPOLLOUT) re |= POLLOUT;
+    if (evs[i].events & (EPOLLHUP | EPOLLRDHUP)) re |= POLLHUP;
+    if (evs[i].events & EPOLLERR) re |= POLLERR;
+    ev->rdy[i].fd = evs[i].data.fd;
+    ev->rdy[i].events = 0;
+    ev->rdy[i].revents = re;
+  }
+  return n;
+}
+#endif
+
+int evwait(struct evloop* ev, struct pollfd* fds, int nfd, int tmo) {
+#ifdef __linux__
+  if (ev->be == EV_EPOLL) return ewait(ev, tmo);
+#endif
+  return pwait(ev, fds, nfd, tmo);
+}
+
+int evparse(const char* name, enum evbe* be) {
+  if (strcmp(name, "poll") == 0) {
+    *be = EV_POLL;
+    return 0;
+  }
+  if (strcmp(name, "epoll") == 0) {
+    *be = EV_EPOLL;
+    return 0;
+  }
+  return -1;
+}
+
+const char* evname(enum evbe be) {
+  switch (be) {
+    case EV_EPOLL:
+      return "epoll";
+    case EV_POLL:
+    default:
+      return "poll";
+  }
+}
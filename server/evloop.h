@@ -0,0 +1,67 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <poll.h>
+
+// event loop backends. EV_POLL scans the whole pollfd array per wakeup,
+// EV_EPOLL (linux) is edge-triggered and only returns the ready fds.
+enum evbe { EV_POLL, EV_EPOLL };
+
+struct evloop {
+  enum evbe be;        // backend
+  int epfd;            // epoll instance (EV_EPOLL only)
+  int cap;             // ready list capacity
+  struct pollfd* rdy;  // ready list (fd + revents) filled by evwait()
+};
+
+/** setup event loop backend
+ * @param ev loop to init
+ * @param be backend
+ * @param cap initial ready list capacity
+ * @return 0 ok, -1 fail/backend unavailable */
+int evinit(struct evloop* ev, enum evbe be, int cap);
+
+/** release backend resources
+ * @param ev loop */
+void evfree(struct evloop* ev);
+
+/** register fd with backend (no-op for poll; the array is the interest set)
+ * @param ev loop
+ * @param fd fd to watch
+ * @param events POLLIN/POLLOUT mask
+ * @return 0 ok, -1 fail */
+int evadd(struct evloop* ev, int fd, short events);
+
+/** change the watched events of a registered fd
+ * @param ev loop
+ * @param fd registered fd
+ * @param events POLLIN/POLLOUT mask
+ * @return 0 ok, -1 fail */
+int evmod(struct evloop* ev, int fd, short events);
+
+/** unregister fd (call before close)
+ * @param ev loop
+ * @param fd registered fd
+ * @return 0 ok, -1 fail */
+int evdel(struct evloop* ev, int fd);
+
+/** wait for events and fill ev->rdy
+ * @param ev loop
+ * @param fds poll fd array (interest set for EV_POLL)
+ * @param nfd fd count
+ * @param tmo timeout ms (-1 = forever)
+ * @return number of ready entries, -1 fail */
+int evwait(struct evloop* ev, struct pollfd* fds, int nfd, int tmo);
+
+/** parse backend name ("poll", "epoll")
+ * @param name backend name
+ * @param be parsed backend (out)
+ * @return 0 ok, -1 unknown */
+int evparse(const char* name, enum evbe* be);
+
+/** backend name
+ * @param be backend
+ * @return static string */
+const char* evname(enum evbe be);
+
+#endif  // EVLOOP_H
@@ -0,0 +1,94 @@
+#include "frame.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const char* nlscan(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == '\n') return p;
+  }
+  return NULL;
+}
+
+/** append to the carry buffer (caller checked the cap) */
+static int frkeep(struct inbuf* in, const char* p, int n, int max) {
+  if (!in->buf) {
+    in->buf = malloc(max);
+    if (!in->buf) return -1;
+  }
+  memcpy(in->buf + in->len, p, n);
+  in->len += n;
+  return 0;
+}
+
+int frnext(struct inbuf* in, const char** data, int* n, int max,
+           const char** line, int* len) {
+  while (*n > 0) {
+    const char* p = *data;
+    const char* nl = nlscan(p, p + *n);
+    int take = nl ? (int)(nl - p) + 1 : *n;  // bytes consumed incl. '\n'
+    *data += take;
+    *n -= take;
+
+    if (in->skip) {
+      // tail of an over-long line: drop through its newline
+      if (nl) in->skip = false;
+      continue;
+    }
+
+    if (!nl) {
+      // partial line: carry it, or start skipping once it can't fit
+      if (in->len + take > max) {
+        in->len = 0;
+        in->skip = true;
+        return FR_LONG;
+      }
+      if (frkeep(in, p, take, max) == -1) {
+        in->len = 0;
+        in->skip = true;
+        return FR_LONG;
+      }
+      return FR_NEED;
+    }
+
+    if (in->len + take > max) {
+      in->len = 0;
+      return FR_LONG;
+    }
+    if (in->len == 0) {
+      // whole line inside this read: no copy
+      *line = p;
+      *len = take;
+      return FR_LINE;
+    }
+    if (frkeep(in, p, take, max) == -1) {
+      in->len = 0;
+      return FR_LONG;
+    }
+    *line = in->buf;
+    *len = in->len;
+    in->len = 0;
+    return FR_LINE;
+  }
+  return FR_NEED;
+}
+
+void frfree(struct inbuf* in) {
+  free(in->buf);
+  in->buf = NULL;
+  in->len = 0;
+  in->skip = false;
+}
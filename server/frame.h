@@ -0,0 +1,41 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+// newline framing for the TCP stream. recv() chunks are split into whole
+// lines; a line cut by a segment boundary is carried in a per-connection
+// buffer until its newline arrives. the length cap applies to whole lines.
+
+#include <stdbool.h>
+
+enum { FR_NEED, FR_LINE, FR_LONG };
+
+struct inbuf {
+  char* buf;  // partial line carried between reads (lazily allocated)
+  int len;    // bytes carried
+  bool skip;  // discarding the rest of an over-long line
+};
+
+/** find the first '\n' (SSE2 16 bytes at a time, scalar tail/fallback)
+ * @param p start
+ * @param end one past the last byte
+ * @return pointer to '\n' or NULL */
+const char* nlscan(const char* p, const char* end);
+
+/** pull the next complete line out of received data. consumes from
+ * (*data, *n); lines that don't need the carry buffer point straight into
+ * data. a returned line is valid until the next call
+ * @param in connection carry buffer
+ * @param data received bytes (advanced)
+ * @param n received byte count (decremented)
+ * @param max max line length incl. '\n'
+ * @param line line start (out, FR_LINE)
+ * @param len line length incl. '\n' (out, FR_LINE)
+ * @return FR_LINE, FR_LONG (line over max, dropped), FR_NEED (data used up) */
+int frnext(struct inbuf* in, const char** data, int* n, int max,
+           const char** line, int* len);
+
+/** release the carry buffer
+ * @param in connection carry buffer */
+void frfree(struct inbuf* in);
+
+#endif  // FRAME_H
@@ -0,0 +1,43 @@
+#include "hist.h"
+
+#include <stdlib.h>
+
+void histinit(struct hist* h, int maxn, int maxb) {
+  h->ring = NULL;
+  h->maxn = maxn;
+  h->maxb = maxb;
+  h->head = h->n = 0;
+  h->bytes = 0;
+}
+
+/** drop the oldest entry */
+static void histpop(struct hist* h) {
+  struct hent* e = histat(h, 0);
+  h->bytes -= e->m->len;
+  msgput(e->m);
+  msgput(e->wm);
+  e->m = e->wm = NULL;
+  h->head = (h->head + 1) % h->maxn;
+  h->n--;
+}
+
+int histadd(struct hist* h, struct msg* m) {
+  if (h->maxn == 0 || m->len > h->maxb) return 0;
+  if (!h->ring) {
+    h->ring = calloc(h->maxn, sizeof(*h->ring));
+    if (!h->ring) return -1;
+  }
+  while (histlen(h) == h->maxn || h->bytes + m->len > h->maxb) histpop(h);
+
+  struct hent* e = &h->ring[(h->head + h->n++) % h->maxn];
+  e->m = msgget(m);
+  e->wm = NULL;
+  h->bytes += m->len;
+  return 0;
+}
+
+void histfree(struct hist* h) {
+  while (histlen(h) > 0) histpop(h);
+  free(h->ring);
+  histinit(h, h->maxn, h->maxb);
+}
@@ -0,0 +1,55 @@
+#ifndef HIST_H
+#define HIST_H
+
+// scrollback: a fixed size ring of the last messages said in a room, kept
+// by reference. a joining client gets them queued as-is (no re-format, no
+// copy); websocket joiners share one framed copy per entry, made by the
+// first of them. bounded in messages and in bytes, oldest evicted first.
+
+#include "msg.h"
+
+struct hent {
+  struct msg* m;   // formatted message (one ref held)
+  struct msg* wm;  // websocket framed copy, NULL until first needed
+};
+
+struct hist {
+  struct hent* ring;  // maxn entries, allocated with the first message
+  int maxn;           // max messages, 0 = scrollback off
+  int maxb;           // max message bytes
+  int head;           // oldest entry
+  int n;              // entries held
+  int bytes;          // message bytes held
+};
+
+/** setup an empty ring (allocates nothing yet)
+ * @param h ring
+ * @param maxn max messages (0 = keep nothing)
+ * @param maxb max message bytes */
+void histinit(struct hist* h, int maxn, int maxb);
+
+/** remember a message, evicting the oldest to stay within both limits.
+ * messages bigger than maxb are not kept
+ * @param h ring
+ * @param m message (a ref is taken)
+ * @return 0 ok, -1 out of memory (message not kept) */
+int histadd(struct hist* h, struct msg* m);
+
+/** messages held */
+static inline int histlen(const struct hist* h) {
+  return h->n;
+}
+
+/** entry i, 0 = oldest
+ * @param h ring
+ * @param i index (< histlen())
+ * @return entry */
+static inline struct hent* histat(struct hist* h, int i) {
+  return &h->ring[(h->head + i) % h->maxn];
+}
+
+/** drop every message and the ring itself
+ * @param h ring */
+void histfree(struct hist* h);
+
+#endif  // HIST_H
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+
+#include "inbox.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+int ibinit(struct inbox* ib) {
+  atomic_store(&ib->stub.next, NULL);
+  ib->stub.m = NULL;
+  atomic_store(&ib->head, &ib->stub);
+  ib->tail = &ib->stub;
+  atomic_store(&ib->wake, 0);
+
+#ifdef __linux__
+  ib->rfd = ib->wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ib->rfd == -1) return -1;
+#else
+  int p[2];
+  if (pipe(p) == -1) return -1;
+  fcntl(p[0], F_SETFL, O_NONBLOCK);
+  fcntl(p[1], F_SETFL, O_NONBLOCK);
+  ib->rfd = p[0];
+  ib->wfd = p[1];
+#endif
+  return 0;
+}
+
+void ibfree(struct inbox* ib) {
+  struct msg* m;
+  while ((m = ibtake(ib)) != NULL) msgput(m);
+  if (ib->wfd != ib->rfd) close(ib->wfd);
+  close(ib->rfd);
+  ib->rfd = ib->wfd = -1;
+}
+
+/** link a node in at the head (wait-free) */
+static void ibpush(struct inbox* ib, struct inode* n) {
+  atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+  struct inode* prev =
+      atomic_exchange_explicit(&ib->head, n, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+void ibpinit(struct ibpool* p) {
+  p->free = NULL;
+  atomic_store(&p->ret, NULL);
+  p->n = 0;
+}
+
+void ibpfree(struct ibpool* p) {
+  struct inode* n = atomic_exchange(&p->ret, NULL);
+  while (n) {
+    struct inode* next = atomic_load_explicit(&n->next, memory_order_relaxed);
+    free(n);
+    n = next;
+  }
+  for (n = p->free; n; n = p->free) {
+    p->free = atomic_load_explicit(&n->next, memory_order_relaxed);
+    free(n);
+  }
+  p->n = 0;
+}
+
+/** take a node: private list, else everything consumers gave back, else
+ * malloc */
+static struct inode* ibnode(struct ibpool* p) {
+  if (!p->free) {
+    p->free = atomic_exchange_explicit(&p->ret, NULL, memory_order_acquire);
+  }
+  struct inode* n = p->free;
+  if (n) {
+    p->free = atomic_load_explicit(&n->next, memory_order_relaxed);
+    return n;
+  }
+  n = malloc(sizeof(*n));
+  if (!n) return NULL;
+  n->home = p;
+  p->n++;
+  return n;
+}
+
+/** hand a taken node back to the pool it came from (any thread) */
+static void ibback(struct inode* n) {
+  struct ibpool* p = n->home;
+  struct inode* h = atomic_load_explicit(&p->ret, memory_order_relaxed);
+  do {
+    atomic_store_explicit(&n->next, h, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(
+      &p->ret, &h, n, memory_order_release, memory_order_relaxed));
+}
+
+int ibpost(struct ibpool* p, struct inbox* ib, struct msg* m) {
+  struct inode* n = ibnode(p);
+  if (!n) {
+    msgput(m);
+    return -1;
+  }
+  n->m = m;
+  ibpush(ib, n);
+  ibwake(ib);
+  return 0;
+}
+
+void ibwake(struct inbox* ib) {
+  // first wakeup since the owner last cleared: write the fd
+  if (!atomic_exchange_explicit(&ib->wake, 1, memory_order_acq_rel)) {
+    uint64_t one = 1;
+    while (write(ib->wfd, &one, ib->wfd == ib->rfd ? 8 : 1) == -1 &&
+           errno == EINTR);
+  }
+}
+
+void ibclear(struct inbox* ib) {
+  uint64_t buf[8];
+  while (read(ib->rfd, buf, sizeof(buf)) > 0);
+  // re-arm before draining so a post racing the drain wakes us again
+  atomic_store_explicit(&ib->wake, 0, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+struct msg* ibtake(struct inbox* ib) {
+  struct inode* tail = ib->tail;
+  struct inode* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (tail == &ib->stub) {
+    if (!next) return NULL;
+    ib->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&next->next, memory_order_acquire);
+  }
+  if (!next) {
+    // tail may be the last node; park the stub behind it to detach it
+    if (tail != atomic_load_explicit(&ib->head, memory_order_acquire)) {
+      return NULL;  // producer mid-push; its wakeup brings us back
+    }
+    ibpush(ib, &ib->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (!next) return NULL;
+  }
+
+  ib->tail = next;
+  struct msg* m = tail->m;
+  ibback(tail);
+  return m;
+}
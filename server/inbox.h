@@ -0,0 +1,79 @@
+#ifndef INBOX_H
+#define INBOX_H
+
+// per shard inbox: lock-free multi-producer / single-consumer queue of
+// message references (intrusive Vyukov MPSC). any shard posts, only the
+// owning shard takes. posts are coalesced into one wakeup write on an
+// eventfd (linux) or pipe that the owner watches in its event loop. queue
+// nodes come from the posting shard's ibpool and go back to it once taken,
+// so cross-shard fan-out does not reach malloc once warm.
+
+#include <stdatomic.h>
+
+#include "msg.h"
+
+struct ibpool;
+
+struct inode {
+  _Atomic(struct inode*) next;  // queue link, then return stack link
+  struct msg* m;
+  struct ibpool* home;          // pool the node goes back to
+};
+
+// queue nodes one shard posts with. the owner pops from its private free
+// list; consumers push spent nodes on ret (Treiber push), which the owner
+// swaps out whole when the free list runs dry: no single pops on the
+// shared side, so no ABA
+struct ibpool {
+  struct inode* free;           // owner only
+  _Atomic(struct inode*) ret;   // spent nodes, pushed by any thread
+  long n;                       // nodes allocated
+};
+
+struct inbox {
+  _Atomic(struct inode*) head;  // producers swap themselves in here
+  struct inode* tail;           // consumer side
+  struct inode stub;
+  atomic_int wake;              // 1 = wakeup already signalled
+  int rfd, wfd;                 // wakeup fds (same fd for eventfd)
+};
+
+/** setup inbox and its wakeup fd
+ * @param ib inbox
+ * @return 0 ok, -1 fail */
+int ibinit(struct inbox* ib);
+
+/** drop queued messages and close the wakeup fd
+ * @param ib inbox */
+void ibfree(struct inbox* ib);
+
+/** setup an empty node pool (allocates nothing yet)
+ * @param p pool */
+void ibpinit(struct ibpool* p);
+
+/** free a pool's nodes. call once no inbox holds any of them (every inbox
+ * it posted to has been ibfree()d)
+ * @param p pool */
+void ibpfree(struct ibpool* p);
+
+/** post a message (pool owner's thread). takes over the caller's reference
+ * @param p posting shard's node pool
+ * @param ib target inbox
+ * @param m message
+ * @return 0 ok, -1 fail (reference dropped) */
+int ibpost(struct ibpool* p, struct inbox* ib, struct msg* m);
+
+/** wake the owner without posting anything (any thread)
+ * @param ib inbox */
+void ibwake(struct inbox* ib);
+
+/** clear the wakeup fd (owner, before draining with ibtake)
+ * @param ib inbox */
+void ibclear(struct inbox* ib);
+
+/** take the next message (owner thread only)
+ * @param ib inbox
+ * @return message (caller owns the ref) or NULL when empty */
+struct msg* ibtake(struct inbox* ib);
+
+#endif  // INBOX_H
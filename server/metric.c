@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include "metric.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MTREQMAX 2048  // request bytes read (the rest is ignored)
+#define MTIOSEC 2      // scraper read/write timeout
+#define MTNAPMS 250    // how often the idle endpoint checks for mtstop()
+
+uint64_t mtlow(int i) {
+  if (i < (1 << MTSUB)) return (uint64_t)i;
+  int g = i >> MTSUB, s = i & ((1 << MTSUB) - 1);
+  return (uint64_t)((1 << MTSUB) + s) << (g - 1);
+}
+
+void mtprintf(struct mtbuf* b, const char* fmt, ...) {
+  if (b->err) return;
+  for (;;) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+      b->err = true;
+      return;
+    }
+    if ((size_t)n < b->cap - b->len) {
+      b->len += n;
+      return;
+    }
+    size_t cap = b->cap ? b->cap * 2 : 16384;
+    while (cap - b->len <= (size_t)n) cap *= 2;
+    char* p = realloc(b->p, cap);
+    if (!p) {
+      b->err = true;
+      return;
+    }
+    b->p = p;
+    b->cap = cap;
+  }
+}
+
+void mthead(struct mtbuf* b, const char* name, const char* type,
+            const char* help) {
+  mtprintf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void mthistout(struct mtbuf* b, const char* name, const char* help,
+               struct mthist* const* hs, int n, double scale) {
+  mthead(b, name, "histogram", help);
+  long cum = 0, sum = 0;
+  for (int i = 0; i <= MTBUCKETS; i++) {
+    for (int k = 0; k < n; k++) {
+      cum += atomic_load_explicit(&hs[k]->b[i], memory_order_relaxed);
+    }
+    if (i == MTBUCKETS) break;
+    // values are whole units, so a bucket's largest is one below the
+    // next one's first (le is inclusive)
+    mtprintf(b, "%s_bucket{le=\"%.9g\"} %ld\n", name,
+             (double)(mtlow(i + 1) - 1) * scale, cum);
+  }
+  for (int k = 0; k < n; k++) {
+    sum += atomic_load_explicit(&hs[k]->sum, memory_order_relaxed);
+  }
+  mtprintf(b, "%s_bucket{le=\"+Inf\"} %ld\n", name, cum);
+  mtprintf(b, "%s_sum %.9g\n%s_count %ld\n", name, (double)sum * scale, name,
+           cum);
+}
+
+/** write all of buf (blocking, with the socket's timeout)
+ * @return 0 ok, -1 fail */
+static int mtwrite(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/** answer one scrape: read the request head, render, reply, done
+ * @param s endpoint
+ * @param fd accepted connection (blocking) */
+static void mtreply(struct mtsrv* s, int fd) {
+  char req[MTREQMAX + 1];
+  size_t len = 0;
+  while (len < MTREQMAX) {
+    ssize_t n = recv(fd, req + len, MTREQMAX - len, 0);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) break;
+    len += n;
+    req[len] = '\0';
+    if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+  }
+  req[len] = '\0';
+
+  char head[160];
+  bool get = strncmp(req, "GET ", 4) == 0;
+  const char* path = req + 4;
+  size_t plen = get ? strcspn(path, " ?\r\n") : 0;
+  bool found = get && ((plen == 8 && strncmp(path, "/metrics", 8) == 0) ||
+                       (plen == 1 && path[0] == '/'));
+  if (!found) {
+    int hl = snprintf(head, sizeof(head),
+                      "HTTP/1.0 %s\r\nContent-Length: 0\r\n"
+                      "Connection: close\r\n\r\n",
+                      get ? "404 Not Found" : "405 Method Not Allowed");
+    mtwrite(fd, head, hl);
+    return;
+  }
+
+  struct mtbuf b = {0};
+  s->render(&b, s->arg);
+  if (b.err) {
+    free(b.p);
+    static const char fail[] =
+        "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    mtwrite(fd, fail, sizeof(fail) - 1);
+    return;
+  }
+  int hl = snprintf(head, sizeof(head),
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                    b.len);
+  if (mtwrite(fd, head, hl) == 0) mtwrite(fd, b.p, b.len);
+  free(b.p);
+}
+
+/** endpoint thread: one scrape at a time, off the event loops */
+static void* mtloop(void* arg) {
+  struct mtsrv* s = arg;
+  while (!atomic_load(&s->stop)) {
+    struct pollfd p = {.fd = s->lfd, .events = POLLIN};
+    if (poll(&p, 1, MTNAPMS) <= 0) continue;
+    int fd = accept(s->lfd, NULL, NULL);
+    if (fd == -1) continue;
+
+    // some systems hand out the listener's O_NONBLOCK; a stuck scraper
+    // only ever holds this thread for the timeout
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    struct timeval tv = {.tv_sec = MTIOSEC};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    mtreply(s, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+int mtstart(struct mtsrv* s, int lfd, void (*render)(struct mtbuf*, void*),
+            void* arg) {
+  s->lfd = lfd;
+  s->render = render;
+  s->arg = arg;
+  atomic_init(&s->stop, false);
+  int rc = pthread_create(&s->tid, NULL, mtloop, s);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  return 0;
+}
+
+void mtstop(struct mtsrv* s) {
+  atomic_store(&s->stop, true);
+  pthread_join(s->tid, NULL);
+  close(s->lfd);
+}
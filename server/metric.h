@@ -0,0 +1,116 @@
+#ifndef METRIC_H
+#define METRIC_H
+
+// counters, gauges and latency histograms for the stats endpoint. each
+// shard owns its metrics and is their only writer: an update is a relaxed
+// load + store (no locked instruction, no cache line shared with other
+// shards), and the endpoint thread reads every shard's copy and sums them.
+// histograms are log-linear: 4 linear buckets per power of two (<= 25%
+// wide), so 96 counters cover 0 .. 2^25 units. the endpoint is a tiny
+// HTTP/1.0 server on its own thread, answering GET /metrics in the
+// Prometheus text format.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MTSUB 2                  // log2 of linear buckets per power of two
+#define MTBUCKETS 96             // buckets below 2^25, then one overflow
+
+// histogram, one writer
+struct mthist {
+  atomic_long b[MTBUCKETS + 1];  // counts per bucket (last: overflow)
+  atomic_long sum;               // sum of observed values
+};
+
+/** add to a counter only this thread writes */
+static inline void mtadd(atomic_long* c, long n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
+
+/** set a gauge */
+static inline void mtset(atomic_long* g, long v) {
+  atomic_store_explicit(g, v, memory_order_relaxed);
+}
+
+/** histogram bucket of a value: exact below 4, then 4 per power of two */
+static inline int mtbucket(uint64_t v) {
+  if (v < (1u << MTSUB)) return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  int i = ((e - MTSUB + 1) << MTSUB) |
+          (int)((v >> (e - MTSUB)) & ((1u << MTSUB) - 1));
+  return i < MTBUCKETS ? i : MTBUCKETS;
+}
+
+/** record one value (histogram owner only)
+ * @param h histogram
+ * @param v value */
+static inline void mtobs(struct mthist* h, uint64_t v) {
+  mtadd(&h->b[mtbucket(v)], 1);
+  mtadd(&h->sum, (long)v);
+}
+
+/** first value of a bucket (MTBUCKETS = end of the last one)
+ * @param i bucket
+ * @return value */
+uint64_t mtlow(int i);
+
+// growable text buffer the exposition is rendered into
+struct mtbuf {
+  char* p;
+  size_t len;
+  size_t cap;
+  bool err;  // out of memory, output truncated
+};
+
+/** append formatted text
+ * @param b buffer
+ * @param fmt printf format */
+void mtprintf(struct mtbuf* b, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** append a HELP / TYPE header
+ * @param b buffer
+ * @param name metric name
+ * @param type counter, gauge or histogram
+ * @param help description */
+void mthead(struct mtbuf* b, const char* name, const char* type,
+            const char* help);
+
+/** append a histogram summed over several owners, values scaled into the
+ * exported unit (e.g. 1e-6 for us -> seconds). buckets are cumulative
+ * @param b buffer
+ * @param name metric name
+ * @param help description
+ * @param hs histograms
+ * @param n histogram count
+ * @param scale unit factor */
+void mthistout(struct mtbuf* b, const char* name, const char* help,
+               struct mthist* const* hs, int n, double scale);
+
+// stats endpoint
+struct mtsrv {
+  int lfd;                                   // listener (non-blocking)
+  void (*render)(struct mtbuf* b, void* arg);  // writes the exposition
+  void* arg;                                 // render argument
+  atomic_bool stop;                          // mtstop() asked
+  pthread_t tid;                             // serving thread
+};
+
+/** serve GET /metrics on a listener from a new thread
+ * @param s endpoint
+ * @param lfd non-blocking listening socket (owned from now on)
+ * @param render renders the exposition (on the endpoint thread)
+ * @param arg render argument
+ * @return 0 ok, -1 fail (errno set) */
+int mtstart(struct mtsrv* s, int lfd, void (*render)(struct mtbuf*, void*),
+            void* arg);
+
+/** stop serving, join the thread and close the listener
+ * @param s endpoint */
+void mtstop(struct mtsrv* s);
+
+#endif  // METRIC_H
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L  // localtime_r
+
+#include "msg.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// per-thread side of the message pools. a message goes back to the cache
+// of whichever thread drops its last reference, and only that thread
+// touches its lists. counters are written by their owner alone and summed
+// by msgstats() from any thread
+struct mcache {
+  struct msg* free[MSGNCLS];       // free blocks, linked through their data
+  int nfree[MSGNCLS];              // blocks on each list
+  atomic_long get[MSGNCLS + 1];    // messages made here (last: too big)
+  atomic_long put[MSGNCLS + 1];    // messages freed here
+  struct mcache* next;             // registered caches
+  bool reg;                        // on the list
+};
+
+static _Thread_local struct mcache mc;
+
+static pthread_mutex_t mlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t monce = PTHREAD_ONCE_INIT;
+static pthread_key_t mkey;             // runs mexit() when a thread ends
+static struct mcache* mcaches;         // live threads' caches (mlock)
+static long mgone[MSGNCLS + 1];        // get - put of ended threads (mlock)
+static atomic_long mheld[MSGNCLS + 1]; // blocks held from malloc
+static atomic_long mhwm[MSGNCLS + 1];  // most blocks held at once
+static atomic_long mbig;               // bytes held by too big messages
+
+/** size class of a message, MSGNCLS = too big for any */
+static int mcls(int len) {
+  size_t need = sizeof(struct msg) + len + 1;
+  if (need > MSGCLSMAX) return MSGNCLS;
+  if (need <= MSGCLSMIN) return 0;
+  // log2 of the next power of two, minus log2(MSGCLSMIN) = 6
+  return 32 - __builtin_clz((unsigned)need - 1) - 6;
+}
+
+/** bump a counter only this thread writes (no locked instruction) */
+static inline void mcount(atomic_long* c) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/** account for a block taken from (n = 1) or given back to (n = -1) malloc */
+static void mhold(int k, long n) {
+  long h = atomic_fetch_add_explicit(&mheld[k], n, memory_order_relaxed) + n;
+  long w = atomic_load_explicit(&mhwm[k], memory_order_relaxed);
+  while (h > w && !atomic_compare_exchange_weak_explicit(
+                      &mhwm[k], &w, h, memory_order_relaxed,
+                      memory_order_relaxed)) {
+  }
+}
+
+/** thread exit: fold its counters into mgone and free its cached blocks */
+static void mexit(void* arg) {
+  struct mcache* c = arg;
+  pthread_mutex_lock(&mlock);
+  for (struct mcache** pp = &mcaches; *pp; pp = &(*pp)->next) {
+    if (*pp == c) {
+      *pp = c->next;
+      break;
+    }
+  }
+  for (int k = 0; k <= MSGNCLS; k++) mgone[k] += c->get[k] - c->put[k];
+  pthread_mutex_unlock(&mlock);
+
+  for (int k = 0; k < MSGNCLS; k++) {
+    while (c->free[k]) {
+      struct msg* m = c->free[k];
+      memcpy(&c->free[k], m->data, sizeof(m));
+      free(m);
+      mhold(k, -1);
+    }
+    c->nfree[k] = 0;
+  }
+  memset(c->get, 0, sizeof(c->get));
+  memset(c->put, 0, sizeof(c->put));
+  c->reg = false;
+}
+
+static void mkeyinit(void) { pthread_key_create(&mkey, mexit); }
+
+/** put this thread's cache on the list, once */
+static void mreg(void) {
+  pthread_once(&monce, mkeyinit);
+  pthread_mutex_lock(&mlock);
+  mc.next = mcaches;
+  mcaches = &mc;
+  pthread_mutex_unlock(&mlock);
+  pthread_setspecific(mkey, &mc);
+  mc.reg = true;
+}
+
+struct msg* msgnew(int len) {
+  if (!mc.reg) mreg();
+  int k = mcls(len);
+  struct msg* m = k < MSGNCLS ? mc.free[k] : NULL;
+  if (m) {
+    memcpy(&mc.free[k], m->data, sizeof(m));
+    mc.nfree[k]--;
+  } else {
+    // class blocks get the full class size so any of them can be reused
+    size_t sz = k < MSGNCLS ? (size_t)MSGCLSMIN << k : sizeof(*m) + len + 1;
+    m = malloc(sz);
+    if (!m) return NULL;
+    mhold(k, 1);
+    if (k == MSGNCLS) atomic_fetch_add_explicit(&mbig, sz, memory_order_relaxed);
+  }
+  mcount(&mc.get[k]);
+  atomic_init(&m->ref, 1);
+  m->len = len;
+  m->room = 0;
+  m->rgen = 0;
+  m->to = -1;
+  m->t0 = 0;
+  m->note = false;
+  m->data[len] = '\0';
+  return m;
+}
+
+void msgput(struct msg* m) {
+  if (!m || atomic_fetch_sub_explicit(&m->ref, 1, memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (!mc.reg) mreg();
+  int k = mcls(m->len);
+  mcount(&mc.put[k]);
+  if (k < MSGNCLS && mc.nfree[k] < MSGCACHE / (MSGCLSMIN << k)) {
+    memcpy(m->data, &mc.free[k], sizeof(m));
+    mc.free[k] = m;
+    mc.nfree[k]++;
+    return;
+  }
+  if (k == MSGNCLS) {
+    atomic_fetch_sub_explicit(&mbig, sizeof(*m) + m->len + 1,
+                              memory_order_relaxed);
+  }
+  free(m);
+  mhold(k, -1);
+}
+
+void msgstats(struct poolstat* st) {
+  static const char* names[MSGNCLS + 1] = {
+      "msg64", "msg128", "msg256", "msg512", "msg1k", "msg2k", "msg4k", "msgbig"};
+  long live[MSGNCLS + 1];
+  pthread_mutex_lock(&mlock);
+  for (int k = 0; k <= MSGNCLS; k++) {
+    live[k] = mgone[k];
+    for (struct mcache* c = mcaches; c; c = c->next) {
+      live[k] += atomic_load_explicit(&c->get[k], memory_order_relaxed) -
+                 atomic_load_explicit(&c->put[k], memory_order_relaxed);
+    }
+  }
+  pthread_mutex_unlock(&mlock);
+
+  for (int k = 0; k <= MSGNCLS; k++) {
+    long held = atomic_load_explicit(&mheld[k], memory_order_relaxed);
+    st[k].name = names[k];
+    st[k].objsz = k < MSGNCLS ? (size_t)MSGCLSMIN << k : 0;
+    st[k].live = live[k] > 0 ? live[k] : 0;  // threads race the sum
+    st[k].hwm = atomic_load_explicit(&mhwm[k], memory_order_relaxed);
+    st[k].bytes = k < MSGNCLS ? held * (long)st[k].objsz
+                              : atomic_load_explicit(&mbig, memory_order_relaxed);
+  }
+}
+
+void tstick(struct tsclk* k) {
+  time_t now = time(NULL);
+  if (now == k->sec) return;
+  struct tm t;
+  localtime_r(&now, &t);
+  k->txt[0] = '[';
+  strftime(k->txt + 1, TSLEN - 2, "%Y-%m-%d %H:%M:%S", &t);
+  memcpy(k->txt + TSLEN - 2, "] ", 3);
+  k->sec = now;
+}
+
+int fmtpfx(char* buf, const char* name) {
+  return snprintf(buf, PFXMAX, "%s: ", name);
+}
+
+struct msg* fmtmsg(const struct tsclk* k, const char* pfx, int plen,
+                   const char* msg, int len) {
+  // every message goes out as one line
+  int nl = len == 0 || msg[len - 1] != '\n';
+  struct msg* out = msgnew(TSLEN + plen + len + nl);
+  if (!out) return NULL;
+  memcpy(out->data, k->txt, TSLEN);
+  memcpy(out->data + TSLEN, pfx, plen);
+  memcpy(out->data + TSLEN + plen, msg, len);
+  if (nl) out->data[TSLEN + plen + len] = '\n';
+
+  return out;
+}
@@ -0,0 +1,88 @@
+#ifndef MSG_H
+#define MSG_H
+
+// refcounted broadcast message. formatted once, then queued by reference on
+// every recipient's send queue (on any shard); freed when the last reference
+// is dropped. messages up to MSGCLSMAX bytes come from power of two size
+// classes recycled through per-thread caches, so the broadcast path does
+// not reach malloc once it is warm.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pool.h"
+
+#define MSGNCLS 7               // size classes: 64 B .. MSGCLSMAX blocks
+#define MSGCLSMIN 64            // smallest class block (header included)
+#define MSGCLSMAX 4096          // largest class block; bigger ones use malloc
+#define MSGCACHE (256 << 10)    // free block bytes kept per class per thread
+#define TSLEN 22      // "[YYYY-MM-DD HH:MM:SS] "
+#define PFXMAX 24     // sender prefix incl. ": " and NUL
+
+struct msg {
+  atomic_int ref;  // references held (creator + queues + in-flight sends)
+  int len;      // bytes in data (excl. NUL)
+  int room;     // room a broadcast goes to (room.h), 0 = lobby
+  unsigned rgen;  // room's generation (room.h), tells a reclaimed id apart
+  int to;       // direct message target id, -1 = broadcast to the room
+  unsigned tgen;  // target's nick generation (nick.h), tells a reused id apart
+  uint32_t t0;  // when its input was received (server clock, us), 0 = untimed
+  bool note;    // server notice: delivered, never kept in scrollback
+  char data[];  // formatted message, NUL terminated
+};
+
+/** allocate a message with room for len bytes (+NUL), ref = 1
+ * @param len payload len
+ * @return message or NULL */
+struct msg* msgnew(int len);
+
+/** take a reference
+ * @param m message
+ * @return m */
+static inline struct msg* msgget(struct msg* m) {
+  atomic_fetch_add_explicit(&m->ref, 1, memory_order_relaxed);
+  return m;
+}
+
+/** drop a reference, freeing the message on the last one
+ * @param m message */
+void msgput(struct msg* m);
+
+/** read the message pool counters: one entry per size class plus one for
+ * messages too big for any class. live counts are summed over threads
+ * @param st stats (out, MSGNCLS + 1 entries) */
+void msgstats(struct poolstat* st);
+
+// wall clock second rendered as header text. one per thread, refreshed
+// once per loop pass: formatting never calls localtime() (tz lock) or
+// strftime()
+struct tsclk {
+  time_t sec;           // second txt shows, 0 = never rendered
+  char txt[TSLEN + 1];  // "[YYYY-MM-DD HH:MM:SS] "
+};
+
+/** refresh the timestamp text; renders only when the second has changed
+ * @param k clock */
+void tstick(struct tsclk* k);
+
+/** render a sender prefix, once per nick (on join and /nick)
+ * @param buf prefix (out, PFXMAX bytes)
+ * @param name sender nick
+ * @return prefix length */
+int fmtpfx(char* buf, const char* name);
+
+/** format msg with the cached timestamp & a pre-rendered sender prefix,
+ * once per broadcast. three copies straight into the message, no
+ * formatting calls; a trailing '\n' is added when msg lacks one
+ * @param k clock (tstick()ed this loop pass)
+ * @param pfx sender prefix from fmtpfx()
+ * @param plen prefix length
+ * @param msg raw message (need not be NUL terminated)
+ * @param len message bytes
+ * @return "[time] id: msg\n" message (ref = 1) or NULL */
+struct msg* fmtmsg(const struct tsclk* k, const char* pfx, int plen,
+                   const char* msg, int len);
+
+#endif  // MSG_H
@@ -0,0 +1,136 @@
+#include "nick.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uthash.h"
+
+struct nent {
+  char key[NICKLEN + 1];  // nick, lowercased
+  struct nickref r;       // holder
+  UT_hash_handle hh;
+};
+
+static pthread_mutex_t nlock = PTHREAD_MUTEX_INITIALIZER;
+static struct nent* nicks;  // key -> entry (under nlock)
+static struct nent* nfree;  // recycled entries, linked through hh.next
+static unsigned ngen;       // last generation handed out (under nlock)
+
+/** lowercase a nick into a hash key
+ * @return key length */
+static int nkey(char key[NICKLEN + 1], const char* name, int len) {
+  for (int i = 0; i < len; i++) {
+    char ch = name[i];
+    key[i] = ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+  }
+  key[len] = '\0';
+  return len;
+}
+
+/** find an entry (under nlock) */
+static struct nent* nget(const char* key, int klen) {
+  struct nent* e;
+  HASH_FIND(hh, nicks, key, (unsigned)klen, e);
+  return e;
+}
+
+int nickreg(char* nick, struct nickref* r) {
+  int len = snprintf(nick, NICKLEN + 1, "guest%d", r->id);
+  pthread_mutex_lock(&nlock);
+  struct nent* e = nfree;
+  if (e) {
+    nfree = e->hh.next;
+  } else if (!(e = malloc(sizeof(*e)))) {
+    pthread_mutex_unlock(&nlock);
+    return -1;
+  }
+  r->gen = ++ngen;
+  nkey(e->key, nick, len);
+  e->r = *r;
+  HASH_ADD(hh, nicks, key[0], (unsigned)len, e);
+  pthread_mutex_unlock(&nlock);
+  return 0;
+}
+
+int nickmv(char* nick, const char* name, int len) {
+  if (len < 1 || len > NICKLEN) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (int i = 0; i < len; i++) {
+    char ch = name[i];
+    if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+          (ch >= '0' && ch <= '9') || ch == '_' || ch == '-')) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  char key[NICKLEN + 1], old[NICKLEN + 1];
+  nkey(key, name, len);
+  int olen = nkey(old, nick, strlen(nick));
+  // guest<digits> belongs to whoever joined with that id
+  if (len > 5 && strncmp(key, "guest", 5) == 0 &&
+      strspn(key + 5, "0123456789") == (size_t)len - 5 &&
+      strcmp(key, old) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_mutex_lock(&nlock);
+  if (strcmp(key, old) != 0) {  // a new name, not just new case
+    struct nent* e = nget(old, olen);
+    if (nget(key, len) || !e) {
+      pthread_mutex_unlock(&nlock);
+      errno = EEXIST;
+      return -1;
+    }
+    HASH_DEL(nicks, e);
+    memcpy(e->key, key, len + 1);
+    HASH_ADD(hh, nicks, key[0], (unsigned)len, e);
+  }
+  pthread_mutex_unlock(&nlock);
+  memcpy(nick, name, len);
+  nick[len] = '\0';
+  return 0;
+}
+
+int nickfind(const char* name, int len, struct nickref* r) {
+  if (len < 1 || len > NICKLEN) return -1;
+  char key[NICKLEN + 1];
+  nkey(key, name, len);
+  pthread_mutex_lock(&nlock);
+  struct nent* e = nget(key, len);
+  if (e) *r = e->r;
+  pthread_mutex_unlock(&nlock);
+  return e ? 0 : -1;
+}
+
+void nickseen(const char* nick, uint64_t seen) {
+  char key[NICKLEN + 1];
+  int len = nkey(key, nick, strlen(nick));
+  pthread_mutex_lock(&nlock);
+  struct nent* e = nget(key, len);
+  if (e) e->r.seen = seen;
+  pthread_mutex_unlock(&nlock);
+}
+
+void nickdel(const char* nick) {
+  char key[NICKLEN + 1];
+  int len = nkey(key, nick, strlen(nick));
+  pthread_mutex_lock(&nlock);
+  struct nent* e = nget(key, len);
+  if (e) {
+    HASH_DEL(nicks, e);
+    e->hh.next = nfree;
+    nfree = e;
+  }
+  pthread_mutex_unlock(&nlock);
+}
+
+size_t nicksize(void) {
+  // at most one bucket per entry (uthash doubles on long chains)
+  return sizeof(struct nent) + sizeof(UT_hash_bucket);
+}
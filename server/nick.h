@@ -0,0 +1,59 @@
+#ifndef NICK_H
+#define NICK_H
+
+// nickname registry: one process wide hash from nick to the client holding
+// it (shard, id, generation), so nicks are unique across shards and a
+// direct message finds its target with one lookup. taken under a lock, only
+// on join, /nick, /msg, /seen, leave and once per client per heartbeat (to
+// publish its last seen time); broadcasts never look a nick up (the
+// sender's prefix is rendered when its nick changes). nicks compare case
+// insensitively. every client is registered on join as guest<id>; names of
+// that form are reserved for it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NICKLEN 15  // longest nick
+
+// where a nick lives
+struct nickref {
+  int shard;      // shard the client is on
+  int id;         // fd or session id on that shard
+  unsigned gen;   // registration generation: tells a reused id apart
+  uint64_t seen;  // last input (monotonic ms), as of the holder's last timer
+};
+
+/** register a joining client under its guest nick
+ * @param nick nick (out, NICKLEN + 1 bytes): "guest<id>"
+ * @param r client (r->gen set)
+ * @return 0 ok, -1 out of memory */
+int nickreg(char* nick, struct nickref* r);
+
+/** change a client's nick
+ * @param nick current nick (updated to the new one on success)
+ * @param name wanted nick ([A-Za-z0-9_-], not guest<digits>)
+ * @param len name bytes
+ * @return 0 ok, -1 invalid (EINVAL), taken (EEXIST) or out of memory */
+int nickmv(char* nick, const char* name, int len);
+
+/** find a client by nick
+ * @param name nick
+ * @param len name bytes
+ * @param r client (out)
+ * @return 0 found, -1 no such nick */
+int nickfind(const char* name, int len, struct nickref* r);
+
+/** publish a client's last input time, for lookups from other shards
+ * @param nick nick
+ * @param seen last input (monotonic ms) */
+void nickseen(const char* nick, uint64_t seen);
+
+/** release a leaving client's nick
+ * @param nick nick */
+void nickdel(const char* nick);
+
+/** registry memory held per nick (entry + its share of the hash buckets)
+ * @return bytes */
+size_t nicksize(void);
+
+#endif  // NICK_H
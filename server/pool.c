@@ -0,0 +1,68 @@
+#include "pool.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+// slab header: link to the next slab, padded so objects stay aligned
+#define SLABHDR alignof(max_align_t)
+
+void poolinit(struct pool* p, const char* name, size_t objsz) {
+  size_t a = alignof(max_align_t);
+  memset(p, 0, sizeof(*p));
+  p->name = name;
+  if (objsz < sizeof(void*)) objsz = sizeof(void*);
+  p->objsz = (objsz + a - 1) / a * a;
+  p->perslab = (POOLSLAB - SLABHDR) / p->objsz;
+}
+
+/** add a slab and thread its objects onto the free list
+ * @return 0 ok, -1 out of memory */
+static int poolgrow(struct pool* p) {
+  char* s = malloc(POOLSLAB);
+  if (!s) return -1;
+  memcpy(s, &p->slabs, sizeof(void*));
+  p->slabs = s;
+  p->nslab++;
+
+  // last object first, so objects go out in address order
+  for (int i = p->perslab - 1; i >= 0; i--) {
+    char* o = s + SLABHDR + (size_t)i * p->objsz;
+    memcpy(o, &p->free, sizeof(void*));
+    p->free = o;
+  }
+  return 0;
+}
+
+void* poolget(struct pool* p) {
+  if (!p->free && poolgrow(p) == -1) return NULL;
+  void* o = p->free;
+  memcpy(&p->free, o, sizeof(void*));
+  memset(o, 0, p->objsz);
+  if (++p->live > p->hwm) p->hwm = p->live;
+  return o;
+}
+
+void poolput(struct pool* p, void* obj) {
+  if (!obj) return;
+  memcpy(obj, &p->free, sizeof(void*));
+  p->free = obj;
+  p->live--;
+}
+
+void poolstat(const struct pool* p, struct poolstat* st) {
+  st->name = p->name;
+  st->objsz = p->objsz;
+  st->live = p->live;
+  st->hwm = p->hwm;
+  st->bytes = p->nslab * POOLSLAB;
+}
+
+void poolfree(struct pool* p) {
+  while (p->slabs) {
+    void* s = p->slabs;
+    memcpy(&p->slabs, s, sizeof(void*));
+    free(s);
+  }
+  poolinit(p, p->name, p->objsz);
+}
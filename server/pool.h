@@ -0,0 +1,60 @@
+#ifndef POOL_H
+#define POOL_H
+
+// slab pool for fixed size records (connection entries, trunk sessions).
+// objects are carved out of POOLSLAB byte slabs and recycled through a free
+// list, so connect/disconnect storms never reach malloc once the pool has
+// grown to the peak. slabs are kept until poolfree(). one pool per shard:
+// not thread safe.
+
+#include <stddef.h>
+
+#define POOLSLAB 65536  // bytes per slab
+
+// pool counters, also filled in for the message size classes (msgstats())
+struct poolstat {
+  const char* name;  // pool name
+  size_t objsz;      // object bytes (0 = any size)
+  long live;         // objects in use
+  long hwm;          // most objects in use at once (message classes: most
+                     // blocks held, cached ones included)
+  long bytes;        // bytes held from malloc now
+};
+
+struct pool {
+  const char* name;  // for stats
+  size_t objsz;      // object size, rounded up for alignment
+  int perslab;       // objects per slab
+  void* free;        // free objects, linked through their first word
+  void* slabs;       // slabs, linked through their first word
+  long nslab;        // slabs allocated
+  long live;         // objects handed out
+  long hwm;          // most objects handed out at once
+};
+
+/** setup an empty pool (allocates nothing yet)
+ * @param p pool
+ * @param name pool name (static string)
+ * @param objsz object size (<= POOLSLAB / 2) */
+void poolinit(struct pool* p, const char* name, size_t objsz);
+
+/** take a zeroed object
+ * @param p pool
+ * @return object or NULL (out of memory) */
+void* poolget(struct pool* p);
+
+/** give an object back
+ * @param p pool
+ * @param obj object from poolget() (NULL is ignored) */
+void poolput(struct pool* p, void* obj);
+
+/** read a pool's counters
+ * @param p pool
+ * @param st stats (out) */
+void poolstat(const struct pool* p, struct poolstat* st);
+
+/** release every slab; outstanding objects become invalid
+ * @param p pool */
+void poolfree(struct pool* p);
+
+#endif  // POOL_H
@@ -0,0 +1,195 @@
+#include "room.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uthash.h"
+
+// registry entry, never freed while the process runs; renamed when an
+// empty room's id is reclaimed
+struct rname {
+  int id;                  // index in rnames
+  atomic_int n;            // members across all shards
+  atomic_uint gen;         // bumped on each rename
+  char name[ROOMLEN + 1];  // room name (changes under rlock)
+  struct rname* prev;      // parked list links (under rlock)
+  struct rname* next;
+  bool parked;             // empty, on the parked list
+  UT_hash_handle hh;
+};
+
+static pthread_mutex_t rlock = PTHREAD_MUTEX_INITIALIZER;
+static struct rname* rbyname;          // name -> entry (under rlock)
+static struct rname* rnames[ROOMMAX];  // id -> entry, written once
+static int nrnames;                    // ids handed out (under rlock)
+static struct rname* rhead;            // parked rooms, longest empty first
+static struct rname* rtail;
+
+/** put an empty room at the back of the parked list (under rlock) */
+static void rpark(struct rname* e) {
+  e->prev = rtail;
+  e->next = NULL;
+  if (rtail) rtail->next = e;
+  else rhead = e;
+  rtail = e;
+  e->parked = true;
+}
+
+/** take a room off the parked list (under rlock) */
+static void runpark(struct rname* e) {
+  if (e->prev) e->prev->next = e->next;
+  else rhead = e->next;
+  if (e->next) e->next->prev = e->prev;
+  else rtail = e->prev;
+  e->parked = false;
+}
+
+int roominit(void) {
+  return roomid("lobby", 5) == ROOMLOBBY ? 0 : -1;
+}
+
+int roomid(const char* name, int len) {
+  if (len > 0 && name[0] == '#') {
+    name++;
+    len--;
+  }
+  if (len < 1 || len > ROOMLEN) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (int i = 0; i < len; i++) {
+    char ch = name[i];
+    if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+          (ch >= '0' && ch <= '9') || ch == '_' || ch == '-')) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&rlock);
+  struct rname* e;
+  HASH_FIND(hh, rbyname, name, (unsigned)len, e);
+  if (e) {
+    if (e->parked) runpark(e);
+  } else if (nrnames < ROOMMAX) {
+    if ((e = calloc(1, sizeof(*e))) != NULL) {
+      memcpy(e->name, name, len);
+      e->id = nrnames;
+      rnames[nrnames++] = e;  // the id reaches other threads after the unlock
+      HASH_ADD(hh, rbyname, name[0], (unsigned)len, e);
+    }
+  } else if ((e = rhead) != NULL) {
+    // out of ids: the room empty the longest goes to the new name
+    runpark(e);
+    HASH_DEL(rbyname, e);
+    memset(e->name, 0, sizeof(e->name));
+    memcpy(e->name, name, len);
+    atomic_fetch_add(&e->gen, 1);
+    HASH_ADD(hh, rbyname, name[0], (unsigned)len, e);
+  }
+  if (e) atomic_fetch_add(&e->n, 1);
+  pthread_mutex_unlock(&rlock);
+  if (!e) {
+    errno = ENOSPC;
+    return -1;
+  }
+  return e->id;
+}
+
+const char* roomname(int id) {
+  return rnames[id]->name;
+}
+
+unsigned roomgen(int id) {
+  return atomic_load_explicit(&rnames[id]->gen, memory_order_acquire);
+}
+
+int roomcount(int id, int d) {
+  struct rname* e = rnames[id];
+  int n = atomic_fetch_add(&e->n, d) + d;
+  if (n == 0 && d < 0 && id != ROOMLOBBY) {
+    // roomid() may have counted someone in since: recheck under the lock
+    pthread_mutex_lock(&rlock);
+    if (atomic_load(&e->n) == 0 && !e->parked) rpark(e);
+    pthread_mutex_unlock(&rlock);
+  }
+  return n;
+}
+
+void roomsinit(struct rooms* rs, int histn, int histb) {
+  rs->r = NULL;
+  rs->n = 0;
+  rs->histn = histn;
+  rs->histb = histb;
+}
+
+struct room* roomget(struct rooms* rs, int id) {
+  return roomat(rs, id, roomgen(id));
+}
+
+struct room* roomat(struct rooms* rs, int id, unsigned gen) {
+  if (id < rs->n && rs->r[id] && rs->r[id]->gen == gen) return rs->r[id];
+  if (id >= rs->n) {
+    int n = rs->n ? rs->n : 16;
+    while (n <= id) n *= 2;
+    struct room** r = realloc(rs->r, sizeof(*r) * n);
+    if (!r) return NULL;
+    memset(r + rs->n, 0, sizeof(*r) * (n - rs->n));
+    rs->r = r;
+    rs->n = n;
+  }
+  // the id may be changing hands: take name and generation together
+  char name[ROOMLEN + 1];
+  pthread_mutex_lock(&rlock);
+  bool ok = atomic_load(&rnames[id]->gen) == gen;
+  if (ok) memcpy(name, rnames[id]->name, sizeof(name));
+  pthread_mutex_unlock(&rlock);
+  if (!ok) return NULL;  // reclaimed since the message was sent
+
+  struct room* r = rs->r[id];
+  if (!r) {
+    if (!(r = calloc(1, sizeof(*r)))) return NULL;
+    rs->r[id] = r;
+  } else {
+    // state left from the id's previous name: nobody is in it any more
+    histfree(&r->hist);
+  }
+  histinit(&r->hist, rs->histn, rs->histb);
+  r->gen = gen;
+  r->taglen = strlen(name);
+  memcpy(r->tag, name, r->taglen);
+  r->tag[r->taglen++] = '\t';
+  return r;
+}
+
+int roomadd(struct room* r, struct fdmap* c) {
+  if (r->n == r->cap) {
+    int cap = r->cap ? r->cap * 2 : 8;
+    struct fdmap** mem = realloc(r->mem, sizeof(*mem) * cap);
+    if (!mem) return -1;
+    r->mem = mem;
+    r->cap = cap;
+  }
+  r->mem[r->n] = c;
+  return r->n++;
+}
+
+struct fdmap* roomdel(struct room* r, int i) {
+  if (i == --r->n) return NULL;
+  r->mem[i] = r->mem[r->n];
+  return r->mem[i];
+}
+
+void roomsfree(struct rooms* rs) {
+  for (int i = 0; i < rs->n; i++) {
+    if (!rs->r[i]) continue;
+    histfree(&rs->r[i]->hist);
+    free(rs->r[i]->mem);
+    free(rs->r[i]);
+  }
+  free(rs->r);
+  roomsinit(rs, rs->histn, rs->histb);
+}
@@ -0,0 +1,113 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+// chat rooms. names map to small ids in one process wide registry (taken
+// under a lock, only on /join), so a message carries its room as an int
+// across shards. each shard keeps, per room id, a dense array of its own
+// members (a broadcast walks exactly that, O(room members) whatever the
+// population) and the room's scrollback. every client is in one room at a
+// time; it starts in the lobby. a room nobody is in keeps its id and
+// scrollback until the ids run out; then the one empty the longest is
+// handed to the next new name, under a new generation so shards can tell
+// the two apart.
+
+#include <stdatomic.h>
+
+#include "hist.h"
+
+#define ROOMMAX 65536  // room ids per process (empty rooms reclaimed)
+#define ROOMLEN 31     // longest room name
+#define ROOMLOBBY 0    // id of the room every client starts in
+
+struct fdmap;
+
+// one room on one shard
+struct room {
+  struct fdmap** mem;  // this shard's members, dense (broadcasts walk this)
+  int n;               // member count
+  int cap;             // mem slots allocated
+  struct hist hist;    // scrollback replayed to joiners on this shard
+  unsigned gen;        // registry generation this state belongs to
+  int taglen;          // tag length
+  char tag[ROOMLEN + 2];  // "name\t", heads the room's message log records
+};
+
+// a shard's rooms, indexed by id; created on first use
+struct rooms {
+  struct room** r;     // NULL = not seen yet
+  int n;               // r slots allocated
+  int histn;           // scrollback size for new rooms (messages)
+  int histb;           // (bytes)
+};
+
+/** register the lobby; call once before any shard starts
+ * @return 0 ok, -1 out of memory */
+int roominit(void);
+
+/** find a room by name, registering it on first use (any thread). the
+ * caller is counted in as a member, so the id cannot be reclaimed before
+ * it joins; roomcount(id, -1) undoes that
+ * @param name room name ([A-Za-z0-9_-], a leading '#' is ignored)
+ * @param len name bytes
+ * @return room id, -1 invalid name (EINVAL) or too many rooms in use
+ *         (ENOSPC) */
+int roomid(const char* name, int len);
+
+/** name of a registered room (any thread, while counted in)
+ * @param id room id
+ * @return name */
+const char* roomname(int id);
+
+/** current generation of a room id (any thread)
+ * @param id room id
+ * @return generation, bumped each time the id goes to a new name */
+unsigned roomgen(int id);
+
+/** adjust a room's member count across all shards. raise it only while
+ * already counted in (roomid() does the first); the room is parked for
+ * reclaiming when it drops to 0 (never the lobby)
+ * @param id room id
+ * @param d change
+ * @return count after the change */
+int roomcount(int id, int d);
+
+/** setup an empty room table (allocates nothing yet)
+ * @param rs table
+ * @param histn scrollback messages per room
+ * @param histb scrollback bytes per room */
+void roomsinit(struct rooms* rs, int histn, int histb);
+
+/** a shard's state for the room currently holding id, created on first
+ * use (reset when the id went to a new name since). the shard must have a
+ * member in it or be counted in
+ * @param rs table
+ * @param id room id
+ * @return room or NULL (out of memory) */
+struct room* roomget(struct rooms* rs, int id);
+
+/** a shard's state for room id at generation gen, for messages from
+ * other shards
+ * @param rs table
+ * @param id room id
+ * @param gen generation the message was sent under
+ * @return room, NULL when the id has been reclaimed since (or out of
+ *         memory) */
+struct room* roomat(struct rooms* rs, int id, unsigned gen);
+
+/** add a member
+ * @param r room
+ * @param c member
+ * @return member slot, -1 out of memory */
+int roomadd(struct room* r, struct fdmap* c);
+
+/** remove the member in slot i (swap-with-last O(1))
+ * @param r room
+ * @param i slot
+ * @return member moved into slot i (its slot changed), NULL = none */
+struct fdmap* roomdel(struct room* r, int i);
+
+/** free every room and the table
+ * @param rs table */
+void roomsfree(struct rooms* rs);
+
+#endif  // ROOM_H
@@ -0,0 +1,171 @@
+#include "sendq.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // SIGPIPE is ignored in main() instead
+#endif
+
+#define SQMASK (SENDQLEN - 1)
+
+static unsigned sqmax = SENDQSZ;  // byte limit (sqlimit())
+
+void sqlimit(unsigned bytes) { sqmax = bytes < SENDQSZ ? bytes : SENDQSZ; }
+
+unsigned sqlen(const struct sendq* q) { return q->bytes; }
+
+/** does a message of len bytes fit behind what is queued */
+static bool sqfits(const struct sendq* q, unsigned len) {
+  return q->tail - q->head < SENDQLEN && len <= sqmax - q->bytes;
+}
+
+int sqsend(struct sendq* q, int fd, struct msg* m) {
+  unsigned sent = 0;
+  unsigned len = m->len;
+
+  if (q->head == q->tail) {
+    // nothing queued: try the socket first, only park the remainder
+    while (sent < len) {
+      ssize_t n = send(fd, m->data + sent, len - sent, MSG_NOSIGNAL);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return -1;
+      }
+      sent += n;
+    }
+    if (sent == len) return 0;
+  }
+
+  if (sent == 0 && !sqfits(q, len)) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  if (!q->ring) {
+    q->ring = malloc(sizeof(*q->ring) * SENDQLEN);
+    if (!q->ring) return -1;
+    q->head = q->tail = 0;
+  }
+  // a partly sent message always fits: the queue was empty
+  if (q->head == q->tail) q->off = sent;
+  q->ring[q->tail++ & SQMASK] = msgget(m);
+  q->bytes += len - sent;
+  return q->bytes;
+}
+
+int sqflush(struct sendq* q, int fd) {
+  while (q->head != q->tail) {
+    struct iovec iov[SQIOV];
+    int niov = 0;
+    for (unsigned i = q->head; i != q->tail && niov < SQIOV; i++, niov++) {
+      struct msg* m = q->ring[i & SQMASK];
+      unsigned skip = i == q->head ? q->off : 0;
+      iov[niov].iov_base = m->data + skip;
+      iov[niov].iov_len = m->len - skip;
+    }
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = niov;
+    ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return -1;
+    }
+
+    // release fully sent messages, remember progress into the next one
+    q->bytes -= n;
+    while (n > 0) {
+      struct msg* m = q->ring[q->head & SQMASK];
+      size_t rest = m->len - q->off;
+      if ((size_t)n < rest) {
+        q->off += n;
+        break;
+      }
+      n -= rest;
+      q->off = 0;
+      q->head++;
+      msgput(m);
+    }
+  }
+
+  if (q->head == q->tail) {
+    // drained: give the memory back, idle clients hold no ring
+    free(q->ring);
+    q->ring = NULL;
+    q->head = q->tail = q->off = q->bytes = 0;
+  }
+  return q->bytes;
+}
+
+int sqpush(struct sendq* q, struct msg* m) {
+  if (!sqfits(q, m->len)) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  if (!q->ring) {
+    q->ring = malloc(sizeof(*q->ring) * SENDQLEN);
+    if (!q->ring) return -1;
+    q->head = q->tail = q->off = 0;
+  }
+  q->ring[q->tail++ & SQMASK] = msgget(m);
+  q->bytes += m->len;
+  return q->bytes;
+}
+
+struct msg* sqpeek(const struct sendq* q) {
+  return q->head == q->tail ? NULL : q->ring[q->head & SQMASK];
+}
+
+void sqpop(struct sendq* q) {
+  struct msg* m = q->ring[q->head++ & SQMASK];
+  q->bytes -= m->len;
+  msgput(m);
+  if (q->head == q->tail) sqfree(q);  // idle clients hold no ring
+}
+
+/** drop the oldest message not yet started, behind a partly sent head
+ * @param q client queue (holds one) */
+static void sqcut(struct sendq* q) {
+  // a partly sent head moves up into the freed slot
+  unsigned keep = q->off ? 1 : 0;
+  struct msg* m = q->ring[(q->head + keep) & SQMASK];
+  if (keep) q->ring[(q->head + 1) & SQMASK] = q->ring[q->head & SQMASK];
+  q->head++;
+  q->bytes -= m->len;
+  msgput(m);
+}
+
+int sqevict(struct sendq* q, unsigned len) {
+  // what stays when everything unstarted goes
+  unsigned rest = q->off ? q->ring[q->head & SQMASK]->len - q->off : 0;
+  if (len > sqmax - rest) return -1;
+
+  int n = 0;
+  for (; !sqfits(q, len); n++) sqcut(q);
+  if (q->head == q->tail) sqfree(q);  // idle clients hold no ring
+  return n;
+}
+
+int sqtrim(struct sendq* q) {
+  int n = 0;
+  for (unsigned keep = q->off ? 1 : 0; q->tail - q->head > keep; n++) {
+    sqcut(q);
+  }
+  if (q->head == q->tail) sqfree(q);
+  return n;
+}
+
+void sqfree(struct sendq* q) {
+  for (; q->head != q->tail; q->head++) msgput(q->ring[q->head & SQMASK]);
+  free(q->ring);
+  q->ring = NULL;
+  q->head = q->tail = q->off = q->bytes = 0;
+}
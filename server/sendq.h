@@ -0,0 +1,82 @@
+#ifndef SENDQ_H
+#define SENDQ_H
+
+// per client outbound queue: a bounded ring of message references. messages
+// the socket won't take right away are parked here (no copy, just a ref) and
+// flushed with one vectored send per POLLOUT wakeup, so a slow reader never
+// stalls the broadcast path. the byte bound (the hard limit) is set once
+// at startup with sqlimit(); what happens to a message that does not fit is
+// the caller's policy: drop it, evict older ones (sqevict()), or cut the
+// backlog (sqtrim()).
+
+#include "msg.h"
+
+#define SENDQLEN 256   // max queued messages (power of 2)
+#define SENDQSZ 65536  // max queued bytes (ceiling for sqlimit())
+#define SQIOV 64       // messages per sendmsg() on flush
+
+struct sendq {
+  struct msg** ring;     // queued messages, allocated while backlogged
+  unsigned head, tail;   // free running ring indices
+  unsigned off;          // bytes of the head message already sent
+  unsigned bytes;        // bytes still to send
+  unsigned long drops;   // messages dropped for this client (the caller
+                         // counts: it picks what is dropped)
+};
+
+/** set the byte limit of every queue (default SENDQSZ)
+ * @param bytes limit, at most SENDQSZ */
+void sqlimit(unsigned bytes);
+
+/** bytes waiting in the queue */
+unsigned sqlen(const struct sendq* q);
+
+/** send msg, or queue a reference behind messages already waiting.
+ * messages are queued whole or not at all, so a full queue never tears a
+ * line
+ * @param q client queue
+ * @param fd client fd
+ * @param m message (a ref is taken if queued)
+ * @return bytes now pending, -1 fail (ENOBUFS = queue full, msg dropped) */
+int sqsend(struct sendq* q, int fd, struct msg* m);
+
+/** write out as many queued messages as the socket takes, SQIOV per
+ * sendmsg()
+ * @param q client queue
+ * @param fd client fd
+ * @return bytes still pending, -1 hard error */
+int sqflush(struct sendq* q, int fd);
+
+/** queue a reference without touching a socket, for clients whose bytes
+ * leave through another connection (trunk sessions). same limits as
+ * sqsend()
+ * @param q client queue
+ * @param m message (a ref is taken)
+ * @return bytes now queued, -1 fail (ENOBUFS = queue full, msg dropped) */
+int sqpush(struct sendq* q, struct msg* m);
+
+/** oldest queued message (still queued), NULL if empty */
+struct msg* sqpeek(const struct sendq* q);
+
+/** drop the oldest queued message after it went out some other way
+ * @param q client queue (not empty) */
+void sqpop(struct sendq* q);
+
+/** make room for a message of len bytes by dropping the oldest queued
+ * messages. a message already partly on the wire stays: the peer must get
+ * it whole
+ * @param q client queue
+ * @param len bytes wanted
+ * @return messages dropped, -1 it can't fit even so (nothing dropped) */
+int sqevict(struct sendq* q, unsigned len);
+
+/** drop every queued message that has not started going out
+ * @param q client queue
+ * @return messages dropped */
+int sqtrim(struct sendq* q);
+
+/** drop every queued reference and release the ring
+ * @param q client queue */
+void sqfree(struct sendq* q);
+
+#endif  // SENDQ_H
@@ -1,16 +1,41 @@
 // program: cchat/server/server.c
 // TODO:
-// [] dynamic arrays sizing
-// [x] hash table for storing fd info (index in array, nicknames, etc)
-// [] get nicknames when client joins
-// [] ring buffer for per client send queue (backpressure handling)
-// [] testing multiple clients connecting and sending messages
+// [x] dynamic arrays sizing
+// [x] table for storing fd info (index in array, nicknames, etc)
+// [x] get nicknames when client joins
+// [x] ring buffer for per client send queue (backpressure handling)
+// [x] testing multiple clients connecting and sending messages (bench-load)
+// [x] epoll backend (edge-triggered, ready list only)
+// [x] shards: reactor thread per core, SO_REUSEPORT, cross-shard inbox
+// [x] websocket gateway in the same event loop (WS_PORT)
+// [x] multiplexed gateway trunk: many browser sessions on one fd
+// [x] allocation-free message headers (cached timestamp, per-conn prefix)
+// [x] slab pool for connection records, size-classed message pools
+// [x] dense fd-indexed connection table (slot arrays, no hash lookups)
+// [x] scrollback ring replayed to joining clients
+// [x] durable message log (mmap'd segments, writer thread, group commit)
+// [x] rooms (/join, /leave, /room) with per-room member sets for fan-out
+// [x] nickname registry (/nick) and direct messages (/msg)
+// [x] timing wheel: heartbeats, idle disconnects, last seen (/seen)
+// [x] graceful shutdown: stop accepting, flush queues, then close
+// [x] metrics endpoint: counters, fan-out latency histogram (METRICS_PORT)
+// [x] structured event log: JSON lines written off the hot path (EVENT_LOG)
+// [x] slow consumers: soft/hard queue limits, policy, lag metrics
+// [x] batched accept (accept4 until EAGAIN, budgeted), batched join notices
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,74 +44,423 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "elog.h"
+#include "evloop.h"
+#include "frame.h"
+#include "hist.h"
+#include "inbox.h"
+#include "metric.h"
+#include "msg.h"
+#include "nick.h"
+#include "pool.h"
+#include "room.h"
+#include "sendq.h"
+#include "simd.h"
+#include "trunk.h"
 #include "uthash.h"
 #include "utils.h"
+#include "wal.h"
+#include "wheel.h"
+#include "ws.h"
+#ifdef CCHAT_URING
+#include "uring.h"
+#endif
 
 #define HOSTNAME "localhost"
 #define PORT "3490"
-#define MAXDATASIZE 256  // max number of bytes
-#define MAXFDS 6         // 1 listener, n clients
+#define TRPORT "3491"    // gateway trunk port (TRUNK_PORT overrides)
+#define MAXDATASIZE 256  // max message bytes (incl. newline)
+#define RECVSZ 4096      // bytes per recv() (may hold several messages)
+#define MAXCLIENTS 100   // default client ceiling (MAX_CLIENTS overrides)
+#define FDSINIT 64       // initial fd table slots per shard (doubles)
+#define NSYSFDS 5        // listeners (tcp, ws, trunk) + inbox + signal pipe
+#define MAXEVS 256       // epoll events per wakeup
+#define MAXSHARDS 256    // upper bound for SHARDS
+#define WSPATH "/ws"     // websocket upgrade path
+#define SIDBASE (1 << 24)  // first trunk session id (above any fd)
+#define HISTMSGS 50        // scrollback messages (SCROLLBACK overrides)
+#define HISTBYTES 16384    // scrollback bytes (SCROLLBACK_BYTES overrides)
+#define LOGSYNCMS 10       // log group commit interval (LOG_FSYNC_MS)
+#define LOGSEGMB 64        // log segment size in MiB (LOG_SEGMENT_MB)
+#define LOGKEEP 16         // log segments retained (LOG_SEGMENTS)
+#define HBSEC 30           // heartbeat interval (HEARTBEAT_SEC)
+#define IDLESEC 300        // idle disconnect (IDLE_TIMEOUT_SEC)
+#define SEENMS 30000       // last seen refresh with heartbeats off
+#define DRAINMS 5000       // shutdown flush deadline (SHUTDOWN_DRAIN_MS)
+#define KICKMS 2000        // slow consumer: time to flush its last words
+#define ACCEPTMAX 256      // accepts per listener per loop pass
+#define JOINMAX 256        // joins announced together (joinflush())
+#define ACCEPTNAP 100      // listener rest when out of fds, no reserve (ms)
+
+// default backend, override at build time (-DEVDEFAULT=\"poll\") or run
+// time (EVLOOP=poll|epoll|uring). uring needs a CCHAT_URING build
+#ifndef EVDEFAULT
+#ifdef __linux__
+#define EVDEFAULT "epoll"
+#else
+#define EVDEFAULT "poll"
+#endif
+#endif
+
+// connection kinds: plain TCP (newline framed), websocket (browser), a
+// gateway trunk, or one browser session carried on a trunk
+enum ckind { CK_TCP, CK_WS, CK_TRUNK, CK_SESS };
+
+struct tconn;
+struct tsess;
+
+// per shard counters, written by the shard alone (metric.h)
+enum sctr {
+  SC_ACCEPTS,   // connections accepted
+  SC_REJECTS,   // connections / trunk sessions refused at MAX_CLIENTS
+  SC_MSGSIN,    // lines / frames received from clients
+  SC_BYTESIN,   // bytes received (trunks: with framing)
+  SC_MSGSOUT,   // deliveries: one per message per recipient
+  SC_BYTESOUT,  // bytes of those deliveries
+  SC_EAGAIN,    // sends the socket refused: a backlog started or stayed
+  SC_DROPS,     // messages dropped on full send queues (any policy)
+  SC_LAGS,      // clients whose queue crossed the soft limit
+  SC_KICKS,     // slow consumers disconnected (SLOW_POLICY=disconnect)
+  SC_URENTER,   // io_uring_enter() calls (EVLOOP=uring)
+  SC_N
+};
+
+// per shard gauges: connection table and pools are published once per loop
+// pass, the backlog count as it changes
+enum sgauge {
+  SG_CONNS,    // connections in the table (clients, trunks)
+  SG_SESS,     // browser sessions on trunks
+  SG_BACKLOG,  // connections waiting for POLLOUT
+  SG_TIMERS,   // armed timers
+  SG_LAGGING,  // clients over the soft queue limit
+  SG_POOL,     // pool live, hwm, bytes: conn pool, then tsess pool
+  SG_N = SG_POOL + 6
+};
 
+struct srvstat {
+  atomic_long c[SC_N];  // counters
+  atomic_long g[SG_N];  // gauges
+  struct mthist fan;    // us from recv() to a message's last send on a
+                        // shard (one sample per message per shard)
+  struct mthist qlen;   // bytes left queued when a send stops short
+  struct mthist lag;    // ms a client stayed over the soft queue limit
+};
+
+// event log kinds (elog.h); the argument each one carries is in evs[]
+enum sev {
+  EV_JOIN,      // client joined the chat
+  EV_LEAVE,     // joined client left
+  EV_NICK,      // nick changed
+  EV_TRUNKUP,   // gateway trunk connected
+  EV_TRUNKDN,   // gateway trunk closed
+  EV_IDLE,      // idle client disconnected
+  EV_STOP,      // shutdown started (deadline 0 = a second signal)
+  EV_CLOSED,    // shard dropped its last connections
+  EV_QFULL,     // message dropped on a full send queue
+  EV_SLOW,      // client's queue crossed the soft limit
+  EV_SLOWOK,    // and went back under it
+  EV_SLOWKICK,  // slow consumer disconnected
+  EV_IOERR,     // send / recv on a connection failed
+  EV_TRUNKERR,  // gateway broke the trunk protocol
+  EV_ERR,       // internal failure (allocation, registry)
+  EV_N
+};
+
+static const struct elev evs[EV_N] = {
+    [EV_JOIN] = {"join", EL_INFO, NULL, "addr"},
+    [EV_LEAVE] = {"leave", EL_INFO, NULL, "nick"},
+    [EV_NICK] = {"nick", EL_DEBUG, NULL, "nick"},
+    [EV_TRUNKUP] = {"trunk_open", EL_INFO, NULL, NULL},
+    [EV_TRUNKDN] = {"trunk_close", EL_INFO, "sessions", NULL},
+    [EV_IDLE] = {"idle_disconnect", EL_INFO, "idle_s", "nick"},
+    [EV_STOP] = {"shutdown", EL_INFO, "drain_ms", NULL},
+    [EV_CLOSED] = {"shard_closed", EL_INFO, "connections", "output"},
+    [EV_QFULL] = {"queue_full", EL_WARN, "dropped", NULL},
+    [EV_SLOW] = {"slow_consumer", EL_WARN, "queued", "nick"},
+    [EV_SLOWOK] = {"slow_recovered", EL_INFO, "lag_ms", "nick"},
+    [EV_SLOWKICK] = {"slow_disconnect", EL_WARN, "queued", "nick"},
+    [EV_IOERR] = {"io_error", EL_ERROR, "errno", "op"},
+    [EV_TRUNKERR] = {"trunk_error", EL_WARN, "arg", "reason"},
+    [EV_ERR] = {"error", EL_ERROR, "errno", "op"},
+};
+
+// connection record, from the shard's slab pool. the broadcast loop reaches
+// it through the dense slot arrays in struct srv; fields the loop touches
+// come first, per-user text last
 struct fdmap {
-  int fd;         // key
-  int idx;        // indx in array of fd's
-  char nick[11];  // chat nickname
+  int fd;             // fd, or session id for CK_SESS
+  int idx;            // slot in fds/cons/kinds, -1 for CK_SESS
+  enum ckind kind;    // wire protocol
+  struct sendq sq;    // outbound messages waiting for POLLOUT
+  uint64_t lagat;     // over the soft queue limit since (ms), 0 = not
+  bool kick;          // being disconnected as a slow consumer
+  bool joining;       // in sv->jq, not announced yet: skipped by fanout()
+  struct wsconn* ws;  // websocket state (CK_WS only)
+  struct tconn* tc;   // trunk state (CK_TRUNK only)
+  struct tsess* ts;   // session state (CK_SESS only)
+  struct inbuf in;    // partial inbound line (CK_TCP stream reassembly)
+  struct tmr tm;      // heartbeat / idle timer on the shard's wheel
+  uint64_t seen;      // last input, monotonic ms
+  int room;           // room id (room.h)
+  int ridx;           // slot in the room's member array, -1 = not joined
+  unsigned gen;       // nick registration (nick.h), 0 = not registered
+  int pfxlen;         // prefix length
+  char pfx[PFXMAX];   // rendered sender prefix ("nick: "), see fmtpfx()
+  char nick[NICKLEN + 1];  // chat nickname, set on join
+};
+
+// a browser session multiplexed over a trunk. it is a regular client found
+// by its session id (see sidnew()), but has no slot in fds
+struct tsess {
+  uint32_t ch;       // gateway channel (key in the trunk's chans)
+  struct fdmap* c;   // client entry
+  struct fdmap* tk;  // trunk it lives on
+  int idx;           // slot in the trunk's session array
+  int credit;        // bytes the gateway still takes on this channel
+  int rwin;          // bytes the gateway may still send on this channel
+  bool skip;         // left out of the broadcast frame being built
   UT_hash_handle hh;
 };
 
-/** add fd to poll array & hash map
- * @param fds poll fd array
- * @param usrs fd->user hash map
+// server side of a gateway trunk
+struct tconn {
+  struct trunk t;       // wire buffers
+  struct tsess* chans;  // channel -> session
+  struct tsess** ss;    // sessions, dense (broadcasts walk this)
+  int nss;              // session count
+  int capss;            // ss slots allocated
+  bool dirty;           // frames batched since the last flush
+  bool dead;            // output overflowed, dropped at the next flush
+  struct fdmap* next;   // dirty list link
+  int rn;               // sessions in the room of the message being sent
+  bool rdata;           // that message goes out per session, not TR_BCAST
+  struct fdmap* rnext;  // list of trunks the message reaches
+};
+
+// one shard: a reactor thread with its own listener, fds and fdmap. shards
+// only talk through each other's inbox
+struct srv {
+  int id;               // shard index
+  int lfd;              // listener fd (SO_REUSEPORT when sharded)
+  int wfd;              // websocket listener fd, -1 = off
+  int tfd;              // gateway trunk listener fd, -1 = off
+  int nfd;              // fd count
+  int nsys;             // system fds at the head of fds (listener, inbox)
+  int cap;              // fds slots allocated (grows geometrically)
+  struct pollfd* fds;   // poll fd array (system fds, then clients)
+  uint8_t* kinds;       // enum ckind per fds slot (broadcast loop)
+  struct fdmap** cons;  // record per fds slot
+  int* tgt;             // broadcast target scratch (cap entries)
+  int* fdix;            // fd -> fds slot, -1 = none (indexed by fd)
+  int nfdix;            // fdix entries
+  struct fdmap** sids;  // trunk sessions by slot, NULL = free (sidnew())
+  int* sidfree;         // free session slots (stack, nsids entries)
+  int nsids;            // session slots allocated
+  int nsidfree;         // free slots on the stack
+  struct fdmap* tdirty; // trunks with frames batched this loop pass
+  struct tsclk clk;     // message timestamp, ticked once per loop pass
+  uint64_t now;         // monotonic ms, ticked once per loop pass
+  struct wheel wh;      // connection timers
+  bool stopping;        // shutting down: not accepting, flushing queues
+  bool acmore;          // a backlog outlasted ACCEPTMAX: accept again next
+                        // pass (edge-triggered epoll won't say so)
+  uint64_t acat;        // ... but not before this (ms): out of fds
+  unsigned acoff;       // listeners resting until acat (lstnbit())
+  int spare;            // reserve fd, given up to shed a backlog when out of
+                        // fds; -1 = lost to another thread
+  struct fdmap* jq[JOINMAX];  // joined, not announced yet (joinflush())
+  int njq;              // entries in jq
+  char jfrom[JOINMAX][64];  // their addresses
+  uint32_t rxus;        // receive time of the input being handled (us), 0
+                        // = not handling input
+  struct srvstat st;    // metrics (read by the stats endpoint)
+  struct rooms rooms;   // room members on this shard, and scrollback
+  struct walq* wq;      // this shard's message log ring, NULL = log off
+  struct elq* lq;       // this shard's event log ring, NULL = log off
+  struct pool cpool;    // fdmap records (clients, trunk sessions)
+  struct pool spool;    // trunk session records
+  struct evloop ev;     // readiness backend
+  struct inbox ib;      // broadcasts posted by other shards
+  struct ibpool ip;     // nodes this shard posts to other inboxes with
+  struct srv* shards;   // all shards (including this one)
+  int nshards;          // shard count
+  int cpu;              // pinned cpu, -1 = not pinned
+  pthread_t tid;        // reactor thread
+#ifdef CCHAT_URING
+  bool uring;           // completion engine in use (EVLOOP=uring)
+  struct uring ur;      // io_uring engine
+#endif
+};
+
+static int maxcli = MAXCLIENTS;  // process wide ceiling (MAX_CLIENTS)
+static atomic_int nclients;      // clients connected across all shards
+static const char* wsport;       // websocket port (WS_PORT), NULL = off
+static const char* trport;       // trunk port (TRUNK_PORT), NULL = off
+static int histn = HISTMSGS;     // scrollback messages (SCROLLBACK)
+static int histb = HISTBYTES;    // scrollback bytes (SCROLLBACK_BYTES)
+static struct wal wal;           // message log (LOG_DIR), wal.dir NULL = off
+static int hbms = HBSEC * 1000;  // heartbeat interval (HEARTBEAT_SEC), 0 = off
+static int idlems = IDLESEC * 1000;  // idle disconnect (IDLE_TIMEOUT_SEC)
+static int tmrms;                // timer period: heartbeat, else SEENMS
+static int drainms = DRAINMS;    // shutdown flush deadline (SHUTDOWN_DRAIN_MS)
+static int sigfds[2] = {-1, -1};  // self-pipe: signal handler -> shard 0
+static _Atomic uint64_t stopat;  // shutdown deadline (monotonic ms), 0 = none
+static struct mtsrv mts;         // stats endpoint (METRICS_PORT)
+static const char* mtport;       // stats endpoint port, NULL = off
+static struct elog elg;          // event log (EVENT_LOG, EVENT_LOG_LEVEL)
+
+// what a full send queue does with one more message (SLOW_POLICY)
+enum slowpol {
+  SP_NEWEST,    // drop the new message
+  SP_OLDEST,    // drop the oldest queued ones to make room
+  SP_COALESCE,  // replace the backlog with a "n messages skipped" notice
+  SP_KICK,      // disconnect the client, telling it why
+  SP_N
+};
+
+static const char* slownames[SP_N] = {"drop-newest", "drop-oldest",
+                                      "coalesce", "disconnect"};
+static enum slowpol slowpol = SP_NEWEST;  // SLOW_POLICY
+static int sqsoft = SENDQSZ / 4;  // lag mark (SENDQ_SOFT_BYTES)
+static int sqhard = SENDQSZ;      // queue limit (SENDQ_HARD_BYTES)
+
+/** monotonic clock in ms */
+static uint64_t msnow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** monotonic clock in us, cut to 32 bits (wraps every 71 minutes; only
+ * differences are used) and never 0 */
+static uint32_t usclk(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000) | 1;
+}
+
+/** grow the fd table (and target scratch) geometrically
+ * @param sv server state
+ * @return 0 ok, -1 fail */
+static int fdgrow(struct srv* sv) {
+  int cap = sv->cap ? sv->cap * 2 : FDSINIT;
+  if (cap > maxcli + NSYSFDS) cap = maxcli + NSYSFDS;
+  if (cap <= sv->cap) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  struct pollfd* fds = realloc(sv->fds, sizeof(*fds) * cap);
+  if (!fds) return -1;
+  sv->fds = fds;
+  uint8_t* kinds = realloc(sv->kinds, sizeof(*kinds) * cap);
+  if (!kinds) return -1;
+  sv->kinds = kinds;
+  struct fdmap** cons = realloc(sv->cons, sizeof(*cons) * cap);
+  if (!cons) return -1;
+  sv->cons = cons;
+  int* tgt = realloc(sv->tgt, sizeof(*tgt) * cap);
+  if (!tgt) return -1;
+  sv->tgt = tgt;
+  sv->cap = cap;
+  return 0;
+}
+
+/** make fdix cover fd. fds are small and dense (lowest free number first),
+ * so the index stays about as long as the fd table
+ * @param sv server state
+ * @param fd fd about to be added
+ * @return 0 ok, -1 fail */
+static int fdixgrow(struct srv* sv, int fd) {
+  if (fd < sv->nfdix) return 0;
+  int n = sv->nfdix ? sv->nfdix : FDSINIT;
+  while (n <= fd) n *= 2;
+  int* ix = realloc(sv->fdix, sizeof(*ix) * n);
+  if (!ix) return -1;
+  for (int i = sv->nfdix; i < n; i++) ix[i] = -1;
+  sv->fdix = ix;
+  sv->nfdix = n;
+  return 0;
+}
+
+/** find a connection by fd, or a trunk session by id
+ * @param sv server state
+ * @param id fd or session id
+ * @return record or NULL */
+static inline struct fdmap* conget(struct srv* sv, int id) {
+  if (id >= SIDBASE) {
+    // ids are SIDBASE + slot * nshards + shard
+    int k = (id - SIDBASE) / sv->nshards;
+    if ((id - SIDBASE) % sv->nshards != sv->id || k >= sv->nsids) return NULL;
+    return sv->sids[k];
+  }
+  if (id < 0 || id >= sv->nfdix || sv->fdix[id] < 0) return NULL;
+  return sv->cons[sv->fdix[id]];
+}
+
+/** add fd to the slot arrays, fd index & event backend
+ * @param sv server state (nfd incremented)
  * @param addfd fd to add
- * @param islfd true=listener, false=client
- * @param nfd fd count (incremented)
+ * @param islfd true=system fd (listener, inbox; before any client),
+ *              false=client
  * @return 0 ok, -1 fail */
-int fdadd(struct pollfd** fds, struct fdmap** usrs, int addfd, bool islfd,
-          int* nfd) {
-  struct fdmap* s;
-  s = malloc(sizeof(*s));
+int fdadd(struct srv* sv, int addfd, bool islfd) {
+  if (islfd == true && sv->nfd != sv->nsys) return -1;
+  if (sv->nfd == sv->cap && fdgrow(sv) == -1) return -1;
+  if (fdixgrow(sv, addfd) == -1) return -1;
+
+  struct fdmap* s = poolget(&sv->cpool);
   if (!s) return -1;
 
+  if (evadd(&sv->ev, addfd, POLLIN) == -1) {
+    poolput(&sv->cpool, s);
+    return -1;
+  }
+
+  s->fd = addfd;
+  s->ridx = -1;
+  s->gen = 0;
+  s->lagat = 0;
+  s->kick = false;
+  s->tm.next = NULL;
   if (islfd == true) {
-    // add server to fdmap
-    s->fd = addfd;
-    s->idx = 0;
+    // server fds go ahead of the clients
+    s->idx = sv->nsys++;
     strcpy(s->nick, "srvr");
-    HASH_ADD_INT(*usrs, fd, s);
-
-    // add server fd to array
-    (*fds)[0].fd = addfd;
-    (*fds)[0].events = POLLIN | POLLERR;
-    (*fds)[0].revents = 0;
+    sv->fds[s->idx].events = POLLIN | POLLERR;
   } else {
-    // add client to fdmap
-    s->fd = addfd;
-    s->idx = *nfd;
-    strcpy(s->nick, "guest");
-    HASH_ADD_INT(*usrs, fd, s);
-
-    // add client to fd array
-    (*fds)[*nfd].fd = addfd;
-    (*fds)[*nfd].events = POLLIN | POLLHUP | POLLERR;
-    (*fds)[*nfd].revents = 0;
+    s->idx = sv->nfd;
+    s->nick[0] = '\0';
+    s->pfxlen = 0;
+    s->seen = sv->now;
+    tmradd(&sv->wh, &s->tm, sv->now + tmrms);
+    sv->fds[s->idx].events = POLLIN | POLLHUP | POLLERR;
   }
+  sv->fds[s->idx].fd = addfd;
+  sv->fds[s->idx].revents = 0;
+  sv->kinds[s->idx] = s->kind;
+  sv->cons[s->idx] = s;
+  sv->fdix[addfd] = s->idx;
 
-  (*nfd)++;
+  sv->nfd++;
   return 0;
 }
 
-/** remove fd from poll array & hash map (swap-with-last O(1))
- * @param fds poll fd array
- * @param usrs fd->user hash map
+/** set a connection's wire protocol, in its record and its slot
+ * @param sv server state
+ * @param c connection (with a slot)
+ * @param kind wire protocol */
+static void conkind(struct srv* sv, struct fdmap* c, enum ckind kind) {
+  c->kind = kind;
+  sv->kinds[c->idx] = kind;
+}
+
+/** remove fd from the slot arrays, fd index & event backend
+ * (swap-with-last O(1))
+ * @param sv server state (nfd decremented)
  * @param rmfd fd to remove
- * @param nfd fd count (decremented)
  * @return 0 ok, -1 fail/not found */
-int fdrm(struct pollfd** fds, struct fdmap** usrs, int rmfd, int* nfd) {
-  if ((*fds)[0].fd == rmfd) {
-    // if the fd to remove is the listener fd, do nothing
-    // and exit
-    return -1;
-  }
+int fdrm(struct srv* sv, int rmfd) {
 
   // removal tasks -
   // (a) find fd in index
@@ -104,92 +478,737 @@ int fdrm(struct pollfd** fds, struct fdmap** usrs, int rmfd, int* nfd) {
   //   }
   // }
 
-  // lookup index from fdmap usr
-  struct fdmap *srem, *slast;
-  HASH_FIND_INT(*usrs, &rmfd, srem);
+  // lookup slot from the fd index
+  struct fdmap* srem = rmfd < SIDBASE ? conget(sv, rmfd) : NULL;
   if (!srem) return -1;
-  HASH_FIND_INT(*usrs, &(*fds)[*nfd - 1].fd, slast);
-  // do swap-with-last O(1) removal
-  (*fds)[srem->idx] = (*fds)[*nfd - 1];
-  // update fdmap usr with new index of ex-last element
-  if (srem != slast) slast->idx = srem->idx;
+  // if the fd to remove is a system fd (listener, inbox), do nothing
+  // and exit
+  if (srem->idx < sv->nsys) return -1;
+  // do swap-with-last O(1) removal, the last slot's record learns its new
+  // index
+  int i = srem->idx, last = sv->nfd - 1;
+  if (sv->fds[i].events & POLLOUT) mtadd(&sv->st.g[SG_BACKLOG], -1);
+  sv->fds[i] = sv->fds[last];
+  sv->kinds[i] = sv->kinds[last];
+  sv->cons[i] = sv->cons[last];
+  sv->cons[i]->idx = i;
+  sv->fdix[sv->fds[i].fd] = i;
+  sv->fdix[rmfd] = -1;
 
-  HASH_DEL(*usrs, srem);
-  free(srem);
-  (*nfd)--;
+  evdel(&sv->ev, rmfd);
+  tmrdel(&sv->wh, &srem->tm);
+  atomic_fetch_sub(&nclients, 1);
+  sqfree(&srem->sq);
+  frfree(&srem->in);
+  free(srem->ws);
+  if (srem->tc) {
+    trfree(&srem->tc->t);
+    free(srem->tc->ss);
+    free(srem->tc);
+  }
+  poolput(&sv->cpool, srem);
+  sv->nfd--;
 
   return 0;
 }
 
-/** format msg with timestamp & sender fd prefix
- * @param sfd sender fd
- * @param msg raw message
- * @return malloc'd "fd: msg" string or NULL */
-static char* fmtmsg(int sfd, const char* msg) {
-  time_t now = time(NULL);
-  struct tm* t = localtime(&now);
-  char tbuf[19];
-  strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", t);
+/** arm or disarm POLLOUT for a client (only while bytes are pending)
+ * @param sv server state
+ * @param c client
+ * @param out true=watch POLLOUT */
+static void conwout(struct srv* sv, struct fdmap* c, bool out) {
+  short ev = sv->fds[c->idx].events;
+  short want = out ? (ev | POLLOUT) : (ev & ~POLLOUT);
+  if (want == ev) return;
+  mtadd(&sv->st.g[SG_BACKLOG], out ? 1 : -1);
+  sv->fds[c->idx].events = want;
+  evmod(&sv->ev, c->fd, want & (POLLIN | POLLOUT));
+}
+
+/** count messages dropped for a slow client, logged on powers of two so a
+ * stuck reader can't flood the event log
+ * @param sv server state
+ * @param c client
+ * @param n messages dropped */
+static void condrop(struct srv* sv, struct fdmap* c, int n) {
+  if (n <= 0) return;
+  unsigned long was = c->sq.drops;
+  c->sq.drops += n;
+  mtadd(&sv->st.c[SC_DROPS], n);
+  if ((was ^ c->sq.drops) > was) {  // passed a power of two
+    elog(sv->lq, EV_QFULL, c->fd, c->sq.drops, NULL);
+  }
+}
+
+/** follow a client's queue against the soft limit: crossing it starts a
+ * lag episode (counted and logged), falling back under half of it ends one
+ * and its length goes into the lag histogram. senders only call it to
+ * start one, the flush paths to end it: a backlog cut by SLOW_POLICY has
+ * not caught up
+ * @param sv server state
+ * @param c client
+ * @param left bytes queued now */
+static void conlag(struct srv* sv, struct fdmap* c, unsigned left) {
+  if (c->kick) return;  // lagging until it is gone
+  if (!c->lagat) {
+    if (left <= (unsigned)sqsoft) return;
+    c->lagat = sv->now;
+    mtadd(&sv->st.c[SC_LAGS], 1);
+    mtadd(&sv->st.g[SG_LAGGING], 1);
+    elog(sv->lq, EV_SLOW, c->fd, left, c->nick);
+  } else if (left <= (unsigned)sqsoft / 2) {
+    uint64_t ms = sv->now - c->lagat;
+    c->lagat = 0;
+    mtobs(&sv->st.lag, ms);
+    mtadd(&sv->st.g[SG_LAGGING], -1);
+    elog(sv->lq, EV_SLOWOK, c->fd, ms, c->nick);
+  }
+}
 
-  int need = snprintf(NULL, 0, "[%s] %d: %s", tbuf, sfd, msg);
-  if (need < 0) return NULL;
+/** frame a server notice for one client's protocol
+ * @param c client
+ * @param text notice (incl. newline)
+ * @param len notice bytes
+ * @return message (caller owns the ref), NULL out of memory */
+static struct msg* connote(struct fdmap* c, const char* text, int len) {
+  if (c->kind == CK_WS) return wsmsg(WS_TEXT, text, len);
+  struct msg* m = msgnew(len);
+  if (m) memcpy(m->data, text, len);
+  return m;
+}
 
-  char* out = malloc(need + 1);
-  if (!out) return NULL;
+/** a client's outbound queue, whichever engine holds it: the sendq, or
+ * (EVLOOP=uring, except trunk sessions) the engine's chain of sends. the
+ * cq* helpers below are what SLOW_POLICY works through
+ * @param sv server state
+ * @param c client
+ * @return true = uring chain */
+static inline bool conur(struct srv* sv, struct fdmap* c) {
+#ifdef CCHAT_URING
+  return sv->uring && c->kind != CK_SESS;
+#else
+  (void)sv, (void)c;
+  return false;
+#endif
+}
 
-  if (snprintf(out, need + 1, "[%s] %d: %s", tbuf, sfd, msg) < 0) {
-    free(out);
-    return NULL;
+/** bytes queued for a client (see conur()) */
+static unsigned cqlen(struct srv* sv, struct fdmap* c) {
+#ifdef CCHAT_URING
+  if (conur(sv, c)) return uqlen(&sv->ur, c->fd);
+#else
+  (void)sv;
+#endif
+  return sqlen(&c->sq);
+}
+
+/** make room for len bytes on a client's queue (sqevict()/uevict()) */
+static int cqevict(struct srv* sv, struct fdmap* c, unsigned len) {
+#ifdef CCHAT_URING
+  if (conur(sv, c)) return uevict(&sv->ur, c->fd, len);
+#else
+  (void)sv;
+#endif
+  return sqevict(&c->sq, len);
+}
+
+/** drop what has not started going out (sqtrim()/utrim()) */
+static int cqtrim(struct srv* sv, struct fdmap* c) {
+#ifdef CCHAT_URING
+  if (conur(sv, c)) return utrim(&sv->ur, c->fd);
+#else
+  (void)sv;
+#endif
+  return sqtrim(&c->sq);
+}
+
+/** queue a message behind the rest (sqpush()/ubcast()), no limit check */
+static int cqpush(struct srv* sv, struct fdmap* c, struct msg* m) {
+#ifdef CCHAT_URING
+  if (conur(sv, c)) return ubcast(&sv->ur, &c->fd, 1, m);
+#else
+  (void)sv;
+#endif
+  return sqpush(&c->sq, m);
+}
+
+/** disconnect a slow consumer: its backlog goes, one last line (and close
+ * frame) says why, and it is dropped once that is out or after KICKMS,
+ * whichever comes first. never right here, the caller may be walking a
+ * room. sessions are closed on their trunk when the timer fires
+ * @param sv server state
+ * @param c client
+ * @return messages dropped from the queue */
+static int conkick(struct srv* sv, struct fdmap* c) {
+  elog(sv->lq, EV_SLOWKICK, c->fd, cqlen(sv, c), c->nick);
+  mtadd(&sv->st.c[SC_KICKS], 1);
+  int n = cqtrim(sv, c);
+  c->kick = true;
+  if (c->kind == CK_SESS) {
+    tmradd(&sv->wh, &c->tm, sv->now);
+    return n;
   }
 
-  return out;
+  struct msg* m[2] = {NULL, NULL};
+  static const char note[] = "too slow reading (send queue full), "
+                             "disconnecting\n";
+  int len = sizeof(note) - 1;
+  if (c->kind == CK_TCP) {
+    m[0] = connote(c, note, len);
+  } else if (c->kind == CK_WS && c->ws->open) {
+    char pl[2] = {1008 >> 8, 1008 & 0xff};  // policy violation
+    m[0] = connote(c, note, len);
+    m[1] = wsmsg(WS_CLOSE, pl, 2);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (m[i]) cqpush(sv, c, m[i]);
+    msgput(m[i]);
+  }
+  if (c->ws) c->ws->closing = true;
+  bool left = cqlen(sv, c) > 0;
+#ifdef CCHAT_URING
+  if (conur(sv, c)) uwatch(&sv->ur, c->fd, true);  // udrain() drops it
+#endif
+  if (!conur(sv, c)) conwout(sv, c, left);
+  tmradd(&sv->wh, &c->tm, sv->now + (left ? KICKMS : 0));
+  return n;
 }
 
-/** broadcast msg to all clients except sender
- * @param nfd fd count
- * @param fds poll fd array
- * @param msg message to send
- * @param sfd sender fd (skipped)
- * @return 0 ok, -1 fail */
-int bcast(int nfd, struct pollfd** fds, const char* msg, int sfd) {
-  char* buf = fmtmsg(sfd, msg);
-  if (!buf) return -1;
+/** a message did not fit a client's queue: apply SLOW_POLICY
+ * @param sv server state
+ * @param c client (either engine, or trunk session)
+ * @param m message (a ref is taken if queued)
+ * @return 0 queued after all, -1 dropped */
+static int conslow(struct srv* sv, struct fdmap* c, struct msg* m) {
+  int n = 0;
+  switch (slowpol) {
+    case SP_OLDEST:
+      if ((n = cqevict(sv, c, m->len)) == -1) {
+        n = 0;
+        break;
+      }
+      condrop(sv, c, n);
+      if (cqpush(sv, c, m) == -1) {
+        n = 0;
+        break;
+      }
+      return 0;
+    case SP_COALESCE: {
+      // one notice stands for the whole backlog; the new message follows
+      n = cqtrim(sv, c);
+      char note[80];
+      int len = snprintf(note, sizeof(note),
+                         "*** %d messages skipped, connection too slow ***\n",
+                         n);
+      struct msg* nm = n ? connote(c, note, len) : NULL;
+      if (nm) cqpush(sv, c, nm);
+      msgput(nm);
+      condrop(sv, c, n);
+      n = 0;
+      if (cqpush(sv, c, m) == -1) break;
+      return 0;
+    }
+    case SP_KICK:
+      n = conkick(sv, c);
+      break;
+    default:
+      break;
+  }
+  condrop(sv, c, n + 1);
+  return -1;
+}
 
-  int mlen = strlen(buf);  // message len
+/** count a send the socket did not take whole
+ * @param sv server state
+ * @param left bytes still queued */
+static void constall(struct srv* sv, int left) {
+  mtadd(&sv->st.c[SC_EAGAIN], 1);
+  mtobs(&sv->st.qlen, left);
+}
 
-  // build target list once (excl. listener & sender fd)
-  // Sized for all clients (sender excluded in loop: -1 if listener, -2 if
-  // client). Worst case -1.
-  int tgtfds[MAXFDS - 1];
-  int tgtidx = 0;
-  for (int i = 1; i < nfd; i++) {  // start at 1 to excl lfd
-    if ((*fds)[i].fd != sfd) {     // skip sender fd
-      tgtfds[tgtidx] = (*fds)[i].fd;
-      tgtidx++;
+/** send to one client through its outbound queue
+ * @param sv server state
+ * @param c client
+ * @param m message (queued by reference)
+ * @return 0 sent/queued, -1 dropped or hard error */
+static int conq(struct srv* sv, struct fdmap* c, struct msg* m) {
+  if (c->kick) return -1;  // only its last words go out
+  unsigned was = sqlen(&c->sq);
+  int left = sqsend(&c->sq, c->fd, m);
+  if (left == -1) {
+    if (errno != ENOBUFS) {
+      // permanent error (EPIPE, ECONNRESET, etc.), or no memory for the
+      // queue after part of the line went out: the stream is torn either
+      // way and recv need not notice. drop it on the next timer pass,
+      // never here, the caller may be walking a room
+      elog(sv->lq, EV_IOERR, c->fd, errno, "send");
+      sqfree(&c->sq);
+      c->kick = true;
+      conwout(sv, c, false);
+      tmradd(&sv->wh, &c->tm, sv->now);
+      return -1;
     }
+    int rc = conslow(sv, c, m);
+    if (!c->lagat) conlag(sv, c, sqlen(&c->sq));
+    return rc;
   }
+  if (left > 0 && was == 0) constall(sv, left);  // queued behind: no send
+  if (!c->lagat) conlag(sv, c, left);
+  conwout(sv, c, left > 0);
+  return 0;
+}
 
-  // batch send to all targets
-  for (int i = 0; i < tgtidx; i++) {
-    int nsent = 0;
+static int conrm(struct srv* sv, int sfd, int n);
 
-    while (nsent < mlen) {
-      int n = send(tgtfds[i], buf + nsent, mlen - nsent, 0);
+/** POLLOUT: flush a client's queue, disarm POLLOUT once it is empty. a
+ * closing websocket client or a slow consumer being disconnected is
+ * dropped once its final frame is out
+ * @param sv server state
+ * @param fd client fd
+ * @return 0 ok, -1 hard error/client removed */
+static int conflush(struct srv* sv, int fd) {
+  struct fdmap* c = conget(sv, fd);
+  if (!c) return -1;
 
-      if (n == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-          // Buffer full, retry (could add a small delay or use poll)
-          continue;
-        }
-        // Permanent error (EPIPE, ECONNRESET, etc.)
-        fprintf(stderr, "bcast err | fd %d: %s\n", tgtfds[i], strerror(errno));
-        break;  // Give up on this client, move to next
+  int left = c->kind == CK_TRUNK ? trflush(&c->tc->t, fd) : sqflush(&c->sq, fd);
+  if (left == -1) {
+    // dead peer: drop it here so the caller never touches the fd again
+    elog(sv->lq, EV_IOERR, fd, errno, "flush");
+    return conrm(sv, fd, 0);
+  }
+  if (left == 0 && (c->kick || (c->ws && c->ws->closing))) {
+    return conrm(sv, fd, 0);
+  }
+  if (left > 0) constall(sv, left);
+  if (c->kind != CK_TRUNK) conlag(sv, c, left);
+  conwout(sv, c, left > 0);
+  return 0;
+}
+
+/** put a trunk on the flush list for the end of this loop pass
+ * @param sv server state
+ * @param tk trunk */
+static void trmark(struct srv* sv, struct fdmap* tk) {
+  if (tk->tc->dirty) return;
+  tk->tc->dirty = true;
+  tk->tc->next = sv->tdirty;
+  sv->tdirty = tk;
+}
+
+/** frame one message for one trunk session, or park it on the session's
+ * queue while the gateway owes it window
+ * @param sv server state
+ * @param c session
+ * @param m message (a ref is taken if parked)
+ * @return 0 framed/parked, -1 dropped */
+static int tsout(struct srv* sv, struct fdmap* c, struct msg* m) {
+  struct tsess* s = c->ts;
+  struct tconn* tc = s->tk->tc;
+  if (c->kick) return -1;
+  if (sqlen(&c->sq) == 0 && s->credit >= m->len) {
+    uint8_t* p = trframe(&tc->t, TR_DATA, s->ch, m->len);
+    trmark(sv, s->tk);
+    if (!p) {
+      tc->dead = true;
+      return -1;
+    }
+    memcpy(p, m->data, m->len);
+    s->credit -= m->len;
+    return 0;
+  }
+  int rc = 0;
+  if (sqpush(&c->sq, m) == -1) rc = errno == ENOBUFS ? conslow(sv, c, m) : -1;
+  if (!c->lagat) conlag(sv, c, sqlen(&c->sq));
+  return rc;
+}
+
+/** window returned by the gateway: send what was parked meanwhile
+ * @param sv server state
+ * @param s session
+ * @param bytes window returned */
+static void tscredit(struct srv* sv, struct tsess* s, uint32_t bytes) {
+  long cr = (long)s->credit + bytes;
+  s->credit = cr > TRWIN ? TRWIN : (int)cr;
+  struct tconn* tc = s->tk->tc;
+  struct msg* m;
+  while ((m = sqpeek(&s->c->sq)) != NULL && s->credit >= m->len) {
+    uint8_t* p = trframe(&tc->t, TR_DATA, s->ch, m->len);
+    trmark(sv, s->tk);
+    if (!p) {
+      tc->dead = true;
+      return;
+    }
+    memcpy(p, m->data, m->len);
+    s->credit -= m->len;
+    sqpop(&s->c->sq);
+  }
+  conlag(sv, s->c, sqlen(&s->c->sq));
+}
+
+/** broadcast to the sessions of a trunk in the message's room with one
+ * TR_BCAST frame. sessions elsewhere are listed as skipped, and so are
+ * those out of window, which get the message parked instead; when the skip
+ * list would not fit in the frame, or would outweigh one TR_DATA frame per
+ * remaining session, those are sent instead
+ * @param sv server state
+ * @param tk trunk
+ * @param m message
+ * @param sfd sender id (skipped) */
+static void trfan(struct srv* sv, struct fdmap* tk, struct msg* m, int sfd) {
+  struct tconn* tc = tk->tc;
+  int nskip = 0;
+  for (int i = 0; i < tc->nss; i++) {
+    struct tsess* s = tc->ss[i];
+    bool in = s->c->room == m->room && s->c->fd != sfd;
+    s->skip = !in || sqlen(&s->c->sq) > 0 || s->credit < m->len;
+    if (!s->skip) continue;
+    nskip++;
+    if (in) tsout(sv, s->c, m);  // parks it
+  }
+  if (nskip == tc->nss) return;
+
+  long nsend = tc->nss - nskip;
+  if (2 + 4L * nskip + m->len > TRMAXPL ||
+      4L * nskip > nsend * (TRHDR + m->len)) {
+    for (int i = 0; i < tc->nss; i++) {
+      if (!tc->ss[i]->skip) tsout(sv, tc->ss[i]->c, m);
+    }
+    return;
+  }
+
+  uint8_t* p = trframe(&tc->t, TR_BCAST, 0, 2 + 4 * nskip + m->len);
+  trmark(sv, tk);
+  if (!p) {
+    tc->dead = true;
+    return;
+  }
+  p[0] = nskip >> 8;
+  p[1] = nskip;
+  p += 2;
+  for (int i = 0; i < tc->nss; i++) {
+    struct tsess* s = tc->ss[i];
+    if (s->skip) {
+      trput32(p, s->ch);
+      p += 4;
+    } else {
+      s->credit -= m->len;
+    }
+  }
+  memcpy(p, m->data, m->len);
+}
+
+/** send a message to the room's sessions on each trunk it reaches: one
+ * TR_BCAST frame per trunk while the sessions outside the room (its skip
+ * list) cost less than one TR_DATA frame per member, else a frame per
+ * member, so a small room on a busy trunk never walks the whole trunk
+ * @param sv server state
+ * @param r room
+ * @param tks trunks with members in r (rn counted), linked by rnext
+ * @param m message
+ * @param sfd sender id (skipped) */
+static void trroom(struct srv* sv, struct room* r, struct fdmap* tks,
+                   struct msg* m, int sfd) {
+  bool perss = false;
+  for (struct fdmap* tk = tks; tk; tk = tk->tc->rnext) {
+    struct tconn* tc = tk->tc;
+    long nout = tc->nss - tc->rn;
+    tc->rdata = 4L * nout > (long)tc->rn * (TRHDR + m->len);
+    if (tc->rdata) {
+      perss = true;
+    } else {
+      trfan(sv, tk, m, sfd);
+    }
+    tc->rn = 0;
+  }
+  if (!perss) return;
+
+  for (int i = 0; i < r->n; i++) {
+    struct fdmap* t = r->mem[i];
+    if (t->kind == CK_SESS && t->fd != sfd && t->ts->tk->tc->rdata) {
+      tsout(sv, t, m);
+    }
+  }
+  for (struct fdmap* tk = tks; tk; tk = tk->tc->rnext) tk->tc->rdata = false;
+}
+
+#ifdef CCHAT_URING
+static int uout(struct srv* sv, struct fdmap* c, struct msg* m);
+#endif
+
+/** deliver a formatted message to the members of its room on this shard,
+ * except the sender
+ * @param sv server state
+ * @param r the message's room on this shard
+ * @param m message (caller keeps its ref)
+ * @param sfd sender fd (skipped), -1 = none
+ * @return 0 ok, -1 fail */
+static int fanout(struct srv* sv, struct room* r, struct msg* m, int sfd) {
+  // websocket clients share one framed copy, made for the first of them
+  struct msg* wm = NULL;
+  int rc = 0, nout = 0;
+  struct fdmap* tks = NULL;  // trunks carrying members
+
+#ifdef CCHAT_URING
+  // uring target lists share the scratch: tcp from the front, ws from the
+  // back. Scratch is sized with the fd table, so both always fit.
+  int* tgtfds = sv->tgt;
+  int ntcp = 0, nws = 0;
+#endif
+
+  // the room's members only: a message costs the same whatever the
+  // population of the shard
+  for (int i = 0; i < r->n; i++) {
+    struct fdmap* t = r->mem[i];
+    int fd = t->fd;
+    if (fd == sfd || t->joining) continue;  // skip sender, unannounced
+    enum ckind kind = t->kind;
+
+    nout++;
+    if (kind == CK_SESS) {
+      // counted per trunk here, sent with one frame per trunk below
+      struct tconn* tc = t->ts->tk->tc;
+      if (tc->rn++ == 0) {
+        tc->rnext = tks;
+        tks = t->ts->tk;
       }
-      nsent += n;
+      continue;
     }
+
+    struct msg* tm = m;
+    if (kind == CK_WS) {
+      if (!t->ws->open || t->ws->closing) {
+        nout--;
+        continue;
+      }
+      if (!wm && !(wm = wsmsg(WS_TEXT, m->data, m->len))) {
+        rc = -1;
+        continue;
+      }
+      tm = wm;
+    }
+
+#ifdef CCHAT_URING
+    // one SQE per target, submitted together on the next uwait(). a
+    // client with a backlog (or over the hard limit) goes one at a time
+    if (sv->uring) {
+      if (t->lagat || t->kick ||
+          uqlen(&sv->ur, fd) + tm->len > (unsigned)sqsoft) {
+        uout(sv, t, tm);
+        continue;
+      }
+      if (tm == m) {
+        tgtfds[ntcp++] = fd;
+      } else {
+        tgtfds[sv->cap - 1 - nws++] = fd;
+      }
+      continue;
+    }
+#endif
+
+    // send or enqueue per target; never wait on a slow client
+    conq(sv, t, tm);
+  }
+  if (tks) trroom(sv, r, tks, m, sfd);
+
+#ifdef CCHAT_URING
+  if (sv->uring) {
+    if (ubcast(&sv->ur, tgtfds, ntcp, m) == -1) rc = -1;
+    if (nws && ubcast(&sv->ur, tgtfds + sv->cap - nws, nws, wm) == -1) {
+      rc = -1;
+    }
+  }
+#endif
+
+  msgput(wm);
+  mtadd(&sv->st.c[SC_MSGSOUT], nout);
+  mtadd(&sv->st.c[SC_BYTESOUT], (long)nout * m->len);
+  if (m->t0) mtobs(&sv->st.fan, (uint32_t)(usclk() - m->t0));
+  return rc;
+}
+
+/** broadcast msg to the sender's room except the sender, on every shard
+ * @param sv server state (sender's shard)
+ * @param from sender (skipped; its prefix heads the message, its room
+ *             gets it)
+ * @param msg message to send (one line, '\n' optional)
+ * @param len message bytes
+ * @return 0 ok, -1 fail */
+int bcast(struct srv* sv, struct fdmap* from, const char* msg, int len) {
+  // formatted once, shared by all
+  struct msg* m = fmtmsg(&sv->clk, from->pfx, from->pfxlen, msg, len);
+  if (!m) return -1;
+  m->room = from->room;
+  m->t0 = sv->rxus;  // fan-out latency is timed for received input only
+
+  struct room* r = roomget(&sv->rooms, m->room);
+  if (!r) {
+    msgput(m);
+    return -1;
+  }
+  m->rgen = r->gen;
+  int rc = fanout(sv, r, m, from->fd);
+  histadd(&r->hist, m);
+  // copied, the writer syncs
+  if (sv->wq) walput(sv->wq, r->tag, r->taglen, m->data, m->len);
+
+  // other shards get a reference through their inbox
+  for (int i = 0; i < sv->nshards; i++) {
+    if (i != sv->id) ibpost(&sv->ip, &sv->shards[i].ib, msgget(m));
+  }
+
+  msgput(m);
+  return rc;
+}
+
+/** send a server notice to a room on every shard: no sender prefix, so
+ * no client's line can pass for one, and kept out of scrollback and the
+ * message log
+ * @param sv server state
+ * @param id room id
+ * @param sfd fd to skip (-1 = none)
+ * @param msg notice text (one line, '\n' optional)
+ * @param len notice bytes
+ * @return 0 ok, -1 fail */
+static int bnote(struct srv* sv, int id, int sfd, const char* msg, int len) {
+  struct room* r = roomget(&sv->rooms, id);
+  if (!r) return -1;
+  struct msg* m = fmtmsg(&sv->clk, "", 0, msg, len);
+  if (!m) return -1;
+  m->room = id;
+  m->rgen = r->gen;
+  m->note = true;
+  int rc = fanout(sv, r, m, sfd);
+  for (int i = 0; i < sv->nshards; i++) {
+    if (i != sv->id) ibpost(&sv->ip, &sv->shards[i].ib, msgget(m));
+  }
+  msgput(m);
+  return rc;
+}
+
+#ifdef CCHAT_URING
+/** send to one client through the uring engine, applying SLOW_POLICY once
+ * its queued sends would pass SENDQ_HARD_BYTES. a lag episode watches the
+ * fd's completions (udrain()) to see it end
+ * @param sv server state
+ * @param c client (not a trunk session)
+ * @param m message (a ref is taken if queued)
+ * @return 0 queued, -1 dropped */
+static int uout(struct srv* sv, struct fdmap* c, struct msg* m) {
+  if (c->kick) return -1;  // only its last words go out
+  int rc = uqlen(&sv->ur, c->fd) + m->len > (unsigned)sqhard
+               ? conslow(sv, c, m)
+               : ubcast(&sv->ur, &c->fd, 1, m);
+  if (!c->lagat) {
+    conlag(sv, c, uqlen(&sv->ur, c->fd));
+    if (c->lagat) uwatch(&sv->ur, c->fd, true);
+  }
+  return rc;
+}
+
+/** U_DRAIN: a watched client's send completed. like conflush(): a slow
+ * consumer being disconnected is dropped once its last words are out, a
+ * lag episode ends once the backlog is down, then the watch is lifted
+ * @param sv server state
+ * @param fd client fd */
+static void udrain(struct srv* sv, int fd) {
+  struct fdmap* c = conget(sv, fd);
+  if (!c) return;
+  unsigned left = uqlen(&sv->ur, fd);
+  if (left == 0 && c->kick) {
+    conrm(sv, fd, 0);
+    return;
   }
+  conlag(sv, c, left);
+  if (!c->lagat && !c->kick) uwatch(&sv->ur, fd, false);
+}
+#endif
+
+/** send one message to one client, whichever engine is running
+ * @param sv server state
+ * @param c client
+ * @param m message (caller keeps its ref)
+ * @return 0 sent/queued, -1 fail */
+static int conout(struct srv* sv, struct fdmap* c, struct msg* m) {
+  if (c->kind == CK_SESS) return tsout(sv, c, m);
+#ifdef CCHAT_URING
+  if (sv->uring) return uout(sv, c, m);
+#endif
+  return conq(sv, c, m);
+}
+
+/** send a server notice to one client only
+ * @param sv server state
+ * @param fd client fd
+ * @param text notice (NUL terminated, incl. newline)
+ * @return 0 sent/queued, -1 fail */
+static int consay(struct srv* sv, int fd, const char* text) {
+  struct fdmap* c = conget(sv, fd);
+  if (!c) return -1;
+
+  struct msg* m = connote(c, text, strlen(text));
+  if (!m) return -1;
+
+  int rc = conout(sv, c, m);
+  msgput(m);
+  return rc;
+}
+
+/** send a direct message to one client, framed for its protocol
+ * @param sv server state
+ * @param t client
+ * @param m message (caller keeps its ref)
+ * @return 0 sent/queued, -1 fail */
+static int dmout(struct srv* sv, struct fdmap* t, struct msg* m) {
+  mtadd(&sv->st.c[SC_MSGSOUT], 1);
+  mtadd(&sv->st.c[SC_BYTESOUT], m->len);
+  if (t->kind != CK_WS) return conout(sv, t, m);
 
-  free(buf);
+  if (t->ws->closing) return -1;
+  struct msg* wm = wsmsg(WS_TEXT, m->data, m->len);
+  if (!wm) return -1;
+  int rc = conout(sv, t, wm);
+  msgput(wm);
+  return rc;
+}
+
+/** deliver a direct message on the target's shard. the target is checked
+ * by id and nick generation, so a message never reaches a client that
+ * took over the id of one that left
+ * @param sv server state (target's shard)
+ * @param m message (m->to, m->tgen set; caller keeps its ref)
+ * @return 0 sent/queued, -1 target gone or fail */
+static int dmsend(struct srv* sv, struct msg* m) {
+  struct fdmap* t = conget(sv, m->to);
+  if (!t || t->gen != m->tgen) return -1;
+  return dmout(sv, t, m);
+}
+
+static void joinflush(struct srv* sv);
+
+/** deliver broadcasts and direct messages posted by other shards
+ * @param sv server state
+ * @return 0 ok */
+static int xdrain(struct srv* sv) {
+  // fanout() skips unannounced joiners, and their scrollback is already
+  // shown: announce them first so they get these messages
+  joinflush(sv);
+  ibclear(&sv->ib);
+  struct msg* m;
+  while ((m = ibtake(&sv->ib)) != NULL) {
+    if (m->to != -1) {
+      dmsend(sv, m);
+      msgput(m);
+      continue;
+    }
+    // NULL: the room emptied and its id went to a new name meanwhile
+    struct room* r = roomat(&sv->rooms, m->room, m->rgen);
+    if (r) {
+      fanout(sv, r, m, -1);
+      // every shard keeps each room's whole history
+      if (!m->note) histadd(&r->hist, m);
+    }
+    msgput(m);
+  }
   return 0;
 }
 
@@ -216,155 +1235,2089 @@ int ipstr(struct sockaddr_storage raddr, char ipstr[INET6_ADDRSTRLEN]) {
   return 0;
 }
 
-/** handle new client connection (accept, add to poll, broadcast join)
- * @param lsock listener socket
- * @param nfd fd count
- * @param fds poll fd array
- * @param usrs fd->user hash map
- * @return 0 ok, -1 fail/capacity */
-int newcon(int lsock, int* nfd, struct pollfd** fds, struct fdmap** usrs) {
+static int conadd(struct srv* sv, int cfd, struct sockaddr_storage* caddr,
+                  enum ckind kind);
+
+/** refuse a connection over MAX_CLIENTS (or while out of fds) with a line
+ * saying why, and close it
+ * @param sv server state
+ * @param cfd accepted client fd
+ * @param kind wire protocol */
+static void conrefuse(struct srv* sv, int cfd, enum ckind kind) {
+  mtadd(&sv->st.c[SC_REJECTS], 1);
+  const char* msg =
+      kind == CK_WS ? "HTTP/1.1 503 Service Unavailable\r\n"
+                      "Content-Length: 0\r\nConnection: close\r\n\r\n"
+                    : "server at capacity. please try again later.\n";
+  send(cfd, msg, strlen(msg), MSG_NOSIGNAL);
+  close(cfd);
+}
+
+/** a listener's bit in sv->acoff */
+static unsigned lstnbit(struct srv* sv, int lfd) {
+  return lfd == sv->lfd ? 1 : lfd == sv->wfd ? 2 : 4;
+}
+
+/** stop or resume taking connections from a listener: its poll interest
+ * (readiness engines) or its multishot accept (uring)
+ * @param sv server state
+ * @param lfd listener
+ * @param on true=resume */
+static void lstnarm(struct srv* sv, int lfd, bool on) {
+#ifdef CCHAT_URING
+  if (sv->uring) {
+    if (on) uaccept(&sv->ur, lfd);
+    return;
+  }
+#endif
+  struct fdmap* l = conget(sv, lfd);
+  if (!l) return;
+  sv->fds[l->idx].events = on ? POLLIN | POLLERR : 0;
+  evmod(&sv->ev, lfd, on ? POLLIN : 0);
+}
+
+/** resume the listeners rested by conshed() once ACCEPTNAP is up
+ * @param sv server state */
+static void lstnwake(struct srv* sv) {
+  if (!sv->acoff || sv->now < sv->acat) return;
+  int lfds[3] = {sv->lfd, sv->wfd, sv->tfd};
+  for (int i = 0; i < 3; i++) {
+    if (lfds[i] != -1 && (sv->acoff & lstnbit(sv, lfds[i]))) {
+      lstnarm(sv, lfds[i], true);
+    }
+  }
+  sv->acoff = 0;
+}
+
+/** out of fds (EMFILE/ENFILE): give up the reserve fd to accept the oldest
+ * queued connection and refuse it, so the backlog drains instead of being
+ * stranded (edge-triggered epoll) or spinning the loop (poll, uring). with
+ * no reserve fd to give up the listener rests for ACCEPTNAP ms
+ * @param sv server state
+ * @param lfd listener
+ * @return 0 one refused (go on), -1 stop accepting for now */
+static int conshed(struct srv* sv, int lfd) {
+  if (sv->spare == -1) sv->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  int cfd = -1;
+  if (sv->spare != -1) {
+    close(sv->spare);
+    cfd = accept(lfd, NULL, NULL);
+    if (cfd != -1) {
+      conrefuse(sv, cfd, lfd == sv->wfd ? CK_WS : CK_TCP);
+    }
+    // another shard may win the freed slot: retried on the next shed
+    sv->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+  if (cfd != -1) return 0;
+  if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;  // drained
+
+  sv->acoff |= lstnbit(sv, lfd);
+  lstnarm(sv, lfd, false);
+  sv->acat = sv->now + ACCEPTNAP;
+  sv->acmore = true;
+  return -1;
+}
+
+/** handle new client connection (accept, add to poll, queue its join)
+ * @param sv server state
+ * @param lfd listener that fired (TCP or websocket)
+ * @return 0 handled (added, rejected or gone), -1 accept fail (EAGAIN =
+ *         drained) */
+int newcon(struct srv* sv, int lfd) {
   struct sockaddr_storage caddr;  // new remote client address
   socklen_t caddrlen;             // new client address len
   int cfd;                        // new client fd
 
-  // Accept new connection on listener fd with error checking
+  // Accept new connection on listener fd with error checking. accept4()
+  // makes it non-blocking and close-on-exec in the same syscall
   caddrlen = sizeof(caddr);
-  cfd = accept(lsock, (struct sockaddr*)&caddr, &caddrlen);
+#ifdef __linux__
+  cfd = accept4(lfd, (struct sockaddr*)&caddr, &caddrlen,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  cfd = accept(lfd, (struct sockaddr*)&caddr, &caddrlen);
+#endif
   if (cfd == -1) {
-    fprintf(stderr, "accept: %s\n", strerror(errno));
+    // the peer hung up while queued: the next one may be fine
+    if (errno == ECONNABORTED || errno == EINTR) return 0;
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      elog(sv->lq, EV_IOERR, lfd, errno, "accept");
+    }
+    if (errno == EMFILE || errno == ENFILE) return conshed(sv, lfd);
     return -1;
   }
 
-  // set as non-blocking
-  fcntl(cfd, F_SETFL, O_NONBLOCK);
-
-  // Validate if pfds array has space. If not,
-  // reject new client with a msg
-  if (*nfd >= MAXFDS) {
-    char msg[] = "server at capacity. please try again later.\n";
-    send(cfd, msg, strlen(msg), 0);
-    // printf("%s", msg);
+#ifndef __linux__
+  // no accept4() (macOS): two more syscalls
+  if (fcntl(cfd, F_SETFL, O_NONBLOCK) == -1 ||
+      fcntl(cfd, F_SETFD, FD_CLOEXEC) == -1) {
+    elog(sv->lq, EV_IOERR, cfd, errno, "fcntl");
     close(cfd);
-    return -1;
+    return 0;
   }
+#endif
 
-  // Add new client fd to the pfds array
-  fdadd(fds, usrs, cfd, false, nfd);
+  conadd(sv, cfd, &caddr, lfd == sv->wfd   ? CK_WS
+                         : lfd == sv->tfd ? CK_TRUNK
+                                          : CK_TCP);
+  return 0;
+}
 
-  // broadcast new client info to chat group
-  char cip[INET6_ADDRSTRLEN];  // client ip
-  if (ipstr(caddr, cip) == -1) {
-    fprintf(stderr, "ipstr failed for client: %d\n", cfd);
-    strcpy(cip, "unknown");
+/** accept from a listener until its backlog is empty or ACCEPTMAX are in,
+ * so a reconnect storm can't starve the clients already connected. the
+ * rest is picked up at the start of the next pass
+ * @param sv server state
+ * @param lfd listener */
+static void conaccept(struct srv* sv, int lfd) {
+  for (int n = 0; n < ACCEPTMAX; n++) {
+    if (newcon(sv, lfd) == -1) return;
+  }
+  sv->acmore = true;
+}
+
+/** replay a room's scrollback to a joining client. the stored messages are
+ * queued by reference and go out together on the next POLLOUT, one
+ * sendmsg() per SQIOV of them; websocket joiners share each entry's framed
+ * copy. stops early if the client's queue fills
+ * @param sv server state
+ * @param c client (or trunk session)
+ * @param r room */
+static void conhist(struct srv* sv, struct fdmap* c, struct room* r) {
+  struct hist* h = &r->hist;
+  bool queue = c->kind != CK_SESS;  // sessions go out as trunk frames
+#ifdef CCHAT_URING
+  if (sv->uring) queue = false;  // the engine sends each one itself
+#endif
+  for (int i = 0; i < histlen(h); i++) {
+    struct hent* e = histat(h, i);
+    struct msg* m = e->m;
+    if (c->kind == CK_WS) {
+      if (!e->wm) e->wm = wsmsg(WS_TEXT, m->data, m->len);
+      if (!(m = e->wm)) break;
+    }
+    if ((queue ? sqpush(&c->sq, m) : conout(sv, c, m)) == -1) break;
+  }
+  if (queue) conwout(sv, c, sqlen(&c->sq) > 0);
+}
+
+/** put a client in a room (it must not be in one)
+ * @param sv server state
+ * @param c client (or trunk session)
+ * @param id room id, c already counted in (roomid(), or roomcount() for
+ *           the lobby)
+ * @return room, NULL out of memory (c stays outside any room, uncounted) */
+static struct room* conenter(struct srv* sv, struct fdmap* c, int id) {
+  struct room* r = roomget(&sv->rooms, id);
+  if (!r || (c->ridx = roomadd(r, c)) == -1) {
+    elog(sv->lq, EV_ERR, c->fd, errno, "conenter");
+    roomcount(id, -1);
+    c->ridx = -1;
+    return NULL;
+  }
+  c->room = id;
+  return r;
+}
+
+/** take a client out of its room (no-op when in none)
+ * @param sv server state
+ * @param c client (or trunk session) */
+static void conexit(struct srv* sv, struct fdmap* c) {
+  if (c->ridx == -1) return;
+  struct fdmap* moved = roomdel(roomget(&sv->rooms, c->room), c->ridx);
+  if (moved) moved->ridx = c->ridx;
+  roomcount(c->room, -1);
+  c->ridx = -1;
+}
+
+/** register a joining client's nick and queue its announcement to the
+ * lobby (joinflush()), after showing it the scrollback
+ * @param sv server state
+ * @param c client (or trunk session)
+ * @param from client address text */
+static void sayjoin(struct srv* sv, struct fdmap* c, const char* from) {
+  // guest<id> is free: ids are unique and every leaver releases its nick
+  struct nickref nr = {sv->id, c->fd, 0, c->seen};
+  if (nickreg(c->nick, &nr) == -1) {
+    // still chats as guest<id>, but /msg cannot find it
+    elog(sv->lq, EV_ERR, c->fd, errno, "nickreg");
   }
+  c->gen = nr.gen;
+  c->pfxlen = fmtpfx(c->pfx, c->nick);
+
+  roomcount(ROOMLOBBY, 1);
+  struct room* r = conenter(sv, c, ROOMLOBBY);
+  if (r) conhist(sv, c, r);
 
   char msg[256];  // Buffer to hold the message
-  snprintf(msg, sizeof(msg), "new client connecting from %s\n", cip);
-  printf("%s", msg);
-  bcast(*nfd, fds, msg, cfd);
+  snprintf(msg, sizeof(msg), "you are %s, /nick <name> to change it\n",
+           c->nick);
+  consay(sv, c->fd, msg);
+  elog(sv->lq, EV_JOIN, c->fd, 0, from);
 
-  return 0;
+  // the room hears about it with the rest of this batch
+  if (sv->njq == JOINMAX) joinflush(sv);
+  snprintf(sv->jfrom[sv->njq], sizeof(sv->jfrom[0]), "%s", from);
+  sv->jq[sv->njq++] = c;
+  c->joining = true;
 }
 
-/** handle existing client I/O (recv msg, broadcast, or handle disconnect)
- * @param sfd client socket fd
- * @param nfd fd count
- * @param pfds poll fd array
- * @param usrs fd->user hash map
- * @return 0 ok, -1 disconnect/error */
-int extcon(int sfd, int* nfd, struct pollfd** pfds, struct fdmap** usrs) {
-  char buf[MAXDATASIZE];  // buffer to recv data
-  int n = recv(sfd, buf, MAXDATASIZE, 0);
-  switch (n) {
-    case 0: {
-      // client disconnected early. handle!
-      // handles POLLHUP || POLLERR
-      char msg[256];  // Buffer to hold the message
-      snprintf(msg, sizeof(msg), "client %d has left the chat!\n", sfd);
-      printf("%s", msg);
-      bcast(*nfd, pfds, msg, 0);
-      fdrm(pfds, usrs, sfd, nfd);
-      close(sfd);
-      return -1;
-    }
-    case -1: {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        // not a real error for non-blocking sockets
-        return 0;
-      }
-      fprintf(stderr, "extcon: %s\n", strerror(errno));
-      fdrm(pfds, usrs, sfd, nfd);
-      close(sfd);
-      return -1;
+/** announce the clients queued by sayjoin() in one line, so a reconnect
+ * storm costs a broadcast per batch rather than one per client. a server
+ * notice to the lobby on every shard: no sender prefix, never the joiners
+ * themselves, kept out of scrollback and the message log. called at the
+ * end of each loop pass, and before anything a joiner does (input,
+ * leaving) could overtake its announcement
+ * @param sv server state */
+static void joinflush(struct srv* sv) {
+  int n = sv->njq;
+  if (n == 0) return;
+
+  char msg[MAXDATASIZE];
+  int len;
+  if (n == 1) {
+    len = snprintf(msg, sizeof(msg), "%s connecting from %s\n",
+                   sv->jq[0]->nick, sv->jfrom[0]);
+  } else {
+    // as many "nick (address)" as fit one line
+    len = snprintf(msg, sizeof(msg), "%d new clients connecting:", n);
+    int i = 0;
+    for (; i < n; i++) {
+      int w = snprintf(NULL, 0, "%s%s (%s)", i ? ", " : " ", sv->jq[i]->nick,
+                       sv->jfrom[i]);
+      if (len + w + 24 >= (int)sizeof(msg)) break;
+      len += snprintf(msg + len, sizeof(msg) - len, "%s%s (%s)",
+                      i ? ", " : " ", sv->jq[i]->nick, sv->jfrom[i]);
     }
-    default: {
-      buf[n] = '\0';  // Null-terminate the received data
-      bcast(*nfd, pfds, buf, sfd);
-      return 0;
+    if (i < n) {
+      len += snprintf(msg + len, sizeof(msg) - len, " and %d more", n - i);
     }
+    msg[len++] = '\n';
   }
+
+  bnote(sv, ROOMLOBBY, -1, msg, len);
+  for (int i = 0; i < n; i++) sv->jq[i]->joining = false;
+  sv->njq = 0;
 }
 
-/** process poll events (new connections + client I/O)
- * @param lfd listener fd
- * @param nfd fd count
- * @param pfds poll fd array
- * @param usrs fd->user hash map
- * @return 0 ok */
-int proc(int lfd, int* nfd, struct pollfd** pfds, struct fdmap** usrs) {
-  // >>> 1. process a new client connection
-  if ((*pfds)[0].revents & POLLIN) {
-    if (newcon(lfd, nfd, pfds, usrs) != 0) {
-      fprintf(stderr, "newcon: %s\n", strerror(errno));
-    }
+/** announce a connected client to the chat group
+ * @param sv server state
+ * @param c client
+ * @param caddr client address */
+static void conjoin(struct srv* sv, struct fdmap* c,
+                    struct sockaddr_storage* caddr) {
+  char cip[INET6_ADDRSTRLEN];  // client ip
+  if (ipstr(*caddr, cip) == -1) {
+    elog(sv->lq, EV_ERR, c->fd, EAFNOSUPPORT, "ipstr");
+    strcpy(cip, "unknown");
   }
+  sayjoin(sv, c, cip);
+}
 
-  // >>> 2. process existing connections
-  for (int i = 1; i < *nfd; i++) {
-    if ((*pfds)[i].revents & POLLIN) {
-      if (extcon((*pfds)[i].fd, nfd, pfds, usrs) == -1) {
-        i--;  // client removed. adjust index to check this position.
-      }
+/** tell a client which room it is in
+ * @param sv server state
+ * @param c client */
+static void sayroom(struct srv* sv, struct fdmap* c) {
+  char note[96];
+  int n = roomcount(c->room, 0);
+  snprintf(note, sizeof(note), "you are in #%s (%d member%s)\n",
+           roomname(c->room), n, n == 1 ? "" : "s");
+  consay(sv, c->fd, note);
+}
+
+/** move a client to another room: the old room hears it leave, the client
+ * gets the new room's scrollback, then the new room hears it arrive (server
+ * notices, bnote())
+ * @param sv server state
+ * @param c client
+ * @param id room id, c already counted in (roomid(), or roomcount() for
+ *           the lobby) */
+static void conmove(struct srv* sv, struct fdmap* c, int id) {
+  char msg[96];
+  int len;
+  if (c->ridx != -1) {
+    if (id == c->room) {
+      roomcount(id, -1);  // counted twice
+      sayroom(sv, c);
+      return;
     }
+    len = snprintf(msg, sizeof(msg), "%s has left #%s\n", c->nick,
+                   roomname(c->room));
+    bnote(sv, c->room, c->fd, msg, len);
+    conexit(sv, c);
   }
 
-  return 0;
+  struct room* r = conenter(sv, c, id);
+  if (!r) {
+    consay(sv, c->fd, "could not join, please try again\n");
+    return;
+  }
+  conhist(sv, c, r);
+  sayroom(sv, c);
+  len = snprintf(msg, sizeof(msg), "%s has joined #%s\n", c->nick,
+                 roomname(id));
+  bnote(sv, id, c->fd, msg, len);
 }
 
-int main() {
-  int rstat = 0;
-
-  int lsock = -1;
+/** change a client's nick and tell its room (a server notice)
+ * @param sv server state
+ * @param c client
+ * @param name wanted nick
+ * @param len name bytes */
+static void connick(struct srv* sv, struct fdmap* c, const char* name,
+                    int len) {
+  char old[NICKLEN + 1];
+  strcpy(old, c->nick);
+  if (nickmv(c->nick, name, len) == -1) {
+    consay(sv, c->fd,
+           errno == EEXIST
+               ? "that nick is taken\n"
+               : "usage: /nick <name> (letters, digits, _ and -, at most 15; "
+                 "not guest<number>)\n");
+    return;
+  }
+  // rendered once here; broadcasts copy it, never look the nick up
+  c->pfxlen = fmtpfx(c->pfx, c->nick);
+  elog(sv->lq, EV_NICK, c->fd, 0, c->nick);
 
-  // setup array of fd's for poll() and add server to it
-  int sz = MAXFDS;  // 1 listener, 5 clients
-  int cnt = 0;      // current count
-  struct pollfd* fds = malloc(sizeof(*fds) * sz);
-  if (!fds) return -1;
+  char msg[64];
+  int n = snprintf(msg, sizeof(msg), "%s is now known as %s\n", old, c->nick);
+  bnote(sv, c->room, c->fd, msg, n);
+  snprintf(msg, sizeof(msg), "you are now %s\n", c->nick);
+  consay(sv, c->fd, msg);
+}
 
-  struct fdmap* users = NULL;
+/** send a direct message: one registry lookup finds the target's shard,
+ * then it goes to exactly that client (through the target shard's inbox
+ * when it lives elsewhere). the sender gets a copy as confirmation.
+ * direct messages stay out of scrollback and the message log
+ * @param sv server state
+ * @param c sender
+ * @param arg "<nick> <text>"
+ * @param len arg bytes */
+static void conmsg(struct srv* sv, struct fdmap* c, const char* arg,
+                   int len) {
+  int n = 0;
+  while (n < len && arg[n] != ' ') n++;
+  const char* text = arg + n;
+  int tlen = len - n;
+  while (tlen > 0 && *text == ' ') {
+    text++;
+    tlen--;
+  }
+  if (n == 0 || tlen == 0) {
+    consay(sv, c->fd, "usage: /msg <nick> <text>\n");
+    return;
+  }
+  struct nickref r;
+  if (nickfind(arg, n, &r) == -1) {
+    consay(sv, c->fd, "no such nick\n");
+    return;
+  }
 
-  if (lstnfd(HOSTNAME, PORT, true, &lsock) == -1) {
-    fprintf(stderr, "lstnfd: %s\n", strerror(errno));
-    return -1;
+  char pfx[2 * NICKLEN + 8];  // "from -> to: "
+  int plen = snprintf(pfx, sizeof(pfx), "%s -> %.*s: ", c->nick, n, arg);
+  struct msg* m = fmtmsg(&sv->clk, pfx, plen, text, tlen);
+  if (!m) return;
+  m->to = r.id;
+  m->tgen = r.gen;
+  if (r.shard != sv->id) {
+    ibpost(&sv->ip, &sv->shards[r.shard].ib, msgget(m));
+  } else if (dmsend(sv, m) == -1 || r.id == c->fd) {
+    msgput(m);
+    return;
   }
-  fdadd(&fds, &users, lsock, true, &cnt);
+  dmout(sv, c, m);
+  msgput(m);
+}
 
-  while (1) {
-    if (poll(fds, cnt, -1) == -1)  // fd's ready for IO
-    {
-      fprintf(stderr, "poll: %s\n", strerror(errno));
-      exit(1);
-    }
+/** say when a client was last active. a client on this shard is read
+ * directly; others are as of their shard's last heartbeat
+ * @param sv server state
+ * @param c asking client
+ * @param name nick
+ * @param len name bytes */
+static void conseen(struct srv* sv, struct fdmap* c, const char* name,
+                    int len) {
+  struct nickref r;
+  char note[96];
+  if (nickfind(name, len, &r) == -1) {
+    snprintf(note, sizeof(note), "%.*s is not online\n",
+             len > NICKLEN ? NICKLEN : len, name);
+    consay(sv, c->fd, note);
+    return;
+  }
+  struct fdmap* t = r.shard == sv->id ? conget(sv, r.id) : NULL;
+  if (t && t->gen == r.gen) r.seen = t->seen;
+  uint64_t ago = sv->now > r.seen ? (sv->now - r.seen) / 1000 : 0;
+  snprintf(note, sizeof(note), "%.*s is online, last active %llu s ago\n",
+           len, name, (unsigned long long)ago);
+  consay(sv, c->fd, note);
+}
 
-    proc(lsock, &cnt, &fds, &users);
+/** run a chat command: /join <room>, /leave (back to the lobby), /room,
+ * /nick <name>, /msg <nick> <text>, /seen <nick>
+ * @param sv server state
+ * @param c client
+ * @param line command line, '/' first (no line ending)
+ * @param len line bytes */
+static void concmd(struct srv* sv, struct fdmap* c, const char* line,
+                   int len) {
+  int n = 1;
+  while (n < len && line[n] != ' ') n++;
+  const char* arg = line + n;
+  int alen = len - n;
+  while (alen > 0 && *arg == ' ') {
+    arg++;
+    alen--;
   }
+  while (alen > 0 && arg[alen - 1] == ' ') alen--;
+
+  if (n == 5 && memcmp(line, "/join", 5) == 0) {
+    int id = roomid(arg, alen);
+    if (id == -1) {
+      consay(sv, c->fd,
+             errno == ENOSPC
+                 ? "too many rooms in use, try an existing one\n"
+                 : "usage: /join <room> (letters, digits, _ and -, at most "
+                   "31)\n");
+      return;
+    }
+    conmove(sv, c, id);
+  } else if (n == 6 && memcmp(line, "/leave", 6) == 0) {
+    roomcount(ROOMLOBBY, 1);
+    conmove(sv, c, ROOMLOBBY);
+  } else if (n == 5 && memcmp(line, "/room", 5) == 0) {
+    sayroom(sv, c);
+  } else if (n == 5 && memcmp(line, "/nick", 5) == 0) {
+    connick(sv, c, arg, alen);
+  } else if (n == 4 && memcmp(line, "/msg", 4) == 0) {
+    conmsg(sv, c, arg, alen);
+  } else if (n == 5 && memcmp(line, "/seen", 5) == 0 && alen > 0) {
+    conseen(sv, c, arg, alen);
+  } else {
+    consay(sv, c->fd,
+           "commands: /join <room>, /leave, /room, /nick <name>, "
+           "/msg <nick> <text>, /seen <nick>\n");
+  }
+}
+
+/** one line of chat input: a command, or a message for the client's room
+ * @param sv server state
+ * @param c client
+ * @param line line (no line ending)
+ * @param len line bytes */
+static void conline(struct srv* sv, struct fdmap* c, const char* line,
+                    int len) {
+  if (sv->stopping) return;  // shutting down: input is read, not acted on
+  joinflush(sv);             // a joiner speaks after it is announced
+  mtadd(&sv->st.c[SC_MSGSIN], 1);
+  if (line[0] == '/') {
+    concmd(sv, c, line, len);
+  } else {
+    bcast(sv, c, line, len);
+  }
+}
+
+/** register an accepted client (capacity check, add to poll, broadcast
+ * join). websocket clients are announced once their handshake completes;
+ * a trunk is not a chat client itself, its sessions are
+ * @param sv server state
+ * @param cfd accepted non-blocking client fd
+ * @param caddr client address
+ * @param kind wire protocol
+ * @return 0 added, -1 rejected (cfd closed) */
+static int conadd(struct srv* sv, int cfd, struct sockaddr_storage* caddr,
+                  enum ckind kind) {
+  // Validate if the server has room (MAX_CLIENTS across all shards). If
+  // not, reject new client with a msg
+  if (atomic_fetch_add(&nclients, 1) >= maxcli) {
+    atomic_fetch_sub(&nclients, 1);
+    conrefuse(sv, cfd, kind);
+    return -1;
+  }
+
+  // Add new client fd to the pfds array
+  if (fdadd(sv, cfd, false) == -1) {
+    atomic_fetch_sub(&nclients, 1);
+    elog(sv->lq, EV_ERR, cfd, errno, "fdadd");
+    close(cfd);
+    return -1;
+  }
+  mtadd(&sv->st.c[SC_ACCEPTS], 1);
+
+  struct fdmap* c = conget(sv, cfd);
+  conkind(sv, c, kind);
+  if (kind == CK_WS) {
+    c->ws = calloc(1, sizeof(*c->ws));
+    if (!c->ws) {
+      elog(sv->lq, EV_ERR, cfd, errno, "conadd");
+      fdrm(sv, cfd);
+      close(cfd);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (kind == CK_TRUNK) {
+    c->tc = calloc(1, sizeof(*c->tc));
+    if (!c->tc) {
+      elog(sv->lq, EV_ERR, cfd, errno, "conadd");
+      fdrm(sv, cfd);
+      close(cfd);
+      return -1;
+    }
+    trinit(&c->tc->t);
+    elog(sv->lq, EV_TRUNKUP, cfd, 0, NULL);
+    return 0;
+  }
+
+  // broadcast new client info to chat group
+  conjoin(sv, c, caddr);
+  return 0;
+}
+
+/** give a trunk session an id: a free slot in this shard's session table,
+ * SIDBASE + slot * nshards + shard, so ids never collide across shards
+ * and conget() finds the session by indexing
+ * @param sv server state
+ * @param c session record
+ * @return 0 ok (c->fd set), -1 out of memory */
+static int sidnew(struct srv* sv, struct fdmap* c) {
+  if (sv->nsidfree == 0) {
+    int n = sv->nsids ? sv->nsids * 2 : FDSINIT;
+    struct fdmap** sids = realloc(sv->sids, sizeof(*sids) * n);
+    if (!sids) return -1;
+    sv->sids = sids;
+    int* sf = realloc(sv->sidfree, sizeof(*sf) * n);
+    if (!sf) return -1;
+    sv->sidfree = sf;
+    // push new slots so the lowest comes out first
+    for (int k = n - 1; k >= sv->nsids; k--) {
+      sv->sids[k] = NULL;
+      sv->sidfree[sv->nsidfree++] = k;
+    }
+    sv->nsids = n;
+  }
+  int k = sv->sidfree[--sv->nsidfree];
+  sv->sids[k] = c;
+  c->fd = SIDBASE + k * sv->nshards + sv->id;
+  return 0;
+}
+
+/** forget a trunk session once its leave notice is out
+ * @param sv server state
+ * @param c session */
+static void tsfree(struct srv* sv, struct fdmap* c) {
+  struct tsess* s = c->ts;
+  struct tconn* tc = s->tk->tc;
+  HASH_DEL(tc->chans, s);
+  tc->ss[s->idx] = tc->ss[--tc->nss];
+  tc->ss[s->idx]->idx = s->idx;
+  int k = (c->fd - SIDBASE) / sv->nshards;
+  sv->sids[k] = NULL;
+  sv->sidfree[sv->nsidfree++] = k;
+  tmrdel(&sv->wh, &c->tm);
+  atomic_fetch_sub(&nclients, 1);
+  sqfree(&c->sq);
+  frfree(&c->in);
+  poolput(&sv->spool, s);
+  poolput(&sv->cpool, c);
+}
+
+/** take a trunk off the flush list before it is freed
+ * @param sv server state
+ * @param tk trunk */
+static void trunlink(struct srv* sv, struct fdmap* tk) {
+  for (struct fdmap** p = &sv->tdirty; *p; p = &(*p)->tc->next) {
+    if (*p == tk) {
+      *p = tk->tc->next;
+      break;
+    }
+  }
+  tk->tc->dirty = false;
+}
+
+/** drop a client after recv() returned 0 (hangup) or a hard error. a trunk
+ * takes all of its sessions with it; a session has no fd of its own
+ * @param sv server state
+ * @param sfd client socket fd (or session id)
+ * @param n recv() result
+ * @return -1 (client removed) */
+static int conrm(struct srv* sv, int sfd, int n) {
+  joinflush(sv);  // no leave before the join, no dangling joiner
+  struct fdmap* c = conget(sv, sfd);
+  if (c && c->kind == CK_TRUNK) {
+    // every browser behind the gateway leaves the chat
+    elog(sv->lq, EV_TRUNKDN, sfd, c->tc->nss, NULL);
+    while (c->tc->nss > 0) conrm(sv, c->tc->ss[c->tc->nss - 1]->c->fd, 0);
+    trunlink(sv, c);
+  }
+
+  if (n == 0) {
+    // client disconnected early. handle!
+    // handles POLLHUP || POLLERR
+    // a last line without its newline still counts as a message
+    if (c && c->in.len > 0 && !c->in.skip) {
+      conline(sv, c, c->in.buf, c->in.len);
+    }
+
+    // websocket clients that never finished the handshake never joined
+    // (nobody is told while the server shuts down)
+    if (c && !sv->stopping &&
+        (c->kind == CK_TCP || c->kind == CK_SESS ||
+         (c->kind == CK_WS && c->ws->open))) {
+      char msg[256];  // Buffer to hold the message
+      int len =
+          snprintf(msg, sizeof(msg), "%s has left the chat!\n", c->nick);
+      bcast(sv, c, msg, len);
+    }
+  } else {
+    elog(sv->lq, EV_IOERR, sfd, errno, "recv");
+  }
+  if (c && c->gen) elog(sv->lq, EV_LEAVE, sfd, 0, c->nick);
+  if (c && c->lagat) {
+    // a lag episode ends with the client
+    mtobs(&sv->st.lag, sv->now - c->lagat);
+    mtadd(&sv->st.g[SG_LAGGING], -1);
+  }
+  if (c) conexit(sv, c);
+  if (c && c->gen) nickdel(c->nick);
+  if (c && c->kind == CK_SESS) {
+    tsfree(sv, c);
+    return -1;
+  }
+  fdrm(sv, sfd);
+#ifdef CCHAT_URING
+  if (sv->uring) uforget(&sv->ur, sfd);
+#endif
+  close(sfd);
+  return -1;
+}
+
+/** tell a client its over-long message was dropped
+ * @param sv server state
+ * @param fd client fd */
+static void conlong(struct srv* sv, int fd) {
+  char note[64];
+  snprintf(note, sizeof(note), "message too long (max %d bytes), dropped\n",
+           MAXDATASIZE - 1);
+  consay(sv, fd, note);
+}
+
+/** send a last message (http error or close frame) to a websocket client
+ * and drop it once that is out; input is ignored meanwhile
+ * @param sv server state
+ * @param c client
+ * @param m final message (consumed, may be NULL)
+ * @return -1 removed now, 0 removal deferred to conflush() */
+static int conbye(struct srv* sv, struct fdmap* c, struct msg* m) {
+  c->ws->closing = true;
+#ifdef CCHAT_URING
+  if (sv->uring) {
+    // the fd is closed before queued SQEs are submitted; try it directly
+    if (m) send(c->fd, m->data, m->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    msgput(m);
+    return conrm(sv, c->fd, 0);
+  }
+#endif
+  if (m) {
+    conq(sv, c, m);
+    msgput(m);
+  }
+  if (sqlen(&c->sq) == 0) return conrm(sv, c->fd, 0);
+  return 0;
+}
+
+/** start the websocket closing handshake (or answer the peer's close)
+ * @param sv server state
+ * @param c client
+ * @param code status code, 0 = none
+ * @return -1 removed now, 0 removal deferred */
+static int wsclose(struct srv* sv, struct fdmap* c, int code) {
+  char pl[2] = {(char)(code >> 8), (char)(code & 0xff)};
+  return conbye(sv, c, wsmsg(WS_CLOSE, pl, code ? 2 : 0));
+}
+
+/** complete the upgrade handshake from buffered request bytes
+ * @param sv server state
+ * @param c client (not yet open)
+ * @return 1 upgraded, 0 need more (or rejected, closing), -1 removed */
+static int wsopen(struct srv* sv, struct fdmap* c) {
+  struct wsconn* w = c->ws;
+  char resp[256];
+  int rlen;
+  int used = wshs((const char*)w->buf, w->len, WSPATH, resp, &rlen);
+  if (used == 0) {
+    if (w->len < WSBUFSZ) return 0;
+    rlen = snprintf(resp, sizeof(resp),
+                    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                    "Content-Length: 0\r\nConnection: close\r\n\r\n");
+    used = -1;
+  }
+
+  struct msg* m = msgnew(rlen);
+  if (m) memcpy(m->data, resp, rlen);
+  if (used == -1) return conbye(sv, c, m);
+  if (m) {
+    conout(sv, c, m);
+    msgput(m);
+  }
+  w->open = true;
+  w->pos = used;  // frames may follow in the same read
+
+  struct sockaddr_storage caddr;
+  socklen_t caddrlen = sizeof(caddr);
+  memset(&caddr, 0, sizeof(caddr));
+  getpeername(c->fd, (struct sockaddr*)&caddr, &caddrlen);
+  conjoin(sv, c, &caddr);
+  return 1;
+}
+
+/** websocket input: handshake, then frames. each text message is broadcast
+ * line by line like TCP input; pings are answered, close is echoed
+ * @param sv server state
+ * @param c client
+ * @param data received bytes
+ * @param n byte count
+ * @return number of messages broadcast, -1 client removed */
+static int wsrecv(struct srv* sv, struct fdmap* c, const char* data, int n) {
+  struct wsconn* w = c->ws;
+  int nmsg = 0;
+  while (n > 0 && !w->closing) {
+    int k = wsput(w, data, n);
+    data += k;
+    n -= k;
+
+    if (!w->open) {
+      int r = wsopen(sv, c);
+      if (r == -1) return -1;
+      if (r == 0) continue;
+    }
+
+    const char* p;
+    int len, code, r;
+    while ((r = wsnext(w, MAXDATASIZE - 1, &p, &len, &code)) != WS_NEED) {
+      if (r == WS_PINGED) {
+        struct msg* m = wsmsg(WS_PONG, p, len);
+        if (m) {
+          conout(sv, c, m);
+          msgput(m);
+        }
+        continue;
+      }
+      if (r == WS_PONGED) continue;
+      if (r == WS_LONG) {
+        conlong(sv, c->fd);
+        continue;
+      }
+      if (r != WS_MSG) return wsclose(sv, c, code);  // closed or failed
+
+      // one message may carry several lines
+      const char* end = p + len;
+      while (p < end) {
+        const char* nl = nlscan(p, end);
+        const char* e = nl ? nl : end;
+        int llen = (int)(e - p);
+        if (llen > 0 && p[llen - 1] == '\r') llen--;
+        if (llen > 0) {
+          conline(sv, c, p, llen);
+          nmsg++;
+        }
+        p = e + 1;
+      }
+    }
+  }
+  return nmsg;
+}
+
+static int conrecv(struct srv* sv, int sfd, const char* data, int n);
+
+/** open a session for a new browser on a trunk: a logical client with a
+ * session id, announced like any other. refused with a TR_CLOSE at
+ * capacity
+ * @param sv server state
+ * @param tk trunk
+ * @param f TR_OPEN frame (payload = peer address text) */
+static void tsopen(struct srv* sv, struct fdmap* tk, const struct trfrm* f) {
+  struct tconn* tc = tk->tc;
+  struct tsess* s;
+  HASH_FIND(hh, tc->chans, &f->ch, sizeof(f->ch), s);
+  if (s || f->ch == 0) {
+    elog(sv->lq, EV_TRUNKERR, tk->fd, f->ch, "channel already open");
+    return;
+  }
+
+  if (atomic_fetch_add(&nclients, 1) >= maxcli) {
+    atomic_fetch_sub(&nclients, 1);
+    mtadd(&sv->st.c[SC_REJECTS], 1);
+    const char* msg = "server at capacity. please try again later.\n";
+    int len = strlen(msg);
+    uint8_t* p = trframe(&tc->t, TR_CLOSE, f->ch, len);
+    if (p) memcpy(p, msg, len);
+    trmark(sv, tk);
+    return;
+  }
+
+  if (tc->nss == tc->capss) {
+    int cap = tc->capss ? tc->capss * 2 : FDSINIT;
+    struct tsess** ss = realloc(tc->ss, sizeof(*ss) * cap);
+    if (!ss) goto fail;
+    tc->ss = ss;
+    tc->capss = cap;
+  }
+  struct fdmap* c = poolget(&sv->cpool);
+  s = poolget(&sv->spool);
+  if (!c || !s || sidnew(sv, c) == -1) {
+    poolput(&sv->cpool, c);
+    poolput(&sv->spool, s);
+    goto fail;
+  }
+  c->idx = -1;
+  c->ridx = -1;
+  c->gen = 0;
+  c->lagat = 0;
+  c->kick = false;
+  c->joining = false;
+  c->nick[0] = '\0';
+  c->pfxlen = 0;
+  c->seen = sv->now;
+  c->tm.next = NULL;
+  tmradd(&sv->wh, &c->tm, sv->now + tmrms);
+  c->kind = CK_SESS;
+  c->ts = s;
+  s->ch = f->ch;
+  s->c = c;
+  s->tk = tk;
+  s->idx = tc->nss;
+  s->credit = s->rwin = TRWIN;
+  tc->ss[tc->nss++] = s;
+  HASH_ADD(hh, tc->chans, ch, sizeof(s->ch), s);
+
+  // the gateway passes the browser's address along; keep it printable
+  char from[64];
+  int n = f->len < (int)sizeof(from) - 1 ? f->len : (int)sizeof(from) - 1;
+  for (int i = 0; i < n; i++) {
+    from[i] = f->pl[i] > ' ' && f->pl[i] < 0x7f ? f->pl[i] : '?';
+  }
+  strcpy(from + n, n ? "" : "unknown");
+  sayjoin(sv, c, from);
+  return;
+
+fail:
+  atomic_fetch_sub(&nclients, 1);
+  elog(sv->lq, EV_ERR, tk->fd, errno, "tsopen");
+}
+
+/** gateway trunk input: frames for any number of sessions in one read.
+ * session bytes are framed into lines like TCP input; window is returned
+ * in batches once half of it is used
+ * @param sv server state
+ * @param tk trunk
+ * @param data received bytes
+ * @param n byte count
+ * @return number of messages broadcast, -1 trunk removed */
+static int trrecv(struct srv* sv, struct fdmap* tk, const char* data, int n) {
+  struct tconn* tc = tk->tc;
+  struct trfrm f;
+  int r, nmsg = 0;
+  while ((r = trnext(&tc->t, &data, &n, &f)) == 1) {
+    struct tsess* s = NULL;
+    if (f.type == TR_DATA || f.type == TR_CLOSE) {
+      HASH_FIND(hh, tc->chans, &f.ch, sizeof(f.ch), s);
+      if (!s) continue;  // already closed on our side
+    }
+
+    switch (f.type) {
+      case TR_OPEN:
+        tsopen(sv, tk, &f);
+        break;
+      case TR_DATA:
+        if ((s->rwin -= f.len) < 0) {
+          elog(sv->lq, EV_TRUNKERR, tk->fd, f.ch, "channel over its window");
+          uint8_t* p = trframe(&tc->t, TR_CLOSE, f.ch, 0);
+          trmark(sv, tk);
+          if (!p) tc->dead = true;
+          conrm(sv, s->c->fd, 0);
+          break;
+        }
+        int k = conrecv(sv, s->c->fd, (const char*)f.pl, f.len);
+        if (k > 0) nmsg += k;
+        if (s->rwin <= TRWIN / 2) {
+          if (trcredit(&tc->t, s->ch, TRWIN - s->rwin) == -1) tc->dead = true;
+          s->rwin = TRWIN;
+          trmark(sv, tk);
+        }
+        break;
+      case TR_CLOSE:
+        conrm(sv, s->c->fd, 0);
+        break;
+      case TR_CREDIT:
+        for (int i = 0; i + 8 <= f.len; i += 8) {
+          uint32_t ch = trget32(f.pl + i);
+          HASH_FIND(hh, tc->chans, &ch, sizeof(ch), s);
+          if (s) tscredit(sv, s, trget32(f.pl + i + 4));
+        }
+        break;
+      default:
+        elog(sv->lq, EV_TRUNKERR, tk->fd, f.type, "bad frame type");
+        return conrm(sv, tk->fd, 0);
+    }
+  }
+  if (r == -1) {
+    elog(sv->lq, EV_IOERR, tk->fd, errno, "trunk recv");
+    return conrm(sv, tk->fd, 0);
+  }
+  return nmsg;
+}
+
+/** write out the frames batched for trunks during this loop pass, one
+ * write per trunk
+ * @param sv server state */
+static void trdrain(struct srv* sv) {
+  while (sv->tdirty) {
+    struct fdmap* tk = sv->tdirty;
+    sv->tdirty = tk->tc->next;
+    tk->tc->dirty = false;
+    if (tk->tc->dead) {
+      elog(sv->lq, EV_TRUNKERR, tk->fd, 0, "gateway not reading");
+      conrm(sv, tk->fd, 0);
+      continue;
+    }
+#ifdef CCHAT_URING
+    if (sv->uring) {
+      struct msg* m = trtake(&tk->tc->t);
+      if (m) {
+        ubcast(&sv->ur, &tk->fd, 1, m);
+        msgput(m);
+      }
+      continue;
+    }
+#endif
+    int left = trflush(&tk->tc->t, tk->fd);
+    if (left == -1) {
+      elog(sv->lq, EV_IOERR, tk->fd, errno, "trunk send");
+      conrm(sv, tk->fd, 0);
+      continue;
+    }
+    if (left > 0) constall(sv, left);
+    conwout(sv, tk, left > 0);
+  }
+}
+
+/** frame TCP input into messages and broadcast each one. input is newline
+ * framed: a read may hold zero, one or many messages; partial lines are
+ * carried in the client's inbuf. over-long messages are dropped whole and
+ * the sender is told
+ * @param sv server state
+ * @param c client (TCP or trunk session)
+ * @param data received bytes
+ * @param n byte count
+ * @return number of messages broadcast */
+static int tcprecv(struct srv* sv, struct fdmap* c, const char* data, int n) {
+  int sfd = c->fd;
+  const char* line;
+  int len, r, nmsg = 0;
+  while ((r = frnext(&c->in, &data, &n, MAXDATASIZE, &line, &len)) !=
+         FR_NEED) {
+    if (r == FR_LONG) {
+      conlong(sv, sfd);
+      continue;
+    }
+    // strip the line ending (\n or \r\n); blank lines are not broadcast
+    len--;
+    if (len > 0 && line[len - 1] == '\r') len--;
+    if (len == 0) continue;
+    conline(sv, c, line, len);
+    nmsg++;
+  }
+  return nmsg;
+}
+
+/** handle received bytes: websocket input goes through wsrecv(), trunk
+ * input through trrecv() (whose sessions come back here), the rest through
+ * tcprecv(). fan-out latency is timed from here
+ * @param sv server state
+ * @param sfd client fd
+ * @param data received bytes
+ * @param n byte count
+ * @return number of messages broadcast, -1 unknown/removed client */
+static int conrecv(struct srv* sv, int sfd, const char* data, int n) {
+  struct fdmap* c = conget(sv, sfd);
+  if (!c) return -1;
+  c->seen = sv->now;  // the timer catches up when it fires, no re-arm here
+
+  // a session's bytes arrive inside its trunk's, already counted and timed
+  uint32_t rx = sv->rxus;
+  if (!rx) {
+    mtadd(&sv->st.c[SC_BYTESIN], n);
+    sv->rxus = usclk();
+  }
+  int nmsg = c->kind == CK_WS      ? wsrecv(sv, c, data, n)
+             : c->kind == CK_TRUNK ? trrecv(sv, c, data, n)
+                                   : tcprecv(sv, c, data, n);
+  sv->rxus = rx;
+  return nmsg;
+}
+
+
+/** disconnect a client that sent nothing for IDLE_TIMEOUT_SEC, telling it
+ * why. it is dropped at once: a dead peer would never drain its queue
+ * @param sv server state
+ * @param c client */
+static void conidle(struct srv* sv, struct fdmap* c) {
+  struct msg* m[2] = {NULL, NULL};
+  char note[64];
+  int len = snprintf(note, sizeof(note), "idle for %d s, disconnecting\n",
+                     idlems / 1000);
+  if (c->kind == CK_TCP && (m[0] = msgnew(len)) != NULL) {
+    memcpy(m[0]->data, note, len);
+  } else if (c->kind == CK_WS && c->ws->open) {
+    char pl[2] = {1001 >> 8, 1001 & 0xff};  // going away
+    m[0] = wsmsg(WS_TEXT, note, len);
+    m[1] = wsmsg(WS_CLOSE, pl, 2);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (!m[i]) continue;
+#ifdef CCHAT_URING
+    // the fd is closed before queued SQEs are submitted; try it directly
+    if (sv->uring) {
+      send(c->fd, m[i]->data, m[i]->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } else
+#endif
+      conq(sv, c, m[i]);
+    msgput(m[i]);
+  }
+  elog(sv->lq, EV_IDLE, c->fd, idlems / 1000, c->nick);
+  conrm(sv, c->fd, 0);
+}
+
+/** a connection's timer fired: publish its last seen time, disconnect it
+ * when idle too long, else probe it if it has been quiet for a heartbeat,
+ * and re-arm. input never touches the wheel; it only moves c->seen, and
+ * the timer re-arms from it here, so a busy client costs one timer firing
+ * per period whatever its message rate
+ * @param sv server state
+ * @param c connection */
+static void contimer(struct srv* sv, struct fdmap* c) {
+  uint64_t idle = sv->now - c->seen;
+  if (c->gen) nickseen(c->nick, c->seen);
+
+  if (c->kick) {
+    // a slow consumer out of time; a session is closed on its trunk,
+    // which shows the browser why
+    if (c->kind == CK_SESS) {
+      static const char why[] = "too slow reading, disconnecting";
+      struct fdmap* tk = c->ts->tk;
+      uint8_t* p = trframe(&tk->tc->t, TR_CLOSE, c->ts->ch, sizeof(why) - 1);
+      if (p) memcpy(p, why, sizeof(why) - 1);
+      if (!p) tk->tc->dead = true;
+      trmark(sv, tk);
+    }
+    conrm(sv, c->fd, 0);
+    return;
+  }
+
+  // trunks carry many sessions; the gateway sends nothing when they are
+  // all quiet. sessions are probed by the gateway, not us
+  bool kick = idlems && c->kind != CK_TRUNK && c->kind != CK_SESS;
+  if (kick && idle >= (uint64_t)idlems) {
+    conidle(sv, c);
+    return;
+  }
+  if (hbms && idle >= (uint64_t)hbms) {
+    if (c->kind == CK_WS && c->ws->open) {
+      struct msg* m = wsmsg(WS_PING, NULL, 0);  // the pong is input
+      if (m) {
+        conout(sv, c, m);
+        msgput(m);
+      }
+    } else if (c->kind == CK_TRUNK) {
+      // an empty credit frame: a no-op the gateway reads, so a dead trunk
+      // shows up as a send error
+      if (trframe(&c->tc->t, TR_CREDIT, 0, 0)) trmark(sv, c);
+    } else if (c->kind == CK_TCP && kick && idle + hbms >= (uint64_t)idlems) {
+      // plain lines have no ping; warn once before the disconnect
+      char note[96];
+      snprintf(note, sizeof(note),
+               "no input for %d s, send anything within %d s to stay\n",
+               (int)(idle / 1000), (int)((idlems - idle) / 1000));
+      consay(sv, c->fd, note);
+    }
+  }
+
+  uint64_t next = idle < (uint64_t)tmrms ? c->seen + tmrms : sv->now + tmrms;
+  if (kick && c->seen + idlems < next) next = c->seen + idlems;
+  tmradd(&sv->wh, &c->tm, next);
+}
+
+/** fire every connection timer due by sv->now
+ * @param sv server state */
+static void tmrrun(struct srv* sv) {
+  wheeladv(&sv->wh, sv->now);
+  struct tmr* t;
+  while ((t = tmrpop(&sv->wh)) != NULL) {
+    contimer(sv, (struct fdmap*)((char*)t - offsetof(struct fdmap, tm)));
+  }
+  trdrain(sv);  // trunk heartbeats and leave notices
+}
+
+/** poll timeout: ms until the next timer
+ * @param sv server state
+ * @return ms, -1 = no timers */
+static int tmrwait(struct srv* sv) {
+  uint64_t nx = wheelnext(&sv->wh);
+  if (nx == WNEVER) return -1;
+  if (nx <= sv->now) return 0;
+  return nx - sv->now > INT_MAX ? INT_MAX : (int)(nx - sv->now);
+}
+
+/** SIGINT/SIGTERM: hand the signal to shard 0's loop through the pipe
+ * @param sig signal number */
+static void onsig(int sig) {
+  int e = errno;
+  char b = (char)sig;
+  ssize_t rc = write(sigfds[1], &b, 1);  // pipe full = already pending
+  (void)rc;
+  errno = e;
+}
+
+/** signal pipe readable (shard 0): start shutting down every shard with a
+ * flush deadline; a second signal cuts the deadline short
+ * @param sv server state */
+static void sigrecv(struct srv* sv) {
+  char buf[16];
+  while (read(sigfds[0], buf, sizeof(buf)) > 0);
+  if (atomic_load(&stopat)) {
+    atomic_store(&stopat, sv->now);
+    elog(sv->lq, EV_STOP, -1, 0, NULL);
+  } else {
+    atomic_store(&stopat, sv->now + drainms);
+    elog(sv->lq, EV_STOP, -1, drainms, NULL);
+  }
+  for (int i = 0; i < sv->nshards; i++) {
+    if (i != sv->id) ibwake(&sv->shards[i].ib);
+  }
+}
+
+/** close a listener; its slot stays (fd -1 is ignored by poll)
+ * @param sv server state
+ * @param fd listener fd (set to -1) */
+static void lstnstop(struct srv* sv, int* fd) {
+  if (*fd == -1) return;
+  evdel(&sv->ev, *fd);
+  sv->fds[sv->fdix[*fd]].fd = -1;
+  sv->fdix[*fd] = -1;
+#ifdef CCHAT_URING
+  if (sv->uring) uforget(&sv->ur, *fd);
+#endif
+  close(*fd);
+  *fd = -1;
+}
+
+/** begin shutting a shard down: stop accepting and tell every client. a
+ * websocket client also gets its close frame; trunks are closed at the
+ * end, and the gateway closes its browsers with them
+ * @param sv server state */
+static void shdown(struct srv* sv) {
+  static const char note[] = "server shutting down\n";
+  sv->stopping = true;
+  lstnstop(sv, &sv->lfd);
+  lstnstop(sv, &sv->wfd);
+  lstnstop(sv, &sv->tfd);
+
+  for (int i = sv->nsys; i < sv->nfd; i++) {
+    struct fdmap* c = sv->cons[i];
+    if (c->kind == CK_TCP) {
+      consay(sv, c->fd, note);
+    } else if (c->kind == CK_WS && c->ws->open && !c->ws->closing) {
+      char pl[2] = {1001 >> 8, 1001 & 0xff};  // going away
+      struct msg* m = wsmsg(WS_CLOSE, pl, 2);
+      consay(sv, c->fd, note);
+      if (m) {
+        conout(sv, c, m);
+        msgput(m);
+      }
+      c->ws->closing = true;  // dropped by conflush() once it is out
+    } else if (c->kind == CK_TRUNK) {
+      for (int j = 0; j < c->tc->nss; j++) {
+        consay(sv, c->tc->ss[j]->c->fd, note);
+      }
+    }
+  }
+  trdrain(sv);
+}
+
+/** does any connection still have output waiting
+ * @param sv server state
+ * @return true while something is queued */
+static bool shbusy(struct srv* sv) {
+  for (int i = sv->nsys; i < sv->nfd; i++) {
+    struct fdmap* c = sv->cons[i];
+#ifdef CCHAT_URING
+    if (sv->uring && ubusy(&sv->ur, c->fd)) return true;
+#endif
+    if (sqlen(&c->sq) > 0) return true;
+    if (c->kind != CK_TRUNK) continue;
+    if (c->tc->t.outoff < c->tc->t.outlen) return true;
+    for (int j = 0; j < c->tc->nss; j++) {
+      if (sqlen(&c->tc->ss[j]->c->sq) > 0) return true;  // awaiting credit
+    }
+  }
+  return false;
+}
+
+/** drop every connection left on a shard
+ * @param sv server state */
+static void shclose(struct srv* sv) {
+  int n = sv->nfd - sv->nsys;
+  bool busy = shbusy(sv);
+  while (sv->nfd > sv->nsys) conrm(sv, sv->fds[sv->nfd - 1].fd, 0);
+  elog(sv->lq, EV_CLOSED, -1, n, busy ? "deadline hit, unsent" : "flushed");
+}
+
+/** shutdown progress, once per loop pass: start it when a signal came in,
+ * and finish once every queue is flushed or the deadline passed
+ * @param sv server state
+ * @return true = shard done, leave the loop */
+static bool shstop(struct srv* sv) {
+  uint64_t at = atomic_load(&stopat);
+  if (!at) return false;
+  if (!sv->stopping) shdown(sv);
+  if (sv->now < at && shbusy(sv)) return false;
+  shclose(sv);
+  return true;
+}
+
+/** poll timeout: the next timer, or the shutdown deadline while flushing
+ * (0 while a listener backlog waits)
+ * @param sv server state
+ * @return ms, -1 = wait for I/O */
+static int shwait(struct srv* sv) {
+  int tmo = tmrwait(sv);
+  if (sv->acmore) {
+    // connections still queued on a listener (after a rest when out of fds)
+    int rest = sv->acat > sv->now ? (int)(sv->acat - sv->now) : 0;
+    if (tmo == -1 || rest < tmo) tmo = rest;
+  }
+  if (!sv->stopping) return tmo;
+  uint64_t at = atomic_load(&stopat);
+  int left = at > sv->now ? (int)(at - sv->now) : 0;
+  return tmo == -1 || left < tmo ? left : tmo;
+}
+
+/** publish the gauges read off the shard's own structures, once per loop
+ * pass (a few stores)
+ * @param sv server state */
+static void stpub(struct srv* sv) {
+  struct srvstat* st = &sv->st;
+  mtset(&st->g[SG_CONNS], sv->nfd - sv->nsys);
+  mtset(&st->g[SG_SESS], sv->nsids - sv->nsidfree);
+  mtset(&st->g[SG_TIMERS], sv->wh.n);
+#ifdef CCHAT_URING
+  mtset(&st->c[SC_URENTER], (long)sv->ur.nenter);
+#endif
+  struct pool* ps[2] = {&sv->cpool, &sv->spool};
+  for (int i = 0; i < 2; i++) {
+    struct poolstat p;
+    poolstat(ps[i], &p);
+    mtset(&st->g[SG_POOL + i * 3], p.live);
+    mtset(&st->g[SG_POOL + i * 3 + 1], p.hwm);
+    mtset(&st->g[SG_POOL + i * 3 + 2], p.bytes);
+  }
+}
+
+/** handle existing client I/O (recv msg, broadcast, or handle disconnect).
+ * reads until EAGAIN so edge-triggered backends don't lose data
+ * @param sv server state
+ * @param sfd client socket fd
+ * @return 0 ok, -1 disconnect/error */
+int extcon(struct srv* sv, int sfd) {
+  char buf[RECVSZ];  // buffer to recv data
+  while (1) {
+    int n = recv(sfd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      if (conrecv(sv, sfd, buf, n) == -1) return -1;  // client removed
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // not a real error for non-blocking sockets
+      return 0;
+    }
+    if (n == -1 && errno == EINTR) continue;
+    return conrm(sv, sfd, n);
+  }
+}
+
+/** process ready events (new connections + client I/O). only the ready
+ * list is walked, so idle clients cost nothing with the epoll backend
+ * @param sv server state
+ * @param nrdy number of entries in sv->ev.rdy
+ * @return 0 ok */
+int proc(struct srv* sv, int nrdy) {
+  // backlogs left over by the accept budget last pass, or by running out
+  // of fds once the rest is up
+  if (sv->acmore && sv->now >= sv->acat) {
+    sv->acmore = false;
+    lstnwake(sv);
+    int lfds[3] = {sv->lfd, sv->wfd, sv->tfd};
+    for (int i = 0; i < 3; i++) {
+      if (lfds[i] != -1) conaccept(sv, lfds[i]);
+    }
+  }
+
+  for (int i = 0; i < nrdy; i++) {
+    struct pollfd* r = &sv->ev.rdy[i];
+
+    // >>> 1. process new client connections (drain the backlog)
+    if (r->fd == sv->lfd || r->fd == sv->wfd || r->fd == sv->tfd) {
+      if (r->revents & POLLIN) conaccept(sv, r->fd);
+      continue;
+    }
+
+    // >>> 2. broadcasts from other shards, shutdown signal
+    if (r->fd == sv->ib.rfd) {
+      xdrain(sv);
+      continue;
+    }
+    if (r->fd == sigfds[0]) {
+      sigrecv(sv);
+      continue;
+    }
+
+    // >>> 3. flush queued output, then process existing connections
+    if ((r->revents & POLLOUT) && conflush(sv, r->fd) == -1) {
+      continue;  // client removed
+    }
+    if (r->revents & (POLLIN | POLLHUP | POLLERR)) {
+      extcon(sv, r->fd);
+    }
+  }
+
+  joinflush(sv);  // one announcement for every client accepted above
+  trdrain(sv);    // one write per trunk for everything above
+  return 0;
+}
+
+#ifdef CCHAT_URING
+/** io_uring completion loop: multishot accept & recv feed the same
+ * conadd()/bcast()/conrm() paths as the readiness loop
+ * @param sv server state
+ * @return 0 shut down, -1 on fatal engine error */
+static int urun(struct srv* sv) {
+  if (uaccept(&sv->ur, sv->lfd) == -1) return -1;
+  if (sv->wfd != -1 && uaccept(&sv->ur, sv->wfd) == -1) return -1;
+  if (sv->tfd != -1 && uaccept(&sv->ur, sv->tfd) == -1) return -1;
+  if (upoll(&sv->ur, sigfds[0]) == -1) return -1;
+
+  while (1) {
+    int n = uwait(&sv->ur, shwait(sv));
+    if (n == -1) return -1;
+    tstick(&sv->clk);
+    sv->now = msnow();
+    if (sv->acmore && sv->now >= sv->acat) {
+      sv->acmore = false;
+      lstnwake(sv);
+    }
+
+    for (int i = 0; i < n; i++) {
+      struct uev* e = &sv->ur.evs[i];
+      if (ustale(&sv->ur, e)) {
+        // client removed earlier in this batch
+        urecycle(&sv->ur, e->bid);
+        continue;
+      }
+
+      if (e->op == U_POLL) {
+        sigrecv(sv);
+        upoll(&sv->ur, sigfds[0]);  // one-shot, watch for a second signal
+      } else if (e->op == U_DRAIN) {
+        udrain(sv, e->fd);
+      } else if (e->op == U_ACCEPT && e->fd < 0) {
+        // out of fds: the multishot accept ended, re-armed once a queued
+        // connection is refused or after the rest
+        if (conshed(sv, e->lfd) == 0 || errno == EAGAIN) {
+          lstnarm(sv, e->lfd, true);
+        }
+      } else if (e->op == U_ACCEPT) {
+        struct sockaddr_storage caddr;
+        socklen_t caddrlen = sizeof(caddr);
+        memset(&caddr, 0, sizeof(caddr));
+        getpeername(e->fd, (struct sockaddr*)&caddr, &caddrlen);
+        enum ckind kind = e->lfd == sv->wfd   ? CK_WS
+                          : e->lfd == sv->tfd ? CK_TRUNK
+                                              : CK_TCP;
+        if (conadd(sv, e->fd, &caddr, kind) == 0 &&
+            urecv(&sv->ur, e->fd) == -1) {
+          conrm(sv, e->fd, -1);
+        }
+      } else if (e->n > 0) {
+        conrecv(sv, e->fd, e->buf, e->n);
+        urecycle(&sv->ur, e->bid);
+      } else {
+        errno = -e->n;
+        conrm(sv, e->fd, e->n);
+      }
+    }
+    joinflush(sv);
+    trdrain(sv);
+    tmrrun(sv);
+    stpub(sv);
+    if (shstop(sv)) return 0;
+  }
+}
+#endif
+
+/** setup one shard: backend, fd array, listeners, inbox (and the signal
+ * pipe on shard 0)
+ * @param sv shard to init
+ * @param id shard index
+ * @param shards all shards
+ * @param n shard count
+ * @param be readiness backend
+ * @return 0 ok, -1 fail */
+static int shinit(struct srv* sv, int id, struct srv* shards, int n,
+                  enum evbe be) {
+  sv->id = id;
+  sv->shards = shards;
+  sv->nshards = n;
+  sv->lfd = -1;
+  sv->wfd = -1;
+  sv->tfd = -1;
+  sv->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  poolinit(&sv->cpool, "conn", sizeof(struct fdmap));
+  roomsinit(&sv->rooms, histn, histb);
+  sv->wq = wal.dir ? &wal.qs[id] : NULL;
+  sv->lq = elg.on ? &elg.qs[id] : NULL;
+  sv->now = msnow();
+  wheelinit(&sv->wh, sv->now);
+  poolinit(&sv->spool, "tsess", sizeof(struct tsess));
+  ibpinit(&sv->ip);
+
+  if (evinit(&sv->ev, be, be == EV_EPOLL ? MAXEVS : FDSINIT) == -1) {
+    fprintf(stderr, "evinit(%s): %s\n", evname(be), strerror(errno));
+    return -1;
+  }
+
+  // setup array of fd's for poll() (grows on demand) and add server to it
+  if (fdgrow(sv) == -1) return -1;
+
+  // every shard binds its own listener; SO_REUSEPORT lets the kernel
+  // spread incoming connections across them
+  if (lstnfd(HOSTNAME, PORT, true, n > 1, &sv->lfd) == -1) {
+    fprintf(stderr, "lstnfd: %s\n", strerror(errno));
+    return -1;
+  }
+  // browsers connect straight to the same loop (no bridge process)
+  if (wsport && lstnfd(HOSTNAME, (char*)wsport, true, n > 1, &sv->wfd) == -1) {
+    fprintf(stderr, "lstnfd(ws): %s\n", strerror(errno));
+    return -1;
+  }
+  // one connection per websocket gateway, carrying all of its browsers
+  if (trport && lstnfd(HOSTNAME, (char*)trport, true, n > 1, &sv->tfd) == -1) {
+    fprintf(stderr, "lstnfd(trunk): %s\n", strerror(errno));
+    return -1;
+  }
+  if (ibinit(&sv->ib) == -1) {
+    fprintf(stderr, "ibinit: %s\n", strerror(errno));
+    return -1;
+  }
+  if (fdadd(sv, sv->lfd, true) == -1 ||
+      (sv->wfd != -1 && fdadd(sv, sv->wfd, true) == -1) ||
+      (sv->tfd != -1 && fdadd(sv, sv->tfd, true) == -1) ||
+      fdadd(sv, sv->ib.rfd, true) == -1 ||
+      (id == 0 && fdadd(sv, sigfds[0], true) == -1)) {
+    fprintf(stderr, "fdadd: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/** shard reactor: wait for readiness, dispatch, repeat until shut down
+ * @param arg shard (struct srv*)
+ * @return NULL (fatal errors exit) */
+static void* shrun(void* arg) {
+  struct srv* sv = arg;
+
+  if (sv->cpu >= 0) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(sv->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+      fprintf(stderr, "shard %d: pin cpu %d: %s\n", sv->id, sv->cpu,
+              strerror(rc));
+    }
+#else
+    fprintf(stderr, "shard %d: cpu pinning not supported\n", sv->id);
+#endif
+  }
+
+#ifdef CCHAT_URING
+  if (sv->uring) {
+    if (urun(sv) == 0) return NULL;
+    fprintf(stderr, "io_uring: %s\n", strerror(errno));
+    exit(1);
+  }
+#endif
+
+  while (1) {
+    // fd's ready for IO, or the next timer
+    int nrdy = evwait(&sv->ev, sv->fds, sv->nfd, shwait(sv));
+    if (nrdy == -1) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "%s: %s\n", evname(sv->ev.be), strerror(errno));
+      exit(1);
+    }
+
+    tstick(&sv->clk);  // one clock read for every message this pass
+    sv->now = msnow();
+    proc(sv, nrdy);
+    tmrrun(sv);  // after the ready list: no stale entries for removed fds
+    stpub(sv);
+    if (shstop(sv)) break;
+  }
+  return NULL;
+}
+
+/** shard count from SHARDS (number or "auto" = online cpus)
+ * @return shard count, -1 invalid */
+static int shcount(void) {
+  const char* v = getenv("SHARDS");
+  if (!v || !*v) return 1;
+  if (strcmp(v, "auto") == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 ? (ncpu > MAXSHARDS ? MAXSHARDS : (int)ncpu) : 1;
+  }
+  char* end;
+  long n = strtol(v, &end, 10);
+  if (*end || n < 1 || n > MAXSHARDS) return -1;
+  return (int)n;
+}
+
+/** per shard cpu from SHARD_CPUS: unset = no pinning, "auto" = shard i on
+ * cpu i (mod online cpus), or a list "0,2,4" used round-robin
+ * @param shards all shards
+ * @param n shard count
+ * @return 0 ok, -1 invalid list */
+static int shcpus(struct srv* shards, int n) {
+  const char* v = getenv("SHARD_CPUS");
+  for (int i = 0; i < n; i++) shards[i].cpu = -1;
+  if (!v || !*v) return 0;
+
+  if (strcmp(v, "auto") == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < n; i++) shards[i].cpu = ncpu > 0 ? i % ncpu : i;
+    return 0;
+  }
+
+  int cpus[MAXSHARDS];
+  int ncpus = 0;
+  const char* p = v;
+  while (*p && ncpus < MAXSHARDS) {
+    char* end;
+    long c = strtol(p, &end, 10);
+    if (end == p || c < 0) return -1;
+    cpus[ncpus++] = (int)c;
+    p = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',') return -1;
+  }
+  if (ncpus == 0) return -1;
+  for (int i = 0; i < n; i++) shards[i].cpu = cpus[i % ncpus];
+  return 0;
+}
+
+/** read MAX_CLIENTS, make sure RLIMIT_NOFILE covers it (raising the soft
+ * limit when allowed, else clamping), and print the per-connection cost
+ * @param nsh shard count
+ * @return 0 ok, -1 invalid MAX_CLIENTS */
+static int cliconf(int nsh) {
+  const char* v = getenv("MAX_CLIENTS");
+  if (v && *v) {
+    char* end;
+    long n = strtol(v, &end, 10);
+    if (*end || n < 1 || n > 10000000) {
+      fprintf(stderr, "MAX_CLIENTS must be 1..10000000\n");
+      return -1;
+    }
+    maxcli = (int)n;
+  }
+
+  // stdio + per shard (listener, ws/trunk listeners, inbox, epoll) + clients
+  long sysfds = 3 + 5L * nsh + 16;
+  long lim = nofile(maxcli + sysfds);
+  if (lim < maxcli + sysfds) {
+    long fit = lim - sysfds > 0 ? lim - sysfds : 1;
+    fprintf(stderr,
+            "RLIMIT_NOFILE=%ld too low for MAX_CLIENTS=%d, clamping to %ld "
+            "(raise with ulimit -n)\n",
+            lim, maxcli, fit);
+    maxcli = (int)fit;
+  }
+
+  // table cost per connection; send queues only exist while backlogged
+  size_t tbl = sizeof(struct fdmap) + sizeof(struct pollfd) +
+               sizeof(uint8_t) + sizeof(struct fdmap*) /* slot arrays */ +
+               sizeof(int) * 2 /* target scratch + fd index */ +
+               sizeof(struct fdmap*) /* room member slot */ + nicksize();
+  size_t sq = sizeof(struct msg*) * SENDQLEN;
+  printf("max clients: %d | memory/conn: %zu B table + %zu B send ring "
+         "while backlogged (+ queued msgs <= %d B)\n",
+         maxcli, tbl, sq, sqhard);
+  return 0;
+}
+
+/** read a non-negative int setting from the environment
+ * @param name variable
+ * @param max largest accepted value
+ * @param v value (out, untouched when unset)
+ * @return 0 ok/unset, -1 invalid */
+static int envint(const char* name, long max, int* v) {
+  const char* s = getenv(name);
+  if (!s || !*s) return 0;
+  char* end;
+  long n = strtol(s, &end, 10);
+  if (*end || n < 0 || n > max) {
+    fprintf(stderr, "%s must be 0..%ld\n", name, max);
+    return -1;
+  }
+  *v = (int)n;
+  return 0;
+}
+
+/** read SLOW_POLICY / SENDQ_SOFT_BYTES / SENDQ_HARD_BYTES: what a full
+ * send queue does, and where a client starts counting as lagging
+ * @return 0 ok, -1 invalid */
+static int slowconf(void) {
+  const char* v = getenv("SLOW_POLICY");
+  if (v && *v) {
+    int k = 0;
+    while (k < SP_N && strcmp(v, slownames[k]) != 0) k++;
+    if (k == SP_N) {
+      fprintf(stderr, "SLOW_POLICY must be drop-newest, drop-oldest, "
+                      "coalesce or disconnect\n");
+      return -1;
+    }
+    slowpol = k;
+  }
+  if (envint("SENDQ_HARD_BYTES", SENDQSZ, &sqhard) == -1) return -1;
+  if (sqhard < MAXDATASIZE * 4) {
+    fprintf(stderr, "SENDQ_HARD_BYTES must be %d..%d\n", MAXDATASIZE * 4,
+            SENDQSZ);
+    return -1;
+  }
+  sqsoft = sqhard / 4;
+  if (envint("SENDQ_SOFT_BYTES", sqhard, &sqsoft) == -1) return -1;
+  sqlimit(sqhard);
+  printf("slow consumers: lagging over %d B queued, at %d B %s\n", sqsoft,
+         sqhard, slownames[slowpol]);
+  return 0;
+}
+
+/** read SCROLLBACK / SCROLLBACK_BYTES. replay goes through the joiner's
+ * send queue, so the ring never holds more than one queue takes
+ * @return 0 ok, -1 invalid */
+static int histconf(void) {
+  if (envint("SCROLLBACK", SENDQLEN, &histn) == -1) return -1;
+  if (envint("SCROLLBACK_BYTES", SENDQSZ, &histb) == -1) return -1;
+  if (histn == 0 || histb == 0) {
+    histn = 0;
+    printf("scrollback: off\n");
+  } else {
+    printf("scrollback: last %d messages, %d B\n", histn, histb);
+  }
+  return 0;
+}
+
+/** read HEARTBEAT_SEC / IDLE_TIMEOUT_SEC
+ * @return 0 ok, -1 invalid */
+static int tmrconf(void) {
+  int hb = HBSEC, idle = IDLESEC;
+  if (envint("HEARTBEAT_SEC", 86400, &hb) == -1) return -1;
+  if (envint("IDLE_TIMEOUT_SEC", 7 * 86400, &idle) == -1) return -1;
+  hbms = hb * 1000;
+  idlems = idle * 1000;
+  tmrms = hbms ? hbms : SEENMS;
+  char hbs[32] = "off", idles[32] = "off";
+  if (hb) snprintf(hbs, sizeof(hbs), "every %d s", hb);
+  if (idle) snprintf(idles, sizeof(idles), "after %d s", idle);
+  printf("heartbeat: %s, idle disconnect: %s\n", hbs, idles);
+  return 0;
+}
+
+/** read SHUTDOWN_DRAIN_MS and route SIGINT/SIGTERM into shard 0's loop
+ * through a self-pipe (the handler only writes a byte)
+ * @return 0 ok, -1 invalid or fail */
+static int sigconf(void) {
+  if (envint("SHUTDOWN_DRAIN_MS", 600000, &drainms) == -1) return -1;
+  if (pipe(sigfds) == -1) {
+    fprintf(stderr, "pipe: %s\n", strerror(errno));
+    return -1;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (fcntl(sigfds[i], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(sigfds[i], F_SETFD, FD_CLOEXEC) == -1) {
+      fprintf(stderr, "fcntl: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onsig;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGINT, &sa, NULL) == -1 ||
+      sigaction(SIGTERM, &sa, NULL) == -1) {
+    fprintf(stderr, "sigaction: %s\n", strerror(errno));
+    return -1;
+  }
+  printf("shutdown: SIGINT/SIGTERM flush queues for up to %d ms\n", drainms);
+  return 0;
+}
+
+/** read LOG_DIR / LOG_FSYNC_MS / LOG_SEGMENT_MB / LOG_SEGMENTS, recover
+ * the log and start its writer
+ * @param nsh shard count (one ring each)
+ * @return 0 ok (or off), -1 invalid or unusable */
+static int walconf(int nsh) {
+  const char* dir = getenv("LOG_DIR");
+  if (!dir || !*dir) {
+    printf("message log: off\n");
+    return 0;
+  }
+  int syncms = LOGSYNCMS, segmb = LOGSEGMB, keep = LOGKEEP;
+  if (envint("LOG_FSYNC_MS", 60000, &syncms) == -1) return -1;
+  if (envint("LOG_SEGMENT_MB", 1024, &segmb) == -1) return -1;
+  if (envint("LOG_SEGMENTS", 1000000, &keep) == -1) return -1;
+  if (segmb == 0) segmb = 1;
+
+  if (walopen(&wal, dir, (size_t)segmb << 20, syncms, keep, nsh) == -1) {
+    fprintf(stderr, "walopen(%s): %s\n", dir, strerror(errno));
+    return -1;
+  }
+  printf("message log: %s, %d MiB segments, keep %d, fsync %s", dir, segmb,
+         keep, syncms ? "every " : "off");
+  if (syncms) printf("%d ms", syncms);
+  printf(" | recovered %lu records in %d segments, next seq %llu",
+         wal.rrecs, wal.rsegs, (unsigned long long)wal.rseq);
+  if (wal.rtorn) printf(", %lu torn tails cut", wal.rtorn);
+  printf("\n");
+  return 0;
+}
+
+/** read EVENT_LOG / EVENT_LOG_LEVEL and start the event log writer
+ * @param nsh shard count (one ring each)
+ * @return 0 ok (or off), -1 invalid or unusable */
+static int elconf(int nsh) {
+  const char* lvs = getenv("EVENT_LOG_LEVEL");
+  enum ellvl min = EL_INFO;
+  if (lvs && *lvs && ellevel(lvs, &min) == -1) {
+    fprintf(stderr,
+            "EVENT_LOG_LEVEL must be debug, info, warn, error or off\n");
+    return -1;
+  }
+  const char* path = getenv("EVENT_LOG");
+  int fd = STDOUT_FILENO;
+  if (min != EL_OFF && path && *path && strcmp(path, "-") != 0) {
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+      return -1;
+    }
+  } else {
+    path = "stdout";
+  }
+  if (min == EL_OFF) {
+    printf("event log: off\n");
+  } else {
+    printf("event log: %s, level %s\n", path, lvs && *lvs ? lvs : "info");
+  }
+  if (elopen(&elg, evs, EV_N, min, fd, nsh) == -1) {
+    fprintf(stderr, "elopen: %s\n", strerror(errno));
+    if (fd != STDOUT_FILENO) close(fd);
+    return -1;
+  }
+  return 0;
+}
+
+/** render the stats endpoint's exposition (endpoint thread): per shard
+ * counters and gauges, fan-out latency and backlog histograms summed over
+ * shards, message pools and the message log
+ * @param b output
+ * @param arg shards (struct srv*) */
+static void strender(struct mtbuf* b, void* arg) {
+  static const char* ctrs[SC_N][2] = {
+      {"cchat_accepts_total", "Connections accepted."},
+      {"cchat_rejects_total",
+       "Connections and trunk sessions refused at MAX_CLIENTS."},
+      {"cchat_messages_in_total", "Lines and frames received from clients."},
+      {"cchat_bytes_in_total", "Bytes received (trunks: with framing)."},
+      {"cchat_messages_out_total",
+       "Deliveries, one per message per recipient."},
+      {"cchat_bytes_out_total", "Bytes of those deliveries."},
+      {"cchat_send_eagain_total",
+       "Sends the socket did not take whole; the rest was queued."},
+      {"cchat_send_drops_total",
+       "Messages dropped on full send queues (any SLOW_POLICY)."},
+      {"cchat_slow_consumers_total",
+       "Clients whose send queue crossed SENDQ_SOFT_BYTES."},
+      {"cchat_slow_disconnects_total",
+       "Slow consumers disconnected (SLOW_POLICY=disconnect)."},
+      {"cchat_uring_enters_total",
+       "io_uring_enter() calls (EVLOOP=uring); per message out, the "
+       "syscalls the engine saves."},
+  };
+  static const char* gauges[SG_POOL][2] = {
+      {"cchat_connections", "Connections in the table (clients, trunks)."},
+      {"cchat_trunk_sessions", "Browser sessions on gateway trunks."},
+      {"cchat_backlogged_connections",
+       "Connections with output waiting for the socket."},
+      {"cchat_timers", "Armed connection timers."},
+      {"cchat_lagging_clients",
+       "Clients with more than SENDQ_SOFT_BYTES queued."},
+  };
+  static const char* pools[3][2] = {
+      {"cchat_pool_live", "Records in use."},
+      {"cchat_pool_hwm", "Most records in use at once."},
+      {"cchat_pool_bytes", "Bytes held from malloc."},
+  };
+  static const char* pnames[2] = {"conn", "tsess"};
+  struct srv* shards = arg;
+  int n = shards[0].nshards;
+
+  for (int k = 0; k < SC_N; k++) {
+    mthead(b, ctrs[k][0], "counter", ctrs[k][1]);
+    for (int i = 0; i < n; i++) {
+      mtprintf(b, "%s{shard=\"%d\"} %ld\n", ctrs[k][0], i,
+               atomic_load_explicit(&shards[i].st.c[k], memory_order_relaxed));
+    }
+  }
+  for (int k = 0; k < SG_POOL; k++) {
+    mthead(b, gauges[k][0], "gauge", gauges[k][1]);
+    for (int i = 0; i < n; i++) {
+      mtprintf(b, "%s{shard=\"%d\"} %ld\n", gauges[k][0], i,
+               atomic_load_explicit(&shards[i].st.g[k], memory_order_relaxed));
+    }
+  }
+  mthead(b, "cchat_clients", "gauge",
+         "Clients counted against MAX_CLIENTS, all shards.");
+  mtprintf(b, "cchat_clients %d\n", atomic_load(&nclients));
+  mthead(b, "cchat_max_clients", "gauge", "MAX_CLIENTS.");
+  mtprintf(b, "cchat_max_clients %d\n", maxcli);
+
+  struct mthist* hs[MAXSHARDS];
+  for (int i = 0; i < n; i++) hs[i] = &shards[i].st.fan;
+  mthistout(b, "cchat_fanout_seconds",
+            "Time from recv() of a message to its last send on a shard, "
+            "one sample per shard it reaches.",
+            hs, n, 1e-6);
+  for (int i = 0; i < n; i++) hs[i] = &shards[i].st.qlen;
+  mthistout(b, "cchat_send_backlog_bytes",
+            "Bytes left queued when a send stopped short.", hs, n, 1);
+  for (int i = 0; i < n; i++) hs[i] = &shards[i].st.lag;
+  mthistout(b, "cchat_client_lag_seconds",
+            "How long a client stayed over SENDQ_SOFT_BYTES, until it "
+            "caught up or left.",
+            hs, n, 1e-3);
+
+  // connection pools per shard; message pools are process wide
+  for (int f = 0; f < 3; f++) {
+    mthead(b, pools[f][0], "gauge", pools[f][1]);
+    for (int i = 0; i < n; i++) {
+      for (int p = 0; p < 2; p++) {
+        long v = atomic_load_explicit(&shards[i].st.g[SG_POOL + p * 3 + f],
+                                      memory_order_relaxed);
+        mtprintf(b, "%s{pool=\"%s\",shard=\"%d\"} %ld\n", pools[f][0],
+                 pnames[p], i, v);
+      }
+    }
+    struct poolstat ms[MSGNCLS + 1];
+    msgstats(ms);
+    for (int k = 0; k <= MSGNCLS; k++) {
+      long v = f == 0 ? ms[k].live : f == 1 ? ms[k].hwm : ms[k].bytes;
+      mtprintf(b, "%s{pool=\"%s\"} %ld\n", pools[f][0], ms[k].name, v);
+    }
+  }
+
+  if (wal.dir) {
+    struct walstat ws;
+    walstat(&wal, &ws);
+    unsigned long v[4] = {ws.records, ws.bytes, ws.syncs, ws.drops};
+    static const char* wnames[4][2] = {
+        {"cchat_log_records_total", "Records appended to the message log."},
+        {"cchat_log_bytes_total", "Payload bytes appended."},
+        {"cchat_log_syncs_total", "Group commits."},
+        {"cchat_log_drops_total", "Records dropped on full log rings."},
+    };
+    for (int k = 0; k < 4; k++) {
+      mthead(b, wnames[k][0], "counter", wnames[k][1]);
+      mtprintf(b, "%s %lu\n", wnames[k][0], v[k]);
+    }
+  }
+
+  if (elg.on) {
+    mthead(b, "cchat_event_log_drops_total", "counter",
+           "Events dropped on full event log rings.");
+    mtprintf(b, "cchat_event_log_drops_total %lu\n", eldrops(&elg));
+  }
+}
+
+/** read METRICS_PORT and start the stats endpoint (after the shards are
+ * set up: it reads them)
+ * @param shards all shards
+ * @return 0 ok (or off), -1 fail */
+static int stconf(struct srv* shards) {
+  mtport = getenv("METRICS_PORT");
+  if (!mtport || !*mtport || strcmp(mtport, "off") == 0) {
+    mtport = NULL;
+    printf("metrics: off\n");
+    return 0;
+  }
+  int fd;
+  if (lstnfd(HOSTNAME, (char*)mtport, true, false, &fd) == -1) {
+    fprintf(stderr, "lstnfd(metrics): %s\n", strerror(errno));
+    return -1;
+  }
+  if (mtstart(&mts, fd, strender, shards) == -1) {
+    fprintf(stderr, "mtstart: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  printf("metrics: http://%s:%s/metrics\n", HOSTNAME, mtport);
+  return 0;
+}
+
+// benchmarks compile this file in for its hot path functions and bring
+// their own main (bench/hotbench.c)
+#ifndef CCHAT_NOMAIN
+int main() {
+  int rstat = 0;
+
+  // a peer closing mid-send must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  int nsh = shcount();
+  if (nsh == -1) {
+    fprintf(stderr, "SHARDS must be 1..%d or auto\n", MAXSHARDS);
+    return -1;
+  }
+  if (slowconf() == -1) return -1;
+  if (cliconf(nsh) == -1) return -1;
+  if (histconf() == -1) return -1;
+  if (tmrconf() == -1) return -1;
+  if (sigconf() == -1) return -1;
+  if (roominit() == -1) return -1;
+
+  // native websocket listener (WS_PORT, e.g. 8080); off by default so it
+  // doesn't collide with the node bridge
+  wsport = getenv("WS_PORT");
+  if (wsport && !*wsport) wsport = NULL;
+
+  // gateway trunk listener (TRUNK_PORT, default 3491, empty or "off" = off)
+  trport = getenv("TRUNK_PORT") ? getenv("TRUNK_PORT") : TRPORT;
+  if (!*trport || strcmp(trport, "off") == 0) trport = NULL;
+
+  struct srv* shards = calloc(nsh, sizeof(*shards));
+  if (!shards) return -1;
+  if (shcpus(shards, nsh) == -1) {
+    fprintf(stderr, "SHARD_CPUS must be auto or a list like 0,2,4\n");
+    return -1;
+  }
+
+  // pick readiness backend
+  enum evbe be;
+  const char* bename = getenv("EVLOOP") ? getenv("EVLOOP") : EVDEFAULT;
+  if (strcmp(bename, "uring") == 0) {
+#ifdef CCHAT_URING
+    // completion engine; the readiness loop stays idle (poll = no-op ctl)
+    if (nsh != 1) {
+      fprintf(stderr, "EVLOOP=uring runs a single shard (SHARDS=1)\n");
+      return -1;
+    }
+    if (uinit(&shards[0].ur) == -1) {
+      fprintf(stderr, "uinit: %s\n", strerror(errno));
+      return -1;
+    }
+    shards[0].uring = true;
+    shards[0].ur.qlim = sqhard;  // SLOW_POLICY applies past it
+    bename = "poll";
+#else
+    fprintf(stderr, "EVLOOP=uring needs an io_uring build (make build-uring)\n");
+    return -1;
+#endif
+  }
+  if (evparse(bename, &be) == -1) {
+    fprintf(stderr, "unknown EVLOOP backend: %s\n", bename);
+    return -1;
+  }
+#ifdef CCHAT_URING
+  printf("event backend: %s, shards: %d\n",
+         shards[0].uring ? "io_uring" : evname(be), nsh);
+#else
+  printf("event backend: %s, shards: %d\n", evname(be), nsh);
+#endif
+  if (wsport) {
+    enum simdlvl lvl = simdinit();
+    printf("websocket: ws://%s:%s%s (%s kernels)\n", HOSTNAME, wsport, WSPATH,
+           simdname(lvl));
+  }
+  if (trport) printf("gateway trunk: %s:%s\n", HOSTNAME, trport);
+  if (walconf(nsh) == -1) return -1;
+  if (elconf(nsh) == -1) return -1;
+
+  for (int i = 0; i < nsh; i++) {
+    if (shinit(&shards[i], i, shards, nsh, be) == -1) return -1;
+  }
+  if (stconf(shards) == -1) return -1;
+  fflush(stdout);  // startup lines go out before the event log's
+
+  // shard 0 runs on the main thread
+  for (int i = 1; i < nsh; i++) {
+    int rc = pthread_create(&shards[i].tid, NULL, shrun, &shards[i]);
+    if (rc != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+      return -1;
+    }
+  }
+  shards[0].tid = pthread_self();
+  shrun(&shards[0]);
+  for (int i = 1; i < nsh; i++) pthread_join(shards[i].tid, NULL);
+  if (mtport) mtstop(&mts);
 
   // cleanup
-  if (fds) free(fds);
+  for (int i = 0; i < nsh; i++) {
+    struct srv* sv = &shards[i];
+    if (sv->fds) free(sv->fds);
+    free(sv->kinds);
+    free(sv->cons);
+    free(sv->tgt);
+    free(sv->fdix);
+    free(sv->sids);
+    free(sv->sidfree);
+    evfree(&sv->ev);
+    ibfree(&sv->ib);
+    roomsfree(&sv->rooms);
+    poolfree(&sv->cpool);
+    poolfree(&sv->spool);
+    if (sv->lfd != -1) close(sv->lfd);
+    if (sv->wfd != -1) close(sv->wfd);
+    if (sv->tfd != -1) close(sv->tfd);
+    if (sv->spare != -1) close(sv->spare);
+#ifdef CCHAT_URING
+    if (sv->uring) ufree(&sv->ur);
+#endif
+  }
+  // inbox nodes go back to the shard that posted them: free the pools once
+  // every inbox is drained
+  for (int i = 0; i < nsh; i++) ibpfree(&shards[i].ip);
+  free(shards);
+  walclose(&wal);
+  elclose(&elg);
+  if (elg.fd != STDOUT_FILENO) close(elg.fd);
+  close(sigfds[0]);
+  close(sigfds[1]);
 
   printf("\nClosing connection.\n");
-  if (lsock) close(lsock);
 
   return rstat;
 }
+#endif  // CCHAT_NOMAIN
@@ -0,0 +1,291 @@
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/** scalar: one UTF-8 sequence at p
+ * @return sequence length, 0 invalid or truncated */
+static int u8seq(const uint8_t* p, uint64_t n) {
+  uint8_t c = p[0];
+  if (c < 0x80) return 1;
+  int k;
+  uint32_t cp, min;
+  if ((c & 0xE0) == 0xC0) {
+    k = 1, cp = c & 0x1F, min = 0x80;
+  } else if ((c & 0xF0) == 0xE0) {
+    k = 2, cp = c & 0x0F, min = 0x800;
+  } else if ((c & 0xF8) == 0xF0) {
+    k = 3, cp = c & 0x07, min = 0x10000;
+  } else {
+    return 0;
+  }
+  if (n <= (uint64_t)k) return 0;
+  for (int j = 1; j <= k; j++) {
+    if ((p[j] & 0xC0) != 0x80) return 0;
+    cp = cp << 6 | (p[j] & 0x3F);
+  }
+  if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+  return k + 1;
+}
+
+uint64_t utf8len(const uint8_t* p, uint64_t n) {
+  uint64_t i = 0;
+  while (i < n) {
+    int k = u8seq(p + i, n - i);
+    if (k == 0) return i;
+    i += k;
+  }
+  return n;
+}
+
+static bool utf8scalar(const uint8_t* p, uint64_t n) {
+  return utf8len(p, n) == n;
+}
+
+/** scalar unmask, 8 bytes per step */
+static void unmaskscalar(uint8_t* p, uint64_t n, const uint8_t key[4]) {
+  uint64_t i = 0;
+  if (n >= 8) {
+    uint8_t kk[8];
+    memcpy(kk, key, 4);
+    memcpy(kk + 4, key, 4);
+    uint64_t k;
+    memcpy(&k, kk, 8);
+    for (; i + 8 <= n; i += 8) {
+      uint64_t w;
+      memcpy(&w, p + i, 8);
+      w ^= k;
+      memcpy(p + i, &w, 8);
+    }
+  }
+  for (; i < n; i++) p[i] ^= key[i & 3];
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse2"))) static void unmasksse2(uint8_t* p,
+                                                        uint64_t n,
+                                                        const uint8_t key[4]) {
+  int32_t k;
+  memcpy(&k, key, 4);
+  __m128i kv = _mm_set1_epi32(k);
+  uint64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+    _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(v, kv));
+  }
+  unmaskscalar(p + i, n - i, key);
+}
+
+__attribute__((target("avx2"))) static void unmaskavx2(uint8_t* p,
+                                                        uint64_t n,
+                                                        const uint8_t key[4]) {
+  int32_t k;
+  memcpy(&k, key, 4);
+  __m256i kv = _mm256_set1_epi32(k);
+  uint64_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+    _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(a, kv));
+    _mm256_storeu_si256((__m256i*)(p + i + 32), _mm256_xor_si256(b, kv));
+  }
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+    _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(a, kv));
+  }
+  if (i + 16 <= n) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+    _mm_storeu_si128((__m128i*)(p + i),
+                     _mm_xor_si128(a, _mm256_castsi256_si128(kv)));
+    i += 16;
+  }
+  // inline, a call into non-VEX code with dirty ymm state stalls
+  for (; i < n; i++) p[i] ^= key[i & 3];
+}
+
+/** sse2: skip ASCII 16 bytes at a time, decode the rest with the scalar
+ * sequence check (chat text is mostly ASCII) */
+__attribute__((target("sse2"))) static bool utf8sse2(const uint8_t* p,
+                                                      uint64_t n) {
+  uint64_t i = 0;
+  while (i < n) {
+    if (n - i >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+      int m = _mm_movemask_epi8(v);
+      if (m == 0) {
+        i += 16;
+        continue;
+      }
+      i += __builtin_ctz(m);
+    } else if (p[i] < 0x80) {
+      i++;
+      continue;
+    }
+    int k = u8seq(p + i, n - i);
+    if (k == 0) return false;
+    i += k;
+  }
+  return true;
+}
+
+// avx2: the lookup validator of Keiser & Lemire ("Validating UTF-8 in less
+// than one instruction per byte", 2021). three nibble tables classify each
+// byte pair; AND-ing them leaves a bit set only for an error, and 3rd/4th
+// continuation bytes are checked against the lead bytes 2 and 3 back
+#define U8_SHORT (1 << 0)   // lead or ASCII followed by a lead or ASCII
+#define U8_LONG (1 << 1)    // ASCII followed by a continuation
+#define U8_OVER3 (1 << 2)   // 11100000 100_____
+#define U8_LARGE (1 << 3)   // past U+10FFFF
+#define U8_SURR (1 << 4)    // 11101101 101_____
+#define U8_OVER2 (1 << 5)   // 1100000_ 10______
+#define U8_L1000 (1 << 6)   // past U+10FFFF, 1000____ second byte
+#define U8_OVER4 (1 << 6)   // 11110000 1000____
+#define U8_2CONT (1 << 7)   // continuation followed by a continuation
+#define U8_CARRY (U8_SHORT | U8_LONG | U8_2CONT)
+
+#define TBL16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+/** bytes of the previous block shifted in front of this one, by k */
+#define PREV(in, prev, k) \
+  _mm256_alignr_epi8(in, _mm256_permute2x128_si256(prev, in, 0x21), 16 - (k))
+
+/** high nibble of each byte */
+__attribute__((target("avx2"))) static __m256i hinib(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+/** error bits for one 32 byte block following prev */
+__attribute__((target("avx2"))) static __m256i u8blk(__m256i in,
+                                                      __m256i prev) {
+  const __m256i b1hi = TBL16(
+      U8_LONG, U8_LONG, U8_LONG, U8_LONG, U8_LONG, U8_LONG, U8_LONG, U8_LONG,
+      U8_2CONT, U8_2CONT, U8_2CONT, U8_2CONT, U8_SHORT | U8_OVER2, U8_SHORT,
+      U8_SHORT | U8_OVER3 | U8_SURR,
+      U8_SHORT | U8_LARGE | U8_L1000 | U8_OVER4);
+  const __m256i b1lo = TBL16(
+      U8_CARRY | U8_OVER3 | U8_OVER2 | U8_OVER4, U8_CARRY | U8_OVER2, U8_CARRY,
+      U8_CARRY, U8_CARRY | U8_LARGE, U8_CARRY | U8_LARGE | U8_L1000,
+      U8_CARRY | U8_LARGE | U8_L1000, U8_CARRY | U8_LARGE | U8_L1000,
+      U8_CARRY | U8_LARGE | U8_L1000, U8_CARRY | U8_LARGE | U8_L1000,
+      U8_CARRY | U8_LARGE | U8_L1000, U8_CARRY | U8_LARGE | U8_L1000,
+      U8_CARRY | U8_LARGE | U8_L1000,
+      U8_CARRY | U8_LARGE | U8_L1000 | U8_SURR,
+      U8_CARRY | U8_LARGE | U8_L1000, U8_CARRY | U8_LARGE | U8_L1000);
+  const __m256i b2hi = TBL16(
+      U8_SHORT, U8_SHORT, U8_SHORT, U8_SHORT, U8_SHORT, U8_SHORT, U8_SHORT,
+      U8_SHORT,
+      U8_LONG | U8_OVER2 | U8_2CONT | U8_OVER3 | U8_L1000 | U8_OVER4,
+      U8_LONG | U8_OVER2 | U8_2CONT | U8_OVER3 | U8_LARGE,
+      U8_LONG | U8_OVER2 | U8_2CONT | U8_SURR | U8_LARGE,
+      U8_LONG | U8_OVER2 | U8_2CONT | U8_SURR | U8_LARGE, U8_SHORT, U8_SHORT,
+      U8_SHORT, U8_SHORT);
+
+  __m256i p1 = PREV(in, prev, 1);
+  __m256i sc = _mm256_and_si256(
+      _mm256_and_si256(_mm256_shuffle_epi8(b1hi, hinib(p1)),
+                       _mm256_shuffle_epi8(
+                           b1lo, _mm256_and_si256(p1, _mm256_set1_epi8(0x0F)))),
+      _mm256_shuffle_epi8(b2hi, hinib(in)));
+
+  // bytes 2/3 after a 3/4 byte lead must be continuations (0x80 set in sc)
+  __m256i p2 = PREV(in, prev, 2), p3 = PREV(in, prev, 3);
+  __m256i third = _mm256_subs_epu8(p2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(p3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+  __m256i must = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                  _mm256_set1_epi8((char)0x80));
+  return _mm256_xor_si256(must, sc);
+}
+
+__attribute__((target("avx2"))) static bool utf8avx2(const uint8_t* p,
+                                                      uint64_t n) {
+  // a lead byte in the last 1/2/3 positions needs the next block
+  const __m256i incmax = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0 - 1),
+      (char)(0xE0 - 1), (char)(0xC0 - 1));
+  if (n < 32) return utf8sse2(p, n);  // not worth a padded block
+
+  __m256i err = _mm256_setzero_si256(), prev = err, inc = err;
+  uint8_t tail[32];
+
+  for (uint64_t i = 0; i < n; i += 32) {
+    __m256i in;
+    if (n - i >= 32) {
+      in = _mm256_loadu_si256((const __m256i*)(p + i));
+    } else {
+      memset(tail, 0, sizeof(tail));  // zero padding is ASCII
+      memcpy(tail, p + i, n - i);
+      in = _mm256_loadu_si256((const __m256i*)tail);
+    }
+    if (_mm256_movemask_epi8(in) == 0) {
+      err = _mm256_or_si256(err, inc);
+      inc = _mm256_setzero_si256();
+    } else {
+      err = _mm256_or_si256(err, u8blk(in, prev));
+      inc = _mm256_subs_epu8(in, incmax);
+    }
+    prev = in;
+  }
+  err = _mm256_or_si256(err, inc);
+  return _mm256_testz_si256(err, err);
+}
+
+#endif  // SIMD_X86
+
+static const struct kern {
+  const char* name;
+  void (*unmask)(uint8_t* p, uint64_t n, const uint8_t key[4]);
+  bool (*utf8)(const uint8_t* p, uint64_t n);
+} kerns[SIMD_NLVL] = {
+    {"scalar", unmaskscalar, utf8scalar},
+#ifdef SIMD_X86
+    {"sse2", unmasksse2, utf8sse2},
+    {"avx2", unmaskavx2, utf8avx2},
+#else
+    {"sse2", NULL, NULL},
+    {"avx2", NULL, NULL},
+#endif
+};
+
+static const struct kern* kern = &kerns[SIMD_SCALAR];
+
+enum simdlvl simdmax(void) {
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+  return SIMD_SCALAR;
+}
+
+const char* simdname(enum simdlvl lvl) {
+  return lvl < SIMD_NLVL ? kerns[lvl].name : "?";
+}
+
+int simdset(enum simdlvl lvl) {
+  if (lvl >= SIMD_NLVL || lvl > simdmax()) return -1;
+  kern = &kerns[lvl];
+  return 0;
+}
+
+enum simdlvl simdinit(void) {
+  enum simdlvl lvl = simdmax();
+  const char* s = getenv("SIMD");
+  for (int i = 0; s && i < (int)lvl; i++) {
+    if (strcmp(s, kerns[i].name) == 0) lvl = i;
+  }
+  simdset(lvl);
+  return lvl;
+}
+
+void unmask(uint8_t* p, uint64_t n, const uint8_t key[4]) {
+  kern->unmask(p, n, key);
+}
+
+bool utf8ok(const uint8_t* p, uint64_t n) { return kern->utf8(p, n); }
@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// vector kernels for the websocket hot path: payload unmasking and UTF-8
+// validation. SSE2 and AVX2 versions are picked at run time from cpu
+// features (SIMD env can force a lower level); other cpus use scalar.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum simdlvl { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NLVL };
+
+/** select the best kernels this cpu supports. SIMD=scalar|sse2|avx2 caps
+ * the level (handy for comparisons); until called, scalar kernels run
+ * @return level in use */
+enum simdlvl simdinit(void);
+
+/** force a kernel level
+ * @param lvl level
+ * @return 0 ok, -1 not supported by this cpu/build */
+int simdset(enum simdlvl lvl);
+
+/** best level this cpu/build supports */
+enum simdlvl simdmax(void);
+
+/** level name ("scalar", "sse2", "avx2") */
+const char* simdname(enum simdlvl lvl);
+
+/** XOR a websocket payload with its masking key, in place
+ * @param p payload (any alignment)
+ * @param n payload bytes
+ * @param key masking key (applied from payload byte 0) */
+void unmask(uint8_t* p, uint64_t n, const uint8_t key[4]);
+
+/** check bytes are well-formed UTF-8 (no overlongs, surrogates or code
+ * points past U+10FFFF)
+ * @param p bytes
+ * @param n byte count
+ * @return true valid */
+bool utf8ok(const uint8_t* p, uint64_t n);
+
+/** scalar: length of the valid UTF-8 prefix
+ * @param p bytes
+ * @param n byte count
+ * @return bytes before the first invalid sequence (n if all valid) */
+uint64_t utf8len(const uint8_t* p, uint64_t n);
+
+#endif  // SIMD_H
@@ -0,0 +1,165 @@
+#include "trunk.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // SIGPIPE is ignored in main() instead
+#endif
+
+#define TROUTINIT 4096  // first output allocation (doubles)
+
+void trinit(struct trunk* t) {
+  memset(t, 0, sizeof(*t));
+  t->credoff = -1;
+}
+
+/** decode a header */
+static void trhdr(const uint8_t* p, struct trfrm* f) {
+  f->type = p[0];
+  f->len = (int)p[2] << 8 | p[3];
+  f->ch = trget32(p + 4);
+}
+
+int trnext(struct trunk* t, const char** data, int* n, struct trfrm* f) {
+  const uint8_t* p = (const uint8_t*)*data;
+
+  if (t->inlen == 0) {
+    // whole frame inside this read: no copy
+    if (*n >= TRHDR) {
+      trhdr(p, f);
+      if (*n >= TRHDR + f->len) {
+        f->pl = p + TRHDR;
+        *data += TRHDR + f->len;
+        *n -= TRHDR + f->len;
+        return 1;
+      }
+    }
+    if (*n == 0) return 0;
+  }
+
+  // partial frame: carry it (header first, then as much payload as needed)
+  if (!t->in) {
+    t->in = malloc(TRHDR + TRMAXPL);
+    if (!t->in) return -1;
+  }
+  int need = TRHDR;
+  if (t->inlen >= TRHDR) need += (int)t->in[2] << 8 | t->in[3];
+  while (*n > 0) {
+    int take = need - t->inlen < *n ? need - t->inlen : *n;
+    memcpy(t->in + t->inlen, *data, take);
+    t->inlen += take;
+    *data += take;
+    *n -= take;
+    if (t->inlen == TRHDR && need == TRHDR) {
+      need += (int)t->in[2] << 8 | t->in[3];
+    }
+    if (t->inlen == need) {
+      trhdr(t->in, f);
+      f->pl = t->in + TRHDR;
+      t->inlen = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** make room for len more output bytes
+ * @return 0 ok, -1 over TROUTMAX (ENOBUFS) or out of memory */
+static int trroom(struct trunk* t, int len) {
+  if (t->outlen + len <= t->outcap) return 0;
+  if (t->outoff > 0) {
+    // reclaim what was already written before growing
+    memmove(t->out, t->out + t->outoff, t->outlen - t->outoff);
+    t->outlen -= t->outoff;
+    t->credoff = t->credoff >= t->outoff ? t->credoff - t->outoff : -1;
+    t->outoff = 0;
+    if (t->outlen + len <= t->outcap) return 0;
+  }
+  if (t->outlen + len > TROUTMAX) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  int cap = t->outcap ? t->outcap : TROUTINIT;
+  while (cap < t->outlen + len) cap *= 2;
+  char* out = realloc(t->out, cap);
+  if (!out) return -1;
+  t->out = out;
+  t->outcap = cap;
+  return 0;
+}
+
+uint8_t* trframe(struct trunk* t, int type, uint32_t ch, int len) {
+  if (trroom(t, TRHDR + len) == -1) return NULL;
+  uint8_t* h = (uint8_t*)t->out + t->outlen;
+  h[0] = type;
+  h[1] = 0;
+  h[2] = len >> 8;
+  h[3] = len;
+  trput32(h + 4, ch);
+  t->outlen += TRHDR + len;
+  t->credoff = -1;  // later credits need a frame of their own
+  return h + TRHDR;
+}
+
+int trcredit(struct trunk* t, uint32_t ch, uint32_t bytes) {
+  uint8_t* p;
+  if (t->credoff >= t->outoff) {  // open and its header not sent yet
+    uint8_t* h = (uint8_t*)t->out + t->credoff;
+    int len = (int)h[2] << 8 | h[3];
+    if (len + 8 <= TRMAXPL) {
+      if (trroom(t, 8) == -1) return -1;
+      h = (uint8_t*)t->out + t->credoff;  // out may have moved
+      len += 8;
+      h[2] = len >> 8;
+      h[3] = len;
+      p = (uint8_t*)t->out + t->outlen;
+      t->outlen += 8;
+      trput32(p, ch);
+      trput32(p + 4, bytes);
+      return 0;
+    }
+  }
+  if (!(p = trframe(t, TR_CREDIT, 0, 8))) return -1;
+  t->credoff = (int)((char*)p - TRHDR - t->out);
+  trput32(p, ch);
+  trput32(p + 4, bytes);
+  return 0;
+}
+
+int trflush(struct trunk* t, int fd) {
+  while (t->outoff < t->outlen) {
+    ssize_t n = send(fd, t->out + t->outoff, t->outlen - t->outoff,
+                     MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return -1;
+    }
+    t->outoff += n;
+  }
+  if (t->outoff == t->outlen) {
+    t->outoff = t->outlen = 0;
+    t->credoff = -1;
+  }
+  return t->outlen - t->outoff;
+}
+
+struct msg* trtake(struct trunk* t) {
+  int len = t->outlen - t->outoff;
+  if (len == 0) return NULL;
+  struct msg* m = msgnew(len);
+  if (!m) return NULL;
+  memcpy(m->data, t->out + t->outoff, len);
+  t->outoff = t->outlen = 0;
+  t->credoff = -1;
+  return m;
+}
+
+void trfree(struct trunk* t) {
+  free(t->in);
+  free(t->out);
+  trinit(t);
+}
@@ -0,0 +1,110 @@
+#ifndef TRUNK_H
+#define TRUNK_H
+
+// trunk: one TCP connection from a websocket gateway (bridge/bridge.js)
+// carrying many browser sessions. every frame is an 8 byte header
+//   u8 type | u8 0 | u16 payload length | u32 channel id   (big endian)
+// followed by the payload. the gateway opens, feeds and closes channels;
+// the server answers per channel or once per broadcast for the whole
+// trunk. each side may have at most TRWIN payload bytes in flight per
+// channel and returns window with TR_CREDIT as it consumes them, so one
+// slow browser never holds up the others. frames are batched: everything
+// produced in one loop pass leaves in one write. protocol only; the event
+// loop feeds bytes in and acts on the frames.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "msg.h"
+
+#define TRHDR 8               // frame header bytes
+#define TRMAXPL 65535         // max payload bytes per frame
+#define TRWIN 65536           // per channel window (payload bytes in flight)
+#define TROUTMAX (16 << 20)   // unsent output before the gateway is dropped
+
+// frame types
+enum {
+  TR_OPEN = 1,  // gw->srv: new session on ch, payload = peer address text
+  TR_DATA,      // both: session bytes (gw->srv newline framed chat input)
+  TR_CLOSE,     // both: session over, srv->gw payload = reason text
+  TR_CREDIT,    // both: window back, payload = {u32 ch, u32 bytes} pairs
+                // (none = srv->gw heartbeat)
+  TR_BCAST      // srv->gw: payload = u16 n, u32 skip[n], message; deliver
+                // to every session on the trunk not in skip
+};
+
+// decoded frame; payload points into the received data or the carry buffer
+struct trfrm {
+  uint8_t type;
+  uint32_t ch;
+  const uint8_t* pl;
+  int len;
+};
+
+// per trunk connection: inbound reassembly and batched outbound frames
+struct trunk {
+  uint8_t* in;   // partial frame carried between reads (lazily allocated)
+  int inlen;     // bytes carried
+  char* out;     // frames not yet written
+  int outlen;    // bytes in out
+  int outoff;    // bytes of out already written
+  int outcap;    // out allocation
+  int credoff;   // open TR_CREDIT frame at the end of out, -1 = none
+};
+
+/** reset a trunk
+ * @param t trunk */
+void trinit(struct trunk* t);
+
+/** pull the next complete frame out of received data. consumes from
+ * (*data, *n); frames that fit in data are returned in place. a returned
+ * frame is valid until the next call
+ * @param t trunk
+ * @param data received bytes (advanced)
+ * @param n received byte count (decremented)
+ * @param f frame (out)
+ * @return 1 frame, 0 data used up, -1 out of memory */
+int trnext(struct trunk* t, const char** data, int* n, struct trfrm* f);
+
+/** append a frame header and reserve its payload
+ * @param t trunk
+ * @param type frame type
+ * @param ch channel id
+ * @param len payload bytes (<= TRMAXPL)
+ * @return payload to fill in, NULL over TROUTMAX or out of memory */
+uint8_t* trframe(struct trunk* t, int type, uint32_t ch, int len);
+
+/** return window for a channel; consecutive credits share one frame
+ * @param t trunk
+ * @param ch channel id
+ * @param bytes window returned
+ * @return 0 ok, -1 over TROUTMAX or out of memory */
+int trcredit(struct trunk* t, uint32_t ch, uint32_t bytes);
+
+/** write out batched frames
+ * @param t trunk
+ * @param fd trunk fd
+ * @return bytes still pending, -1 hard error */
+int trflush(struct trunk* t, int fd);
+
+/** take the batched frames as one message (for engines that send on
+ * their own); the trunk starts a new batch
+ * @param t trunk
+ * @return frames (ref = 1) or NULL when empty or out of memory */
+struct msg* trtake(struct trunk* t);
+
+/** release both buffers
+ * @param t trunk */
+void trfree(struct trunk* t);
+
+/** big endian helpers for frame payloads */
+static inline uint32_t trget32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static inline void trput32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+#endif  // TRUNK_H
@@ -0,0 +1,560 @@
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BGID 1  // provided buffer group id
+
+// user_data layout: op(8) | gen(24) | fd or send index(32)
+#define UDATA(op, gen, v) \
+  (((uint64_t)(op) << 56) | ((uint64_t)((gen)&0xffffff) << 32) | (uint32_t)(v))
+#define UDOP(ud) ((enum uop)((ud) >> 56))
+#define UDGEN(ud) ((unsigned)(((ud) >> 32) & 0xffffff))
+#define UDVAL(ud) ((int)(uint32_t)(ud))
+
+static int ursetup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int urenter(int fd, unsigned nsub, unsigned minc, unsigned flags,
+                   void* arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, nsub, minc, flags, arg, argsz);
+}
+
+static int urreg(int fd, unsigned op, void* arg, unsigned nargs) {
+  return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+/** add provided buffer bid to the tail of the buffer ring */
+static void brput(struct uring* u, int bid) {
+  struct io_uring_buf* b = &u->br->bufs[u->brtail & (UNBUF - 1)];
+  b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * (UBUFSZ + 1));
+  b->len = UBUFSZ;
+  b->bid = bid;
+  u->brtail++;
+  __atomic_store_n(&u->br->tail, u->brtail, __ATOMIC_RELEASE);
+}
+
+/** map rings & register the provided buffer ring */
+static int umap(struct uring* u, struct io_uring_params* p) {
+  u->sqmapsz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  u->cqmapsz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cqmapsz > u->sqmapsz) u->sqmapsz = u->cqmapsz;
+    u->cqmapsz = u->sqmapsz;
+  }
+
+  u->sqmap = mmap(NULL, u->sqmapsz, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, u->rfd, IORING_OFF_SQ_RING);
+  if (u->sqmap == MAP_FAILED) return -1;
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    u->cqmap = u->sqmap;
+  } else {
+    u->cqmap = mmap(NULL, u->cqmapsz, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->rfd, IORING_OFF_CQ_RING);
+    if (u->cqmap == MAP_FAILED) return -1;
+  }
+  u->sqemapsz = p->sq_entries * sizeof(struct io_uring_sqe);
+  u->sqemap = mmap(NULL, u->sqemapsz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->rfd, IORING_OFF_SQES);
+  if (u->sqemap == MAP_FAILED) return -1;
+
+  char* sq = u->sqmap;
+  char* cq = u->cqmap;
+  u->sqhead = (unsigned*)(sq + p->sq_off.head);
+  u->sqtail = (unsigned*)(sq + p->sq_off.tail);
+  u->sqmask = (unsigned*)(sq + p->sq_off.ring_mask);
+  u->sqarray = (unsigned*)(sq + p->sq_off.array);
+  u->sqents = p->sq_entries;
+  u->sqes = u->sqemap;
+  u->cqhead = (unsigned*)(cq + p->cq_off.head);
+  u->cqtail = (unsigned*)(cq + p->cq_off.tail);
+  u->cqmask = (unsigned*)(cq + p->cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+
+  // sqe slots are used in ring order, so the index array is the identity
+  for (unsigned i = 0; i < u->sqents; i++) u->sqarray[i] = i;
+  u->sqlocal = u->sqsub = *u->sqtail;
+
+  // provided buffer ring (page aligned) + buffer memory
+  u->br = mmap(NULL, UNBUF * sizeof(struct io_uring_buf),
+               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->br == MAP_FAILED) {
+    u->br = NULL;
+    return -1;
+  }
+  u->bufs = malloc((size_t)UNBUF * (UBUFSZ + 1));
+  if (!u->bufs) return -1;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+  reg.ring_entries = UNBUF;
+  reg.bgid = BGID;
+  if (urreg(u->rfd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) return -1;
+
+  for (int i = 0; i < UNBUF; i++) brput(u, i);
+  return 0;
+}
+
+int uinit(struct uring* u) {
+  memset(u, 0, sizeof(*u));
+  u->rfd = -1;
+  u->sfree = -1;
+  u->qlim = UINT_MAX;
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+            IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+  p.cq_entries = UENTRIES * 4;
+  u->rfd = ursetup(UENTRIES, &p);
+  if (u->rfd == -1 && errno == EINVAL) {
+    // older kernel, retry without the optional flags
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = UENTRIES * 4;
+    u->rfd = ursetup(UENTRIES, &p);
+  }
+  if (u->rfd == -1) return -1;
+
+  u->evcap = p.cq_entries;
+  u->evs = malloc(sizeof(*u->evs) * u->evcap);
+  if (!u->evs || umap(u, &p) == -1) {
+    int e = errno;
+    ufree(u);
+    errno = e;
+    return -1;
+  }
+  return 0;
+}
+
+void ufree(struct uring* u) {
+  if (u->sqemap && u->sqemap != MAP_FAILED) munmap(u->sqemap, u->sqemapsz);
+  if (u->cqmap && u->cqmap != MAP_FAILED && u->cqmap != u->sqmap)
+    munmap(u->cqmap, u->cqmapsz);
+  if (u->sqmap && u->sqmap != MAP_FAILED) munmap(u->sqmap, u->sqmapsz);
+  if (u->br) munmap(u->br, UNBUF * sizeof(struct io_uring_buf));
+  if (u->rfd != -1) close(u->rfd);
+  for (int i = 0; i < u->nfdst; i++) {
+    for (int s = u->fdst[i].sqh; s != -1; s = u->sends[s].next) {
+      msgput(u->sends[s].m);
+    }
+  }
+  free(u->bufs);
+  free(u->evs);
+  free(u->fdst);
+  free(u->sends);
+  memset(u, 0, sizeof(*u));
+  u->rfd = -1;
+}
+
+/** publish queued SQEs to the kernel and enter
+ * @param u engine
+ * @param minc completions to wait for
+ * @param tmo timeout ms when waiting (-1 = forever)
+ * @return 0 ok, -1 fail */
+static int usubmit(struct uring* u, unsigned minc, int tmo) {
+  unsigned nsub = u->sqlocal - u->sqsub;
+  __atomic_store_n(u->sqtail, u->sqlocal, __ATOMIC_RELEASE);
+  u->sqsub = u->sqlocal;
+
+  unsigned flags = minc ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  void* argp = NULL;
+  size_t argsz = 0;
+  if (minc && tmo >= 0) {
+    ts.tv_sec = tmo / 1000;
+    ts.tv_nsec = (long long)(tmo % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+  if (!nsub && !minc) return 0;
+
+  u->nenter++;
+  if (urenter(u->rfd, nsub, minc, flags, argp, argsz) == -1) {
+    // ETIME = timeout expired, EINTR = signal; both are just "no events"
+    if (errno == ETIME || errno == EINTR) return 0;
+    return -1;
+  }
+  return 0;
+}
+
+/** next free SQE, flushing the queue to the kernel when it is full */
+static struct io_uring_sqe* usqe(struct uring* u) {
+  unsigned head = __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE);
+  if (u->sqlocal - head >= u->sqents) {
+    if (usubmit(u, 0, -1) == -1) return NULL;
+    head = __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE);
+    if (u->sqlocal - head >= u->sqents) {
+      errno = EBUSY;
+      return NULL;
+    }
+  }
+  struct io_uring_sqe* e = &u->sqes[u->sqlocal & *u->sqmask];
+  u->sqlocal++;
+  memset(e, 0, sizeof(*e));
+  return e;
+}
+
+/** grow per-fd state to cover fd */
+static struct ufd* ufdget(struct uring* u, int fd) {
+  if (fd >= u->nfdst) {
+    int n = u->nfdst ? u->nfdst : 64;
+    while (n <= fd) n *= 2;
+    struct ufd* f = realloc(u->fdst, sizeof(*f) * n);
+    if (!f) return NULL;
+    for (int i = u->nfdst; i < n; i++) {
+      f[i].gen = 0;
+      f[i].sqh = f[i].sqt = -1;
+      f[i].qbytes = 0;
+      f[i].qn = 0;
+      f[i].watch = false;
+    }
+    u->fdst = f;
+    u->nfdst = n;
+  }
+  return &u->fdst[fd];
+}
+
+int uaccept(struct uring* u, int lfd) {
+  struct io_uring_sqe* e = usqe(u);
+  if (!e) return -1;
+  e->opcode = IORING_OP_ACCEPT;
+  e->fd = lfd;
+  e->ioprio = IORING_ACCEPT_MULTISHOT;
+  e->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  e->user_data = UDATA(U_ACCEPT, 0, lfd);
+  return 0;
+}
+
+int urecv(struct uring* u, int fd) {
+  struct ufd* f = ufdget(u, fd);
+  if (!f) return -1;
+  struct io_uring_sqe* e = usqe(u);
+  if (!e) return -1;
+  e->opcode = IORING_OP_RECV;
+  e->fd = fd;
+  e->ioprio = IORING_RECV_MULTISHOT;
+  e->flags = IOSQE_BUFFER_SELECT;
+  e->buf_group = BGID;
+  e->user_data = UDATA(U_RECV, f->gen, fd);
+  return 0;
+}
+
+int upoll(struct uring* u, int fd) {
+  struct io_uring_sqe* e = usqe(u);
+  if (!e) return -1;
+  e->opcode = IORING_OP_POLL_ADD;
+  e->fd = fd;
+  e->poll32_events = POLLIN;
+  e->user_data = UDATA(U_POLL, 0, fd);
+  return 0;
+}
+
+int ubusy(const struct uring* u, int fd) {
+  return fd < u->nfdst && u->fdst[fd].sqh != -1;
+}
+
+/** queue SQE for the head send of an fd */
+static int ussqe(struct uring* u, int si) {
+  struct usend* s = &u->sends[si];
+  struct io_uring_sqe* e = usqe(u);
+  if (!e) return -1;
+  e->opcode = IORING_OP_SEND;
+  e->fd = s->fd;
+  e->addr = (uint64_t)(uintptr_t)(s->m->data + s->off);
+  e->len = s->m->len - s->off;
+  e->msg_flags = MSG_NOSIGNAL;
+  e->user_data = UDATA(U_SEND, 0, si);
+  return 0;
+}
+
+/** release a send slot and its message ref */
+static void usput(struct uring* u, int si) {
+  struct usend* s = &u->sends[si];
+  msgput(s->m);
+  s->m = NULL;
+  s->next = u->sfree;
+  u->sfree = si;
+}
+
+/** grab a send slot from the pool (indices stay valid across growth) */
+static int usget(struct uring* u) {
+  if (u->sfree == -1) {
+    int n = u->nsends ? u->nsends * 2 : 256;
+    struct usend* s = realloc(u->sends, sizeof(*s) * n);
+    if (!s) return -1;
+    for (int i = n - 1; i >= u->nsends; i--) {
+      s[i].next = u->sfree;
+      u->sfree = i;
+    }
+    u->sends = s;
+    u->nsends = n;
+  }
+  int si = u->sfree;
+  u->sfree = u->sends[si].next;
+  u->sends[si].next = -1;
+  return si;
+}
+
+unsigned uqlen(const struct uring* u, int fd) {
+  return fd < u->nfdst ? u->fdst[fd].qbytes : 0;
+}
+
+/** unlink and release the send queued right behind an fd's head */
+static void usdrop(struct uring* u, struct ufd* f) {
+  struct usend* h = &u->sends[f->sqh];
+  int si = h->next;
+  h->next = u->sends[si].next;
+  if (f->sqt == si) f->sqt = f->sqh;
+  f->qbytes -= u->sends[si].m->len;
+  f->qn--;
+  usput(u, si);
+}
+
+int uevict(struct uring* u, int fd, unsigned len) {
+  struct ufd* f = ufdget(u, fd);
+  if (!f) return -1;
+  unsigned busy = 0;  // the head's unsent bytes
+  if (f->sqh != -1) {
+    busy = u->sends[f->sqh].m->len - u->sends[f->sqh].off;
+  }
+  if (busy + len > u->qlim) return -1;
+  int n = 0;
+  for (; f->qbytes + len > u->qlim; n++) usdrop(u, f);
+  return n;
+}
+
+void uwatch(struct uring* u, int fd, bool on) {
+  struct ufd* f = ufdget(u, fd);
+  if (f) f->watch = on;
+}
+
+int utrim(struct uring* u, int fd) {
+  struct ufd* f = ufdget(u, fd);
+  if (!f || f->sqh == -1) return 0;
+  int n = 0;
+  for (; u->sends[f->sqh].next != -1; n++) usdrop(u, f);
+  return n;
+}
+
+int ubcast(struct uring* u, const int* fds, int n, struct msg* m) {
+  int rc = 0;
+  for (int i = 0; i < n; i++) {
+    struct ufd* f = ufdget(u, fds[i]);
+    int si = f ? usget(u) : -1;
+    if (si == -1) {
+      rc = -1;
+      continue;
+    }
+    struct usend* s = &u->sends[si];
+    s->m = msgget(m);
+    s->fd = fds[i];
+    s->gen = f->gen;
+    s->off = 0;
+
+    if (f->sqh == -1) {
+      // idle fd: goes out with the next batch submit
+      f->sqh = f->sqt = si;
+      if (ussqe(u, si) == -1) {
+        f->sqh = f->sqt = -1;
+        usput(u, si);
+        rc = -1;
+        continue;
+      }
+    } else {
+      // a send is in flight; keep byte order by chaining behind it
+      u->sends[f->sqt].next = si;
+      f->sqt = si;
+    }
+    f->qbytes += m->len;
+    f->qn++;
+  }
+  return rc;
+}
+
+void uforget(struct uring* u, int fd) {
+  struct ufd* f = ufdget(u, fd);
+  if (!f) return;
+
+  // head is in flight and comes back orphaned (gen mismatch); drop the rest
+  if (f->sqh != -1) {
+    int si = u->sends[f->sqh].next;
+    while (si != -1) {
+      int nx = u->sends[si].next;
+      usput(u, si);
+      si = nx;
+    }
+    u->sends[f->sqh].next = -1;
+  }
+  f->sqh = f->sqt = -1;
+  f->qbytes = 0;
+  f->qn = 0;
+  f->watch = false;
+  f->gen = (f->gen + 1) & 0xffffff;
+
+  // multishot recv holds a file ref; cancel it so close() really closes
+  struct io_uring_sqe* e = usqe(u);
+  if (!e) return;
+  e->opcode = IORING_OP_ASYNC_CANCEL;
+  e->fd = fd;
+  e->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  e->user_data = UDATA(U_CANCEL, 0, fd);
+  // the cancel finds the recv through the fd: submit before it is closed
+  usubmit(u, 0, -1);
+}
+
+/** handle a send completion: continue short sends, start the next one */
+static void usdone(struct uring* u, int si, int res) {
+  struct usend* s = &u->sends[si];
+  struct ufd* f = &u->fdst[s->fd];
+
+  if (s->gen != f->gen) {
+    // client was forgotten while this send was in flight
+    usput(u, si);
+    return;
+  }
+  if (res > 0 && s->off + res < s->m->len) {
+    s->off += res;
+    f->qbytes -= res;
+    if (ussqe(u, si) == 0) return;
+    res = -errno;
+  }
+  if (res < 0) {
+    // hard error; the recv side sees the dead peer and removes the client
+    while (f->sqh != -1) {
+      int nx = u->sends[f->sqh].next;
+      usput(u, f->sqh);
+      f->sqh = nx;
+    }
+    f->sqt = -1;
+    f->qbytes = 0;
+    f->qn = 0;
+    return;
+  }
+
+  f->qbytes -= s->m->len - s->off;
+  f->qn--;
+  f->sqh = s->next;
+  if (f->sqh == -1) f->sqt = -1;
+  usput(u, si);
+  if (f->sqh != -1 && ussqe(u, f->sqh) == -1) {
+    // out of SQEs; drop this fd's queue rather than stall it forever
+    usdone(u, f->sqh, -errno);
+  }
+}
+
+int uwait(struct uring* u, int tmo) {
+  unsigned head = *u->cqhead;
+  unsigned tail = __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE);
+  // only block when nothing is pending already
+  if (usubmit(u, head == tail ? 1 : 0, tmo) == -1) return -1;
+
+  int nev = 0;
+  head = *u->cqhead;
+  tail = __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE);
+  for (; head != tail && nev < u->evcap; head++) {
+    struct io_uring_cqe* c = &u->cqes[head & *u->cqmask];
+    uint64_t ud = c->user_data;
+    int res = c->res;
+    unsigned cf = c->flags;
+
+    switch (UDOP(ud)) {
+      case U_ACCEPT: {
+        // out of fds: passed up (fd < 0) and left to the owner to re-arm,
+        // re-arming here would fail again at once
+        bool nofd = res == -EMFILE || res == -ENFILE;
+        if (res >= 0 || nofd) {
+          struct uev* e = &u->evs[nev++];
+          memset(e, 0, sizeof(*e));
+          e->op = U_ACCEPT;
+          e->fd = res;
+          e->lfd = UDVAL(ud);
+        }
+        if (!(cf & IORING_CQE_F_MORE) && !nofd) uaccept(u, UDVAL(ud));
+        break;
+      }
+
+      case U_RECV: {
+        int fd = UDVAL(ud);
+        unsigned gen = UDGEN(ud);
+        int bid = (cf & IORING_CQE_F_BUFFER) ? (int)(cf >> IORING_CQE_BUFFER_SHIFT)
+                                             : -1;
+        int live = fd < u->nfdst && u->fdst[fd].gen == gen;
+        if (!live) {
+          if (bid != -1) brput(u, bid);
+          break;
+        }
+        if (res == -ENOBUFS) {
+          // every buffer is parked in this batch; re-arm after recycle
+          urecv(u, fd);
+          break;
+        }
+        struct uev* e = &u->evs[nev++];
+        e->op = U_RECV;
+        e->fd = fd;
+        e->gen = gen;
+        e->n = res;
+        e->bid = bid;
+        e->buf = bid != -1 ? u->bufs + (size_t)bid * (UBUFSZ + 1) : NULL;
+        if (res > 0 && !(cf & IORING_CQE_F_MORE)) urecv(u, fd);
+        break;
+      }
+
+      case U_SEND: {
+        // read before usdone() releases the slot
+        int fd = u->sends[UDVAL(ud)].fd;
+        unsigned gen = u->sends[UDVAL(ud)].gen;
+        usdone(u, UDVAL(ud), res);
+        if (u->fdst[fd].watch && u->fdst[fd].gen == gen) {
+          struct uev* e = &u->evs[nev++];
+          memset(e, 0, sizeof(*e));
+          e->op = U_DRAIN;
+          e->fd = fd;
+          e->gen = gen;
+        }
+        break;
+      }
+
+      case U_POLL:
+        if (res >= 0) {
+          struct uev* e = &u->evs[nev++];
+          memset(e, 0, sizeof(*e));
+          e->op = U_POLL;
+          e->fd = UDVAL(ud);
+        }
+        break;
+
+      case U_CANCEL:
+      default:
+        break;
+    }
+  }
+  __atomic_store_n(u->cqhead, head, __ATOMIC_RELEASE);
+  return nev;
+}
+
+int ustale(const struct uring* u, const struct uev* e) {
+  if (e->op != U_RECV && e->op != U_DRAIN) return 0;
+  return e->fd >= u->nfdst || u->fdst[e->fd].gen != e->gen;
+}
+
+void urecycle(struct uring* u, int bid) {
+  if (bid >= 0) brput(u, bid);
+}
@@ -0,0 +1,179 @@
+#ifndef URING_H
+#define URING_H
+
+// io_uring I/O engine (linux, build with -DCCHAT_URING / make build-uring).
+// completion based: multishot accept on the listener, multishot recv into a
+// provided buffer ring per client, and broadcast sends queued as SQEs that
+// are submitted together on the next uwait(). talks to the kernel through
+// the raw syscalls so there is no liburing dependency.
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "msg.h"
+
+#define UENTRIES 256  // SQ entries (CQ is 4x)
+#define UNBUF 256     // provided recv buffers (power of 2)
+#define UBUFSZ 255    // recv buffer payload size (+1 byte for NUL)
+
+enum uop { U_ACCEPT = 1, U_RECV, U_SEND, U_CANCEL, U_POLL, U_DRAIN };
+
+// completion handed back to the server loop
+struct uev {
+  enum uop op;    // U_ACCEPT, U_RECV, U_POLL or U_DRAIN
+  int fd;         // new client fd (U_ACCEPT; -EMFILE/-ENFILE = out of fds,
+                  // the accept is re-armed with uaccept()), client fd
+                  // (U_RECV, U_DRAIN), or the readable fd (U_POLL)
+  int lfd;        // listener that accepted it (U_ACCEPT)
+  unsigned gen;   // fd generation when the recv was armed / send queued
+  int n;          // bytes received, 0 = EOF, -errno = error
+  char* buf;      // received data (U_RECV, n > 0), room for a NUL at buf[n]
+  int bid;        // provided buffer id to hand back with urecycle()
+};
+
+// one queued send of a shared message to one fd
+struct usend {
+  struct msg* m;  // holds a ref until the send completes
+  int fd;
+  unsigned gen;  // fd generation at queue time (mismatch = orphaned)
+  int off;       // bytes already sent
+  int next;      // next queued send for this fd, -1 = none
+};
+
+// per-fd engine state
+struct ufd {
+  unsigned gen;     // bumped by uforget() so stale completions are ignored
+  int sqh, sqt;     // queued sends (head is in flight), -1 = empty
+  unsigned qbytes;  // bytes of those still to go out
+  int qn;           // sends queued (the one in flight included)
+  bool watch;       // report send completions (U_DRAIN), see uwatch()
+};
+
+struct uring {
+  int rfd;  // ring fd
+
+  // submission queue
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned sqents, sqlocal, sqsub;
+  struct io_uring_sqe* sqes;
+
+  // completion queue
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe* cqes;
+
+  void *sqmap, *cqmap, *sqemap;
+  size_t sqmapsz, cqmapsz, sqemapsz;
+
+  // provided buffer ring for multishot recv
+  struct io_uring_buf_ring* br;
+  char* bufs;
+  unsigned short brtail;
+
+  struct ufd* fdst;  // indexed by fd
+  int nfdst;
+
+  struct usend* sends;  // send pool
+  int nsends, sfree;    // pool size, free list head (-1 = none)
+  unsigned qlim;        // bytes an fd may have queued (uevict())
+
+  struct uev* evs;  // completions filled by uwait()
+  int evcap;
+
+  unsigned long long nenter;  // io_uring_enter calls (metrics)
+};
+
+/** setup ring, provided buffers & pools
+ * @param u engine
+ * @return 0 ok, -1 fail (errno set) */
+int uinit(struct uring* u);
+
+/** tear down ring and free everything */
+void ufree(struct uring* u);
+
+/** arm multishot accept on a listener (re-armed when the kernel ends it;
+ * several listeners may be armed)
+ * @param u engine
+ * @param lfd listener fd
+ * @return 0 ok, -1 fail */
+int uaccept(struct uring* u, int lfd);
+
+/** arm multishot recv on a client
+ * @param u engine
+ * @param fd client fd
+ * @return 0 ok, -1 fail */
+int urecv(struct uring* u, int fd);
+
+/** arm a one-shot readability watch (U_POLL completion; re-arm after
+ * reading)
+ * @param u engine
+ * @param fd fd to watch
+ * @return 0 ok, -1 fail */
+int upoll(struct uring* u, int fd);
+
+/** is a send to this fd still queued or in flight
+ * @param u engine
+ * @param fd client fd
+ * @return 1 yes, 0 no */
+int ubusy(const struct uring* u, int fd);
+
+/** bytes queued for an fd and not sent yet
+ * @param u engine
+ * @param fd client fd
+ * @return bytes */
+unsigned uqlen(const struct uring* u, int fd);
+
+/** make room for a message of len bytes under u->qlim by dropping the
+ * oldest queued sends. the one in flight stays: the peer must get it whole
+ * @param u engine
+ * @param fd client fd
+ * @param len bytes wanted
+ * @return sends dropped, -1 it can't fit even so (nothing dropped) */
+int uevict(struct uring* u, int fd, unsigned len);
+
+/** report each send completion on an fd as a U_DRAIN event, while the
+ * owner follows a backlog (the POLLOUT of this engine). cleared by
+ * uforget()
+ * @param u engine
+ * @param fd client fd
+ * @param on true=report */
+void uwatch(struct uring* u, int fd, bool on);
+
+/** drop every queued send of an fd but the one in flight
+ * @param u engine
+ * @param fd client fd
+ * @return sends dropped */
+int utrim(struct uring* u, int fd);
+
+/** queue one send per target of a shared message (a ref is taken per
+ * target and dropped when that send completes). sends to one fd go out in
+ * order, one in flight at a time. no bound is applied here: callers check
+ * uqlen() against their limit
+ * @param u engine
+ * @param fds target fds
+ * @param n target count
+ * @param m message
+ * @return 0 ok, -1 fail */
+int ubcast(struct uring* u, const int* fds, int n, struct msg* m);
+
+/** forget a client before close(): drop queued sends, cancel in-flight ops
+ * @param u engine
+ * @param fd client fd */
+void uforget(struct uring* u, int fd);
+
+/** submit queued SQEs in one batch and wait for completions
+ * @param u engine
+ * @param tmo timeout ms (-1 = forever)
+ * @return number of entries in u->evs, -1 fail */
+int uwait(struct uring* u, int tmo);
+
+/** true if a completion belongs to a client that was since forgotten */
+int ustale(const struct uring* u, const struct uev* e);
+
+/** hand a provided recv buffer back to the kernel
+ * @param u engine
+ * @param bid buffer id from struct uev */
+void urecycle(struct uring* u, int bid);
+
+#endif  // URING_H
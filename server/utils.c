@@ -1,13 +1,19 @@
+#define _DEFAULT_SOURCE  // SO_REUSEPORT
 #ifndef _POSIX_C_SOURCE
 #define _POSIX_C_SOURCE 200112L
 #endif
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -60,3 +66,64 @@ void print_addrinfo(const struct addrinfo* ai) {
   }
   printf("\n");
 }
+
+int lstnfd(char* hostname, char* port, bool nblk, bool rport, int* lsock) {
+  struct addrinfo *servinfo, *p;
+  int rv = resolve_server_addrinfo(hostname, port, &servinfo);
+  if (rv != 0) {
+    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+    return -1;
+  }
+
+  // bind to the first address that works
+  int fd = -1;
+  for (p = servinfo; p != NULL; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd == -1) continue;
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (rport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    if (bind(fd, p->ai_addr, p->ai_addrlen) == -1 ||
+        listen(fd, LSTNBACKLOG) == -1) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    print_addrinfo(p);
+    break;
+  }
+  freeaddrinfo(servinfo);
+  if (fd == -1) return -1;
+
+  // non-blocking so accept() can be drained until EAGAIN
+  if (nblk && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+
+  *lsock = fd;
+  return 0;
+}
+
+long nofile(long want) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1) return -1;
+  if (rl.rlim_cur != RLIM_INFINITY && (long)rl.rlim_cur < want) {
+    rlim_t up = (rlim_t)want;
+    if (rl.rlim_max != RLIM_INFINITY && up > rl.rlim_max) up = rl.rlim_max;
+    rl.rlim_cur = up;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  return rl.rlim_cur == RLIM_INFINITY ? want : (long)rl.rlim_cur;
+}
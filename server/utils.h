@@ -6,9 +6,35 @@
 #endif
 
 #include <netdb.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define LSTNBACKLOG 4096  // pending connection queue (capped at somaxconn)
 
 int resolve_server_addrinfo(char* hostname, char* port,
                             struct addrinfo** servinfo);
 void print_addrinfo(const struct addrinfo* ai);
 
+/** open a bound, listening TCP socket
+ * @param hostname host to bind
+ * @param port port to bind
+ * @param nblk true=set O_NONBLOCK
+ * @param rport true=SO_REUSEPORT (one listener per shard, kernel balances)
+ * @param lsock listener fd (out)
+ * @return 0 ok, -1 fail */
+int lstnfd(char* hostname, char* port, bool nblk, bool rport, int* lsock);
+
+/** raise the RLIMIT_NOFILE soft limit towards want (capped by the hard
+ * limit)
+ * @param want fds needed
+ * @return resulting soft limit */
+long nofile(long want);
+
+/** monotonic clock in ns */
+static inline long long nsnow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 #endif  // UTILS_H
@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+
+#include "wal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define WALMAGIC "CCHATLOG"
+#define WALVER 1
+#define WALWRAP 0xffffffffu  // ring marker: skip to the ring start
+#define WALNAP 8             // longest idle sleep (ms)
+#define WALRETRY 1000        // longest wait between new segment attempts (ms)
+#define WALNAME 21           // "<16 hex>.log" + NUL
+
+static uint32_t crctab[8][256];  // crc32c (Castagnoli), slice-by-8
+
+/** fill the crc32c tables */
+static void crcinit(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+    crctab[0][i] = c;
+  }
+  for (int t = 1; t < 8; t++) {
+    for (int i = 0; i < 256; i++) {
+      uint32_t c = crctab[t - 1][i];
+      crctab[t][i] = crctab[0][c & 0xff] ^ (c >> 8);
+    }
+  }
+}
+
+/** fold n bytes into a running crc32c, 8 bytes per step */
+static uint32_t crcadd(uint32_t c, const unsigned char* s, size_t n) {
+  for (; n >= 8; s += 8, n -= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, s, 4);
+    memcpy(&hi, s + 4, 4);
+    lo ^= c;  // little endian hosts (the files are host byte order)
+    c = crctab[7][lo & 0xff] ^ crctab[6][(lo >> 8) & 0xff] ^
+        crctab[5][(lo >> 16) & 0xff] ^ crctab[4][lo >> 24] ^
+        crctab[3][hi & 0xff] ^ crctab[2][(hi >> 8) & 0xff] ^
+        crctab[1][(hi >> 16) & 0xff] ^ crctab[0][hi >> 24];
+  }
+  while (n--) c = crctab[0][(c ^ *s++) & 0xff] ^ (c >> 8);
+  return c;
+}
+
+/** crc32c of seq + payload, as stored in a record */
+static uint32_t reccrc(uint64_t seq, const char* p, size_t n) {
+  uint32_t c = crcadd(~0u, (const unsigned char*)&seq, sizeof(seq));
+  return ~crcadd(c, (const unsigned char*)p, n);
+}
+
+/** record bytes on disk for a payload of len */
+static inline size_t recsz(size_t len) {
+  return (WALREC + len + 7) & ~(size_t)7;
+}
+
+/** segment file name for a first seq */
+static void segname(char name[WALNAME], uint64_t seq) {
+  snprintf(name, WALNAME, "%016" PRIx64 ".log", seq);
+}
+
+/** fsync the directory so created/removed names survive a crash */
+static void dirsync(struct wal* w) {
+  int fd = open(w->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return;
+  fsync(fd);
+  close(fd);
+}
+
+/** remember a segment on disk, dropping the oldest past the retention
+ * @return 0 ok, -1 out of memory */
+static int segkeep(struct wal* w, uint64_t seq0) {
+  if (w->nsegs == w->capsegs) {
+    int ncap = w->capsegs ? w->capsegs * 2 : 16;
+    uint64_t* s = realloc(w->segs, sizeof(*s) * ncap);
+    if (!s) return -1;
+    w->segs = s;
+    w->capsegs = ncap;
+  }
+  w->segs[w->nsegs++] = seq0;
+
+  // the segment being written is never dropped (nsegs counts it)
+  bool gone = false;
+  while (w->keep > 0 && w->nsegs > w->keep) {
+    char name[WALNAME];
+    segname(name, w->segs[0]);
+    int dfd = open(w->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd != -1) {
+      if (unlinkat(dfd, name, 0) == -1 && errno != ENOENT) {
+        fprintf(stderr, "wal: unlink %s: %s\n", name, strerror(errno));
+      }
+      close(dfd);
+    }
+    memmove(w->segs, w->segs + 1, sizeof(*w->segs) * --w->nsegs);
+    gone = true;
+  }
+  if (gone && w->syncms > 0) dirsync(w);
+  return 0;
+}
+
+// ─── recovery ───────────────────────────────────────────────────────────────
+
+static int seqcmp(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+/** validate one segment, cut a torn tail and trim the zero fill
+ * @param w log (seq, rrecs, rtorn updated)
+ * @param dfd directory fd
+ * @param seq0 first seq from the file name
+ * @return 1 kept, 0 empty (removed), -1 fail */
+static int segscan(struct wal* w, int dfd, uint64_t seq0) {
+  char name[WALNAME];
+  segname(name, seq0);
+  int fd = openat(dfd, name, O_RDWR | O_CLOEXEC);
+  if (fd == -1) return -1;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  size_t size = st.st_size, end = 0;
+  bool torn = false;
+  if (size >= WALHDR) {
+    char* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    uint64_t hseq;
+    memcpy(&hseq, p + 16, sizeof(hseq));
+    if (memcmp(p, WALMAGIC, 8) == 0 && hseq == seq0) {
+      uint64_t want = seq0;
+      end = WALHDR;
+      while (end + WALREC <= size) {
+        uint32_t len, crc;
+        uint64_t seq;
+        memcpy(&len, p + end, 4);
+        memcpy(&crc, p + end + 4, 4);
+        memcpy(&seq, p + end + 8, 8);
+        if (len == 0) break;  // zero fill: clean end
+        if (recsz(len) > size - end || seq != want ||
+            reccrc(seq, p + end + WALREC, len) != crc) {
+          torn = true;
+          break;
+        }
+        end += recsz(len);
+        want++;
+        w->rrecs++;
+      }
+      if (want > w->seq) w->seq = want;
+    }
+    munmap(p, size);
+  }
+
+  if (end <= WALHDR) {
+    // no records: a segment created just before a crash, or a bad header
+    if (end == 0 || torn) w->rtorn++;
+    close(fd);
+    unlinkat(dfd, name, 0);
+    return 0;
+  }
+  if (torn) w->rtorn++;
+  if (end < size && ftruncate(fd, end) == -1) {
+    close(fd);
+    return -1;
+  }
+  if (torn) fsync(fd);
+  close(fd);
+  return 1;
+}
+
+/** scan every segment in the directory, oldest first
+ * @return 0 ok, -1 fail */
+static int walscan(struct wal* w) {
+  DIR* d = opendir(w->dir);
+  if (!d) return -1;
+  uint64_t* found = NULL;
+  int n = 0, cap = 0;
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    char* end;
+    if (strlen(e->d_name) != WALNAME - 1) continue;
+    uint64_t seq = strtoull(e->d_name, &end, 16);
+    if (end != e->d_name + 16 || strcmp(end, ".log") != 0) continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 16;
+      uint64_t* f = realloc(found, sizeof(*f) * cap);
+      if (!f) {
+        free(found);
+        closedir(d);
+        return -1;
+      }
+      found = f;
+    }
+    found[n++] = seq;
+  }
+  qsort(found, n, sizeof(*found), seqcmp);
+
+  int rc = 0;
+  for (int i = 0; i < n && rc == 0; i++) {
+    int k = segscan(w, dirfd(d), found[i]);
+    if (k == -1) {
+      fprintf(stderr, "wal: scan %016" PRIx64 ".log: %s\n", found[i],
+              strerror(errno));
+      rc = -1;
+    } else if (k == 1 && segkeep(w, found[i]) == -1) {
+      rc = -1;
+    }
+  }
+  free(found);
+  closedir(d);
+  return rc;
+}
+
+// ─── writer ─────────────────────────────────────────────────────────────────
+
+/** group commit: flush every record since the last sync */
+static void walsync(struct wal* w) {
+  if (w->fd == -1 || w->off == w->synced) return;
+  size_t pg = sysconf(_SC_PAGESIZE);
+  size_t from = w->synced & ~(pg - 1);
+  if (msync(w->base + from, w->off - from, MS_SYNC) == -1) {
+    fprintf(stderr, "wal: msync: %s\n", strerror(errno));
+  }
+  w->synced = w->off;
+  atomic_fetch_add_explicit(&w->syncs, 1, memory_order_relaxed);
+}
+
+/** close the current segment, trimmed to its records */
+static void segend(struct wal* w) {
+  if (w->fd == -1) return;
+  if (w->syncms > 0) walsync(w);
+  munmap(w->base, w->segsz);
+  if (ftruncate(w->fd, w->off) == -1) {
+    fprintf(stderr, "wal: ftruncate: %s\n", strerror(errno));
+  }
+  close(w->fd);
+  w->fd = -1;
+  w->base = NULL;
+}
+
+/** start a segment at the next seq. a half made file is unlinked again,
+ * so a retry is not stuck on EEXIST
+ * @return 0 ok, -1 fail */
+static int segnew(struct wal* w) {
+  char name[WALNAME];
+  segname(name, w->seq);
+  int dfd = open(w->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd == -1) return -1;
+  int fd = openat(dfd, name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    close(dfd);
+    return -1;
+  }
+
+  // reserve the blocks up front so a full disk fails here, not as SIGBUS
+  // on a store into the mapping
+  char* p = MAP_FAILED;
+#ifdef __linux__
+  int err = posix_fallocate(fd, 0, w->segsz);
+  if (err != 0) {
+    errno = err;
+    goto fail;
+  }
+#else
+  if (ftruncate(fd, w->segsz) == -1) goto fail;
+#endif
+  p = mmap(NULL, w->segsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) goto fail;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint32_t ver = WALVER, hdr = WALHDR;
+  uint64_t born = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  memcpy(p, WALMAGIC, 8);
+  memcpy(p + 8, &ver, 4);
+  memcpy(p + 12, &hdr, 4);
+  memcpy(p + 16, &w->seq, 8);
+  memcpy(p + 24, &born, 8);
+  if (segkeep(w, w->seq) == -1) goto fail;
+  close(dfd);
+
+  w->fd = fd;
+  w->base = p;
+  w->off = WALHDR;
+  w->synced = 0;
+  if (w->syncms > 0) dirsync(w);
+  return 0;
+
+fail:;
+  int e = errno;
+  if (p != MAP_FAILED) munmap(p, w->segsz);
+  close(fd);
+  unlinkat(dfd, name, 0);
+  close(dfd);
+  errno = e;
+  return -1;
+}
+
+/** no segment to write to: retry with backoff (1, 2, 4.. WALRETRY ms),
+ * reporting the first failure of a streak only; records in between are
+ * counted as lost and reported once a second by walrun()
+ * @return 0 segment open, -1 not (record lost) */
+static int segretry(struct wal* w) {
+  long long now = nsnow();
+  if (w->retryms && now < w->retryat) {
+    w->lost++;
+    return -1;
+  }
+  if (segnew(w) == 0) {
+    w->retryms = 0;
+    return 0;
+  }
+  if (!w->retryms) fprintf(stderr, "wal: new segment: %s\n", strerror(errno));
+  w->retryms = w->retryms ? w->retryms * 2 : 1;
+  if (w->retryms > WALRETRY) w->retryms = WALRETRY;
+  w->retryat = now + w->retryms * 1000000LL;
+  w->lost++;
+  return -1;
+}
+
+/** append one record, rotating when the segment is full
+ * @return 0 ok, -1 no segment to write to (record lost) */
+static int walapp(struct wal* w, const char* data, uint32_t len) {
+  size_t need = recsz(len);
+  if (w->fd != -1 && w->off + need > w->segsz) segend(w);
+  if (w->fd == -1 && segretry(w) == -1) return -1;
+
+  char* p = w->base + w->off;
+  uint32_t crc = reccrc(w->seq, data, len);
+  memcpy(p + 4, &crc, 4);
+  memcpy(p + 8, &w->seq, 8);
+  memcpy(p + WALREC, data, len);
+  memset(p + WALREC + len, 0, need - WALREC - len);
+  memcpy(p, &len, 4);  // len last: a zero len still marks the end
+  w->off += need;
+  w->seq++;
+  return 0;
+}
+
+/** move every queued record from one ring into the log
+ * @return records moved */
+static unsigned long wqdrain(struct wal* w, struct walq* q) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  size_t mask = q->cap - 1;
+  unsigned long n = 0, bytes = 0;
+
+  while (head != tail) {
+    char* p = q->buf + (head & mask);
+    uint32_t len;
+    memcpy(&len, p, 4);
+    if (len == WALWRAP) {
+      head += q->cap - (head & mask);
+      continue;
+    }
+    if (walapp(w, p + 4, len) == 0) {
+      n++;
+      bytes += len;
+    }
+    head += (4 + len + 7) & ~(size_t)7;
+  }
+  atomic_store_explicit(&q->head, head, memory_order_release);
+  atomic_fetch_add_explicit(&w->records, n, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->bytes, bytes, memory_order_relaxed);
+  return n;
+}
+
+/** writer thread: drain the rings, group commit, nap when idle */
+static void* walrun(void* arg) {
+  struct wal* w = arg;
+  int nap = 0;
+  long long lastrep = nsnow();
+
+  while (1) {
+    bool stop = atomic_load_explicit(&w->stop, memory_order_acquire);
+    unsigned long n = 0;
+    for (int i = 0; i < w->nq; i++) n += wqdrain(w, &w->qs[i]);
+
+    long long now = nsnow();
+    if (w->syncms > 0 && now - w->lastsync >= w->syncms * 1000000LL) {
+      walsync(w);
+      w->lastsync = now;
+    }
+    if (now - lastrep >= 1000000000LL) {
+      unsigned long drops = 0;
+      for (int i = 0; i < w->nq; i++) drops += atomic_load(&w->qs[i].drops);
+      if (drops != w->rdrops) {
+        fprintf(stderr, "wal: %lu records dropped (writer behind)\n",
+                drops - w->rdrops);
+        w->rdrops = drops;
+      }
+      if (w->lost != w->rlost) {
+        fprintf(stderr, "wal: %lu records lost (no segment)\n",
+                w->lost - w->rlost);
+        w->rlost = w->lost;
+      }
+      lastrep = now;
+    }
+    if (stop) break;  // the drain above was the last one
+
+    // busy: go again at once; idle: back off 1, 2, 4.. WALNAP ms, capped by
+    // the commit interval so a sync is never late
+    if (n > 0) {
+      nap = 0;
+      continue;
+    }
+    nap = nap ? (nap * 2 > WALNAP ? WALNAP : nap * 2) : 1;
+    int ms = w->syncms > 0 && w->syncms < nap ? w->syncms : nap;
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+  }
+  segend(w);
+  return NULL;
+}
+
+// ─── api ────────────────────────────────────────────────────────────────────
+
+int walput(struct walq* q, const char* tag, int tlen, const char* data,
+           int len) {
+  size_t plen = (size_t)tlen + len;
+  size_t need = (4 + plen + 7) & ~(size_t)7;
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t end = q->cap - (tail & (q->cap - 1));  // bytes before the wrap
+  size_t want = need <= end ? need : end + need;
+
+  if (tlen < 0 || len < 0 || need > q->cap / 2) {
+    atomic_fetch_add_explicit(&q->drops, 1, memory_order_relaxed);
+    return -1;
+  }
+  if (tail + want - q->chead > q->cap) {
+    q->chead = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail + want - q->chead > q->cap) {
+      atomic_fetch_add_explicit(&q->drops, 1, memory_order_relaxed);
+      return -1;
+    }
+  }
+
+  if (need > end) {  // no split records: mark the gap and start over
+    uint32_t wrap = WALWRAP;
+    memcpy(q->buf + (tail & (q->cap - 1)), &wrap, 4);
+    tail += end;
+  }
+  char* p = q->buf + (tail & (q->cap - 1));
+  uint32_t l = plen;
+  memcpy(p, &l, 4);
+  memcpy(p + 4, tag, tlen);
+  memcpy(p + 4 + tlen, data, len);
+  atomic_store_explicit(&q->tail, tail + need, memory_order_release);
+  return 0;
+}
+
+int walopen(struct wal* w, const char* dir, size_t segsz, int syncms,
+            int keep, int nq) {
+  memset(w, 0, sizeof(*w));
+  w->fd = -1;
+  size_t pg = sysconf(_SC_PAGESIZE);
+  w->segsz = (segsz < WALMINSEG ? WALMINSEG : segsz + pg - 1) & ~(pg - 1);
+  w->syncms = syncms;
+  w->keep = keep;
+  w->nq = nq;
+  crcinit();
+
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) return -1;
+  if (!(w->dir = strdup(dir))) return -1;
+  if (walscan(w) == -1) goto fail;
+  w->rseq = w->seq;
+  w->rsegs = w->nsegs;
+
+  if (!(w->qs = calloc(nq, sizeof(*w->qs)))) goto fail;
+  for (int i = 0; i < nq; i++) {
+    w->qs[i].cap = WALQSZ;
+    if (!(w->qs[i].buf = malloc(WALQSZ))) goto fail;
+  }
+
+  // a fresh segment: recovered ones are never appended to
+  if (segnew(w) == -1) goto fail;
+  w->lastsync = nsnow();
+  int rc = pthread_create(&w->tid, NULL, walrun, w);
+  if (rc != 0) {
+    errno = rc;
+    goto fail;
+  }
+  return 0;
+
+fail:;
+  int err = errno;
+  segend(w);
+  if (w->qs) {
+    for (int i = 0; i < nq; i++) free(w->qs[i].buf);
+  }
+  free(w->qs);
+  free(w->segs);
+  free(w->dir);
+  w->qs = NULL;
+  w->segs = NULL;
+  w->dir = NULL;
+  errno = err;
+  return -1;
+}
+
+void walclose(struct wal* w) {
+  if (!w->dir) return;
+  atomic_store_explicit(&w->stop, true, memory_order_release);
+  pthread_join(w->tid, NULL);
+  for (int i = 0; i < w->nq; i++) free(w->qs[i].buf);
+  free(w->qs);
+  free(w->segs);
+  free(w->dir);
+  w->qs = NULL;
+  w->segs = NULL;
+  w->dir = NULL;
+  w->nq = 0;
+}
+
+void walstat(struct wal* w, struct walstat* st) {
+  st->records = atomic_load(&w->records);
+  st->bytes = atomic_load(&w->bytes);
+  st->syncs = atomic_load(&w->syncs);
+  st->drops = 0;
+  for (int i = 0; i < w->nq; i++) st->drops += atomic_load(&w->qs[i].drops);
+}
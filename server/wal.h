@@ -0,0 +1,116 @@
+#ifndef WAL_H
+#define WAL_H
+
+// durable message log: every broadcast appended to fixed size segment files
+// in a directory, in the order the writer sees them. shards never touch the
+// disk: each one copies the formatted message into its own lock-free byte
+// ring (single producer, single consumer) and a writer thread moves records
+// from the rings into the mmap'd current segment. fsyncs are group-committed
+// on an interval, so one msync covers every record written since the last.
+// a full ring drops the record (counted) rather than stall the loop.
+//
+// segment file (host byte order), named <first seq, 16 hex digits>.log:
+//   header  WALHDR bytes: "CCHATLOG", u32 version, u32 header bytes,
+//           u64 first seq, u64 creation time (unix ns)
+//   records u32 len, u32 crc32c(seq + payload), u64 seq, payload,
+//           zero padding to 8 bytes
+// a zero len ends the segment. at startup every segment is scanned, a torn
+// tail (bad length, crc or seq) is cut off and writing resumes in a new
+// segment after the last good seq.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WALHDR 32            // segment header bytes
+#define WALREC 16            // record header bytes
+#define WALQSZ (4u << 20)    // ring bytes per shard
+#define WALMINSEG (1u << 16) // smallest segment
+
+// one shard's ring; only walput() runs on the shard
+struct walq {
+  char* buf;                // ring bytes
+  size_t cap;               // ring size (power of two)
+  size_t chead;             // producer's cached copy of head
+  _Atomic size_t tail;      // next byte the shard writes (free running)
+  _Atomic size_t head;      // next byte the writer reads (free running)
+  atomic_ulong drops;       // records dropped on a full ring
+};
+
+struct wal {
+  char* dir;                // segment directory
+  size_t segsz;             // segment file size
+  int syncms;               // group commit interval, 0 = leave it to the OS
+  int keep;                 // segments retained, 0 = all
+  struct walq* qs;          // one ring per shard
+  int nq;                   // ring count
+  pthread_t tid;            // writer thread
+  atomic_bool stop;         // writer exits after a last drain + sync
+  // writer thread only
+  int fd;                   // current segment, -1 = none
+  char* base;               // its mapping
+  size_t off;               // append offset
+  size_t synced;            // bytes known to be on disk
+  uint64_t seq;             // next record seq
+  uint64_t* segs;           // retained segments (first seqs), oldest first
+  int nsegs;                // retained count
+  int capsegs;              // segs slots allocated
+  long long lastsync;       // last group commit (monotonic ns)
+  unsigned long rdrops;     // drops already reported
+  unsigned long lost;       // records lost with no segment to write to
+  unsigned long rlost;      // losses already reported
+  long long retryat;        // next new segment attempt (monotonic ns)
+  int retryms;              // current retry backoff, 0 = not failing
+  // counters (read with walstat())
+  atomic_ulong records;     // records appended
+  atomic_ulong bytes;       // payload bytes appended
+  atomic_ulong syncs;       // group commits
+  // recovery scan results, fixed once walopen() returns
+  unsigned long rrecs;      // good records found
+  unsigned long rtorn;      // segments with a torn tail cut off
+  uint64_t rseq;            // first seq of this run
+  int rsegs;                // segments kept from earlier runs
+};
+
+struct walstat {
+  unsigned long records;    // records appended since walopen()
+  unsigned long bytes;      // payload bytes appended
+  unsigned long syncs;      // group commits
+  unsigned long drops;      // records dropped on full rings
+};
+
+/** recover the log in dir (created if missing), open a fresh segment and
+ * start the writer thread
+ * @param w log
+ * @param dir directory
+ * @param segsz segment bytes (>= WALMINSEG, rounded to pages)
+ * @param syncms group commit interval in ms, 0 = never fsync
+ * @param keep segments to retain, 0 = all
+ * @param nq producer rings (one per shard)
+ * @return 0 ok, -1 fail (errno set) */
+int walopen(struct wal* w, const char* dir, size_t segsz, int syncms,
+            int keep, int nq);
+
+/** queue one record for the writer (producer side, wait-free). the
+ * payload is tag followed by data
+ * @param q the calling shard's ring
+ * @param tag payload head (the server's: room name and a tab)
+ * @param tlen tag bytes
+ * @param data payload rest (the formatted message)
+ * @param len data bytes
+ * @return 0 queued, -1 ring full or record too big (dropped, counted) */
+int walput(struct walq* q, const char* tag, int tlen, const char* data,
+           int len);
+
+/** stop the writer: drain every ring, sync, trim the segment and free
+ * @param w log */
+void walclose(struct wal* w);
+
+/** read the counters
+ * @param w log
+ * @param st stats (out) */
+void walstat(struct wal* w, struct walstat* st);
+
+#endif  // WAL_H
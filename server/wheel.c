@@ -0,0 +1,134 @@
+#include "wheel.h"
+
+/** empty circular list */
+static void lhinit(struct tmr* h) {
+  h->next = h->prev = h;
+}
+
+/** unlink a node from whatever list holds it */
+static void lunlink(struct tmr* t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t->prev = NULL;
+}
+
+/** append a node */
+static void lpush(struct tmr* h, struct tmr* t) {
+  t->prev = h->prev;
+  t->next = h;
+  h->prev->next = t;
+  h->prev = t;
+}
+
+/** level a due tick belongs on: the highest WBITS group in which it
+ * differs from now (when > now) */
+static int tlevel(uint64_t now, uint64_t when) {
+  return (63 - __builtin_clzll(when ^ now)) / WBITS;
+}
+
+/** link a timer into its slot (t->when > w->now) */
+static void tplace(struct wheel* w, struct tmr* t) {
+  int l = tlevel(w->now, t->when);
+  int s = (t->when >> (l * WBITS)) & (WSLOTS - 1);
+  lpush(&w->slot[l][s], t);
+  w->busy[l] |= 1ULL << s;
+}
+
+void wheelinit(struct wheel* w, uint64_t now) {
+  w->now = now;
+  w->n = 0;
+  for (int l = 0; l < WLEVELS; l++) {
+    w->busy[l] = 0;
+    for (int s = 0; s < WSLOTS; s++) lhinit(&w->slot[l][s]);
+  }
+  lhinit(&w->due);
+}
+
+/** unlink an armed timer, clearing its slot's busy bit if it empties.
+ * timers in a slot are due after now (their slot starts after it), and
+ * the level they sit on does not change while now approaches the slot */
+static void tunlink(struct wheel* w, struct tmr* t) {
+  if (t->when > w->now) {
+    int l = tlevel(w->now, t->when);
+    int s = (t->when >> (l * WBITS)) & (WSLOTS - 1);
+    if (t->next == t->prev) w->busy[l] &= ~(1ULL << s);  // last one
+  }
+  lunlink(t);
+}
+
+void tmradd(struct wheel* w, struct tmr* t, uint64_t when) {
+  if (t->next) {
+    tunlink(w, t);
+  } else {
+    w->n++;
+  }
+  t->when = when;
+  if (when <= w->now) {
+    lpush(&w->due, t);
+    return;
+  }
+  tplace(w, t);
+}
+
+void tmrdel(struct wheel* w, struct tmr* t) {
+  if (!t->next) return;
+  tunlink(w, t);
+  w->n--;
+}
+
+/** start of the first busy slot: the lowest level with one holds it, as
+ * busy slots are always ahead of now's slot on their level
+ * @return tick, WNEVER = every slot empty */
+static uint64_t wnext(const struct wheel* w) {
+  for (int l = 0; l < WLEVELS; l++) {
+    uint64_t b = w->busy[l];
+    if (!b) continue;
+    int s = __builtin_ctzll(b);
+    int sh = (l + 1) * WBITS;
+    uint64_t base = sh >= 64 ? 0 : w->now >> sh << sh;
+    return base | (uint64_t)s << (l * WBITS);
+  }
+  return WNEVER;
+}
+
+uint64_t wheelnext(const struct wheel* w) {
+  if (w->due.next != &w->due) return w->now;
+  return w->n ? wnext(w) : WNEVER;
+}
+
+/** move a slot's timers to the due list (level 0) or down a level */
+static void tcascade(struct wheel* w, int l, int s) {
+  struct tmr* h = &w->slot[l][s];
+  w->busy[l] &= ~(1ULL << s);
+  while (h->next != h) {
+    struct tmr* t = h->next;
+    lunlink(t);
+    if (t->when <= w->now) {
+      lpush(&w->due, t);
+    } else {
+      tplace(w, t);
+    }
+  }
+}
+
+void wheeladv(struct wheel* w, uint64_t now) {
+  uint64_t nx;
+  while ((nx = wnext(w)) <= now) {
+    w->now = nx;
+    // the slot starting here on each level whose boundary this is, top
+    // down, so timers land in the slots below before those are read
+    for (int l = WLEVELS - 1; l >= 0; l--) {
+      if (l && nx & ((1ULL << (l * WBITS)) - 1)) continue;
+      tcascade(w, l, (nx >> (l * WBITS)) & (WSLOTS - 1));
+    }
+  }
+  if (now > w->now) w->now = now;
+}
+
+struct tmr* tmrpop(struct wheel* w) {
+  struct tmr* t = w->due.next;
+  if (t == &w->due) return NULL;
+  lunlink(t);
+  w->n--;
+  return t;
+}
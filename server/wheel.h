@@ -0,0 +1,73 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+// hierarchical timing wheel, one per shard. timers are intrusive list nodes
+// (no allocation) kept in WLEVELS wheels of 64 slots: level l holds timers
+// due 64^l..64^(l+1) ms out, so arming and cancelling are O(1) list links,
+// and a timer is moved down a level at most WLEVELS - 1 times before it
+// fires. a bitmap per level finds the next busy slot with one ctz, which is
+// also what sizes the poll timeout. ticks are monotonic ms.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WBITS 6                 // slots per level = 1 << WBITS
+#define WSLOTS (1 << WBITS)
+#define WLEVELS 11              // 66 bits: any 64 bit due time fits
+#define WNEVER UINT64_MAX       // wheelnext(): nothing armed
+
+// a timer, embedded in its owner
+struct tmr {
+  struct tmr* next;  // list links, next = NULL when not armed
+  struct tmr* prev;
+  uint64_t when;     // due tick
+};
+
+struct wheel {
+  uint64_t now;                          // last tick advanced to
+  int n;                                 // armed timers (incl. due ones)
+  uint64_t busy[WLEVELS];                // non-empty slots, bit per slot
+  struct tmr slot[WLEVELS][WSLOTS];      // list heads (circular)
+  struct tmr due;                        // expired, waiting for tmrpop()
+};
+
+/** setup an empty wheel
+ * @param w wheel
+ * @param now current tick */
+void wheelinit(struct wheel* w, uint64_t now);
+
+/** arm a timer, or move it if armed. due ticks already past fire on the
+ * next wheeladv()
+ * @param w wheel
+ * @param t timer
+ * @param when due tick */
+void tmradd(struct wheel* w, struct tmr* t, uint64_t when);
+
+/** disarm a timer (no-op when not armed; it may already be due)
+ * @param w wheel
+ * @param t timer */
+void tmrdel(struct wheel* w, struct tmr* t);
+
+/** is a timer armed (or due and not yet popped) */
+static inline int tmrarmed(const struct tmr* t) {
+  return t->next != NULL;
+}
+
+/** earliest tick anything needs doing at: a timer firing, or a level
+ * moving down. never later than the first due timer
+ * @param w wheel
+ * @return tick, WNEVER = nothing armed */
+uint64_t wheelnext(const struct wheel* w);
+
+/** advance time, moving every timer due by now to the due list
+ * @param w wheel
+ * @param now current tick (earlier ticks are ignored) */
+void wheeladv(struct wheel* w, uint64_t now);
+
+/** take the next due timer (disarmed). the owner may re-arm it or free
+ * other timers, due ones included, before the next call
+ * @param w wheel
+ * @return timer, NULL = none due */
+struct tmr* tmrpop(struct wheel* w);
+
+#endif  // WHEEL_H
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE  // memmem, strncasecmp
+
+#include "ws.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "simd.h"
+
+#define WSGUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint32_t rol(uint32_t x, int k) { return (x << k) | (x >> (32 - k)); }
+
+/** one SHA-1 compression round over a 64 byte block */
+static void sha1blk(uint32_t h[5], const uint8_t* p) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+           (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t t = rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rol(b, 30);
+    b = a;
+    a = t;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+/** SHA-1 digest (only used for Sec-WebSocket-Accept) */
+static void sha1(const uint8_t* p, size_t n, uint8_t out[20]) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                   0xC3D2E1F0};
+  size_t i = 0;
+  for (; n - i >= 64; i += 64) sha1blk(h, p + i);
+
+  // tail + 0x80 + zero pad + 64-bit bit length, one or two blocks
+  uint8_t tail[128] = {0};
+  size_t r = n - i;
+  memcpy(tail, p + i, r);
+  tail[r] = 0x80;
+  size_t tl = r + 1 + 8 <= 64 ? 64 : 128;
+  uint64_t bits = (uint64_t)n * 8;
+  for (int j = 0; j < 8; j++) tail[tl - 1 - j] = (uint8_t)(bits >> (8 * j));
+  sha1blk(h, tail);
+  if (tl == 128) sha1blk(h, tail + 64);
+
+  for (int j = 0; j < 5; j++) {
+    out[4 * j] = h[j] >> 24;
+    out[4 * j + 1] = h[j] >> 16;
+    out[4 * j + 2] = h[j] >> 8;
+    out[4 * j + 3] = h[j];
+  }
+}
+
+/** base64 encode (out needs 4 * ceil(n / 3) + 1 bytes) */
+static void b64(const uint8_t* p, size_t n, char* out) {
+  static const char tbl[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i = 0;
+  for (; i + 2 < n; i += 3) {
+    uint32_t v = (uint32_t)p[i] << 16 | (uint32_t)p[i + 1] << 8 | p[i + 2];
+    *out++ = tbl[v >> 18];
+    *out++ = tbl[(v >> 12) & 63];
+    *out++ = tbl[(v >> 6) & 63];
+    *out++ = tbl[v & 63];
+  }
+  if (i < n) {
+    uint32_t v = (uint32_t)p[i] << 16;
+    if (i + 1 < n) v |= (uint32_t)p[i + 1] << 8;
+    *out++ = tbl[v >> 18];
+    *out++ = tbl[(v >> 12) & 63];
+    *out++ = i + 1 < n ? tbl[(v >> 6) & 63] : '=';
+    *out++ = '=';
+  }
+  *out = '\0';
+}
+
+/** case-insensitive search for a token in a header value */
+static bool hasword(const char* v, int vlen, const char* word) {
+  int wl = strlen(word);
+  for (int i = 0; i + wl <= vlen; i++) {
+    if (strncasecmp(v + i, word, wl) == 0) return true;
+  }
+  return false;
+}
+
+/** fill an http error response
+ * @return -1 */
+static int hserr(char out[256], int* outlen, const char* status,
+                 const char* extra) {
+  *outlen = snprintf(out, 256,
+                     "HTTP/1.1 %s\r\n%sContent-Length: 0\r\n"
+                     "Connection: close\r\n\r\n",
+                     status, extra);
+  return -1;
+}
+
+int wshs(const char* req, int n, const char* path, char out[256], int* outlen) {
+  const char* end = memmem(req, n, "\r\n\r\n", 4);
+  if (!end) return 0;
+  int used = (int)(end - req) + 4;
+
+  // request line: GET <path>[?query] HTTP/1.1
+  const char* eol = memmem(req, end - req + 2, "\r\n", 2);
+  if (eol - req < 4 || strncmp(req, "GET ", 4) != 0) {
+    return hserr(out, outlen, "405 Method Not Allowed", "Allow: GET\r\n");
+  }
+  const char* tgt = req + 4;
+  const char* sp = memchr(tgt, ' ', eol - tgt);
+  if (!sp) return hserr(out, outlen, "400 Bad Request", "");
+  const char* q = memchr(tgt, '?', sp - tgt);
+  int tlen = (int)((q ? q : sp) - tgt);
+  if (tlen != (int)strlen(path) || strncmp(tgt, path, tlen) != 0) {
+    return hserr(out, outlen, "404 Not Found", "");
+  }
+
+  bool upg = false, conn = false, ver = false;
+  char key[64] = {0};
+  for (const char* p = eol + 2; p < end; p = eol + 2) {
+    eol = memmem(p, end - p + 2, "\r\n", 2);
+    const char* colon = memchr(p, ':', eol - p);
+    if (!colon) continue;
+    int nlen = (int)(colon - p);
+    const char* v = colon + 1;
+    while (v < eol && (*v == ' ' || *v == '\t')) v++;
+    int vlen = (int)(eol - v);
+    while (vlen > 0 && (v[vlen - 1] == ' ' || v[vlen - 1] == '\t')) vlen--;
+
+    if (nlen == 7 && strncasecmp(p, "Upgrade", 7) == 0) {
+      upg = hasword(v, vlen, "websocket");
+    } else if (nlen == 10 && strncasecmp(p, "Connection", 10) == 0) {
+      conn = hasword(v, vlen, "upgrade");
+    } else if (nlen == 17 && strncasecmp(p, "Sec-WebSocket-Key", 17) == 0) {
+      if (vlen == 24) memcpy(key, v, vlen);
+    } else if (nlen == 21 &&
+               strncasecmp(p, "Sec-WebSocket-Version", 21) == 0) {
+      ver = vlen == 2 && strncmp(v, "13", 2) == 0;
+    }
+  }
+  if (!upg || !conn || !key[0]) {
+    return hserr(out, outlen, "400 Bad Request", "");
+  }
+  if (!ver) {
+    return hserr(out, outlen, "426 Upgrade Required",
+                 "Sec-WebSocket-Version: 13\r\n");
+  }
+
+  // accept = base64(sha1(key + guid))
+  char cat[64 + sizeof(WSGUID)];
+  int clen = snprintf(cat, sizeof(cat), "%s%s", key, WSGUID);
+  uint8_t dig[20];
+  sha1((const uint8_t*)cat, clen, dig);
+  char acc[29];
+  b64(dig, sizeof(dig), acc);
+
+  *outlen = snprintf(out, 256,
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %s\r\n\r\n",
+                     acc);
+  return used;
+}
+
+int wsframe(const uint8_t* p, int n, struct wsfrm* f) {
+  if (n < 2) return 0;
+  if (p[0] & 0x70) return -1;     // RSV bits: no extensions negotiated
+  if (!(p[1] & 0x80)) return -1;  // client frames must be masked
+  f->fin = p[0] & 0x80;
+  f->op = p[0] & 0x0F;
+
+  uint64_t len = p[1] & 0x7F;
+  int h = 2;
+  if (len == 126) {
+    if (n < 4) return 0;
+    len = (uint64_t)p[2] << 8 | p[3];
+    h = 4;
+  } else if (len == 127) {
+    if (n < 10) return 0;
+    len = 0;
+    for (int i = 0; i < 8; i++) len = len << 8 | p[2 + i];
+    if (len >> 63) return -1;
+    h = 10;
+  }
+
+  switch (f->op) {
+    case WS_CONT:
+    case WS_TEXT:
+    case WS_BIN:
+      break;
+    case WS_CLOSE:
+    case WS_PING:
+    case WS_PONG:
+      if (!f->fin || len > WSCTLMAX) return -1;
+      break;
+    default:
+      return -1;  // reserved opcode
+  }
+
+  if (n < h + 4) return 0;
+  memcpy(f->key, p + h, 4);
+  f->len = len;
+  return h + 4;
+}
+
+int wsput(struct wsconn* w, const char* data, int n) {
+  int room = WSBUFSZ - w->len;
+  if (n > room) n = room;
+  memcpy(w->buf + w->len, data, n);
+  w->len += n;
+  return n;
+}
+
+/** move unparsed bytes down to sit right behind the assembled message */
+static void wscompact(struct wsconn* w) {
+  if (w->pos == w->mlen) return;
+  int raw = w->len - w->pos;
+  memmove(w->buf + w->mlen, w->buf + w->pos, raw);
+  w->pos = w->mlen;
+  w->len = w->mlen + raw;
+}
+
+/** close codes a peer may send (RFC 6455 7.4) */
+static bool wscodeok(int c) {
+  return (c >= 1000 && c <= 1003) || (c >= 1007 && c <= 1011) ||
+         (c >= 3000 && c <= 4999);
+}
+
+/** over-long data frame: discard its payload as it arrives and drop the
+ * whole message it belongs to
+ * @return WS_LONG once the message's final frame was seen, WS_NEED else */
+static int wslong(struct wsconn* w, const struct wsfrm* f) {
+  w->skip = f->len;
+  w->mlen = 0;
+  if (f->fin) {
+    w->mop = 0;
+    w->drop = false;
+    return WS_LONG;
+  }
+  if (!w->mop) w->mop = f->op;
+  w->drop = true;
+  return WS_NEED;
+}
+
+int wsnext(struct wsconn* w, int max, const char** p, int* len, int* code) {
+  while (1) {
+    if (w->skip) {
+      // payload of a dropped frame, possibly spanning reads
+      uint64_t k = w->len - w->pos;
+      if (k > w->skip) k = w->skip;
+      w->pos += (int)k;
+      w->skip -= k;
+      if (w->skip) {
+        wscompact(w);
+        return WS_NEED;
+      }
+    }
+
+    struct wsfrm f;
+    uint8_t* raw = w->buf + w->pos;
+    int avail = w->len - w->pos;
+    int h = wsframe(raw, avail, &f);
+    *code = WSC_PROTO;
+    if (h == -1) return WS_ERR;
+    if (h == 0) {
+      wscompact(w);
+      return WS_NEED;
+    }
+
+    // sequencing: continuation only inside a message, text only outside
+    if (f.op == WS_CONT && !w->mop) return WS_ERR;
+    if ((f.op == WS_TEXT || f.op == WS_BIN) && w->mop) return WS_ERR;
+    if (f.op == WS_BIN) {
+      *code = WSC_DATA;  // chat is text only
+      return WS_ERR;
+    }
+
+    // messages over the cap are dropped whole without buffering them
+    if (f.op == WS_TEXT || f.op == WS_CONT) {
+      if (w->drop || w->mlen + f.len > (uint64_t)max) {
+        w->pos += h;
+        if (wslong(w, &f) == WS_LONG) return WS_LONG;
+        continue;
+      }
+    }
+    if ((uint64_t)avail < h + f.len) {
+      wscompact(w);
+      return WS_NEED;
+    }
+
+    uint8_t* pl = raw + h;
+    int n = (int)f.len;
+    unmask(pl, n, f.key);
+    w->pos += h + n;
+
+    switch (f.op) {
+      case WS_PING:
+        *p = (const char*)pl;
+        *len = n;
+        return WS_PINGED;
+      case WS_PONG:
+        return WS_PONGED;
+      case WS_CLOSE:
+        // echo the peer's status code back (none if it sent none)
+        *code = 0;
+        if (n == 1) {
+          *code = WSC_PROTO;
+          return WS_ERR;
+        }
+        if (n >= 2) {
+          *code = pl[0] << 8 | pl[1];
+          if (!wscodeok(*code)) {
+            *code = WSC_PROTO;
+            return WS_ERR;
+          }
+        }
+        return WS_CLOSED;
+      case WS_TEXT:
+        if (f.fin) {
+          if (!utf8ok(pl, n)) {
+            *code = WSC_UTF8;
+            return WS_ERR;
+          }
+          *p = (const char*)pl;
+          *len = n;
+          return WS_MSG;
+        }
+        w->mop = f.op;
+        break;
+      case WS_CONT:
+      default:
+        break;
+    }
+
+    // fragment: append behind the part of the message assembled so far
+    memmove(w->buf + w->mlen, pl, n);
+    w->mlen += n;
+    if (!f.fin) continue;
+
+    int mlen = w->mlen;
+    w->mlen = 0;
+    w->mop = 0;
+    if (!utf8ok(w->buf, mlen)) {
+      *code = WSC_UTF8;
+      return WS_ERR;
+    }
+    *p = (const char*)w->buf;
+    *len = mlen;
+    return WS_MSG;
+  }
+}
+
+struct msg* wsmsg(int op, const char* p, int len) {
+  int h = len < 126 ? 2 : len < 65536 ? 4 : 10;
+  struct msg* m = msgnew(h + len);
+  if (!m) return NULL;
+
+  uint8_t* d = (uint8_t*)m->data;
+  d[0] = 0x80 | op;  // FIN, never fragmented
+  if (h == 2) {
+    d[1] = len;
+  } else if (h == 4) {
+    d[1] = 126;
+    d[2] = len >> 8;
+    d[3] = len;
+  } else {
+    d[1] = 127;
+    for (int i = 0; i < 8; i++)
+      d[2 + i] = (uint8_t)((uint64_t)len >> (56 - 8 * i));
+  }
+  memcpy(d + h, p, len);
+
+  // browsers fail the connection on bad UTF-8 in a text frame, and plain
+  // TCP clients may send anything
+  if (op == WS_TEXT && !utf8ok(d + h, len)) {
+    uint8_t* q = d + h;
+    uint64_t i = 0;
+    while ((i += utf8len(q + i, len - i)) < (uint64_t)len) q[i++] = '?';
+  }
+  return m;
+}
@@ -0,0 +1,92 @@
+#ifndef WS_H
+#define WS_H
+
+// websocket (RFC 6455) server side: upgrade handshake, frame decode with
+// unmasking, fragment reassembly, and frame encode into refcounted msgs.
+// protocol only; the event loop feeds bytes in and acts on the events.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "msg.h"
+
+#define WSBUFSZ 4096  // handshake request / frame assembly buffer per client
+#define WSCTLMAX 125  // control frame payload cap
+
+// opcodes
+enum { WS_CONT = 0x0, WS_TEXT = 0x1, WS_BIN = 0x2, WS_CLOSE = 0x8,
+       WS_PING = 0x9, WS_PONG = 0xA };
+
+// wsnext() results
+enum { WS_NEED, WS_MSG, WS_LONG, WS_PINGED, WS_PONGED, WS_CLOSED, WS_ERR };
+
+// close codes
+enum { WSC_NORMAL = 1000, WSC_PROTO = 1002, WSC_DATA = 1003, WSC_UTF8 = 1007,
+       WSC_BIG = 1009 };
+
+// decoded frame header
+struct wsfrm {
+  bool fin;        // final fragment
+  uint8_t op;      // opcode
+  uint64_t len;    // payload bytes
+  uint8_t key[4];  // masking key
+};
+
+// per-client state. buf holds the assembled fragments of the current
+// message at [0, mlen), then raw unparsed bytes at [pos, len)
+struct wsconn {
+  bool open;      // handshake done
+  bool closing;   // final frame/response queued, input ignored
+  uint8_t mop;    // opcode of the fragmented message in progress, 0 = none
+  int mlen;       // assembled message bytes
+  int pos;        // first unparsed byte
+  int len;        // bytes in buf
+  bool drop;      // message over the cap, discarding through its last frame
+  uint64_t skip;  // payload bytes of a dropped frame still to discard
+  uint8_t buf[WSBUFSZ];
+};
+
+/** answer an upgrade request (GET <path>, version 13)
+ * @param req request bytes received so far
+ * @param n byte count
+ * @param path accepted request path ("/ws")
+ * @param out response (101 or an http error), [256]
+ * @param outlen response length (out)
+ * @return bytes consumed (>0) upgraded, 0 incomplete, -1 rejected */
+int wshs(const char* req, int n, const char* path, char out[256], int* outlen);
+
+/** parse one client frame header (must be masked)
+ * @param p bytes
+ * @param n byte count
+ * @param f header (out)
+ * @return header length, 0 incomplete, -1 protocol error */
+int wsframe(const uint8_t* p, int n, struct wsfrm* f);
+
+/** copy received bytes into the client buffer
+ * @param w client
+ * @param data bytes
+ * @param n byte count
+ * @return bytes taken (less than n when the buffer is full) */
+int wsput(struct wsconn* w, const char* data, int n);
+
+/** pull the next event out of buffered frames. control frames are answered
+ * by the caller; data frames are reassembled and unmasked in place, and a
+ * message over the cap is discarded whole (WS_LONG) like an over-long line
+ * @param w client (open)
+ * @param max message payload cap (< WSBUFSZ / 2)
+ * @param p payload (out, WS_MSG/WS_PINGED), valid until the next call
+ * @param len payload bytes (out)
+ * @param code close code to send (out, WS_CLOSED/WS_ERR, 0 = none)
+ * @return WS_MSG, WS_LONG, WS_PINGED, WS_PONGED, WS_CLOSED, WS_ERR or
+ *         WS_NEED */
+int wsnext(struct wsconn* w, int max, const char** p, int* len, int* code);
+
+/** frame a payload as one unmasked server frame (text payloads that are not
+ * valid UTF-8 get the bad bytes replaced with '?')
+ * @param op opcode
+ * @param p payload
+ * @param len payload bytes
+ * @return framed message (ref = 1) or NULL */
+struct msg* wsmsg(int op, const char* p, int len);
+
+#endif  // WS_H